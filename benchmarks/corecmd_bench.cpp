@@ -0,0 +1,532 @@
+// How fast the file commands are on trees of a given size and shape, as a build would run them.
+//
+//     qmcorecmd_bench [options]
+//
+//     --files <n>         small files in each tree, 10000 by default
+//     --shape <shape>     wide, directories of a thousand files each, or deep, chains of 32
+//                         nested directories of 8 files each. May be repeated, both by default
+//     --big <n> <MiB>     large binaries added to each tree, 4 of 64 MiB by default
+//     --repeat <n>        timed runs of each scenario, the median of which is reported, 3 by
+//                         default
+//     --copy-engine <e>   kernel, how qmcorecmd copies a file, or std, the standard library's
+//                         copy it replaced. May be repeated, the copy scenarios being timed
+//                         with each, kernel alone by default
+//     --out <file>        where the results go as JSON, qmcorecmd-bench.json by default
+//     --work <dir>        where the trees are made, a new directory under the temp one by default
+//     --qmcorecmd <file>  what is timed, the qmcorecmd it was built with by default
+//     --keep              leave the trees there afterwards
+//
+// Each tree has a symbolic link beside one file in every hundred, where the platform lets one be
+// made. On it are timed copy into an empty directory, copy again with nothing to do, copy after
+// one file in a hundred has changed, incsync from nothing and again with nothing to do, and rmdir
+// on a tree of the same directories with nothing in them. configure is timed once, on a manifest
+// of a header for every hundred files, written and then again unchanged. With std among the copy
+// engines the three copy scenarios are timed again, as copy.cold.std and so on, with
+// QMCORECMD_COPY_ENGINE=std in qmcorecmd's environment, so that the two ways of copying are
+// compared in the same build and on the same tree.
+//
+// For each one the results give the median time, files a second, where that is directories for
+// rmdir and headers for configure, and the peak resident set. One more untimed run with --trace
+// gives the counters qmcorecmd keeps, being what its shared helpers asked the file system
+// about, bytes copied and files skipped. Where strace is on the PATH on Linux, another under it
+// counts every system call.
+//
+// The JSON is meant to be kept, so that a run can be compared with the one before it.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "process.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+    struct Options {
+        size_t files = 10000;
+        std::vector<std::string> shapes;
+        size_t bigFiles = 4;
+        size_t bigMiB = 64;
+        int repeat = 3;
+        std::vector<std::string> engines;
+        fs::path out = "qmcorecmd-bench.json";
+        fs::path work;
+        fs::path qmcorecmd = QMCORECMD_PATH;
+        bool keep = false;
+    };
+
+    struct Tree {
+        std::string shape;
+        fs::path root;
+        size_t files = 0;
+        size_t directories = 0;
+        size_t links = 0;
+        uint64_t bytes = 0;
+
+        /// The small files, for the partial update to pick from.
+        std::vector<fs::path> smallFiles;
+    };
+
+    struct Scenario {
+        std::string shape;
+        std::string name;
+
+        /// What it works through, being files, directories or headers.
+        size_t items = 0;
+
+        /// Done before every run and left out of the time.
+        std::function<void()> setup;
+
+        std::vector<std::string> args;
+
+        /// What QMCORECMD_COPY_ENGINE is set to for it, or nothing to leave it unset.
+        std::string engine;
+    };
+
+    struct Result {
+        std::string shape;
+        std::string name;
+        std::string engine;
+        size_t items = 0;
+        double medianSeconds = 0;
+        double minSeconds = 0;
+        int64_t peakRssKiB = -1;
+        int64_t syscalls = -1;
+
+        /// What --trace kept under otherData, as the JSON it wrote.
+        std::string counters = "{}";
+    };
+
+    void writeFile(const fs::path &path, const std::string &content) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << content;
+        if (!out) {
+            std::printf("failed to write \"%s\"\n", path.string().data());
+            std::exit(1);
+        }
+    }
+
+    void removeAll(const fs::path &path) {
+        std::error_code ec;
+        fs::remove_all(path, ec);
+    }
+
+    // A small file, different from every other, so that nothing can be taken for a copy of
+    // something else.
+    std::string smallContent(size_t index, unsigned generation) {
+        std::string s = "// " + std::to_string(index) + "." + std::to_string(generation) + "\n";
+        s.resize(512, ' ');
+        s.back() = '\n';
+        return s;
+    }
+
+    void addSmallFile(Tree &tree, const fs::path &dir) {
+        const size_t index = tree.files;
+        const auto &path = dir / ("f" + std::to_string(index) + ".h");
+        writeFile(path, smallContent(index, 0));
+        tree.smallFiles.push_back(path);
+        tree.files++;
+        tree.bytes += 512;
+
+        if (index % 100 == 0) {
+            std::error_code ec;
+            fs::create_symlink(path.filename(), dir / ("l" + std::to_string(index) + ".h"), ec);
+            if (!ec) {
+                tree.links++;
+            }
+        }
+    }
+
+    Tree makeTree(const Options &options, const std::string &shape, const fs::path &root) {
+        Tree tree;
+        tree.shape = shape;
+        tree.root = root;
+        fs::create_directories(root);
+
+        if (shape == "wide") {
+            for (size_t d = 0; tree.files < options.files; ++d) {
+                const auto &dir = root / ("d" + std::to_string(d));
+                fs::create_directory(dir);
+                tree.directories++;
+                for (int i = 0; i < 1000 && tree.files < options.files; ++i) {
+                    addSmallFile(tree, dir);
+                }
+            }
+        } else {
+            for (size_t chain = 0; tree.files < options.files; ++chain) {
+                auto dir = root / ("c" + std::to_string(chain));
+                for (int level = 0; level < 32 && tree.files < options.files; ++level) {
+                    fs::create_directory(dir);
+                    tree.directories++;
+                    for (int i = 0; i < 8 && tree.files < options.files; ++i) {
+                        addSmallFile(tree, dir);
+                    }
+                    dir /= "n";
+                }
+            }
+        }
+
+        if (options.bigFiles > 0) {
+            const auto &dir = root / "big";
+            fs::create_directory(dir);
+            tree.directories++;
+
+            std::mt19937_64 random(42);
+            std::string block(1 << 20, '\0');
+            for (size_t i = 0; i < options.bigFiles; ++i) {
+                std::ofstream out(dir / ("b" + std::to_string(i) + ".bin"), std::ios::binary);
+                for (size_t mib = 0; mib < options.bigMiB; ++mib) {
+                    for (size_t j = 0; j + 8 <= block.size(); j += 8) {
+                        const uint64_t value = random();
+                        std::copy_n(reinterpret_cast<const char *>(&value), 8, &block[j]);
+                    }
+                    out.write(block.data(), std::streamsize(block.size()));
+                }
+                tree.files++;
+                tree.bytes += uint64_t(options.bigMiB) << 20;
+            }
+        }
+        return tree;
+    }
+
+    // The directories of \a tree and nothing else, for rmdir to take away.
+    void makeSkeleton(const Tree &tree, const fs::path &dest) {
+        fs::create_directories(dest);
+        for (auto it = fs::recursive_directory_iterator(tree.root);
+             it != fs::recursive_directory_iterator(); ++it) {
+            if (it->is_directory() && !it->is_symlink()) {
+                fs::create_directories(dest / it->path().lexically_relative(tree.root));
+            }
+        }
+    }
+
+    // One file in a hundred rewritten, a different hundredth each time, and made newer than
+    // anything copied from it could be.
+    void touchHundredth(Tree &tree, unsigned generation) {
+        const auto later = fs::file_time_type::clock::now() + std::chrono::seconds(2);
+        for (size_t i = generation % 100; i < tree.smallFiles.size(); i += 100) {
+            writeFile(tree.smallFiles[i], smallContent(i, generation));
+            fs::last_write_time(tree.smallFiles[i], later);
+        }
+    }
+
+    // The calls column of the total strace -c writes last.
+    int64_t stracedCalls(const fs::path &summaryFile) {
+        std::istringstream in(Bench::readFile(summaryFile));
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::vector<std::string> words;
+            for (std::string word; fields >> word;) {
+                words.push_back(word);
+            }
+            if (words.size() >= 5 && words.back() == "total") {
+                return std::atoll(words[3].data());
+            }
+        }
+        return -1;
+    }
+
+    // What every qmcorecmd started from here copies with, until it is set again.
+    void setCopyEngine(const std::string &engine) {
+#ifdef _WIN32
+        ::_putenv_s("QMCORECMD_COPY_ENGINE", engine.data());
+#else
+        if (engine.empty()) {
+            ::unsetenv("QMCORECMD_COPY_ENGINE");
+        } else {
+            ::setenv("QMCORECMD_COPY_ENGINE", engine.data(), 1);
+        }
+#endif
+    }
+
+    Result measure(const Options &options, const Scenario &scenario, const fs::path &scratch) {
+        Result result;
+        result.shape = scenario.shape;
+        result.name = scenario.name;
+        result.engine = scenario.engine.empty() ? "kernel" : scenario.engine;
+        result.items = scenario.items;
+        setCopyEngine(scenario.engine);
+
+        std::vector<double> times;
+        for (int i = 0; i < options.repeat; ++i) {
+            scenario.setup();
+            const auto &run = Bench::run(options.qmcorecmd, scenario.args);
+            if (run.code != 0) {
+                std::printf("%s %s failed with %d\n", scenario.shape.data(),
+                            scenario.name.data(), run.code);
+                std::exit(1);
+            }
+            times.push_back(run.seconds);
+            result.peakRssKiB = std::max(result.peakRssKiB, run.peakRssKiB);
+        }
+        std::sort(times.begin(), times.end());
+        result.medianSeconds = times[times.size() / 2];
+        result.minSeconds = times.front();
+
+        const auto &traceFile = scratch / "trace.json";
+        scenario.setup();
+        auto args = scenario.args;
+        args.push_back("--trace");
+        args.push_back(traceFile.string());
+        if (Bench::run(options.qmcorecmd, args).code == 0) {
+            result.counters = Bench::tracedCounters(traceFile);
+        }
+
+#ifdef __linux__
+        if (const auto &strace = Bench::findOnPath("strace"); !strace.empty()) {
+            const auto &summaryFile = scratch / "strace.txt";
+            scenario.setup();
+            std::vector<std::string> straced = {"-f", "-c", "-o", summaryFile.string(),
+                                                options.qmcorecmd.string()};
+            straced.insert(straced.end(), scenario.args.begin(), scenario.args.end());
+            if (Bench::run(strace, straced).code == 0) {
+                result.syscalls = stracedCalls(summaryFile);
+            }
+        }
+#endif
+        return result;
+    }
+
+    std::vector<Scenario> scenariosFor(const Options &options, Tree &tree,
+                                       const fs::path &scratch) {
+        const auto &src = tree.root.string() + "/";
+        const auto &copied = (scratch / "copied").string();
+        const auto &included = (scratch / "include").string();
+        const auto &skeleton = scratch / "skeleton";
+        static unsigned generation = 0;
+
+        // The copy scenarios once for each engine, the one qmcorecmd uses unless told otherwise
+        // keeping the plain names.
+        std::vector<Scenario> scenarios;
+        for (const auto &engine : options.engines) {
+            const std::string suffix = engine == "kernel" ? "" : "." + engine;
+            const std::string variable = engine == "kernel" ? "" : engine;
+            scenarios.push_back({tree.shape, "copy.cold" + suffix, tree.files,
+                                 [copied]() { removeAll(copied); }, {"copy", src, copied},
+                                 variable});
+            scenarios.push_back({tree.shape, "copy.warm" + suffix, tree.files, []() {},
+                                 {"copy", src, copied}, variable});
+            scenarios.push_back({tree.shape, "copy.partial" + suffix, tree.files,
+                                 [&tree]() { touchHundredth(tree, ++generation); },
+                                 {"copy", src, copied}, variable});
+        }
+
+        scenarios.insert(scenarios.end(), {
+            {tree.shape, "incsync.cold", tree.smallFiles.size(),
+             [included]() { removeAll(included); }, {"incsync", tree.root.string(), included}},
+            {tree.shape, "incsync.warm", tree.smallFiles.size(), []() {},
+             {"incsync", tree.root.string(), included}},
+            {tree.shape, "rmdir", tree.directories,
+             [&tree, skeleton]() {
+                 removeAll(skeleton);
+                 makeSkeleton(tree, skeleton);
+             },
+             {"rmdir", skeleton.string()}},
+        });
+        return scenarios;
+    }
+
+    // A manifest of \a count headers of 50 definitions each, all of which differ.
+    std::vector<Scenario> configureScenarios(size_t count, const fs::path &scratch) {
+        const auto &manifest = scratch / "configure.json";
+        const auto &outputs = scratch / "configured";
+        std::string json = "{\"headers\": [\n";
+        for (size_t i = 0; i < count; ++i) {
+            json += i ? ",\n" : "";
+            const auto &output = outputs / ("h" + std::to_string(i) + ".h");
+            json += "{\"output\": " + Bench::jsonQuote(output.string()) + ", \"definitions\": [";
+            for (int d = 0; d < 50; ++d) {
+                json += (d ? ", " : "") + Bench::jsonQuote("DEF_" + std::to_string(d) + "=" +
+                                                            std::to_string(i * 50 + d));
+            }
+            json += "], \"warning\": true}";
+        }
+        json += "\n]}\n";
+        writeFile(manifest, json);
+
+        const auto outputsString = outputs.string();
+        return {
+            {"-", "configure.cold", count, [outputsString]() { removeAll(outputsString); },
+             {"configure", "--manifest", manifest.string()}},
+            {"-", "configure.warm", count, []() {}, {"configure", "--manifest", manifest.string()}},
+        };
+    }
+
+    void printResult(const Result &result) {
+        std::printf("%-6s%-18s%10zu%12.3f%14.0f%12lld", result.shape.data(), result.name.data(),
+                    result.items, result.medianSeconds,
+                    result.medianSeconds > 0 ? result.items / result.medianSeconds : 0.0,
+                    static_cast<long long>(result.peakRssKiB));
+        if (result.syscalls >= 0) {
+            std::printf("%12lld", static_cast<long long>(result.syscalls));
+        }
+        std::printf("\n");
+    }
+
+    void writeResults(const Options &options, const std::vector<Tree> &trees,
+                      const std::vector<Result> &results) {
+        char date[32];
+        const std::time_t now = std::time(nullptr);
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+        std::string json = "{\n";
+        json += "\"qmcorecmd\": " + Bench::jsonQuote(options.qmcorecmd.string()) + ",\n";
+        json += "\"date\": \"" + std::string(date) + "\",\n";
+#if defined(_WIN32)
+        json += "\"platform\": \"windows\",\n";
+#elif defined(__APPLE__)
+        json += "\"platform\": \"macos\",\n";
+#else
+        json += "\"platform\": \"linux\",\n";
+#endif
+        json += "\"repeat\": " + std::to_string(options.repeat) + ",\n";
+        json += "\"trees\": [";
+        for (size_t i = 0; i < trees.size(); ++i) {
+            const auto &tree = trees[i];
+            json += (i ? ",\n" : "\n");
+            json += "{\"shape\": " + Bench::jsonQuote(tree.shape) +
+                    ", \"files\": " + std::to_string(tree.files) +
+                    ", \"directories\": " + std::to_string(tree.directories) +
+                    ", \"links\": " + std::to_string(tree.links) +
+                    ", \"bytes\": " + std::to_string(tree.bytes) + "}";
+        }
+        json += "\n],\n\"results\": [";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const auto &result = results[i];
+            char numbers[160];
+            std::snprintf(numbers, sizeof(numbers),
+                          "\"seconds\": %.6f, \"min_seconds\": %.6f, \"files_per_second\": %.1f",
+                          result.medianSeconds, result.minSeconds,
+                          result.medianSeconds > 0 ? result.items / result.medianSeconds : 0.0);
+            json += (i ? ",\n" : "\n");
+            json += "{\"shape\": " + Bench::jsonQuote(result.shape) +
+                    ", \"scenario\": " + Bench::jsonQuote(result.name) +
+                    ", \"engine\": " + Bench::jsonQuote(result.engine) +
+                    ", \"files\": " + std::to_string(result.items) + ", " + numbers +
+                    ", \"peak_rss_kib\": " + std::to_string(result.peakRssKiB) +
+                    ", \"syscalls\": " +
+                    (result.syscalls >= 0 ? std::to_string(result.syscalls) : "null") +
+                    ", \"counters\": " + result.counters + "}";
+        }
+        json += "\n]\n}\n";
+        writeFile(options.out, json);
+    }
+
+    bool parseOptions(int argc, char *argv[], Options &options) {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            const auto &next = [&]() -> std::string {
+                if (i + 1 >= argc) {
+                    std::printf("%s needs a value\n", arg.data());
+                    std::exit(1);
+                }
+                return argv[++i];
+            };
+            if (arg == "--files") {
+                options.files = std::max<size_t>(1, std::strtoull(next().data(), nullptr, 10));
+            } else if (arg == "--shape") {
+                const auto &shape = next();
+                if (shape != "wide" && shape != "deep") {
+                    std::printf("unknown shape: \"%s\", expected wide or deep\n", shape.data());
+                    return false;
+                }
+                options.shapes.push_back(shape);
+            } else if (arg == "--big") {
+                options.bigFiles = std::strtoull(next().data(), nullptr, 10);
+                options.bigMiB = std::strtoull(next().data(), nullptr, 10);
+            } else if (arg == "--repeat") {
+                options.repeat = std::max(1, std::atoi(next().data()));
+            } else if (arg == "--copy-engine") {
+                const auto &engine = next();
+                if (engine != "kernel" && engine != "std") {
+                    std::printf("unknown copy engine: \"%s\", expected kernel or std\n",
+                                engine.data());
+                    return false;
+                }
+                options.engines.push_back(engine);
+            } else if (arg == "--out") {
+                options.out = fs::absolute(next());
+            } else if (arg == "--work") {
+                options.work = fs::absolute(next());
+            } else if (arg == "--qmcorecmd") {
+                options.qmcorecmd = fs::absolute(next());
+            } else if (arg == "--keep") {
+                options.keep = true;
+            } else {
+                std::printf("unknown option: \"%s\"\n", arg.data());
+                return false;
+            }
+        }
+        if (options.shapes.empty()) {
+            options.shapes = {"wide", "deep"};
+        }
+        if (options.engines.empty()) {
+            options.engines = {"kernel"};
+        }
+        if (options.work.empty()) {
+            options.work = fs::temp_directory_path() /
+                           ("qmcorecmd-bench-" + std::to_string(std::time(nullptr)));
+        }
+        options.out = fs::absolute(options.out);
+        return true;
+    }
+
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        return 1;
+    }
+    if (!fs::is_regular_file(options.qmcorecmd)) {
+        std::printf("not a file: \"%s\"\n", options.qmcorecmd.string().data());
+        return 1;
+    }
+
+    std::printf("%s\n%s\n\n", options.qmcorecmd.string().data(), options.work.string().data());
+    std::printf("%-6s%-18s%10s%12s%14s%12s%12s\n", "", "", "files", "seconds", "files/s",
+                "peak KiB", "syscalls");
+
+    std::vector<Tree> trees;
+    std::vector<Result> results;
+    for (const auto &shape : options.shapes) {
+        const auto &scratch = options.work / shape;
+        fs::create_directories(scratch);
+        trees.push_back(makeTree(options, shape, scratch / "tree"));
+        for (const auto &scenario : scenariosFor(options, trees.back(), scratch)) {
+            results.push_back(measure(options, scenario, scratch));
+            printResult(results.back());
+        }
+        if (!options.keep) {
+            removeAll(scratch);
+        }
+    }
+    {
+        const auto &scratch = options.work / "configure";
+        fs::create_directories(scratch);
+        for (const auto &scenario : configureScenarios(std::max<size_t>(1, options.files / 100),
+                                                        scratch)) {
+            results.push_back(measure(options, scenario, scratch));
+            printResult(results.back());
+        }
+    }
+
+    writeResults(options, trees, results);
+    std::printf("\nWritten to %s\n", options.out.string().data());
+
+    if (!options.keep) {
+        removeAll(options.work);
+    }
+    return 0;
+}
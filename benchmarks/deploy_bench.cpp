@@ -0,0 +1,496 @@
+// How deploy scales with the size of the graph it reads, on graphs of shared libraries made for
+// the purpose.
+//
+//     qmcorecmd_deploy_bench [options]
+//
+//     --sizes <n>,...     libraries in each graph, 25,100,400 by default
+//     --fanout <n>        libraries each one links, 3 by default
+//     --depth <n>         levels of libraries below the executable, 6 by default
+//     --jobs <n>          what -j is for the parallel runs, the number of cores by default
+//     --repeat <n>        timed runs of each, the median of which is reported, 3 by default
+//     --out <file>        where the results go as JSON, qmcorecmd-deploy-bench.json by default
+//     --work <dir>        where the graphs are built, a new directory under the temp one by default
+//     --cc <file>         what compiles them, the C compiler this was configured with by default
+//     --qmcorecmd <file>  what is timed, the qmcorecmd it was built with by default
+//     --keep              leave the graphs there afterwards
+//
+// A graph is an executable over levels of libraries, each library linking --fanout of the level
+// below, chosen at random but the same every time and so that every library is linked by
+// something. They are spread across four directories, and each finds what it needs its own way,
+// one in four of each:
+//
+//   - RUNPATH naming the directories beside its own through $ORIGIN
+//   - the same as an old-style RPATH
+//   - RUNPATH naming the directories as absolute paths
+//   - nothing at all, left for -L to find
+//
+// On macOS @loader_path stands in for $ORIGIN and the first two are the same thing.
+//
+// Each graph is deployed four ways: resolve, a dry run that only reads the graph; serial, with one
+// job; parallel, with --jobs; and cached, a parallel run into a directory an earlier run has
+// already filled, so that every copy is passed over. The executable's rpath is put back before
+// every run, since a deployment rewrites it. One more untimed run with --trace gives the counters
+// qmcorecmd keeps, of which the number of tools run is the one that grows with the graph.
+//
+// The libraries are compiled with the local C compiler, a level at a time and in parallel, and
+// nothing else is needed. Linux and macOS only, since Windows has neither rpaths nor patchelf.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "process.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+#ifdef __APPLE__
+    const char *const libraryPrefix = "lib";
+    const char *const librarySuffix = ".dylib";
+    const char *const originToken = "@loader_path";
+#else
+    const char *const libraryPrefix = "lib";
+    const char *const librarySuffix = ".so";
+    const char *const originToken = "$ORIGIN";
+#endif
+
+    constexpr int directoryCount = 4;
+
+    struct Options {
+        std::vector<size_t> sizes;
+        size_t fanout = 3;
+        size_t depth = 6;
+        size_t jobs = std::max(1u, std::thread::hardware_concurrency());
+        int repeat = 3;
+        fs::path out = "qmcorecmd-deploy-bench.json";
+        fs::path work;
+        fs::path cc = QMSETUP_BENCH_CC;
+        fs::path qmcorecmd = QMCORECMD_PATH;
+        bool keep = false;
+    };
+
+    enum Variant {
+        OriginRunPath,
+        OriginRPath,
+        AbsoluteRunPath,
+        NoPath,
+    };
+
+    struct Library {
+        size_t level = 0;
+        int directory = 0;
+        Variant variant = OriginRunPath;
+        std::vector<size_t> needs;
+    };
+
+    struct Graph {
+        fs::path root;
+        std::vector<Library> libraries;
+
+        /// The first library of each level, and one past the last of the last level.
+        std::vector<size_t> levelStarts;
+
+        fs::path executable;
+
+        /// What the executable was built as, for putting it back after a deployment.
+        fs::path pristine;
+    };
+
+    struct Result {
+        size_t size = 0;
+        std::string mode;
+        double medianSeconds = 0;
+        double minSeconds = 0;
+        int64_t peakRssKiB = -1;
+        std::string counters = "{}";
+    };
+
+    void fail(const std::string &message) {
+        std::printf("%s\n", message.data());
+        std::exit(1);
+    }
+
+    void writeFile(const fs::path &path, const std::string &content) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << content;
+        if (!out) {
+            fail("failed to write \"" + path.string() + "\"");
+        }
+    }
+
+    std::string libraryName(size_t index) {
+        return libraryPrefix + ("g" + std::to_string(index)) + librarySuffix;
+    }
+
+    fs::path libraryPath(const Graph &graph, size_t index) {
+        return graph.root / ("d" + std::to_string(graph.libraries[index].directory)) /
+               libraryName(index);
+    }
+
+    // Who links whom. Each library of a level is linked by the one of the level above that its
+    // position falls to, so that nothing is left out, and then by others at random until each of
+    // the level above links as many as it should.
+    Graph makeGraph(const Options &options, size_t size, const fs::path &root) {
+        Graph graph;
+        graph.root = root;
+        graph.libraries.resize(size);
+
+        const size_t depth = std::max<size_t>(1, std::min(options.depth, size));
+        for (size_t level = 0, start = 0; level < depth; ++level) {
+            graph.levelStarts.push_back(start);
+            start += size / depth + (level < size % depth ? 1 : 0);
+        }
+        graph.levelStarts.push_back(size);
+
+        std::mt19937 random(42);
+        for (size_t level = 0; level < depth; ++level) {
+            for (size_t i = graph.levelStarts[level]; i < graph.levelStarts[level + 1]; ++i) {
+                auto &library = graph.libraries[i];
+                library.level = level;
+                library.directory = int(i % directoryCount);
+                library.variant = Variant((i / directoryCount) % 4);
+            }
+        }
+        for (size_t level = 0; level + 1 < depth; ++level) {
+            const size_t begin = graph.levelStarts[level];
+            const size_t count = graph.levelStarts[level + 1] - begin;
+            const size_t belowBegin = graph.levelStarts[level + 1];
+            const size_t belowCount = graph.levelStarts[level + 2] - belowBegin;
+
+            std::vector<std::set<size_t>> needs(count);
+            for (size_t j = 0; j < belowCount; ++j) {
+                needs[j % count].insert(belowBegin + j);
+            }
+            const size_t fanout = std::min(options.fanout, belowCount);
+            for (auto &set : needs) {
+                while (set.size() < fanout) {
+                    set.insert(belowBegin + random() % belowCount);
+                }
+            }
+            for (size_t i = 0; i < count; ++i) {
+                graph.libraries[begin + i].needs.assign(needs[i].begin(), needs[i].end());
+            }
+        }
+        return graph;
+    }
+
+    // The compiler's command line for library \a index, or for the executable where \a index is
+    // past the last library, in which case it links every library of the first level.
+    std::vector<std::string> compileArgs(const Graph &graph, size_t index) {
+        const bool isExecutable = index == graph.libraries.size();
+        std::vector<size_t> needs;
+        Variant variant = OriginRunPath;
+        fs::path dir, output, source;
+        if (isExecutable) {
+            for (size_t i = graph.levelStarts[0]; i < graph.levelStarts[1]; ++i) {
+                needs.push_back(i);
+            }
+            dir = graph.root / "bin";
+            output = graph.pristine;
+            source = graph.root / "src" / "main.c";
+        } else {
+            const auto &library = graph.libraries[index];
+            needs = library.needs;
+            variant = library.variant;
+            output = libraryPath(graph, index);
+            dir = output.parent_path();
+            source = graph.root / "src" / ("g" + std::to_string(index) + ".c");
+        }
+
+        std::string code;
+        for (const size_t need : needs) {
+            code += "int g" + std::to_string(need) + "(void);\n";
+        }
+        code += isExecutable ? "int main(void) {\n    return 0" : "int g" + std::to_string(index) +
+                                                                     "(void) {\n    return " +
+                                                                     std::to_string(index);
+        for (const size_t need : needs) {
+            code += " + g" + std::to_string(need) + "()";
+        }
+        code += ";\n}\n";
+        writeFile(source, code);
+
+        std::vector<std::string> args = {"-o", output.string(), source.string()};
+        if (!isExecutable) {
+            args.insert(args.begin(), {"-shared", "-fPIC"});
+#ifdef __APPLE__
+            args.push_back("-Wl,-install_name,@rpath/" + libraryName(index));
+#else
+            args.push_back("-Wl,-soname," + libraryName(index));
+#endif
+        }
+        std::set<fs::path> needDirs;
+        for (const size_t need : needs) {
+            const auto &path = libraryPath(graph, need);
+            args.push_back(path.string());
+            needDirs.insert(path.parent_path());
+        }
+
+        if (variant != NoPath) {
+#ifndef __APPLE__
+            args.push_back(variant == OriginRPath ? "-Wl,--disable-new-dtags"
+                                                  : "-Wl,--enable-new-dtags");
+#endif
+            for (const auto &needDir : needDirs) {
+                std::string entry;
+                if (variant == AbsoluteRunPath) {
+                    entry = needDir.string();
+                } else if (needDir == dir) {
+                    entry = originToken;
+                } else {
+                    entry = std::string(originToken) + "/../" + needDir.filename().string();
+                }
+                args.push_back("-Wl,-rpath," + entry);
+            }
+        }
+        return args;
+    }
+
+    void buildGraph(const Options &options, Graph &graph) {
+        fs::create_directories(graph.root / "src");
+        fs::create_directories(graph.root / "bin");
+        for (int d = 0; d < directoryCount; ++d) {
+            fs::create_directories(graph.root / ("d" + std::to_string(d)));
+        }
+        graph.executable = graph.root / "bin" / "app";
+        graph.pristine = graph.root / "src" / "app";
+
+        // From the bottom up, since a library cannot be linked against one not yet built.
+        const auto &compile = [&](size_t begin, size_t end) {
+            std::atomic<size_t> next(begin);
+            std::atomic<bool> failed(false);
+            std::vector<std::thread> workers;
+            for (size_t t = 0; t < std::min(options.jobs, end - begin); ++t) {
+                workers.emplace_back([&]() {
+                    for (size_t i; (i = next++) < end && !failed;) {
+                        if (Bench::run(options.cc, compileArgs(graph, i)).code != 0) {
+                            failed = true;
+                        }
+                    }
+                });
+            }
+            for (auto &worker : workers) {
+                worker.join();
+            }
+            if (failed) {
+                fail("failed to compile the graph with \"" + options.cc.string() + "\"");
+            }
+        };
+        for (size_t level = graph.levelStarts.size() - 1; level-- > 0;) {
+            compile(graph.levelStarts[level], graph.levelStarts[level + 1]);
+        }
+        compile(graph.libraries.size(), graph.libraries.size() + 1);
+    }
+
+    void restoreExecutable(const Graph &graph) {
+        fs::copy_file(graph.pristine, graph.executable, fs::copy_options::overwrite_existing);
+    }
+
+    Result measure(const Options &options, const Graph &graph, const std::string &mode,
+                   const fs::path &dest) {
+        Result result;
+        result.size = graph.libraries.size();
+        result.mode = mode;
+
+        std::vector<std::string> args = {"deploy", graph.executable.string()};
+        for (int d = 0; d < directoryCount; ++d) {
+            args.push_back("-L");
+            args.push_back((graph.root / ("d" + std::to_string(d))).string());
+        }
+        args.push_back("-o");
+        args.push_back(dest.string());
+        args.push_back("-s");
+        args.push_back("-j");
+        args.push_back(mode == "serial" ? "1" : std::to_string(options.jobs));
+        if (mode == "resolve") {
+            args.push_back("-d");
+        }
+
+        const auto &setup = [&]() {
+            restoreExecutable(graph);
+            std::error_code ec;
+            if (mode != "cached") {
+                fs::remove_all(dest, ec);
+            } else if (!fs::exists(dest)) {
+                // What the timed runs find there, made by a run of its own.
+                auto first = args;
+                first.back() = std::to_string(options.jobs);
+                if (Bench::run(options.qmcorecmd, first).code != 0) {
+                    fail("deploy failed on a graph of " + std::to_string(result.size));
+                }
+                restoreExecutable(graph);
+            }
+        };
+
+        std::vector<double> times;
+        for (int i = 0; i < options.repeat; ++i) {
+            setup();
+            const auto &run = Bench::run(options.qmcorecmd, args);
+            if (run.code != 0) {
+                fail("deploy failed on a graph of " + std::to_string(result.size) + " in " + mode +
+                     " mode, with " + std::to_string(run.code));
+            }
+            times.push_back(run.seconds);
+            result.peakRssKiB = std::max(result.peakRssKiB, run.peakRssKiB);
+        }
+        std::sort(times.begin(), times.end());
+        result.medianSeconds = times[times.size() / 2];
+        result.minSeconds = times.front();
+
+        const auto &traceFile = graph.root / "trace.json";
+        setup();
+        args.push_back("--trace");
+        args.push_back(traceFile.string());
+        if (Bench::run(options.qmcorecmd, args).code == 0) {
+            result.counters = Bench::tracedCounters(traceFile);
+        }
+        return result;
+    }
+
+    void writeResults(const Options &options, const std::vector<Result> &results) {
+        char date[32];
+        const std::time_t now = std::time(nullptr);
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+        std::string json = "{\n";
+        json += "\"qmcorecmd\": " + Bench::jsonQuote(options.qmcorecmd.string()) + ",\n";
+        json += "\"date\": \"" + std::string(date) + "\",\n";
+        json += "\"fanout\": " + std::to_string(options.fanout) + ",\n";
+        json += "\"depth\": " + std::to_string(options.depth) + ",\n";
+        json += "\"jobs\": " + std::to_string(options.jobs) + ",\n";
+        json += "\"repeat\": " + std::to_string(options.repeat) + ",\n";
+        json += "\"results\": [";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const auto &result = results[i];
+            char numbers[96];
+            std::snprintf(numbers, sizeof(numbers), "\"seconds\": %.6f, \"min_seconds\": %.6f",
+                          result.medianSeconds, result.minSeconds);
+            json += (i ? ",\n" : "\n");
+            json += "{\"libraries\": " + std::to_string(result.size) +
+                    ", \"mode\": " + Bench::jsonQuote(result.mode) + ", " + numbers +
+                    ", \"peak_rss_kib\": " + std::to_string(result.peakRssKiB) +
+                    ", \"counters\": " + result.counters + "}";
+        }
+        json += "\n]\n}\n";
+        writeFile(options.out, json);
+    }
+
+    bool parseOptions(int argc, char *argv[], Options &options) {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            const auto &next = [&]() -> std::string {
+                if (i + 1 >= argc) {
+                    fail(arg + " needs a value");
+                }
+                return argv[++i];
+            };
+            if (arg == "--sizes") {
+                std::istringstream in(next());
+                for (std::string item; std::getline(in, item, ',');) {
+                    if (const size_t size = std::strtoull(item.data(), nullptr, 10); size > 0) {
+                        options.sizes.push_back(size);
+                    }
+                }
+            } else if (arg == "--fanout") {
+                options.fanout = std::max<size_t>(1, std::strtoull(next().data(), nullptr, 10));
+            } else if (arg == "--depth") {
+                options.depth = std::max<size_t>(1, std::strtoull(next().data(), nullptr, 10));
+            } else if (arg == "--jobs") {
+                options.jobs = std::max<size_t>(1, std::strtoull(next().data(), nullptr, 10));
+            } else if (arg == "--repeat") {
+                options.repeat = std::max(1, std::atoi(next().data()));
+            } else if (arg == "--out") {
+                options.out = next();
+            } else if (arg == "--work") {
+                options.work = fs::absolute(next());
+            } else if (arg == "--cc") {
+                options.cc = next();
+            } else if (arg == "--qmcorecmd") {
+                options.qmcorecmd = fs::absolute(next());
+            } else if (arg == "--keep") {
+                options.keep = true;
+            } else {
+                std::printf("unknown option: \"%s\"\n", arg.data());
+                return false;
+            }
+        }
+        if (options.sizes.empty()) {
+            options.sizes = {25, 100, 400};
+        }
+        if (options.work.empty()) {
+            options.work = fs::temp_directory_path() /
+                           ("qmcorecmd-deploy-bench-" + std::to_string(std::time(nullptr)));
+        }
+        // A compiler named without a directory is looked for the way a shell would.
+        if (!options.cc.has_parent_path()) {
+            options.cc = Bench::findOnPath(options.cc.string());
+        }
+        options.out = fs::absolute(options.out);
+        return true;
+    }
+
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        return 1;
+    }
+    if (!fs::is_regular_file(options.qmcorecmd)) {
+        fail("not a file: \"" + options.qmcorecmd.string() + "\"");
+    }
+    if (options.cc.empty() || !fs::is_regular_file(options.cc)) {
+        fail("no C compiler to build the graphs with, name one with --cc");
+    }
+
+    std::printf("%s\n%s\n\n", options.qmcorecmd.string().data(), options.work.string().data());
+    std::printf("%-12s%-10s%12s%12s%12s%14s\n", "libraries", "mode", "seconds", "min",
+                "peak KiB", "subprocesses");
+
+    std::vector<Result> results;
+    for (const size_t size : options.sizes) {
+        const auto &root = options.work / ("g" + std::to_string(size));
+        auto graph = makeGraph(options, size, root);
+        buildGraph(options, graph);
+
+        for (const char *mode : {"resolve", "serial", "parallel", "cached"}) {
+            results.push_back(measure(options, graph, mode, root / "out"));
+            const auto &result = results.back();
+
+            // Picked out of the counters for the table. The JSON has all of them.
+            std::string subprocesses = "-";
+            if (const auto pos = result.counters.find("\"subprocesses\":");
+                pos != std::string::npos) {
+                subprocesses = std::to_string(std::atoll(result.counters.data() + pos + 15));
+            }
+            std::printf("%-12zu%-10s%12.3f%12.3f%12lld%14s\n", size, mode, result.medianSeconds,
+                        result.minSeconds, static_cast<long long>(result.peakRssKiB),
+                        subprocesses.data());
+        }
+        if (!options.keep) {
+            std::error_code ec;
+            fs::remove_all(root, ec);
+        }
+    }
+
+    writeResults(options, results);
+    std::printf("\nWritten to %s\n", options.out.string().data());
+
+    if (!options.keep) {
+        std::error_code ec;
+        fs::remove_all(options.work, ec);
+    }
+    return 0;
+}
@@ -0,0 +1,174 @@
+#include "process.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#ifdef _WIN32
+#  include <windows.h>
+#  include <psapi.h>
+#else
+#  include <fcntl.h>
+#  include <spawn.h>
+#  include <sys/resource.h>
+#  include <sys/wait.h>
+#  include <unistd.h>
+
+extern char **environ;
+#endif
+
+namespace Bench {
+
+    using Clock = std::chrono::steady_clock;
+
+    RunResult run(const fs::path &program, const std::vector<std::string> &args) {
+        RunResult result;
+#ifdef _WIN32
+        std::wstring commandLine = L"\"" + program.wstring() + L"\"";
+        for (const auto &arg : args) {
+            commandLine += L" \"" + fs::u8path(arg).wstring() + L"\"";
+        }
+        SECURITY_ATTRIBUTES sa = {sizeof(sa), nullptr, TRUE};
+        HANDLE nul = ::CreateFileW(L"NUL", GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa,
+                                   OPEN_EXISTING, 0, nullptr);
+        STARTUPINFOW si = {sizeof(si)};
+        si.dwFlags = STARTF_USESTDHANDLES;
+        si.hStdInput = ::GetStdHandle(STD_INPUT_HANDLE);
+        si.hStdOutput = nul;
+        si.hStdError = nul;
+        PROCESS_INFORMATION pi;
+
+        const auto begin = Clock::now();
+        const BOOL started = ::CreateProcessW(program.c_str(), commandLine.data(), nullptr,
+                                              nullptr, TRUE, 0, nullptr, nullptr, &si, &pi);
+        ::CloseHandle(nul);
+        if (!started) {
+            return result;
+        }
+        ::WaitForSingleObject(pi.hProcess, INFINITE);
+        result.seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+
+        DWORD code = 0;
+        ::GetExitCodeProcess(pi.hProcess, &code);
+        result.code = int(code);
+        PROCESS_MEMORY_COUNTERS counters;
+        if (::GetProcessMemoryInfo(pi.hProcess, &counters, sizeof(counters))) {
+            result.peakRssKiB = int64_t(counters.PeakWorkingSetSize / 1024);
+        }
+        ::CloseHandle(pi.hThread);
+        ::CloseHandle(pi.hProcess);
+#else
+        std::vector<std::string> storage;
+        storage.push_back(program.string());
+        storage.insert(storage.end(), args.begin(), args.end());
+        std::vector<char *> argv;
+        for (auto &arg : storage) {
+            argv.push_back(arg.data());
+        }
+        argv.push_back(nullptr);
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+        posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+
+        const auto begin = Clock::now();
+        pid_t pid;
+        const int error = posix_spawn(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        if (error != 0) {
+            return result;
+        }
+
+        // wait4() rather than waitpid() for the child's own resource usage, which is gone once
+        // it has been waited for.
+        int status;
+        struct rusage usage {};
+        while (::wait4(pid, &status, 0, &usage) < 0) {
+            if (errno != EINTR) {
+                return result;
+            }
+        }
+        result.seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+        result.code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#  ifdef __APPLE__
+        result.peakRssKiB = int64_t(usage.ru_maxrss / 1024);
+#  else
+        result.peakRssKiB = int64_t(usage.ru_maxrss);
+#  endif
+#endif
+        return result;
+    }
+
+    fs::path findOnPath(const std::string &name) {
+        const char *path = std::getenv("PATH");
+        if (!path) {
+            return {};
+        }
+#ifdef _WIN32
+        const char separator = ';';
+        const std::string suffix = ".exe";
+#else
+        const char separator = ':';
+        const std::string suffix;
+#endif
+        std::string dirs = path;
+        for (size_t start = 0; start <= dirs.size();) {
+            size_t end = dirs.find(separator, start);
+            if (end == std::string::npos) {
+                end = dirs.size();
+            }
+            if (end > start) {
+                const auto &candidate = fs::path(dirs.substr(start, end - start)) / (name + suffix);
+                std::error_code ec;
+                if (fs::is_regular_file(candidate, ec)) {
+                    return candidate;
+                }
+            }
+            start = end + 1;
+        }
+        return {};
+    }
+
+    std::string jsonQuote(const std::string &s) {
+        std::string out = "\"";
+        for (const char c : s) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            } else {
+                out += c;
+            }
+        }
+        return out + "\"";
+    }
+
+    std::string readFile(const fs::path &path) {
+        std::ifstream in(path, std::ios::binary);
+        std::stringstream ss;
+        ss << in.rdbuf();
+        return ss.str();
+    }
+
+    std::string tracedCounters(const fs::path &traceFile) {
+        const auto &content = readFile(traceFile);
+        const std::string key = "\"otherData\":{\"counters\":";
+        const auto begin = content.find(key);
+        if (begin == std::string::npos) {
+            return "{}";
+        }
+        const auto end = content.find('}', begin + key.size());
+        if (end == std::string::npos) {
+            return "{}";
+        }
+        return content.substr(begin + key.size(), end + 1 - begin - key.size());
+    }
+
+}
@@ -0,0 +1,45 @@
+#ifndef BENCHMARKS_PROCESS_H
+#define BENCHMARKS_PROCESS_H
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Starting the executable under test and finding out what it cost, for the benchmarks that have to
+// time qmcorecmd as a build sees it rather than a part of it, and writing down what was found.
+namespace Bench {
+
+    namespace fs = std::filesystem;
+
+    struct RunResult {
+        /// What it exited with, or -1 where it could not be started or did not exit.
+        int code = -1;
+
+        /// From starting it to having waited for it.
+        double seconds = 0;
+
+        /// The most memory it held at once, in KiB, or -1 where the platform does not say.
+        int64_t peakRssKiB = -1;
+    };
+
+    /// Runs \a program with \a args and waits for it. What it prints goes nowhere, since a
+    /// terminal scrolling would be timed along with it.
+    RunResult run(const fs::path &program, const std::vector<std::string> &args);
+
+    /// Where \a name is found on \c PATH, or nothing.
+    fs::path findOnPath(const std::string &name);
+
+    /// The whole of \a path, or nothing where it cannot be read.
+    std::string readFile(const fs::path &path);
+
+    /// \a s as a JSON string, quotes and all.
+    std::string jsonQuote(const std::string &s);
+
+    /// The counters \c --trace wrote under \c otherData in \a traceFile, as the JSON object it
+    /// wrote, or an empty object.
+    std::string tracedCounters(const fs::path &traceFile);
+
+}
+
+#endif // BENCHMARKS_PROCESS_H
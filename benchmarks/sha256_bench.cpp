@@ -0,0 +1,213 @@
+// How fast each SHA-256 kernel is on this machine, in GB/s.
+//
+//     qmcorecmd_sha256_bench [seconds per measurement]
+//
+// Every kernel the machine has is checked against the portable one first, through the streaming
+// API with the input cut at odd places and through the many-buffer call, and a kernel that
+// disagrees stops the run with a non-zero exit before anything is timed.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "utils/sha-256.h"
+
+namespace {
+
+    struct Kernel {
+        sha_256_impl impl;
+        const char *name;
+    };
+
+    const Kernel kernels[] = {
+        {SHA_256_SCALAR,  "scalar" },
+        {SHA_256_SHANI,   "sha-ni" },
+        {SHA_256_AVX2_X8, "avx2-x8"},
+    };
+
+    std::string hex(const uint8_t hash[32]) {
+        std::string s;
+        char buf[3];
+        for (int i = 0; i < 32; ++i) {
+            std::snprintf(buf, sizeof(buf), "%02x", hash[i]);
+            s += buf;
+        }
+        return s;
+    }
+
+    bool checkKnownAnswers() {
+        const struct {
+            std::string input;
+            const char *digest;
+        } answers[] = {
+            {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+            {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+            {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+             "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+            {std::string(1000000, 'a'),
+             "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+        };
+
+        bool ok = true;
+        for (const auto &answer : answers) {
+            uint8_t hash[32];
+            calc_sha_256(hash, answer.input.data(), answer.input.size());
+            if (hex(hash) != answer.digest) {
+                std::printf("  %s: wrong answer for a message of %zu bytes\n",
+                            sha_256_implementation(), answer.input.size());
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    // Against what the portable kernel made of the same inputs: every length up to a few
+    // chunks, written in pieces cut at random, and the same again eight and more at a time.
+    bool checkAgainst(const std::vector<std::vector<uint8_t>> &inputs,
+                      const std::vector<std::string> &expected) {
+        std::mt19937 rng(42);
+        bool ok = true;
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            const auto &input = inputs[i];
+            struct sha_256 sha;
+            sha_256_init(&sha);
+            for (size_t pos = 0; pos < input.size();) {
+                const size_t n = std::min<size_t>(rng() % 150, input.size() - pos);
+                sha_256_write(&sha, input.data() + pos, n);
+                pos += n;
+            }
+            uint8_t hash[32];
+            sha_256_close(&sha, hash);
+            if (hex(hash) != expected[i]) {
+                std::printf("  %s: streaming a message of %zu bytes disagrees\n",
+                            sha_256_implementation(), input.size());
+                ok = false;
+            }
+        }
+
+        std::vector<const void *> ptrs;
+        std::vector<size_t> lens;
+        for (const auto &input : inputs) {
+            ptrs.push_back(input.data());
+            lens.push_back(input.size());
+        }
+        std::vector<uint8_t> digests(inputs.size() * 32);
+        const auto hashes = reinterpret_cast<uint8_t(*)[32]>(digests.data());
+        calc_sha_256_many(hashes, ptrs.data(), lens.data(), inputs.size());
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            if (hex(hashes[i]) != expected[i]) {
+                std::printf("  %s: a message of %zu bytes among many disagrees\n",
+                            sha_256_implementation(), inputs[i].size());
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    template <class F>
+    double gigabytesPerSecond(double seconds, size_t bytesPerCall, F &&call) {
+        using Clock = std::chrono::steady_clock;
+        size_t calls = 0;
+        const auto start = Clock::now();
+        auto now = start;
+        do {
+            for (int i = 0; i < 16; ++i) {
+                call();
+            }
+            calls += 16;
+            now = Clock::now();
+        } while (std::chrono::duration<double>(now - start).count() < seconds);
+        const double elapsed = std::chrono::duration<double>(now - start).count();
+        return double(calls) * double(bytesPerCall) / elapsed / 1e9;
+    }
+
+}
+
+int main(int argc, char *argv[]) {
+    const double seconds = argc > 1 ? std::atof(argv[1]) : 0.5;
+
+    std::mt19937 rng(1);
+    std::vector<std::vector<uint8_t>> inputs;
+    for (size_t len = 0; len <= 300; ++len) {
+        std::vector<uint8_t> input(len);
+        for (auto &byte : input) {
+            byte = uint8_t(rng());
+        }
+        inputs.push_back(std::move(input));
+    }
+
+    std::vector<std::string> expected;
+    sha_256_force(SHA_256_SCALAR);
+    for (const auto &input : inputs) {
+        uint8_t hash[32];
+        calc_sha_256(hash, input.data(), input.size());
+        expected.push_back(hex(hash));
+    }
+
+    std::vector<const Kernel *> available;
+    bool ok = true;
+    std::printf("Checking:\n");
+    for (const auto &kernel : kernels) {
+        if (!sha_256_force(kernel.impl)) {
+            std::printf("  %s: not on this machine\n", kernel.name);
+            continue;
+        }
+        const bool passed = checkKnownAnswers() && checkAgainst(inputs, expected);
+        std::printf("  %s: %s\n", kernel.name, passed ? "ok" : "FAILED");
+        ok = ok && passed;
+        available.push_back(&kernel);
+    }
+    if (!ok) {
+        return 1;
+    }
+
+    const size_t sizes[] = {64, 4096, size_t(1) << 20, size_t(64) << 20};
+    std::vector<uint8_t> data(sizes[3]);
+    for (auto &byte : data) {
+        byte = uint8_t(rng());
+    }
+
+    // Many buffers of one size at once, which is the only thing eight lanes are faster at.
+    constexpr size_t manyCount = 1024;
+    constexpr size_t manySize = 4096;
+    std::vector<const void *> manyPtrs;
+    std::vector<size_t> manyLens(manyCount, manySize);
+    for (size_t i = 0; i < manyCount; ++i) {
+        manyPtrs.push_back(data.data() + i * manySize);
+    }
+    std::vector<uint8_t> manyDigests(manyCount * 32);
+    const auto manyHashes = reinterpret_cast<uint8_t(*)[32]>(manyDigests.data());
+
+    std::printf("\n%-10s", "GB/s");
+    for (const auto size : sizes) {
+        std::printf("%12zu B", size);
+    }
+    std::printf("%16s\n", "1024 x 4 KiB");
+
+    for (const auto *kernel : available) {
+        sha_256_force(kernel->impl);
+        std::printf("%-10s", kernel->name);
+        for (const auto size : sizes) {
+            uint8_t hash[32];
+            if (kernel->impl == SHA_256_AVX2_X8) {
+                std::printf("%14s", "-");
+                continue;
+            }
+            std::printf("%14.3f", gigabytesPerSecond(seconds, size, [&]() {
+                            calc_sha_256(hash, data.data(), size);
+                        }));
+        }
+        std::printf("%14.3f\n", gigabytesPerSecond(seconds, manyCount * manySize, [&]() {
+                        calc_sha_256_many(manyHashes, manyPtrs.data(), manyLens.data(),
+                                          manyCount);
+                    }));
+    }
+
+    sha_256_force(SHA_256_AUTO);
+    std::printf("\nPicked by default: %s\n", sha_256_implementation());
+    return 0;
+}
@@ -0,0 +1,137 @@
+// How long qmcorecmd takes to start, do almost nothing and exit, in microseconds.
+//
+//     qmcorecmd_startup_bench [warm runs] [qmcorecmd]
+//
+// What is run is `qmcorecmd touch` on one file, being what a build runs most often and for the
+// least work, so that nearly all of what is measured is the cost of an invocation. It is run warm,
+// the same executable again and again, and cold, the first run of a fresh copy of the executable
+// each time. On Linux each copy's pages are dropped from the page cache before it is started, so
+// that it is read from the disk as it would be the first time after a build. `--version`, which
+// puts the whole command tree together, is timed warm beside it, which is what the lazy one saves.
+//
+// It has to start real processes, so unlike the other benchmarks it drives the executable rather
+// than being built out of its sources. Without a path it runs the qmcorecmd it was built with.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+#include "process.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+
+    // One run of \a program, in microseconds, or a negative number where it failed.
+    double timeRun(const fs::path &program, const std::vector<std::string> &args) {
+        const auto &result = Bench::run(program, args);
+        return result.code == 0 ? result.seconds * 1e6 : -1;
+    }
+
+    // Copies \a program to \a copy, and on Linux makes sure that none of the copy is left in the
+    // page cache to be started from.
+    bool freshCopy(const fs::path &program, const fs::path &copy) {
+        std::error_code ec;
+        if (!fs::copy_file(program, copy, fs::copy_options::overwrite_existing, ec)) {
+            return false;
+        }
+#ifdef __linux__
+        // Only clean pages can be dropped, so the copy is written out first.
+        if (int fd = ::open(copy.c_str(), O_RDONLY); fd >= 0) {
+            ::fsync(fd);
+            ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            ::close(fd);
+        }
+#endif
+        return true;
+    }
+
+    void printRow(const char *name, std::vector<double> samples) {
+        if (samples.empty()) {
+            std::printf("%-22s%12s\n", name, "-");
+            return;
+        }
+        std::sort(samples.begin(), samples.end());
+        double total = 0;
+        for (const double sample : samples) {
+            total += sample;
+        }
+        const auto at = [&](double fraction) {
+            return samples[std::min(samples.size() - 1, size_t(fraction * samples.size()))];
+        };
+        std::printf("%-22s%8zu%12.0f%12.0f%12.0f%12.0f\n", name, samples.size(), samples.front(),
+                    at(0.5), at(0.9), total / samples.size());
+    }
+
+}
+
+int main(int argc, char *argv[]) {
+    const int warmRuns = argc > 1 ? std::max(1, std::atoi(argv[1])) : 2000;
+    const int coldRuns = std::max(1, warmRuns / 10);
+    const fs::path program = argc > 2 ? fs::absolute(argv[2]) : fs::path(QMCORECMD_PATH);
+    if (!fs::is_regular_file(program)) {
+        std::printf("not a file: \"%s\"\n", program.string().data());
+        return 1;
+    }
+
+    const auto &dir = fs::temp_directory_path() /
+                      ("qmcorecmd-startup-bench-" +
+                       std::to_string(Clock::now().time_since_epoch().count()));
+    fs::create_directories(dir);
+    const auto &target = (dir / "touched").string();
+    std::ofstream(target).put('x');
+
+    const std::vector<std::string> touchArgs = {"touch", target};
+    if (timeRun(program, touchArgs) < 0) {
+        std::printf("\"%s touch\" failed, so nothing was timed\n", program.string().data());
+        fs::remove_all(dir);
+        return 1;
+    }
+
+    std::vector<double> warm, cold, wholeTree;
+    warm.reserve(warmRuns);
+    for (int i = 0; i < warmRuns; ++i) {
+        if (const double us = timeRun(program, touchArgs); us >= 0) {
+            warm.push_back(us);
+        }
+    }
+    for (int i = 0; i < warmRuns; ++i) {
+        if (const double us = timeRun(program, {"--version"}); us >= 0) {
+            wholeTree.push_back(us);
+        }
+    }
+
+    // A name of its own for each copy, so that nothing the loader or the system remembers about
+    // one path is any help to the next.
+    for (int i = 0; i < coldRuns; ++i) {
+        const auto &copy = dir / ("qmcorecmd-" + std::to_string(i) + program.extension().string());
+        if (!freshCopy(program, copy)) {
+            break;
+        }
+        if (const double us = timeRun(copy, touchArgs); us >= 0) {
+            cold.push_back(us);
+        }
+        fs::remove(copy);
+    }
+
+    std::printf("%s\n\n", program.string().data());
+    std::printf("%-22s%8s%12s%12s%12s%12s\n", "us", "runs", "min", "median", "p90", "mean");
+    printRow("touch, warm", warm);
+    printRow("touch, cold", cold);
+    printRow("--version, warm", wholeTree);
+
+    fs::remove_all(dir);
+    return warm.empty() ? 1 : 0;
+}
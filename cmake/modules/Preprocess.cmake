@@ -28,6 +28,12 @@ if(NOT DEFINED QMSETUP_SYNC_INCLUDE_STANDARD)
     set(QMSETUP_SYNC_INCLUDE_STANDARD on)
 endif()
 
+# Generate every configuration header in one run of the tool at the end of configuring, rather
+# than one run for each as it is asked for. See qm_generate_config.
+if(NOT DEFINED QMSETUP_BATCH_CONFIGURE)
+    set(QMSETUP_BATCH_CONFIGURE off)
+endif()
+
 include_guard(DIRECTORY)
 
 #[==[.rst:
@@ -36,6 +42,10 @@ include_guard(DIRECTORY)
   Generate indirect reference files for header files to make the include statements more orderly.
   The generated file has the same timestamp as the source file.
 
+  Runs at every configure and writes only what changed: a reference that is already right is
+  left as it is, and one written before for a header that has gone is removed. ``FORCE`` clears
+  the destination and writes everything again.
+
   .. code-block:: cmake
 
     qm_sync_include(<src> <dest>
@@ -43,6 +53,8 @@ include_guard(DIRECTORY)
         [INCLUDE <expr> <sub> ...]
         [EXCLUDE <expr...>]
         [INSTALL_DIR <dir>]
+        [EMIT <files | vfsoverlay | hmap>] [TARGET <target>]
+        [BUILD_TIME] [CUSTOM_TARGET <name>]
         [FORCE] [VERBOSE]
     )
 
@@ -50,13 +62,49 @@ include_guard(DIRECTORY)
     Enable standard public-private pattern, can be forced to enable by enabling ``QMSETUP_SYNC_INCLUDE_STANDARD``
   ``NO_STANDARD``
     Disable standard public-private pattern, enable it to override ``QMSETUP_SYNC_INCLUDE_STANDARD``
+  ``EMIT``
+    ``files`` by default. ``vfsoverlay`` writes one Clang ``-ivfsoverlay`` file and ``hmap`` one
+    header map in ``<dest>``, in place of a file for each header. The header map answers both
+    ``<foo.h>`` and ``<name/foo.h>``, where ``name`` is the last directory in ``<dest>``
+  ``TARGET``
+    Add ``<dest>`` to the include directories of ``<target>``, with whatever flag ``EMIT`` needs.
+    A compiler other than Clang understands neither file, so with one of those ``EMIT`` falls
+    back to ``files``
+  ``BUILD_TIME``
+    Sync as a step of the build rather than while configuring. The tool writes a depfile of the
+    directories it looked in and the headers it used, and the step is run again when one of
+    them changes, so a header added since is picked up without configuring again. The step
+    runs before ``TARGET`` is built, and as part of ``all`` otherwise. A generator that cannot
+    take a depfile, which before CMake 3.20 is all but Ninja and before 3.21 Visual Studio and
+    Xcode too, syncs while configuring instead, with a warning
+  ``CUSTOM_TARGET``
+    The name of the target running the step, for something other than ``TARGET`` to depend on.
+    One is made up out of ``<dest>`` if not given
 #]==]
 function(qm_sync_include _src_dir _dest_dir)
-    set(options FORCE VERBOSE STANDARD NO_STANDARD NO_ALL)
-    set(oneValueArgs INSTALL_DIR)
+    set(options FORCE VERBOSE STANDARD NO_STANDARD NO_ALL BUILD_TIME)
+    set(oneValueArgs INSTALL_DIR EMIT TARGET CUSTOM_TARGET)
     set(multiValueArgs INCLUDE EXCLUDE)
     cmake_parse_arguments(FUNC "${options}" "${oneValueArgs}" "${multiValueArgs}" ${ARGN})
 
+    set(_emit files)
+
+    if(FUNC_EMIT)
+        if(NOT FUNC_EMIT MATCHES "^(files|vfsoverlay|hmap)$")
+            message(FATAL_ERROR "qm_sync_include: unknown EMIT mode \"${FUNC_EMIT}\".")
+        endif()
+
+        set(_emit ${FUNC_EMIT})
+    endif()
+
+    # Only Clang reads either file, and clang-cl takes neither flag as written below.
+    if(FUNC_TARGET AND NOT _emit STREQUAL "files")
+        if(NOT CMAKE_CXX_COMPILER_ID MATCHES "Clang" OR CMAKE_CXX_COMPILER_FRONTEND_VARIANT STREQUAL "MSVC")
+            message(WARNING "qm_sync_include: EMIT ${_emit} needs Clang, writing files instead.")
+            set(_emit files)
+        endif()
+    endif()
+
     if(NOT IS_ABSOLUTE ${_src_dir})
         get_filename_component(_src_dir ${_src_dir} ABSOLUTE)
     else()
@@ -69,9 +117,21 @@ function(qm_sync_include _src_dir _dest_dir)
         string(REPLACE "\\" "/" _dest_dir ${_dest_dir})
     endif()
 
-    if(IS_DIRECTORY ${_src_dir})
-        file(GLOB_RECURSE header_files ${_src_dir}/*.h ${_src_dir}/*.hpp)
+    set(_build_time ${FUNC_BUILD_TIME})
 
+    if(_build_time)
+        if(CMAKE_VERSION VERSION_LESS "3.20" AND NOT CMAKE_GENERATOR MATCHES "Ninja")
+            set(_build_time off)
+        elseif(CMAKE_VERSION VERSION_LESS "3.21" AND CMAKE_GENERATOR MATCHES "Visual Studio|Xcode")
+            set(_build_time off)
+        endif()
+
+        if(NOT _build_time)
+            message(WARNING "qm_sync_include: ${CMAKE_GENERATOR} takes no depfile in CMake ${CMAKE_VERSION}, syncing while configuring instead.")
+        endif()
+    endif()
+
+    if(IS_DIRECTORY ${_src_dir})
         set(_args)
 
         if(FUNC_STANDARD OR(QMSETUP_SYNC_INCLUDE_STANDARD AND NOT FUNC_NO_STANDARD))
@@ -102,18 +162,89 @@ function(qm_sync_include _src_dir _dest_dir)
             list(APPEND _args -V)
         endif()
 
-        if(FUNC_FORCE OR NOT EXISTS ${_dest_dir})
-            if(EXISTS ${_dest_dir})
-                file(REMOVE_RECURSE ${_dest_dir})
+        # The tool keeps what it wrote in the destination and compares against it, so running
+        # it again costs a walk of the source and touches nothing that is already right. That
+        # is what lets it run every time, which is what picks up a header added since.
+        set(_sync_args ${_args})
+
+        # Only the build tree's include directory is a file or two. What is installed is the
+        # headers themselves, below, whatever this says.
+        list(APPEND _sync_args --emit ${_emit})
+
+        if(_build_time)
+            string(MD5 _hash "${_dest_dir}")
+            string(SUBSTRING "${_hash}" 0 8 _hash)
+            set(_stamp_dir "${CMAKE_CURRENT_BINARY_DIR}/CMakeFiles/qm_sync_include")
+            set(_stamp "${_stamp_dir}/${_hash}.stamp")
+
+            if(FUNC_CUSTOM_TARGET)
+                set(_sync_target ${FUNC_CUSTOM_TARGET})
+            else()
+                set(_sync_target qm_sync_include_${_hash})
+            endif()
+
+            # The step is run once and not again until something it read changes, so clearing
+            # the destination has to happen here, and take the stamp along with it.
+            if(FUNC_FORCE)
+                file(REMOVE_RECURSE ${_dest_dir} ${_stamp})
+            endif()
+
+            # What it was asked to do, written only when that changes, so that changing a
+            # pattern runs it again under a generator that does not compare command lines.
+            file(CONFIGURE OUTPUT "${_stamp_dir}/${_hash}.args"
+                CONTENT "${_sync_args};${_src_dir};${_dest_dir}\n"
+            )
+
+            add_custom_command(OUTPUT ${_stamp}
+                COMMAND ${QMSETUP_CORECMD_EXECUTABLE} incsync ${_sync_args}
+                --stamp ${_stamp} --depfile ${_stamp}.d ${_src_dir} ${_dest_dir}
+                DEPENDS "${_stamp_dir}/${_hash}.args"
+                DEPFILE ${_stamp}.d
+                WORKING_DIRECTORY ${CMAKE_CURRENT_SOURCE_DIR}
+                COMMENT "Syncing headers to ${_dest_dir}"
+                VERBATIM
+            )
+            add_custom_target(${_sync_target} ALL DEPENDS ${_stamp})
+
+            if(FUNC_TARGET)
+                add_dependencies(${FUNC_TARGET} ${_sync_target})
+            endif()
+        else()
+            if(FUNC_FORCE)
+                list(APPEND _sync_args -f)
             endif()
 
             execute_process(
-                COMMAND ${QMSETUP_CORECMD_EXECUTABLE} incsync ${_args} ${_src_dir} ${_dest_dir}
+                COMMAND ${QMSETUP_CORECMD_EXECUTABLE} incsync ${_sync_args} ${_src_dir} ${_dest_dir}
                 WORKING_DIRECTORY ${CMAKE_CURRENT_SOURCE_DIR}
                 COMMAND_ERROR_IS_FATAL ANY
             )
         endif()
 
+        if(FUNC_TARGET)
+            get_target_property(_type ${FUNC_TARGET} TYPE)
+
+            if(_type STREQUAL "INTERFACE_LIBRARY")
+                set(_scope INTERFACE)
+            else()
+                set(_scope PUBLIC)
+            endif()
+
+            if(_emit STREQUAL "vfsoverlay")
+                target_compile_options(${FUNC_TARGET} ${_scope}
+                    "$<BUILD_INTERFACE:-ivfsoverlay${_dest_dir}/.qmcorecmd-vfsoverlay.yaml>"
+                )
+                target_include_directories(${FUNC_TARGET} ${_scope} "$<BUILD_INTERFACE:${_dest_dir}>")
+            elseif(_emit STREQUAL "hmap")
+                # A header map is named where a directory would be.
+                target_include_directories(${FUNC_TARGET} ${_scope}
+                    "$<BUILD_INTERFACE:${_dest_dir}/.qmcorecmd.hmap>"
+                )
+            else()
+                target_include_directories(${FUNC_TARGET} ${_scope} "$<BUILD_INTERFACE:${_dest_dir}>")
+            endif()
+        endif()
+
         if(FUNC_INSTALL_DIR)
             set(_install_dir ${FUNC_INSTALL_DIR})
 
@@ -323,6 +454,12 @@ endfunction()
   Generate a configuration header of a property scope. If the configuration has not changed,
   the generated file's timestemp will not be updated when you reconfigure it.
 
+  With ``QMSETUP_BATCH_CONFIGURE`` on, this and ``qm_generate_build_info`` only say what to
+  generate, and every header is generated in one run of ``qmcorecmd configure --manifest`` once
+  the top-level ``CMakeLists.txt`` has been read. A project generating dozens of headers saves
+  starting the tool for each, but no header is there until configuring ends, so nothing read
+  while configuring can be one of them.
+
   .. code-block:: cmake
 
     qm_generate_config(<file>
@@ -647,6 +784,11 @@ function(_qm_generate_config_helper _file)
         list(APPEND _args "-f")
     endif()
 
+    if(QMSETUP_BATCH_CONFIGURE)
+        _qm_queue_config_helper("${_file}" ${ARGN})
+        return()
+    endif()
+
     list(APPEND _args ${_file})
 
     if(NOT ARG_NO_WARNING)
@@ -662,3 +804,121 @@ function(_qm_generate_config_helper _file)
         COMMAND_ERROR_IS_FATAL ANY
     )
 endfunction()
+
+#[[
+    A string as JSON has it, quotes and all. A semicolon and the square brackets are escaped
+    too, so that what this answers can be put in a CMake list as one element.
+
+      _qm_json_string(<out> <value>)
+]] #
+function(_qm_json_string _out _value)
+    string(REPLACE "\\" "\\\\" _value "${_value}")
+    string(REPLACE "\"" "\\\"" _value "${_value}")
+    string(REPLACE "\n" "\\n" _value "${_value}")
+    string(REPLACE "\t" "\\t" _value "${_value}")
+    string(REPLACE ";" "\\u003b" _value "${_value}")
+    string(REPLACE "[" "\\u005b" _value "${_value}")
+    string(REPLACE "]" "\\u005d" _value "${_value}")
+    set(${_out} "\"${_value}\"" PARENT_SCOPE)
+endfunction()
+
+#[[
+    Put off generating a header until the end of configuring, when all of them are generated
+    by _qm_flush_config_batch in one run of the tool.
+
+      _qm_queue_config_helper(<file> <the arguments of _qm_generate_config_helper...>)
+
+    The paths are made absolute here, since the manifest is read from somewhere else and
+    relative to itself.
+]] #
+function(_qm_queue_config_helper _file)
+    set(options NO_WARNING NO_HASH)
+    set(oneValueArgs PROJECT_NAME WARNING_FILE)
+    set(multiValueArgs DEFINITIONS)
+    cmake_parse_arguments(ARG "${options}" "${oneValueArgs}" "${multiValueArgs}" ${ARGN})
+
+    get_filename_component(_file "${_file}" ABSOLUTE BASE_DIR "${CMAKE_CURRENT_SOURCE_DIR}")
+    _qm_json_string(_value "${_file}")
+    set(_entry "{\"output\": ${_value}")
+
+    set(_defs)
+
+    foreach(_item IN LISTS ARG_DEFINITIONS)
+        _qm_json_string(_value "${_item}")
+        list(APPEND _defs "${_value}")
+    endforeach()
+
+    list(JOIN _defs ", " _defs)
+    string(APPEND _entry ", \"definitions\": [${_defs}]")
+
+    if(ARG_PROJECT_NAME)
+        _qm_json_string(_value "${ARG_PROJECT_NAME}")
+        string(APPEND _entry ", \"project\": ${_value}")
+    endif()
+
+    if(ARG_NO_WARNING)
+        string(APPEND _entry ", \"warning\": false")
+    elseif(ARG_WARNING_FILE)
+        get_filename_component(_warning "${ARG_WARNING_FILE}" ABSOLUTE
+            BASE_DIR "${CMAKE_CURRENT_SOURCE_DIR}")
+        _qm_json_string(_value "${_warning}")
+        string(APPEND _entry ", \"warning\": ${_value}")
+    else()
+        string(APPEND _entry ", \"warning\": true")
+    endif()
+
+    if(ARG_NO_HASH)
+        string(APPEND _entry ", \"hash\": false")
+    endif()
+
+    string(APPEND _entry "}")
+
+    # The last header asked for under a name is the one generated, as it would be if each
+    # were generated as it was asked for.
+    get_property(_outputs GLOBAL PROPERTY _QMSETUP_CONFIG_BATCH_OUTPUTS)
+    get_property(_entries GLOBAL PROPERTY _QMSETUP_CONFIG_BATCH_ENTRIES)
+    list(FIND _outputs "${_file}" _index)
+
+    if(_index GREATER_EQUAL 0)
+        list(REMOVE_AT _entries ${_index})
+        list(INSERT _entries ${_index} "${_entry}")
+    else()
+        list(APPEND _outputs "${_file}")
+        list(APPEND _entries "${_entry}")
+    endif()
+
+    set_property(GLOBAL PROPERTY _QMSETUP_CONFIG_BATCH_OUTPUTS "${_outputs}")
+    set_property(GLOBAL PROPERTY _QMSETUP_CONFIG_BATCH_ENTRIES "${_entries}")
+
+    get_property(_deferred GLOBAL PROPERTY _QMSETUP_CONFIG_BATCH_DEFERRED)
+
+    if(NOT _deferred)
+        set_property(GLOBAL PROPERTY _QMSETUP_CONFIG_BATCH_DEFERRED on)
+        cmake_language(DEFER DIRECTORY "${CMAKE_SOURCE_DIR}" CALL _qm_flush_config_batch)
+    endif()
+endfunction()
+
+#[[
+    Generate every header _qm_queue_config_helper was given, in one run of the tool.
+
+      _qm_flush_config_batch()
+]] #
+function(_qm_flush_config_batch)
+    get_property(_entries GLOBAL PROPERTY _QMSETUP_CONFIG_BATCH_ENTRIES)
+    set_property(GLOBAL PROPERTY _QMSETUP_CONFIG_BATCH_ENTRIES)
+    set_property(GLOBAL PROPERTY _QMSETUP_CONFIG_BATCH_OUTPUTS)
+    set_property(GLOBAL PROPERTY _QMSETUP_CONFIG_BATCH_DEFERRED off)
+
+    if(NOT _entries)
+        return()
+    endif()
+
+    list(JOIN _entries ",\n    " _entries)
+    set(_manifest "${CMAKE_BINARY_DIR}/CMakeFiles/qmsetup/configure_manifest.json")
+    file(WRITE "${_manifest}" "{\"headers\": [\n    ${_entries}\n]}\n")
+
+    execute_process(COMMAND ${QMSETUP_CORECMD_EXECUTABLE} configure --manifest "${_manifest}"
+        WORKING_DIRECTORY ${CMAKE_SOURCE_DIR}
+        COMMAND_ERROR_IS_FATAL ANY
+    )
+endfunction()
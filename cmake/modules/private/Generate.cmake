@@ -42,14 +42,32 @@ function(qm_make_output_file _infile _prefix _ext _out)
 endfunction()
 
 #[[
-    Create a custom command that writes a binary file out as a C array.
+    Create a custom command that writes a binary file out as a source file.
 
-    qm_add_binary_resource(<input> <output>)
+    qm_add_binary_resource(<input> <output>
+        [FORMAT c | incbin | embed]
+    )
+
+    FORMAT: what the output is, a C array by default. incbin writes an assembly
+            file, so <output> should end in .S and the project enable ASM, and
+            embed writes a C file using #embed. Both of those leave reading the
+            input to the assembler or the compiler.
 
     The array is named after the output file, made into an identifier, and the
     number of bytes follows it as <name>_len.
 #]]
 function(qm_add_binary_resource _input _output)
+    set(options)
+    set(oneValueArgs FORMAT)
+    set(multiValueArgs)
+    cmake_parse_arguments(FUNC "${options}" "${oneValueArgs}" "${multiValueArgs}" ${ARGN})
+
+    if(NOT FUNC_FORMAT)
+        set(FUNC_FORMAT c)
+    elseif(NOT FUNC_FORMAT MATCHES "^(c|incbin|embed)$")
+        message(FATAL_ERROR "qm_add_binary_resource: unknown FORMAT \"${FUNC_FORMAT}\"")
+    endif()
+
     # Always the script, never the xxd the machine may have. They do not agree
     # on what to call the array, and cannot be made to.
     #
@@ -68,14 +86,44 @@ function(qm_add_binary_resource _input _output)
     get_filename_component(_name ${_output} NAME)
     string(MAKE_C_IDENTIFIER ${_name} _name)
 
+    # The script hands the work to qmcorecmd where there is one, which is what
+    # makes an input of any size practical, and writes the array itself where
+    # there is not.
+    set(_corecmd_args)
+    if(QMSETUP_CORECMD_EXECUTABLE)
+        set(_corecmd_args -D "corecmd=${QMSETUP_CORECMD_EXECUTABLE}")
+    elseif(NOT FUNC_FORMAT STREQUAL "c")
+        message(FATAL_ERROR "qm_add_binary_resource: FORMAT ${FUNC_FORMAT} needs qmcorecmd")
+    endif()
+
+    # What incbin and embed write names the input rather than holding it, so
+    # qmcorecmd leaves it as it was when only the input's bytes changed. The
+    # command has still run, and its output has to say so by being newer than
+    # the input. Left older, a Makefile generator would run the command again on
+    # every build from then on. Ninja would not, since it checks again after the
+    # command whether the output changed, but nothing else does.
+    set(_touch_args)
+    if(NOT FUNC_FORMAT STREQUAL "c")
+        set(_touch_args COMMAND ${CMAKE_COMMAND} -E touch_nocreate ${_output})
+    endif()
+
     add_custom_command(
         OUTPUT ${_output}
         COMMAND ${CMAKE_COMMAND}
             -D "input=${_input}"
             -D "output=${_output}"
             -D "name=${_name}"
+            -D "format=${FUNC_FORMAT}"
+            ${_corecmd_args}
             -P "${QMSETUP_MODULES_DIR}/scripts/xxd.cmake"
+        ${_touch_args}
         DEPENDS ${_input}
         VERBATIM
     )
+
+    # The object is what has to be built again when the input changes, since
+    # the assembler or the compiler is what reads it.
+    if(NOT FUNC_FORMAT STREQUAL "c")
+        set_property(SOURCE ${_output} APPEND PROPERTY OBJECT_DEPENDS ${_input})
+    endif()
 endfunction()
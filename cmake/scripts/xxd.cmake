@@ -1,3 +1,18 @@
+# Usage:
+# cmake
+# -D input=<file>
+# -D output=<file>
+# -D name=<identifier>
+# [-D format=c|incbin|embed]
+# [-D corecmd=<qmcorecmd>]
+# -P xxd.cmake
+#
+# With `corecmd`, the work is handed to `qmcorecmd embed`, which reads the input
+# a piece at a time and leaves the output alone when it would come out the same.
+# Without it only the C array can be written, and it is written here, which
+# holds the whole input in memory as hex several times over. That is fine for
+# an icon and hopeless for anything of a size worth asking about.
+
 if(NOT DEFINED input)
     message(FATAL_ERROR "input not defined")
 endif()
@@ -10,14 +25,35 @@ if(NOT DEFINED name)
     message(FATAL_ERROR "name not defined")
 endif()
 
+if(NOT format)
+    set(format c)
+endif()
+
+if(corecmd)
+    execute_process(
+        COMMAND "${corecmd}" embed "${input}" "${output}" -n "${name}" --format "${format}"
+        RESULT_VARIABLE _code
+    )
+
+    if(NOT _code EQUAL 0)
+        message(FATAL_ERROR "qmcorecmd embed failed: ${_code}")
+    endif()
+
+    return()
+endif()
+
+if(NOT format STREQUAL "c")
+    message(FATAL_ERROR "format ${format} needs qmcorecmd, pass it as corecmd")
+endif()
+
 get_filename_component(_output_dir ${output} DIRECTORY)
 if(NOT EXISTS ${_output_dir})
     file(MAKE_DIRECTORY ${_output_dir})
 endif()
 
 file(READ ${input} _file_content HEX)
-string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1, " _hex_content ${_file_content})
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1, " _hex_content "${_file_content}")
 file(WRITE ${output}
     "unsigned char ${name}[] = {${_hex_content}};\n"
     "unsigned int ${name}_len = sizeof(${name});\n"
-)
\ No newline at end of file
+)
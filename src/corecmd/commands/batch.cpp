@@ -0,0 +1,328 @@
+// batch, which runs many command lines from one file in one process, each when the ones it waits
+// for have finished.
+
+#include "commands.h"
+
+#include "utils/json.h"
+#include "utils/utils.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <utility>
+
+#include <stdcorelib/console.h>
+
+using stdc::u8printf;
+
+namespace {
+
+    // One command line of a job file.
+    struct BatchJob {
+        std::string id;
+        std::string command;
+        std::vector<std::string> args;
+
+        /// The jobs this one waits for, each written before it.
+        std::vector<size_t> after;
+    };
+
+    // What may be run from a job file. Another batch would be a second scheduler under this one.
+    bool isBatchable(const std::string &command) {
+        static const char *const commands[] = {
+            "copy", "rmdir", "uninstall", "touch", "hash", "configure", "embed", "incsync", "deploy",
+        };
+        return std::find(std::begin(commands), std::end(commands), command) != std::end(commands);
+    }
+
+    // The jobs a file describes, as one JSON array of them or as one object to a line:
+    //
+    //     {"id": "config", "command": "configure", "args": ["include/config.h", "-D", "FOO"]}
+    //     {"id": "headers", "command": "incsync", "args": ["src", "include"], "after": "config"}
+    //
+    // Only "command" is required. "id" is what "after" names, and defaults to the job's position
+    // in the file counting from 1. "after" is one id or an array of them, each of a job written
+    // before this one, which rules a cycle out without having to look for one. The arguments are
+    // what would follow the command on a command line, and a relative path in them is relative
+    // to where batch runs, as it would be there.
+    //
+    // A job may not have a --trace of its own. There is one recording for the process, which
+    // batch's own --trace starts, and every job's spans go into it.
+    std::vector<BatchJob> readJobs(const fs::path &file) {
+        std::string text;
+        {
+            std::ifstream in(file, std::ios::binary);
+            if (!in.is_open()) {
+                throw std::runtime_error("failed to open job file \"" + tstr2str(file) +
+                                         "\": " + Utils::sysErrorMessage());
+            }
+            std::stringstream ss;
+            ss << in.rdbuf();
+            text = ss.str();
+        }
+
+        const auto invalid = [&file](const std::string &what) {
+            return std::runtime_error("invalid job file \"" + tstr2str(file) + "\": " + what);
+        };
+
+        // Each value, beside what to call it in a message.
+        std::vector<std::pair<std::string, Utils::JsonValue>> values;
+        const auto first = text.find_first_not_of(" \t\r\n");
+        if (first != std::string::npos && text[first] == '[') {
+            Utils::JsonValue root;
+            try {
+                root = Utils::JsonValue::parse(text);
+            } catch (const std::exception &e) {
+                throw invalid(e.what());
+            }
+            for (size_t i = 0; i < root.elements().size(); ++i) {
+                values.emplace_back("[" + std::to_string(i) + "]", root.elements()[i]);
+            }
+        } else {
+            std::istringstream iss(text);
+            std::string line;
+            for (size_t number = 1; std::getline(iss, line); ++number) {
+                if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                    continue;
+                }
+                const auto where = "line " + std::to_string(number);
+                try {
+                    values.emplace_back(where, Utils::JsonValue::parse(line));
+                } catch (const std::exception &e) {
+                    throw invalid(where + ": " + e.what());
+                }
+            }
+        }
+
+        std::vector<BatchJob> jobs;
+        std::map<std::string, size_t> ids;
+        for (const auto &[where, item] : values) {
+            if (!item.isObject()) {
+                throw invalid(where + " is not an object");
+            }
+
+            BatchJob job;
+
+            const auto *command = item.find("command");
+            if (!command || !command->isString() || command->toString().empty()) {
+                throw invalid(where + " has no \"command\"");
+            }
+            job.command = command->toString();
+            if (!isBatchable(job.command)) {
+                throw invalid(where + ": \"" + job.command + "\" cannot be run from a batch");
+            }
+
+            if (const auto *args = item.find("args")) {
+                if (!args->isArray()) {
+                    throw invalid(where + ": \"args\" is not an array");
+                }
+                for (const auto &arg : args->elements()) {
+                    if (!arg.isString()) {
+                        throw invalid(where + ": an argument is not a string");
+                    }
+                    job.args.push_back(arg.toString());
+                }
+                for (const auto &arg : std::as_const(job.args)) {
+                    if (arg == "--") {
+                        break;
+                    }
+                    if (arg == "--trace" || arg.compare(0, 8, "--trace=") == 0) {
+                        throw invalid(where + ": --trace is for the whole batch, not one job");
+                    }
+                }
+            }
+
+            job.id = std::to_string(jobs.size() + 1);
+            if (const auto *id = item.find("id")) {
+                if (!id->isString() || id->toString().empty()) {
+                    throw invalid(where + ": \"id\" is not a string");
+                }
+                job.id = id->toString();
+            }
+            if (!ids.emplace(job.id, jobs.size()).second) {
+                throw invalid(where + ": \"" + job.id + "\" is the id of a job before it too");
+            }
+
+            if (const auto *after = item.find("after")) {
+                std::vector<const Utils::JsonValue *> names;
+                if (after->isArray()) {
+                    for (const auto &name : after->elements()) {
+                        names.push_back(&name);
+                    }
+                } else {
+                    names.push_back(after);
+                }
+                for (const auto *name : names) {
+                    if (!name->isString()) {
+                        throw invalid(where + ": \"after\" is neither an id nor an array of them");
+                    }
+                    const auto it = ids.find(name->toString());
+                    if (it == ids.end() || it->second == jobs.size()) {
+                        throw invalid(where + ": \"" + name->toString() +
+                                      "\" is not the id of a job before it");
+                    }
+                    job.after.push_back(it->second);
+                }
+            }
+
+            jobs.push_back(std::move(job));
+        }
+        return jobs;
+    }
+
+}
+
+int cmd_batch(const cli::ParseResult &result,
+              const std::function<int(const std::vector<std::string> &)> &run) {
+    const bool verbose = isVerboseSet(result);
+    const auto &jobs = readJobs(fs::absolute(str2tstr(argumentValue(result, 0))));
+
+    const size_t jobCount = jobCountOf(result);
+
+    enum State {
+        Waiting,
+        Running,
+        Succeeded,
+        Failed,
+        Skipped,
+    };
+
+    // Everything below is guarded by the one mutex. A job is ready once everything it waits for
+    // has finished, and is skipped rather than run where any of those did not succeed, which
+    // passes on to whatever waits for it in turn.
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<State> states(jobs.size(), Waiting);
+    std::vector<int> codes(jobs.size(), 0);
+    std::vector<size_t> waitingOn(jobs.size());
+    std::vector<std::vector<size_t>> dependents(jobs.size());
+    std::deque<size_t> ready;
+    size_t finished = 0;
+
+    // deploy on macOS remembers which configurations of each framework were asked for, for the
+    // length of one run, so two of them are never run at once. What a deploy's -j says also
+    // limits the tools every job starts from then on, since that limit is the process's.
+    bool deploying = false;
+
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        waitingOn[i] = jobs[i].after.size();
+        for (const auto &dep : jobs[i].after) {
+            dependents[dep].push_back(i);
+        }
+        if (waitingOn[i] == 0) {
+            ready.push_back(i);
+        }
+    }
+
+    const auto printError = [](const std::string &msg) {
+        stdc::console::printf(stdc::console::bold, stdc::console::lightred,
+                              stdc::console::nocolor, "Error: %s\n", msg.data());
+    };
+
+    // Called with the lock held, once \a index is over.
+    const auto finish = [&](size_t index, State state) {
+        std::vector<size_t> stack = {index};
+        states[index] = state;
+        while (!stack.empty()) {
+            const auto done = stack.back();
+            stack.pop_back();
+            ++finished;
+            for (const auto &next : dependents[done]) {
+                if (--waitingOn[next] > 0) {
+                    continue;
+                }
+                const auto &after = jobs[next].after;
+                const auto blocker = std::find_if(after.begin(), after.end(),
+                                                  [&](size_t dep) { return states[dep] != Succeeded; });
+                if (blocker == after.end()) {
+                    ready.push_back(next);
+                    continue;
+                }
+                states[next] = Skipped;
+                u8printf("Skip: job \"%s\", after \"%s\" did not succeed\n",
+                         jobs[next].id.data(), jobs[*blocker].id.data());
+                stack.push_back(next);
+            }
+        }
+        changed.notify_all();
+    };
+
+    const auto work = [&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            std::deque<size_t>::iterator it;
+            changed.wait(lock, [&]() {
+                if (finished == jobs.size()) {
+                    return true;
+                }
+                it = std::find_if(ready.begin(), ready.end(), [&](size_t i) {
+                    return !(deploying && jobs[i].command == "deploy");
+                });
+                return it != ready.end();
+            });
+            if (finished == jobs.size()) {
+                return;
+            }
+
+            const auto index = *it;
+            ready.erase(it);
+            const auto &job = jobs[index];
+            const bool deploy = job.command == "deploy";
+            states[index] = Running;
+            deploying = deploying || deploy;
+            if (verbose) {
+                u8printf("Run: job \"%s\"\n", job.id.data());
+            }
+            lock.unlock();
+
+            std::vector<std::string> args = {"qmcorecmd", job.command};
+            args.insert(args.end(), job.args.begin(), job.args.end());
+            int code;
+            std::string error;
+            try {
+                code = run(args);
+            } catch (const std::exception &e) {
+                code = -1;
+                error = e.what();
+            }
+
+            lock.lock();
+            if (deploy) {
+                deploying = false;
+            }
+            codes[index] = code;
+            if (!error.empty()) {
+                printError("job \"" + job.id + "\": " + error);
+            } else if (code != 0) {
+                printError("job \"" + job.id + "\" exited with " + std::to_string(code));
+            }
+            finish(index, code == 0 ? Succeeded : Failed);
+        }
+    };
+
+    const size_t threads = std::min(jobCount, jobs.size());
+    std::vector<std::future<void>> pending;
+    for (size_t i = 1; i < threads; ++i) {
+        pending.push_back(std::async(std::launch::async, work));
+    }
+    if (threads > 0) {
+        work();
+    }
+    for (auto &item : pending) {
+        item.get();
+    }
+
+    // The first job in the file that failed decides the exit code, so that a batch of one exits
+    // as the command would have.
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        if (states[i] == Failed) {
+            return codes[i];
+        }
+    }
+    return 0;
+}
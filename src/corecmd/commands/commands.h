@@ -1,7 +1,11 @@
 #ifndef COMMANDS_H
 #define COMMANDS_H
 
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <stdcorelib/support/commandline.h>
@@ -17,17 +21,26 @@ namespace cli = stdc::cli;
 ///
 /// One per file, named after it. deploy is three, being a different program on every platform.
 ///
-/// copy, rmdir and touch are here because Windows has no command of its own for any of them and
-/// because CMake's answers are either slower or do not exist.
+/// copy, rmdir, uninstall and touch are here because Windows has no command of its own for any
+/// of them and because CMake's answers are either slower or do not exist.
 /// @{
 
 int cmd_copy(const cli::ParseResult &result);
 int cmd_rmdir(const cli::ParseResult &result);
+int cmd_uninstall(const cli::ParseResult &result);
 int cmd_touch(const cli::ParseResult &result);
+int cmd_hash(const cli::ParseResult &result);
 int cmd_configure(const cli::ParseResult &result);
+int cmd_embed(const cli::ParseResult &result);
 int cmd_incsync(const cli::ParseResult &result);
 int cmd_deploy(const cli::ParseResult &result);
 
+/// Runs the command lines a job file lists, several at once, each after those it names.
+///
+/// \param run what carries out one command line, throwing what went wrong rather than printing it
+int cmd_batch(const cli::ParseResult &result,
+              const std::function<int(const std::vector<std::string> &)> &run);
+
 /// @}
 
 /// \name The options more than one command declares
@@ -105,6 +118,47 @@ inline std::string givenValue(const cli::OptionResult &given, int index = 0, int
     return given.at(occurrence).value<std::string>(index).value_or(std::string());
 }
 
+/// How many things at once \c -j asks for, or the number of cores where it was not given.
+///
+/// \throw std::runtime_error where it was given and is not a whole number of at least one
+inline size_t jobCountOf(const cli::ParseResult &result) {
+    const auto &given = optionValue(result, "-j");
+    if (given.empty()) {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+    int n = 0;
+    try {
+        n = std::stoi(given);
+    } catch (const std::exception &) {
+    }
+    if (n < 1) {
+        throw std::runtime_error("invalid job count: \"" + given + "\"");
+    }
+    return size_t(n);
+}
+
+/// @}
+
+/// \name Printing for a program to read
+/// @{
+
+/// Whether \c --format asked for a JsonRecord for each thing done, rather than text.
+///
+/// With it, the lines \c -V would have printed are not, since the two would be mixed on one
+/// stream and what reads it wants one record to a line.
+///
+/// \throw std::runtime_error where it names anything but \c text or \c json
+inline bool isJsonFormatSet(const cli::ParseResult &result) {
+    const auto &format = optionValue(result, "--format");
+    if (format.empty() || format == "text") {
+        return false;
+    }
+    if (format != "json") {
+        throw std::runtime_error("unknown format: \"" + format + "\", expected text or json");
+    }
+    return true;
+}
+
 /// @}
 
 #endif // COMMANDS_H
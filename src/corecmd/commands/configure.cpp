@@ -3,76 +3,82 @@
 #include "commands.h"
 
 #include "utils/utils.h"
+#include "utils/json.h"
 
+#include <algorithm>
 #include <fstream>
-#include <iomanip>
 #include <iostream>
+#include <map>
+#include <set>
 #include <sstream>
+#include <string_view>
+#include <thread>
 
 #include <stdcorelib/console.h>
+#include <stdcorelib/path.h>
 #include <stdcorelib/str.h>
 
 #include "utils/sha-256.h"
+#include "utils/trace.h"
 
 using stdc::u8printf;
 
-static std::vector<std::string> defaultWarningLines() {
-    return {
-        "Caution: This file is generated by CMake automatically during configure.",
-        "WARNING!!! DO NOT EDIT THIS FILE MANUALLY!!!",
-        "ALL YOUR MODIFICATIONS HERE WILL GET LOST AFTER RE-CONFIGURING!!!",
+namespace {
+
+    std::vector<std::string> defaultWarningLines() {
+        return {
+            "Caution: This file is generated by CMake automatically during configure.",
+            "WARNING!!! DO NOT EDIT THIS FILE MANUALLY!!!",
+            "ALL YOUR MODIFICATIONS HERE WILL GET LOST AFTER RE-CONFIGURING!!!",
+        };
+    }
+
+    // One header, as the command line or one entry of a manifest describes it.
+    struct ConfigureJob {
+        fs::path fileName;
+        std::string projectName;
+        std::vector<std::string> defines;
+        bool warning = false;
+        fs::path warningFile; ///< Empty for the standard text
+        bool force = false;
     };
-}
 
-int cmd_configure(const cli::ParseResult &result) {
-    bool dryrun = isDryRunSet(result);
-    bool force = isForceSet(result);
-    bool verbose = dryrun || isVerboseSet(result);
+    // What became of one header, to be printed once all of them are done.
+    struct ConfigureOutcome {
+        std::string content;
+        std::string hash;
+        bool matched = false;
+    };
 
-    const auto &projectName = optionValue(result, "-p");
-    const auto &fileName = fs::absolute(str2tstr(argumentValue(result, 0)));
-
-    // Warning file
-    std::vector<std::string> warningLines;
-    if (const auto &warningResult = result.option("-w"); warningResult) {
-        do {
-            const auto &warningFileString = givenValue(*warningResult);
-            if (warningFileString.empty())
-                break;
-
-            const auto &warningFile = str2tstr(warningFileString);
-            std::ifstream inFile((fs::path(warningFile)));
-            if (!inFile.is_open()) {
-                break;
-            }
+    std::vector<std::string> readWarningLines(const ConfigureJob &job) {
+        std::vector<std::string> warningLines;
+        if (!job.warning) {
+            return warningLines;
+        }
 
+        if (!job.warningFile.empty()) {
+            std::ifstream inFile(job.warningFile);
             std::string line;
-            while (std::getline(inFile, line)) {
+            while (inFile.is_open() && std::getline(inFile, line)) {
                 line = stdc::str::trim(std::move(line));
                 if (line.empty())
                     continue;
                 warningLines.push_back(line);
             }
-
-            inFile.close();
-        } while (false);
+        }
 
         if (warningLines.empty()) {
             warningLines = defaultWarningLines();
         }
+        return warningLines;
     }
 
-    // Add defines
-    const std::vector<std::string> defines = optionValues(result, "-D");
-
-    // Generate definitions content
-    std::string definitions;
-    {
+    std::string formatDefinitions(const std::vector<std::string> &defines) {
         std::map<std::string, size_t> definitionMap;
         std::vector<std::pair<std::string, std::string>> definitionSequence; // Preserve order
-        for (const auto &def : std::as_const(defines)) {
+        for (const auto &def : defines) {
             // Raw line
-            if (def.front() == '%') {
+            if (!def.empty() && def.front() == '%') {
                 definitionSequence.push_back(std::make_pair("%", def.substr(1)));
                 continue;
             }
@@ -106,31 +112,29 @@ int cmd_configure(const cli::ParseResult &result) {
                 ss << "#define " << pair.first << " " << pair.second << "\n";
             }
         }
-        definitions = ss.str();
+        return ss.str();
     }
 
-    // Calculate hash
-    std::string hash;
-    if (!force) {
+    std::string sha256Hex(const std::string &data) {
         uint8_t buf[32];
-        calc_sha_256(buf, definitions.data(), definitions.size());
+        calc_sha_256(buf, data.data(), data.size());
 
-        std::stringstream ss;
-        ss << std::hex << std::setfill('0');
-        for (auto byte : buf) {
-            ss << std::setw(2) << static_cast<int>(byte);
+        static const char digits[] = "0123456789abcdef";
+        std::string hex(64, '0');
+        for (int i = 0; i < 32; ++i) {
+            hex[2 * i] = digits[buf[i] >> 4];
+            hex[2 * i + 1] = digits[buf[i] & 0xf];
         }
-        hash = ss.str();
+        return hex;
     }
 
-    // Generate content
-    std::string content;
-    {
-        std::string guard = tstr2str(fileName.filename());
+    std::string formatHeader(const ConfigureJob &job, const std::vector<std::string> &warningLines,
+                             const std::string &hash, const std::string &definitions) {
+        std::string guard = tstr2str(job.fileName.filename());
         {
             // Prepend project name
-            if (!projectName.empty()) {
-                guard = projectName + "_" + guard;
+            if (!job.projectName.empty()) {
+                guard = job.projectName + "_" + guard;
             }
 
             // Replace punctuation signs
@@ -155,7 +159,7 @@ int cmd_configure(const cli::ParseResult &result) {
 
         // Warning
         if (!warningLines.empty()) {
-            for (const auto &item : std::as_const(warningLines)) {
+            for (const auto &item : warningLines) {
                 ss << "// " << item << "\n";
             }
             ss << "\n";
@@ -172,89 +176,305 @@ int cmd_configure(const cli::ParseResult &result) {
         // Header guard end
         ss << "#endif // " << guard << "\n";
 
-        content = ss.str();
-    }
-
-    if (dryrun) {
-        u8printf("%s", content.data());
-        return 0;
+        return ss.str();
     }
 
-    // Read file
-    do {
-        if (force)
-            break;
-
-        // Check if file exists and has the same hash
-        std::ifstream inFile(fileName);
+    // Whether \a fileName is there and was written from definitions hashing to \a hash.
+    //
+    // The hash is near the top, after the header guard and the warning, so only as much of the
+    // file as reaches it is read: a few kilobytes, and more only while what has been read is
+    // still the comments above it. Lines are taken apart by hand rather than matched, a line
+    // ending in \r\n counting the same as one ending in \n, since a header written on Windows
+    // has those.
+    bool hashMatches(const fs::path &fileName, const std::string &hash) {
+        std::ifstream inFile(fileName, std::ios::binary);
         if (!inFile.is_open()) {
-            break;
+            return false;
         }
 
-        bool matched = false;
-
-        static std::regex hashPattern(R"(^// SHA256: (\w+)$)");
-        std::smatch match;
-        std::string line;
+        static const std::string_view marker = "// SHA256: ";
+        constexpr size_t firstRead = 4 * 1024;
+        constexpr size_t maxRead = 256 * 1024;
 
+        std::string head;
+        size_t pos = 0;
         int pp_cnt = 0;
-        while (std::getline(inFile, line)) {
-            if (line.empty())
-                continue;
+        for (size_t limit = firstRead;; limit *= 4) {
+            const size_t before = head.size();
+            head.resize(limit);
+            inFile.read(head.data() + before, std::streamsize(limit - before));
+            head.resize(before + size_t(inFile.gcount()));
+            const bool atEnd = head.size() < limit;
+
+            while (pos < head.size()) {
+                size_t end = head.find('\n', pos);
+                if (end == std::string::npos) {
+                    if (!atEnd)
+                        break; // The rest of the line is in what has not been read yet
+                    end = head.size();
+                }
+                std::string_view line(head.data() + pos, end - pos);
+                pos = end + 1;
+                if (!line.empty() && line.back() == '\r') {
+                    line.remove_suffix(1);
+                }
 
-            if (line.front() == '#') {
-                pp_cnt++; // Skip header guard
-                if (pp_cnt > 2) {
-                    break;
+                if (line.empty())
+                    continue;
+
+                if (line.front() == '#') {
+                    pp_cnt++; // Skip header guard
+                    if (pp_cnt > 2) {
+                        return false;
+                    }
+                    continue;
                 }
-                continue;
-            }
 
-            if (!stdc::str::starts_with(line, "//"))
-                break;
+                if (line.substr(0, 2) != "//")
+                    return false;
 
-            if (std::regex_match(line, match, hashPattern)) {
-                if (match[1] == hash) {
-                    matched = true;
+                if (line.substr(0, marker.size()) == marker) {
+                    return line.substr(marker.size()) == hash;
                 }
-                break;
             }
-        }
-        inFile.close();
 
-        if (matched) {
-            if (verbose) {
-                stdc::console::printf(stdc::console::bold, stdc::console::yellow,
-                                      stdc::console::nocolor, "Content matched. (%s)\n",
-                                      hash.data());
+            if (atEnd || limit >= maxRead) {
+                return false;
             }
-            // Same hash found, no need to overwrite the file
-            return 0;
         }
-    } while (false);
+    }
+
+    // Generates one header, and writes it unless \a dryrun or the one already there was
+    // generated from the same definitions.
+    ConfigureOutcome configureOne(const ConfigureJob &job, bool dryrun) {
+        ConfigureOutcome outcome;
+
+        const auto &definitions = formatDefinitions(job.defines);
+        if (!job.force) {
+            outcome.hash = sha256Hex(definitions);
+        }
+
+        // Same hash found, no need to overwrite the file. Asked before anything else is done,
+        // since this is the answer on every configure but the first, and none of the rest of the
+        // header need be made to give it.
+        if (!dryrun && !job.force && hashMatches(job.fileName, outcome.hash)) {
+            Trace::count(Trace::CacheHits);
+            Trace::count(Trace::FilesSkipped);
+            outcome.matched = true;
+            return outcome;
+        }
+
+        outcome.content = formatHeader(job, readWarningLines(job), outcome.hash, definitions);
+        if (dryrun) {
+            return outcome;
+        }
 
-    // Create file
-    {
         // Create directory if needed
-        if (auto dir = fileName.parent_path(); !fs::is_directory(dir)) {
+        if (auto dir = job.fileName.parent_path(); !fs::is_directory(dir)) {
             fs::create_directories(dir);
         }
 
-        std::ofstream outFile(fileName);
+        std::ofstream outFile(job.fileName);
         if (!outFile.is_open()) {
-            throw std::runtime_error("failed to open file \"" + tstr2str(fileName) +
+            throw std::runtime_error("failed to open file \"" + tstr2str(job.fileName) +
                                      "\": " + Utils::sysErrorMessage());
         }
+        outFile << outcome.content;
+        return outcome;
+    }
+
+    // The headers a manifest describes, one object each under "headers":
+    //
+    //     {
+    //         "headers": [
+    //             {
+    //                 "output": "include/foo_config.h",
+    //                 "definitions": ["FOO", "BAR=1", "%// raw line"],
+    //                 "project": "foo",
+    //                 "warning": true,
+    //                 "hash": true
+    //             }
+    //         ]
+    //     }
+    //
+    // Only "output" is required. "warning" is true for the standard text or the path of a file
+    // to read it from, as -w is, and "hash" false is -f. A relative path is relative to the
+    // manifest, which is what lets one be written once and read from anywhere.
+    std::vector<ConfigureJob> readManifest(const fs::path &manifest) {
+        std::string text;
+        {
+            std::ifstream in(manifest, std::ios::binary);
+            if (!in.is_open()) {
+                throw std::runtime_error("failed to open manifest \"" + tstr2str(manifest) +
+                                         "\": " + Utils::sysErrorMessage());
+            }
+            std::stringstream ss;
+            ss << in.rdbuf();
+            text = ss.str();
+        }
+
+        const auto invalid = [&manifest](const std::string &what) {
+            return std::runtime_error("invalid manifest \"" + tstr2str(manifest) +
+                                      "\": " + what);
+        };
+
+        Utils::JsonValue root;
+        try {
+            root = Utils::JsonValue::parse(text);
+        } catch (const std::exception &e) {
+            throw invalid(e.what());
+        }
 
-        outFile << content;
-        outFile.close();
+        const auto *headers = root.find("headers");
+        if (!headers || !headers->isArray()) {
+            throw invalid("expected an object with a \"headers\" array");
+        }
+
+        const auto &base = manifest.parent_path();
+        const auto resolve = [&base](const std::string &path) {
+            return stdc::path::clean_path(base / str2tstr(path));
+        };
+
+        std::vector<ConfigureJob> jobs;
+        std::set<fs::path> outputs;
+        for (size_t i = 0; i < headers->elements().size(); ++i) {
+            const auto &item = headers->elements()[i];
+            const auto where = "headers[" + std::to_string(i) + "]";
+            if (!item.isObject()) {
+                throw invalid(where + " is not an object");
+            }
+
+            ConfigureJob job;
+
+            const auto *output = item.find("output");
+            if (!output || !output->isString() || output->toString().empty()) {
+                throw invalid(where + " has no \"output\"");
+            }
+            job.fileName = resolve(output->toString());
+
+            // Two entries writing one file would be two threads writing it at once, and
+            // whichever finished last deciding what is in it.
+            if (!outputs.insert(job.fileName).second) {
+                throw invalid(where + " writes \"" + tstr2str(job.fileName) +
+                              "\", which an entry before it writes too");
+            }
+
+            if (const auto *definitions = item.find("definitions")) {
+                if (!definitions->isArray()) {
+                    throw invalid(where + ": \"definitions\" is not an array");
+                }
+                for (const auto &def : definitions->elements()) {
+                    if (!def.isString() || def.toString().empty()) {
+                        throw invalid(where + ": a definition is not a string");
+                    }
+                    job.defines.push_back(def.toString());
+                }
+            }
 
-        if (verbose) {
-            if (!hash.empty()) {
-                u8printf("SHA256: %s\n", hash.data());
+            if (const auto *project = item.find("project")) {
+                if (!project->isString()) {
+                    throw invalid(where + ": \"project\" is not a string");
+                }
+                job.projectName = project->toString();
+            }
+
+            if (const auto *warning = item.find("warning")) {
+                if (warning->isBool()) {
+                    job.warning = warning->toBool();
+                } else if (warning->isString()) {
+                    job.warning = true;
+                    if (!warning->toString().empty()) {
+                        job.warningFile = resolve(warning->toString());
+                    }
+                } else {
+                    throw invalid(where + ": \"warning\" is neither a boolean nor a path");
+                }
+            }
+
+            if (const auto *hash = item.find("hash")) {
+                if (!hash->isBool()) {
+                    throw invalid(where + ": \"hash\" is not a boolean");
+                }
+                job.force = !hash->toBool();
             }
+
+            jobs.push_back(std::move(job));
+        }
+        return jobs;
+    }
+
+    void printOutcome(const ConfigureOutcome &outcome) {
+        if (outcome.matched) {
+            stdc::console::printf(stdc::console::bold, stdc::console::yellow,
+                                  stdc::console::nocolor, "Content matched. (%s)\n",
+                                  outcome.hash.data());
+        } else if (!outcome.hash.empty()) {
+            u8printf("SHA256: %s\n", outcome.hash.data());
         }
     }
 
+}
+
+int cmd_configure(const cli::ParseResult &result) {
+    bool dryrun = isDryRunSet(result);
+    bool verbose = dryrun || isVerboseSet(result);
+
+    const auto &manifestString = optionValue(result, "--manifest");
+    const auto &outputString = argumentValue(result, 0);
+    if (manifestString.empty() == outputString.empty()) {
+        throw std::runtime_error("expected either an output file or --manifest");
+    }
+
+    if (manifestString.empty()) {
+        ConfigureJob job;
+        job.fileName = fs::absolute(str2tstr(outputString));
+        job.projectName = optionValue(result, "-p");
+        job.defines = optionValues(result, "-D");
+        job.force = isForceSet(result);
+        if (const auto &warningResult = result.option("-w"); warningResult) {
+            job.warning = true;
+            if (const auto &warningFileString = givenValue(*warningResult);
+                !warningFileString.empty()) {
+                job.warningFile = str2tstr(warningFileString);
+            }
+        }
+
+        const auto &outcome = configureOne(job, dryrun);
+        if (dryrun) {
+            u8printf("%s", outcome.content.data());
+        } else if (verbose) {
+            printOutcome(outcome);
+        }
+        return 0;
+    }
+
+    // What goes on the command line of a single header is the manifest's to say for each of
+    // them, so giving any of it as well is a mistake rather than a default.
+    for (const auto &token : {"-D", "-p", "-w", "-f"}) {
+        if (result.option(token)) {
+            throw std::runtime_error(std::string(token) +
+                                     " describes one header, and --manifest describes each of "
+                                     "its own");
+        }
+    }
+
+    const auto &jobs = readManifest(fs::absolute(str2tstr(manifestString)));
+
+    // Every header at once, one to a thread and as many threads as there are cores. What they
+    // did is printed afterwards, in the order the manifest gave them.
+    std::vector<ConfigureOutcome> outcomes(jobs.size());
+    Utils::runParallel(jobs.size(), std::max(1u, std::thread::hardware_concurrency()),
+                       [&](size_t i) { outcomes[i] = configureOne(jobs[i], dryrun); });
+
+    if (verbose) {
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            u8printf("Configure: \"%s\"\n", tstr2str(jobs[i].fileName).data());
+            if (dryrun) {
+                u8printf("%s", outcomes[i].content.data());
+            } else {
+                printOutcome(outcomes[i]);
+            }
+        }
+    }
     return 0;
 }
@@ -3,13 +3,19 @@
 
 #include "commands.h"
 
+#include "utils/journal.h"
+#include "utils/json.h"
 #include "utils/utils.h"
 
+#include <memory>
 #include <stdexcept>
 #include <utility>
 
+#include <stdcorelib/console.h>
 #include <stdcorelib/path.h>
 
+using stdc::u8printf;
+
 namespace {
 
     // Whether \a dest is \a dir or lies somewhere under it.
@@ -21,11 +27,51 @@ namespace {
         return !relative.empty() && *relative.begin() != fs::path("..");
     }
 
+    // Takes out of \a dir whatever the copy did not arrive at.
+    //
+    // A path the copy arrived at is kept, and so is one \a keep says yes to, since a pattern that
+    // keeps something from being copied says nothing about whether it should be deleted. A link
+    // is taken out or kept as a link and never walked into, as rmdir does.
+    void removeUnlisted(const fs::path &dir, const std::set<fs::path> &targets,
+                        const std::function<bool(const fs::path &)> &keep, bool verbose,
+                        bool json) {
+        for (const auto &entry : fs::directory_iterator(dir)) {
+            const auto &path = entry.path();
+            if (keep(path)) {
+                continue;
+            }
+
+            const bool listed = targets.count(path) != 0;
+            if (!Utils::isLink(path) && entry.is_directory()) {
+                removeUnlisted(path, targets, keep, verbose, json);
+                // A directory the sources do not have is gone once nothing is left in it. One
+                // they do have stays, empty or not, since the copy made it. Only this one is
+                // looked at, since what is below it has been through \a keep already, and an
+                // empty directory kept there keeps this one too.
+                if (listed || !fs::is_empty(path)) {
+                    continue;
+                }
+            } else if (listed) {
+                continue;
+            }
+
+            if (verbose) {
+                u8printf("Remove: \"%s\"\n", tstr2str(path).data());
+            }
+            fs::remove(path);
+            if (json) {
+                Utils::JsonRecord("remove").add("path", tstr2str(path)).print();
+            }
+        }
+    }
+
 }
 
 int cmd_copy(const cli::ParseResult &result) {
     bool force = isForceSet(result);
-    bool verbose = isVerboseSet(result);
+    bool json = isJsonFormatSet(result);
+    bool verbose = !json && isVerboseSet(result);
+    bool mirror = result.option("-m").has_value();
 
     std::set<fs::path> files;
     std::set<fs::path> directories;
@@ -86,14 +132,66 @@ int cmd_copy(const cli::ParseResult &result) {
         return Utils::searchInRegexList(TString(path), excludes);
     };
 
+    // What the copy arrived at, and which source directory each destination directory mirrors,
+    // for --mirror to take the rest out of. Several sources may land in one directory, so nothing
+    // is removed until all of them have been copied.
+    std::set<fs::path> targets;
+    std::vector<std::pair<fs::path, fs::path>> mirrored;
+    std::set<fs::path> *const visited = mirror ? &targets : nullptr;
+
+    std::unique_ptr<Utils::CopyJournal> journal;
+    if (const auto &journalFile = optionValue(result, "--journal"); !journalFile.empty()) {
+        journal = std::make_unique<Utils::CopyJournal>(fs::absolute(str2tstr(journalFile)));
+        journal->load();
+    }
+
     for (const auto &item : std::as_const(files)) {
-        Utils::copyFile(item, dest, {}, force, verbose);
+        Utils::copyFile(item, dest, {}, force, verbose, json);
+        targets.insert(dest / item.filename());
     }
     for (const auto &item : std::as_const(directories)) {
-        Utils::copyDirectory(item, item, dest / item.filename(), force, verbose, excludeFunc);
+        const auto &destDir = dest / item.filename();
+        Utils::copyDirectory(item, item, destDir, force, verbose, excludeFunc, visited,
+                             journal.get(), json);
+        targets.insert(destDir);
+        mirrored.emplace_back(destDir, item);
     }
     for (const auto &item : std::as_const(directoryContents)) {
-        Utils::copyDirectory(item, item, dest, force, verbose, excludeFunc);
+        Utils::copyDirectory(item, item, dest, force, verbose, excludeFunc, visited,
+                             journal.get(), json);
+        mirrored.emplace_back(dest, item);
+    }
+
+    if (mirror) {
+        // A pattern is written against the source tree, so what is asked about a destination
+        // path is whether the path it would have been copied from is excluded. Matching the
+        // destination path itself would have a pattern such as /build keep everything in an
+        // output directory that happens to be under one.
+        const auto &keepFunc = [&](const fs::path &path) {
+            for (const auto &pair : std::as_const(mirrored)) {
+                if (isInside(path, pair.first) &&
+                    excludeFunc(pair.second / path.lexically_relative(pair.first))) {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        std::set<fs::path> roots;
+        for (const auto &pair : std::as_const(mirrored)) {
+            roots.insert(pair.first);
+        }
+        for (const auto &root : std::as_const(roots)) {
+            // Walked already, as part of the destination it lies in.
+            if (root != dest && roots.count(dest)) {
+                continue;
+            }
+            removeUnlisted(root, targets, keepFunc, verbose, json);
+        }
+    }
+
+    if (journal) {
+        journal->save();
     }
 
     return 0;
@@ -4,7 +4,13 @@
 #include "commands.h"
 #include "deploy_p.h"
 
+#include "utils/json.h"
+#include "utils/trace.h"
+
 #include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
 
 #include <stdcorelib/console.h>
 #include <stdcorelib/path.h>
@@ -23,16 +29,33 @@ namespace {
         Deploy::Request request;
 
         request.dryrun = isDryRunSet(result);
+        request.json = isJsonFormatSet(result);
         // There is nothing else for a dry run to do, so it says what it found.
-        request.verbose = request.dryrun || isVerboseSet(result);
+        request.verbose = !request.json && (request.dryrun || isVerboseSet(result));
         request.force = isForceSet(result);
         request.standard = isStandardSet(result);
 
+        // Most of what a deployment waits on is patchelf, ldd, otool and install_name_tool, one
+        // run per binary, so the limit is handed on to what starts them as well.
+        request.jobs = jobCountOf(result);
+        Utils::setCommandJobLimit(request.jobs);
+
         request.dest = fs::current_path();
         if (auto given = result.option("-o"); given) {
             request.dest = absoluteOf(givenValue(*given));
         }
 
+        // Asked about before anything is resolved, so that a name it cannot write to is turned
+        // down without the graph having been walked for nothing.
+        if (const auto &graphString = optionValue(result, "--graph"); !graphString.empty()) {
+            request.graphFile = absoluteOf(graphString);
+            const auto &ext = stdc::str::to_lower(request.graphFile.extension().string());
+            if (ext != ".dot" && ext != ".gv" && ext != ".json") {
+                throw std::runtime_error("unknown graph format: \"" + graphString +
+                                         "\", name a .dot, .gv or .json file");
+            }
+        }
+
         for (const auto &item : argumentValues(result, 0)) {
             request.orgFiles.insert(Deploy::toDeployable(absoluteOf(item)));
         }
@@ -82,12 +105,136 @@ namespace {
         return request;
     }
 
+    // What --graph writes: every binary the walk arrived at, which of them needed which, and
+    // what reading each one cost. The walk itself keeps no more than one level, so this is
+    // filled in only when it was asked for.
+    struct DependencyGraph {
+        struct Node {
+            /// How far from a named binary, which is level 0.
+            int64_t level = 0;
+
+            /// named, deployed, system, excluded, or duplicate for one with the name of a
+            /// binary already taken.
+            const char *status = "deployed";
+
+            /// How long it took to read what it needs, or -1 for one that was never read.
+            int64_t resolveMicros = -1;
+        };
+
+        std::map<fs::path, Node> nodes;
+        std::vector<std::pair<fs::path, fs::path>> edges;
+        std::vector<std::pair<fs::path, std::string>> unresolved;
+    };
+
+    uint64_t fileSizeOf(const fs::path &path) {
+        std::error_code ec;
+        const auto size = fs::is_regular_file(path, ec) ? fs::file_size(path, ec) : 0;
+        return ec ? 0 : size;
+    }
+
+    void writeGraphJson(std::ostream &out, const DependencyGraph &graph) {
+        out << "{\n\"nodes\": [";
+        const char *separator = "\n";
+        for (const auto &[path, node] : graph.nodes) {
+            out << separator << "{\"path\":" << Utils::jsonQuote(tstr2str(path))
+                << ",\"status\":\"" << node.status << "\",\"level\":" << node.level
+                << ",\"bytes\":" << fileSizeOf(path) << ",\"resolve_us\":" << node.resolveMicros
+                << "}";
+            separator = ",\n";
+        }
+        out << "\n],\n\"edges\": [";
+        separator = "\n";
+        for (const auto &[from, to] : graph.edges) {
+            out << separator << "{\"from\":" << Utils::jsonQuote(tstr2str(from))
+                << ",\"to\":" << Utils::jsonQuote(tstr2str(to)) << "}";
+            separator = ",\n";
+        }
+        out << "\n],\n\"unresolved\": [";
+        separator = "\n";
+        for (const auto &[from, name] : graph.unresolved) {
+            out << separator << "{\"from\":" << Utils::jsonQuote(tstr2str(from))
+                << ",\"name\":" << Utils::jsonQuote(name) << "}";
+            separator = ",\n";
+        }
+        out << "\n]\n}\n";
+    }
+
+    // \a s with what DOT reads as an escape escaped, for between quotes.
+    std::string dotEscape(const std::string &s) {
+        std::string out;
+        for (const char c : s) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+            }
+            out += c;
+        }
+        return out;
+    }
+
+    // Graphviz, with each box saying what the file weighs and what reading it cost. What was
+    // passed over is grey and dashed, and a name nothing was found for is a red ellipse.
+    void writeGraphDot(std::ostream &out, const DependencyGraph &graph) {
+        const auto quote = [](const std::string &s) { return "\"" + dotEscape(s) + "\""; };
+
+        out << "digraph deploy {\n"
+               "    rankdir=LR;\n"
+               "    node [shape=box, fontname=\"sans-serif\"];\n";
+        for (const auto &[path, node] : graph.nodes) {
+            // \n is DOT's own line break, so it goes in after the escaping.
+            std::string label = "\"" + dotEscape(tstr2str(path.filename())) + "\\n" +
+                                std::to_string(fileSizeOf(path) / 1024) + " KiB";
+            if (node.resolveMicros >= 0) {
+                label += ", " + std::to_string(node.resolveMicros / 1000) + " ms";
+            }
+            label += "\"";
+
+            const std::string status = node.status;
+            out << "    " << quote(tstr2str(path)) << " [label=" << label;
+            if (status == "named") {
+                out << ", style=bold";
+            } else if (status != "deployed") {
+                out << ", style=dashed, color=grey, fontcolor=grey";
+            }
+            out << ", tooltip=" << quote(status) << "];\n";
+        }
+        for (const auto &[from, to] : graph.edges) {
+            out << "    " << quote(tstr2str(from)) << " -> " << quote(tstr2str(to)) << ";\n";
+        }
+        for (const auto &[from, name] : graph.unresolved) {
+            const auto &id = quote("unresolved:" + name);
+            out << "    " << id << " [label=" << quote(name)
+                << ", shape=ellipse, color=red, fontcolor=red];\n";
+            out << "    " << quote(tstr2str(from)) << " -> " << id << " [color=red];\n";
+        }
+        out << "}\n";
+    }
+
+    void writeGraph(const fs::path &file, const DependencyGraph &graph) {
+        std::ofstream out(file, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            throw std::runtime_error("failed to open file \"" + tstr2str(file) +
+                                     "\": " + Utils::sysErrorMessage());
+        }
+        if (stdc::str::to_lower(file.extension().string()) == ".json") {
+            writeGraphJson(out, graph);
+        } else {
+            writeGraphDot(out, graph);
+        }
+        out.close();
+        if (!out) {
+            throw std::runtime_error("failed to write file \"" + tstr2str(file) +
+                                     "\": " + Utils::sysErrorMessage());
+        }
+    }
+
     // Everything the named binaries need, and everything those need, gathered breadth first.
     //
     // What is followed is each binary's own direct dependencies. A library that is passed over,
     // because it was excluded or because the machine already has it, is never opened, so what
     // only it asked for is never found either.
-    std::vector<fs::path> resolveGraph(const Deploy::Request &request) {
+    //
+    // \a graph, where given, is filled in with the whole of what was found.
+    std::vector<fs::path> resolveGraph(const Deploy::Request &request, DependencyGraph *graph) {
         std::set<fs::path> namesOfOriginals;
         for (const auto &item : std::as_const(request.orgFiles)) {
             namesOfOriginals.insert(item.filename());
@@ -96,22 +243,61 @@ namespace {
             namesOfOriginals.insert(pair.first.filename());
         }
 
-        const auto &dependenciesOf = [&](const std::vector<fs::path> &paths) {
+        // One level of the graph at a time, every binary in it read at once. What each one needs
+        // is kept apart until all are read, so that what is printed comes out in the order the
+        // level was given in, whatever order the reading finished in.
+        //
+        // With --format=json each binary read is a node, each thing it needs an edge from it, and
+        // each name that could not be placed a record of its own. They are printed a level at a
+        // time, so that nothing of the graph is kept but the level being read.
+        const auto &dependenciesOf = [&](const std::vector<fs::path> &paths, int64_t level) {
+            std::vector<std::vector<fs::path>> results(paths.size());
+            std::vector<std::vector<std::string>> unparsedResults(paths.size());
+            std::vector<int64_t> costs(paths.size());
+            Utils::runParallel(paths.size(), request.jobs, [&](size_t i) {
+                Trace::Span span("deploy", "Resolve");
+                span.arg("file", tstr2str(paths[i]));
+                const auto begin = std::chrono::steady_clock::now();
+                results[i] = Deploy::resolveDependencies(Deploy::toResolvable(paths[i]), request,
+                                                         &unparsedResults[i]);
+                costs[i] = std::chrono::duration_cast<std::chrono::microseconds>(
+                               std::chrono::steady_clock::now() - begin)
+                               .count();
+            });
+
             std::set<TString> found;
-            for (const auto &path : std::as_const(paths)) {
+            for (size_t i = 0; i < paths.size(); ++i) {
+                const auto &from = tstr2str(paths[i]);
                 if (request.verbose) {
-                    u8printf("Resolve: \"%s\"\n", tstr2str(path).data());
+                    u8printf("Resolve: \"%s\"\n", from.data());
+                }
+                if (request.json) {
+                    Utils::JsonRecord("node").add("path", from).add("level", level).print();
+                }
+                if (graph) {
+                    graph->nodes[paths[i]].resolveMicros = costs[i];
+                    for (const auto &item : std::as_const(results[i])) {
+                        graph->edges.emplace_back(paths[i], Deploy::toDeployable(item));
+                    }
+                    for (const auto &item : std::as_const(unparsedResults[i])) {
+                        graph->unresolved.emplace_back(paths[i], item);
+                    }
                 }
 
-                std::vector<std::string> unparsed;
-                for (const auto &item :
-                     Deploy::resolveDependencies(Deploy::toResolvable(path), request, &unparsed)) {
+                for (const auto &item : std::as_const(results[i])) {
                     if (request.verbose) {
                         u8printf("    %s\n", tstr2str(item).data());
                     }
+                    if (request.json) {
+                        Utils::JsonRecord("edge")
+                            .add("from", from)
+                            .add("to", tstr2str(item))
+                            .print();
+                    }
                     found.insert(item);
                 }
 
+                const auto &unparsed = unparsedResults[i];
                 if (request.verbose) {
                     size_t widest = 0;
                     for (const auto &item : std::as_const(unparsed)) {
@@ -122,6 +308,14 @@ namespace {
                                  std::string(widest + 4 - item.size(), ' ').data());
                     }
                 }
+                if (request.json) {
+                    for (const auto &item : std::as_const(unparsed)) {
+                        Utils::JsonRecord("unresolved")
+                            .add("from", from)
+                            .add("name", item)
+                            .print();
+                    }
+                }
             }
             return std::vector<fs::path>{found.begin(), found.end()};
         };
@@ -138,8 +332,21 @@ namespace {
             stack.push_back(pair.first);
         }
 
-        while (!stack.empty()) {
-            const auto &libs = dependenciesOf(stack);
+        // Each node is what it was the first time it was arrived at, at the level that was. The
+        // same path arrived at again is an edge and nothing more.
+        const auto noteNode = [graph](const fs::path &path, int64_t level, const char *status) {
+            if (graph) {
+                graph->nodes.emplace(path, DependencyGraph::Node{level, status});
+            }
+        };
+        for (const auto &item : std::as_const(stack)) {
+            noteNode(item, 0, "named");
+        }
+
+        for (int64_t level = 0; !stack.empty(); ++level) {
+            Trace::Span span("deploy", "Resolve level " + std::to_string(level));
+            span.arg("files", int64_t(stack.size()));
+            const auto &libs = dependenciesOf(stack, level);
             stack.clear();
 
             for (const auto &lib : std::as_const(libs)) {
@@ -147,21 +354,39 @@ namespace {
 
                 // One of the binaries that was named, which stays where it is.
                 if (stdc::contains(namesOfOriginals, path.filename())) {
+                    noteNode(path, level + 1, "duplicate");
                     continue;
                 }
 
+                // A name is decided once. Whether it is a system library depends on nothing but
+                // the name, so one passed over is remembered with the rest, and says why only
+                // the first time it is arrived at.
                 const TString fileName = stdc::str::to_lower(TString(path.filename()));
-                if (Deploy::isSystemLibrary(fileName, request.standard) ||
-                    stdc::contains(visited, fileName)) {
+                if (stdc::contains(visited, fileName)) {
+                    noteNode(path, level + 1, "duplicate");
                     continue;
                 }
                 visited.insert(fileName);
 
-                if (Utils::searchInRegexList(TString(path), request.excludes)) {
+                const char *reason = nullptr;
+                if (Deploy::isSystemLibrary(fileName, request.standard)) {
+                    reason = "system";
+                } else if (Utils::searchInRegexList(TString(path), request.excludes)) {
+                    reason = "excluded";
+                }
+                if (reason) {
+                    noteNode(path, level + 1, reason);
+                    if (request.json) {
+                        Utils::JsonRecord("filter")
+                            .add("path", tstr2str(path))
+                            .add("reason", reason)
+                            .print();
+                    }
                     continue;
                 }
 
                 Deploy::noteDependency(path);
+                noteNode(path, level + 1, "deployed");
                 dependencies.push_back(path);
                 stack.push_back(path);
             }
@@ -174,7 +399,15 @@ namespace {
 
 int cmd_deploy(const cli::ParseResult &result) {
     const auto request = readRequest(result);
-    const auto dependencies = resolveGraph(request);
+
+    std::optional<DependencyGraph> graph;
+    if (!request.graphFile.empty()) {
+        graph.emplace();
+    }
+    const auto dependencies = resolveGraph(request, graph ? &*graph : nullptr);
+    if (graph) {
+        writeGraph(request.graphFile, *graph);
+    }
 
     if (request.dryrun) {
         return 0;
@@ -15,9 +15,18 @@ namespace Deploy {
         bool force = false;
         bool standard = false;
 
+        /// Print a JsonRecord for each thing found and done, rather than text.
+        bool json = false;
+
+        /// How many binaries are read, and how many tools are run, at once.
+        size_t jobs = 1;
+
         /// Where the dependencies go.
         fs::path dest;
 
+        /// Where \c --graph writes the dependency graph, as DOT or as JSON by its extension.
+        fs::path graphFile;
+
         /// The binaries that were named. They stay where they are.
         std::set<fs::path> orgFiles;
 
@@ -14,6 +14,8 @@
 #include <stdcorelib/str.h>
 #include <stdcorelib/stlextra/algorithms.h>
 
+#include "utils/json.h"
+#include "utils/trace.h"
 #include "utils/utils.h"
 
 using stdc::u8printf;
@@ -23,26 +25,48 @@ namespace {
     // Copies a library and the symlink that named it, and answers with the real file. A shared
     // library on Unix is usually a chain of names, and what matters at the far end is that the
     // soname the loader asks for is there beside the real thing.
-    fs::path copyCanonical(const fs::path &path, const fs::path &dest, bool force, bool verbose) {
+    fs::path copyCanonical(const fs::path &path, const fs::path &dest, bool force, bool verbose,
+                           bool json) {
         if (fs::is_symlink(path)) {
             const auto &linkPath = fs::canonical(path);
-            Utils::copyFile(linkPath, dest, {}, force, verbose);
-            Utils::copyFile(path, dest, linkPath.filename(), force, verbose);
+            Utils::copyFile(linkPath, dest, {}, force, verbose, json);
+            Utils::copyFile(path, dest, linkPath.filename(), force, verbose, json);
             return dest / linkPath.filename();
         }
 
-        Utils::copyFile(path, dest, {}, force, verbose);
+        Utils::copyFile(path, dest, {}, force, verbose, json);
         return dest / path.filename();
     }
 
-    void fixRPaths(const fs::path &file, const std::vector<std::string> &paths, bool verbose) {
-        if (verbose) {
-            u8printf("Fix rpath: \"%s\"\n", file.string().data());
-            for (const auto &path : paths) {
-                u8printf("    %s\n", path.data());
+    // A binary, and the rpath it is to be given.
+    using RPathFix = std::pair<fs::path, std::vector<std::string>>;
+
+    // Rewrites every rpath that was asked for, as many at once as the request allows. Each one is
+    // a run of patchelf or install_name_tool on a file nothing else is touching, so they have no
+    // order between them. What is done is printed first, so that the log reads the same however
+    // the runs fall out.
+    void fixRPaths(const std::vector<RPathFix> &fixes, const Deploy::Request &request) {
+        if (request.verbose) {
+            for (const auto &fix : fixes) {
+                u8printf("Fix rpath: \"%s\"\n", fix.first.string().data());
+                for (const auto &path : fix.second) {
+                    u8printf("    %s\n", path.data());
+                }
+            }
+        }
+        if (request.json) {
+            for (const auto &fix : fixes) {
+                Utils::JsonRecord("rpath")
+                    .add("path", fix.first.string())
+                    .add("rpaths", fix.second)
+                    .print();
             }
         }
-        Utils::setFileRPaths(file, paths);
+        Utils::runParallel(fixes.size(), request.jobs, [&](size_t i) {
+            Trace::Span span("deploy", "Fix rpath");
+            span.arg("file", fixes[i].first.string());
+            Utils::setFileRPaths(fixes[i].first, fixes[i].second);
+        });
     }
 
 }
@@ -127,27 +151,27 @@ namespace {
 
     // A framework is expected to end up where its rpath already says, so these are the ones a
     // bundle uses rather than anything worked out from where it landed.
-    void fixFrameworkRPaths(const fs::path &path, bool verbose) {
-        fixRPaths(path,
-                  {
-                      "@executable_path/../Frameworks",
-                      "@loader_path/Frameworks",
-                      "@loader_path/../../..",
-                  },
-                  verbose);
+    RPathFix frameworkRPathFix(const fs::path &path) {
+        return {path,
+                {
+                    "@executable_path/../Frameworks",
+                    "@loader_path/Frameworks",
+                    "@loader_path/../../..",
+                }};
     }
 
     fs::path copyFrameworkOrFile(const fs::path &file, const fs::path &dest, int type, bool force,
-                                 bool verbose) {
+                                 bool verbose, bool json) {
         if (!fs::is_directory(file)) {
-            return copyCanonical(file, dest, force, verbose);
+            return copyCanonical(file, dest, force, verbose, json);
         }
 
         const auto &name = file.stem();
         const auto targetPath = dest / file.filename();
-        Utils::copyDirectory(file, file, targetPath, force, verbose, [&](const fs::path &path) {
-            return frameworkIgnore(path, name, type);
-        });
+        Utils::copyDirectory(
+            file, file, targetPath, force, verbose,
+            [&](const fs::path &path) { return frameworkIgnore(path, name, type); }, nullptr,
+            nullptr, json);
         return targetPath;
     }
 
@@ -279,7 +303,8 @@ namespace Deploy {
         auto targetOrgFiles = request.orgFiles;
         for (const auto &pair : std::as_const(request.extraFiles)) {
             targetOrgFiles.insert(copyFrameworkOrFile(pair.first, pair.second, Debug | Release,
-                                                      request.force, request.verbose));
+                                                      request.force, request.verbose,
+                                                      request.json));
         }
 
         std::set<fs::path> targetDependencies;
@@ -289,8 +314,8 @@ namespace Deploy {
                 it != g_frameworkTypes.end()) {
                 type = it->second;
             }
-            targetDependencies.insert(
-                copyFrameworkOrFile(file, request.dest, type, request.force, request.verbose));
+            targetDependencies.insert(copyFrameworkOrFile(file, request.dest, type, request.force,
+                                                          request.verbose, request.json));
         }
 
         if (const auto arch = nativeArchitecture(request.verbose); !arch.empty()) {
@@ -326,39 +351,41 @@ namespace Deploy {
             }
         }
 
+        std::vector<RPathFix> fixes;
+
         // A binary that was named stays where it is, so its rpath has to reach across to wherever
         // the libraries went.
         for (const auto &file : std::as_const(targetOrgFiles)) {
             if (isFramework(file)) {
-                forEachLibrary(file,
-                               [&](const fs::path &lib) { fixFrameworkRPaths(lib, request.verbose); });
+                forEachLibrary(file, [&](const fs::path &lib) {
+                    fixes.push_back(frameworkRPathFix(lib));
+                });
             } else {
-                fixRPaths(file,
-                          {
-                              "@executable_path/../Frameworks",
-                              "@loader_path/" +
-                                  stdc::path::clean_path(
-                                      fs::relative(request.dest, file.parent_path()))
-                                      .string(),
-                          },
-                          request.verbose);
+                fixes.emplace_back(file, std::vector<std::string>{
+                                             "@executable_path/../Frameworks",
+                                             "@loader_path/" +
+                                                 stdc::path::clean_path(
+                                                     fs::relative(request.dest, file.parent_path()))
+                                                     .string(),
+                                         });
             }
         }
 
         // A library that was copied is beside the others, so its own directory is enough.
         for (const auto &file : std::as_const(targetDependencies)) {
             if (isFramework(file)) {
-                forEachLibrary(file,
-                               [&](const fs::path &lib) { fixFrameworkRPaths(lib, request.verbose); });
+                forEachLibrary(file, [&](const fs::path &lib) {
+                    fixes.push_back(frameworkRPathFix(lib));
+                });
             } else {
-                fixRPaths(file,
-                          {
-                              "@executable_path/../Frameworks",
-                              "@loader_path",
-                          },
-                          request.verbose);
+                fixes.emplace_back(file, std::vector<std::string>{
+                                             "@executable_path/../Frameworks",
+                                             "@loader_path",
+                                         });
             }
         }
+
+        fixRPaths(fixes, request);
     }
 
 }
@@ -403,14 +430,14 @@ namespace Deploy {
     void deployFiles(const Request &request, const std::vector<fs::path> &dependencies) {
         auto targetOrgFiles = request.orgFiles;
         for (const auto &pair : std::as_const(request.extraFiles)) {
-            targetOrgFiles.insert(
-                copyCanonical(pair.first, pair.second, request.force, request.verbose));
+            targetOrgFiles.insert(copyCanonical(pair.first, pair.second, request.force,
+                                                request.verbose, request.json));
         }
 
         std::set<fs::path> targetDependencies;
         for (const auto &file : std::as_const(dependencies)) {
             const auto targetPath = copyCanonical(file, request.dest, request.force,
-                                                  request.verbose);
+                                                  request.verbose, request.json);
 
             // libc.so is a linker script rather than a library, so there is nothing in it to
             // rewrite an rpath in.
@@ -419,20 +446,25 @@ namespace Deploy {
             }
         }
 
+        std::vector<RPathFix> fixes;
+
         // A binary that was named stays where it is, so its rpath has to reach across to wherever
         // the libraries went.
         for (const auto &file : std::as_const(targetOrgFiles)) {
-            fixRPaths(file,
-                      {"$ORIGIN/" +
-                       stdc::path::clean_path(fs::relative(request.dest, file.parent_path()))
-                           .string()},
-                      request.verbose);
+            fixes.emplace_back(
+                file, std::vector<std::string>{
+                          "$ORIGIN/" +
+                          stdc::path::clean_path(fs::relative(request.dest, file.parent_path()))
+                              .string(),
+                      });
         }
 
         // A library that was copied is beside the others, so its own directory is enough.
         for (const auto &file : std::as_const(targetDependencies)) {
-            fixRPaths(file, {"$ORIGIN"}, request.verbose);
+            fixes.emplace_back(file, std::vector<std::string>{"$ORIGIN"});
         }
+
+        fixRPaths(fixes, request);
     }
 
 }
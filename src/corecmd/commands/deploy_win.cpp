@@ -84,11 +84,12 @@ namespace Deploy {
 
     void deployFiles(const Request &request, const std::vector<fs::path> &dependencies) {
         for (const auto &pair : std::as_const(request.extraFiles)) {
-            Utils::copyFile(pair.first, pair.second, {}, request.force, request.verbose);
+            Utils::copyFile(pair.first, pair.second, {}, request.force, request.verbose,
+                            request.json);
         }
 
         for (const auto &file : std::as_const(dependencies)) {
-            Utils::copyFile(file, request.dest, {}, request.force, request.verbose);
+            Utils::copyFile(file, request.dest, {}, request.force, request.verbose, request.json);
         }
     }
 
@@ -0,0 +1,291 @@
+// embed, which turns a file into something a C compiler or an assembler can link in.
+
+#include "commands.h"
+
+#include "utils/utils.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include <stdcorelib/console.h>
+#include <stdcorelib/path.h>
+
+using stdc::u8printf;
+
+namespace {
+
+    // Writes a file a piece at a time, and only if it would come out different.
+    //
+    // What is given is compared with what the file holds as it comes, without writing anything.
+    // At the first byte that differs a file is started beside the old one, what matched so far is
+    // copied into it from the old one, and everything after goes into it. So a run that changes
+    // nothing reads the old file once and writes nothing, and a run that changes something never
+    // holds more than a piece of either in memory. The new file is moved over the old one at the
+    // end, so that a run stopped half way leaves the old one whole.
+    class ChangedFileWriter {
+    public:
+        explicit ChangedFileWriter(fs::path file) : m_file(std::move(file)) {
+            m_temp = m_file;
+            m_temp += ".tmp";
+            m_old.open(m_file, std::ios::binary);
+            if (!m_old.is_open()) {
+                diverge();
+            }
+        }
+
+        void write(const char *data, size_t len) {
+            if (!m_diverged) {
+                m_buffer.resize(len);
+                m_old.read(m_buffer.data(), std::streamsize(len));
+                if (size_t(m_old.gcount()) == len && std::equal(data, data + len, m_buffer.data())) {
+                    m_matched += len;
+                    return;
+                }
+                diverge();
+            }
+            m_out.write(data, std::streamsize(len));
+        }
+
+        void write(const std::string &s) {
+            write(s.data(), s.size());
+        }
+
+        /// \return whether the file was written
+        bool finish() {
+            if (!m_diverged) {
+                if (m_old.peek() == std::char_traits<char>::eof()) {
+                    return false;
+                }
+                diverge();
+            }
+            m_out.close();
+            if (!m_out) {
+                throw std::runtime_error("failed to write file \"" + tstr2str(m_temp) +
+                                         "\": " + Utils::sysErrorMessage());
+            }
+            m_old.close();
+            fs::rename(m_temp, m_file);
+            return true;
+        }
+
+    private:
+        void diverge() {
+            m_diverged = true;
+            m_out.open(m_temp, std::ios::binary | std::ios::trunc);
+            if (!m_out.is_open()) {
+                throw std::runtime_error("failed to open file \"" + tstr2str(m_temp) +
+                                         "\": " + Utils::sysErrorMessage());
+            }
+            if (m_matched == 0) {
+                return;
+            }
+
+            m_old.clear();
+            m_old.seekg(0);
+            std::vector<char> buffer(64 * 1024);
+            for (uint64_t left = m_matched; left > 0;) {
+                const auto n = size_t(std::min<uint64_t>(left, buffer.size()));
+                m_old.read(buffer.data(), std::streamsize(n));
+                m_out.write(buffer.data(), std::streamsize(n));
+                left -= n;
+            }
+        }
+
+        fs::path m_file;
+        fs::path m_temp;
+        std::ifstream m_old;
+        std::ofstream m_out;
+        std::vector<char> m_buffer;
+        uint64_t m_matched = 0;
+        bool m_diverged = false;
+    };
+
+    // What CMake's string(MAKE_C_IDENTIFIER) makes of a name, so that the default is the name
+    // qm_add_binary_resource has always given.
+    std::string makeCIdentifier(const std::string &s) {
+        std::string result;
+        for (const auto &c : s) {
+            result += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+        }
+        if (result.empty() || std::isdigit(static_cast<unsigned char>(result.front()))) {
+            result.insert(result.begin(), '_');
+        }
+        return result;
+    }
+
+    // A path as a string literal, in the form every compiler and assembler reads.
+    std::string quotedPath(const fs::path &path) {
+        std::string result = "\"";
+        for (const auto &c : tstr2str(path.generic_string<TChar>())) {
+            if (c == '\\' || c == '"') {
+                result += '\\';
+            }
+            result += c;
+        }
+        return result + "\"";
+    }
+
+    // The bytes themselves, twelve to a line, read and written a piece at a time. A line is made
+    // by copying six characters out of a table for each byte rather than by formatting it, which
+    // is most of the time a big file takes.
+    void writeArray(ChangedFileWriter &out, const fs::path &input, const std::string &name,
+                    uint64_t size) {
+        std::ifstream in(input, std::ios::binary);
+        if (!in.is_open()) {
+            throw std::runtime_error("failed to open file \"" + tstr2str(input) +
+                                     "\": " + Utils::sysErrorMessage());
+        }
+
+        static const auto table = []() {
+            std::vector<char> t(256 * 6);
+            static const char digits[] = "0123456789abcdef";
+            for (int i = 0; i < 256; ++i) {
+                char *p = t.data() + i * 6;
+                p[0] = '0';
+                p[1] = 'x';
+                p[2] = digits[i >> 4];
+                p[3] = digits[i & 0xf];
+                p[4] = ',';
+                p[5] = ' ';
+            }
+            return t;
+        }();
+
+        out.write("unsigned char " + name + "[] = {\n");
+        if (size == 0) {
+            // An empty initialiser is not C, and a zero-length array is not either.
+            out.write("    0\n");
+        }
+
+        constexpr size_t bytesPerLine = 12;
+        constexpr size_t chunk = bytesPerLine * 8192;
+        std::vector<char> bytes(chunk);
+        std::vector<char> text(chunk / bytesPerLine * (4 + bytesPerLine * 6));
+        while (in) {
+            in.read(bytes.data(), std::streamsize(bytes.size()));
+            const auto n = size_t(in.gcount());
+            char *p = text.data();
+            for (size_t i = 0; i < n; i += bytesPerLine) {
+                std::memcpy(p, "    ", 4);
+                p += 4;
+                const size_t end = std::min(n, i + bytesPerLine);
+                for (size_t j = i; j < end; ++j) {
+                    std::memcpy(p, table.data() + static_cast<unsigned char>(bytes[j]) * 6, 6);
+                    p += 6;
+                }
+                p[-1] = '\n';
+            }
+            out.write(text.data(), size_t(p - text.data()));
+        }
+        if (in.bad()) {
+            throw std::runtime_error("failed to read file \"" + tstr2str(input) +
+                                     "\": " + Utils::sysErrorMessage());
+        }
+
+        out.write("};\nunsigned int " + name + "_len = " + std::to_string(size) + ";\n");
+    }
+
+    // An assembly file whose .incbin has the assembler read the file itself, so that nothing
+    // here reads it at all. It is preprocessed, being a .S, which is what lets one file answer
+    // for ELF, Mach-O and COFF.
+    std::string formatIncbin(const fs::path &input, const std::string &name) {
+        std::string s;
+        s += "// Generated by qmcorecmd embed. The assembler reads the file named below.\n"
+             "\n"
+             "#if defined(__APPLE__) || (defined(_WIN32) && defined(__i386__))\n"
+             "#  define QM_EMBED_SYMBOL(x) _##x\n"
+             "#else\n"
+             "#  define QM_EMBED_SYMBOL(x) x\n"
+             "#endif\n"
+             "\n"
+             "#if defined(__APPLE__)\n"
+             "    .const_data\n"
+             "#elif defined(_WIN32)\n"
+             "    .section .rdata,\"dr\"\n"
+             "#else\n"
+             "    .section .rodata\n"
+             "#endif\n"
+             "\n";
+        s += "    .globl QM_EMBED_SYMBOL(" + name + ")\n";
+        s += "    .balign 16\n";
+        s += "QM_EMBED_SYMBOL(" + name + "):\n";
+        s += "    .incbin " + quotedPath(input) + "\n";
+        s += "1:\n";
+        s += "    .globl QM_EMBED_SYMBOL(" + name + "_len)\n";
+        s += "    .balign 4\n";
+        s += "QM_EMBED_SYMBOL(" + name + "_len):\n";
+        s += "    .long 1b - QM_EMBED_SYMBOL(" + name + ")\n";
+        s += "\n"
+             "#if defined(__ELF__)\n"
+             "    .section .note.GNU-stack,\"\",%progbits\n"
+             "#endif\n";
+        return s;
+    }
+
+    // A C file whose #embed has the compiler read the file itself. The size is written out
+    // rather than taken with sizeof, since an empty file still gives the array the one byte
+    // if_empty puts there.
+    std::string formatEmbed(const fs::path &input, const std::string &name, uint64_t size) {
+        std::string s;
+        s += "// Generated by qmcorecmd embed. The compiler reads the file named below.\n\n";
+        s += "unsigned char " + name + "[] = {\n";
+        s += "#embed " + quotedPath(input) + " if_empty(0)\n";
+        s += "};\n";
+        s += "unsigned int " + name + "_len = " + std::to_string(size) + ";\n";
+        return s;
+    }
+
+}
+
+int cmd_embed(const cli::ParseResult &result) {
+    const bool verbose = isVerboseSet(result);
+
+    const auto &inputString = argumentValue(result, 0);
+    const auto &input = stdc::path::clean_path(fs::absolute(str2tstr(inputString)));
+    if (!fs::is_regular_file(input)) {
+        throw std::runtime_error("not a file: \"" + inputString + "\"");
+    }
+    const auto &output = stdc::path::clean_path(fs::absolute(str2tstr(argumentValue(result, 1))));
+
+    std::string name = optionValue(result, "-n");
+    if (name.empty()) {
+        name = makeCIdentifier(tstr2str(output.filename().native()));
+    } else if (name != makeCIdentifier(name)) {
+        throw std::runtime_error("not a C identifier: \"" + name + "\"");
+    }
+
+    std::string format = optionValue(result, "--format");
+    if (format.empty()) {
+        format = "c";
+    }
+    if (format != "c" && format != "incbin" && format != "embed") {
+        throw std::runtime_error("unknown format: \"" + format + "\"");
+    }
+
+    const uint64_t size = fs::file_size(input);
+
+    if (const auto &dir = output.parent_path(); !fs::is_directory(dir)) {
+        fs::create_directories(dir);
+    }
+
+    ChangedFileWriter out(output);
+    if (format == "incbin") {
+        out.write(formatIncbin(input, name));
+    } else if (format == "embed") {
+        out.write(formatEmbed(input, name, size));
+    } else {
+        writeArray(out, input, name, size);
+    }
+
+    if (out.finish()) {
+        if (verbose) {
+            u8printf("Write: \"%s\"\n", tstr2str(output).data());
+        }
+    } else if (verbose) {
+        u8printf("Content matched: \"%s\"\n", tstr2str(output).data());
+    }
+    return 0;
+}
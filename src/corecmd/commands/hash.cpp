@@ -0,0 +1,465 @@
+// hash, which gives a directory one SHA-256 that changes when anything in it does.
+
+#include "commands.h"
+
+#include "utils/sha-256.h"
+#include "utils/trace.h"
+#include "utils/utils.h"
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <utility>
+
+#include <stdcorelib/console.h>
+#include <stdcorelib/path.h>
+
+using stdc::u8printf;
+
+namespace {
+
+    // One thing in a tree, and what it hashes to.
+    //
+    // A file hashes to the SHA-256 of what it holds and a link to that of what it points at. A
+    // directory hashes to the SHA-256 of a line for each thing in it, in order of name:
+    //
+    //     mode <space> name <nul> 32 bytes of hash
+    //
+    // which is how git lays out a tree, modes and all, so that a tree hashes the same wherever it
+    // is and whoever owns it. What is kept of a file's mode is whether it may be run, and nothing
+    // is on Windows, where no file says.
+    struct Node {
+        std::string name;
+        std::string mode;
+        fs::path path;
+        Utils::FileStamp stamp;
+        uint8_t hash[32] = {};
+        std::vector<Node> children;
+
+        bool isDirectory() const {
+            return mode == "40000";
+        }
+        bool isFile() const {
+            return mode == "100644" || mode == "100755";
+        }
+    };
+
+    std::string hexString(const uint8_t hash[32]) {
+        static const char digits[] = "0123456789abcdef";
+        std::string s(64, '0');
+        for (int i = 0; i < 32; ++i) {
+            s[2 * i] = digits[hash[i] >> 4];
+            s[2 * i + 1] = digits[hash[i] & 0xf];
+        }
+        return s;
+    }
+
+    bool isExecutable(const fs::path &path) {
+#ifdef _WIN32
+        std::ignore = path;
+        return false;
+#else
+        return (fs::status(path).permissions() & fs::perms::owner_exec) != fs::perms::none;
+#endif
+    }
+
+    // Reads \a dir into \a node, leaving the files' hashes for later. What \a skip says yes to is
+    // not there as far as the hash is concerned, and neither is anything that is not a file, a
+    // directory or a link.
+    void walk(const fs::path &dir, Node &node, const std::function<bool(const fs::path &)> &skip) {
+        for (const auto &entry : fs::directory_iterator(dir)) {
+            const auto &path = entry.path();
+            if (skip(path)) {
+                continue;
+            }
+
+            Node child;
+            child.name = tstr2str(path.filename().native());
+            child.path = path;
+            if (Utils::isLink(path)) {
+                child.mode = "120000";
+                const auto &target = tstr2str(fs::read_symlink(path).native());
+                calc_sha_256(child.hash, target.data(), target.size());
+            } else if (entry.is_directory()) {
+                child.mode = "40000";
+                walk(path, child, skip);
+            } else if (entry.is_regular_file()) {
+                child.mode = isExecutable(path) ? "100755" : "100644";
+                if (!Utils::fileStamp(path, &child.stamp)) {
+                    throw std::runtime_error("failed to get file stamp: \"" + tstr2str(path) +
+                                             "\"");
+                }
+            } else {
+                continue;
+            }
+            node.children.push_back(std::move(child));
+        }
+        std::sort(node.children.begin(), node.children.end(),
+                  [](const Node &a, const Node &b) { return a.name < b.name; });
+    }
+
+    // Once every file has its hash, the directories' from the bottom up.
+    void hashDirectories(Node &node) {
+        std::string content;
+        for (auto &child : node.children) {
+            if (child.isDirectory()) {
+                hashDirectories(child);
+            }
+            content += child.mode;
+            content += ' ';
+            content += child.name;
+            content += '\0';
+            content.append(reinterpret_cast<const char *>(child.hash), 32);
+        }
+        calc_sha_256(node.hash, content.data(), content.size());
+    }
+
+    // What a run saw of each tree it hashed, for the next one to take a file's hash from rather
+    // than read it again, and for --verify to compare against. One record to a line, fields apart
+    // by tabs:
+    //
+    //     T <tab> hash <tab> directory
+    //     mode <tab> hash <tab> inode <tab> size <tab> mtime <tab> path
+    //
+    // Each tree is a T line and then a line for everything in it, by its path under the tree
+    // with forward slashes. Links and directories have no stamp to keep and have zeroes there.
+    //
+    // As with the copy journal, one of another version is read as an empty one.
+    static const char manifestHeader[] = "# qmcorecmd hash manifest 1";
+
+    struct ManifestEntry {
+        std::string mode;
+        std::string hash;
+        Utils::FileStamp stamp;
+    };
+
+    struct ManifestTree {
+        std::string hash;
+        std::map<std::string, ManifestEntry> entries;
+    };
+
+    using Manifest = std::map<std::string, ManifestTree>;
+
+    Manifest readManifest(const fs::path &file) {
+        Manifest manifest;
+        std::ifstream in(file);
+        if (!in.is_open()) {
+            return manifest;
+        }
+
+        std::string line;
+        if (!std::getline(in, line) || line != manifestHeader) {
+            return manifest;
+        }
+
+        ManifestTree *tree = nullptr;
+        while (std::getline(in, line)) {
+            std::vector<std::string> fields;
+            {
+                std::istringstream iss(line);
+                std::string field;
+                while (std::getline(iss, field, '\t')) {
+                    fields.push_back(field);
+                }
+            }
+            if (fields.size() == 3 && fields[0] == "T") {
+                tree = &manifest[fields[2]];
+                tree->hash = fields[1];
+            } else if (fields.size() == 6 && tree) {
+                ManifestEntry entry;
+                entry.mode = fields[0];
+                entry.hash = fields[1];
+                try {
+                    entry.stamp.inode = std::stoull(fields[2]);
+                    entry.stamp.size = std::stoull(fields[3]);
+                    entry.stamp.modifyTime = std::stoll(fields[4]);
+                } catch (const std::exception &) {
+                    continue;
+                }
+                tree->entries[fields[5]] = std::move(entry);
+            }
+        }
+        return manifest;
+    }
+
+    void writeManifest(const fs::path &file, const Manifest &manifest) {
+        // Written beside and moved over, so that a run stopped half way leaves the last whole
+        // manifest rather than part of this one.
+        auto temp = file;
+        temp += ".tmp";
+        {
+            std::ofstream out(temp, std::ios::trunc);
+            if (!out.is_open()) {
+                throw std::runtime_error("failed to open file \"" + tstr2str(temp) +
+                                         "\": " + Utils::sysErrorMessage());
+            }
+
+            out << manifestHeader << "\n";
+            for (const auto &tree : manifest) {
+                out << "T\t" << tree.second.hash << '\t' << tree.first << "\n";
+                for (const auto &pair : tree.second.entries) {
+                    const auto &entry = pair.second;
+                    out << entry.mode << '\t' << entry.hash << '\t' << entry.stamp.inode << '\t'
+                        << entry.stamp.size << '\t' << entry.stamp.modifyTime << '\t'
+                        << pair.first << "\n";
+                }
+            }
+        }
+        fs::rename(temp, file);
+    }
+
+    // Everything under \a node as the manifest keeps it.
+    void collectEntries(const Node &node, const std::string &prefix,
+                        std::map<std::string, ManifestEntry> &entries) {
+        for (const auto &child : node.children) {
+            const auto &path = prefix + child.name;
+            entries[path] = {child.mode, hexString(child.hash), child.stamp};
+            if (child.isDirectory()) {
+                collectEntries(child, path + "/", entries);
+            }
+        }
+    }
+
+    // Every file under \a node, with its path under the tree. Taken once the walk is over, since
+    // the walk is still moving nodes about.
+    void collectFiles(Node &node, const std::string &prefix,
+                      std::vector<std::pair<std::string, Node *>> &files) {
+        for (auto &child : node.children) {
+            if (child.isDirectory()) {
+                collectFiles(child, prefix + child.name + "/", files);
+            } else if (child.isFile()) {
+                files.emplace_back(prefix + child.name, &child);
+            }
+        }
+    }
+
+    std::string readWholeFile(const fs::path &file) {
+        std::ifstream in(file, std::ios::binary);
+        if (!in.is_open()) {
+            throw std::runtime_error("failed to open file \"" + tstr2str(file) +
+                                     "\": " + Utils::sysErrorMessage());
+        }
+        std::ostringstream ss;
+        ss << in.rdbuf();
+        return ss.str();
+    }
+
+    // Hashes \a files, \a jobCount at a time. A small file is read whole and hashed with seven
+    // others in one call, which is what lets eight of them share a pass where the machine can do
+    // that. A larger one is hashed by itself, out of a mapping rather than a copy.
+    void hashFiles(const std::vector<Node *> &files, size_t jobCount) {
+        constexpr uint64_t smallFile = 64 * 1024;
+
+        std::vector<std::vector<Node *>> tasks;
+        {
+            std::vector<Node *> small;
+            for (const auto &node : files) {
+                if (node->stamp.size > smallFile) {
+                    tasks.push_back({node});
+                    continue;
+                }
+                small.push_back(node);
+                if (small.size() == 8) {
+                    tasks.push_back(std::move(small));
+                    small.clear();
+                }
+            }
+            if (!small.empty()) {
+                tasks.push_back(std::move(small));
+            }
+        }
+
+        const auto &runTask = [](const std::vector<Node *> &task) {
+            if (task.size() == 1 && task.front()->stamp.size > smallFile) {
+                Utils::hashFile(task.front()->path, task.front()->hash);
+                return;
+            }
+
+            std::vector<std::string> contents;
+            std::vector<const void *> inputs;
+            std::vector<size_t> lens;
+            for (const auto &node : task) {
+                contents.push_back(readWholeFile(node->path));
+            }
+            for (const auto &content : std::as_const(contents)) {
+                inputs.push_back(content.data());
+                lens.push_back(content.size());
+            }
+            std::vector<uint8_t> hashes(task.size() * 32);
+            calc_sha_256_many(reinterpret_cast<uint8_t(*)[32]>(hashes.data()), inputs.data(),
+                              lens.data(), task.size());
+            for (size_t i = 0; i < task.size(); ++i) {
+                std::copy_n(hashes.data() + 32 * i, 32, task[i]->hash);
+            }
+        };
+
+        Utils::runParallel(tasks.size(), jobCount, [&](size_t i) { runTask(tasks[i]); });
+    }
+
+    // Prints what is different between a tree as the manifest has it and as it is now, and
+    // answers whether anything was. A directory is only said to have changed where something
+    // else now stands in its place, since otherwise it is one of what is listed inside it.
+    bool printDifferences(const fs::path &root, const std::map<std::string, ManifestEntry> &old,
+                          const std::map<std::string, ManifestEntry> &now) {
+        const auto &display = [&root](const std::string &path) {
+            auto full = root / str2tstr(path);
+            return tstr2str(full.make_preferred().native());
+        };
+
+        bool different = false;
+        auto oldIt = old.begin();
+        auto nowIt = now.begin();
+        while (oldIt != old.end() || nowIt != now.end()) {
+            if (nowIt == now.end() || (oldIt != old.end() && oldIt->first < nowIt->first)) {
+                u8printf("Removed: \"%s\"\n", display(oldIt->first).data());
+                different = true;
+                ++oldIt;
+            } else if (oldIt == old.end() || nowIt->first < oldIt->first) {
+                u8printf("Added: \"%s\"\n", display(nowIt->first).data());
+                different = true;
+                ++nowIt;
+            } else {
+                const auto &was = oldIt->second;
+                const auto &is = nowIt->second;
+                if (was.mode != is.mode || (is.mode != "40000" && was.hash != is.hash)) {
+                    u8printf("Changed: \"%s\"\n", display(nowIt->first).data());
+                    different = true;
+                }
+                ++oldIt;
+                ++nowIt;
+            }
+        }
+        return different;
+    }
+
+}
+
+int cmd_hash(const cli::ParseResult &result) {
+    const bool force = isForceSet(result);
+    const bool verbose = isVerboseSet(result);
+    const bool verify = result.option("--verify").has_value();
+
+    const auto &dirs = argumentValues(result, 0);
+    std::vector<fs::path> roots;
+    for (const auto &dir : dirs) {
+        const auto &path = stdc::path::clean_path(fs::absolute(str2tstr(dir)));
+        if (!fs::is_directory(path)) {
+            throw std::runtime_error("not a directory: \"" + dir + "\"");
+        }
+        roots.push_back(path);
+    }
+
+    fs::path manifestFile;
+    if (const auto &manifestString = optionValue(result, "--manifest");
+        !manifestString.empty()) {
+        manifestFile = stdc::path::clean_path(fs::absolute(str2tstr(manifestString)));
+    }
+    if (verify && manifestFile.empty()) {
+        throw std::runtime_error("--verify compares against a manifest, so it needs --manifest");
+    }
+
+    const size_t jobCount = jobCountOf(result);
+
+    TStringList excludes;
+    for (const auto &item : optionValues(result, "-e")) {
+        excludes.emplace_back(str2tstr(item));
+    }
+
+    // The manifest may well be kept in a tree it describes, and a tree that held its own
+    // description would never hash the same twice.
+    auto manifestTemp = manifestFile;
+    manifestTemp += ".tmp";
+    const auto &skip = [&](const fs::path &path) {
+        if (!manifestFile.empty() && (path == manifestFile || path == manifestTemp)) {
+            return true;
+        }
+        return Utils::searchInRegexList(TString(path), excludes);
+    };
+
+    const auto &oldManifest = manifestFile.empty() ? Manifest() : readManifest(manifestFile);
+
+    std::vector<Node> trees(roots.size());
+    std::vector<std::pair<std::string, Node *>> files;
+    for (size_t i = 0; i < roots.size(); ++i) {
+        trees[i].mode = "40000";
+        trees[i].path = roots[i];
+        walk(roots[i], trees[i], skip);
+    }
+
+    // A file is taken to be what it was where the manifest has it with the stamp it has now,
+    // which is the same bargain copy --journal makes. -f reads every one regardless.
+    std::vector<Node *> toHash;
+    std::vector<std::string> hashedPaths;
+    for (size_t i = 0; i < roots.size(); ++i) {
+        files.clear();
+        collectFiles(trees[i], {}, files);
+
+        const ManifestTree *old = nullptr;
+        if (const auto it = oldManifest.find(tstr2str(roots[i])); it != oldManifest.end()) {
+            old = &it->second;
+        }
+
+        for (const auto &pair : std::as_const(files)) {
+            auto *node = pair.second;
+            if (!force && old) {
+                const auto it = old->entries.find(pair.first);
+                if (it != old->entries.end() && it->second.mode == node->mode &&
+                    it->second.stamp == node->stamp && it->second.hash.size() == 64) {
+                    for (int j = 0; j < 32; ++j) {
+                        node->hash[j] =
+                            uint8_t(std::stoi(it->second.hash.substr(2 * j, 2), nullptr, 16));
+                    }
+                    Trace::count(Trace::CacheHits);
+                    continue;
+                }
+            }
+            toHash.push_back(node);
+            hashedPaths.push_back(tstr2str(node->path));
+        }
+    }
+
+    hashFiles(toHash, jobCount);
+
+    if (verbose) {
+        for (const auto &path : std::as_const(hashedPaths)) {
+            u8printf("Hash: \"%s\"\n", path.data());
+        }
+    }
+
+    Manifest manifest;
+    bool different = false;
+    for (size_t i = 0; i < roots.size(); ++i) {
+        hashDirectories(trees[i]);
+
+        auto &tree = manifest[tstr2str(roots[i])];
+        tree.hash = hexString(trees[i].hash);
+        collectEntries(trees[i], {}, tree.entries);
+
+        if (verify) {
+            static const ManifestTree empty;
+            const auto it = oldManifest.find(tstr2str(roots[i]));
+            const auto &old = it == oldManifest.end() ? empty : it->second;
+            different = printDifferences(roots[i], old.entries, tree.entries) || different;
+        }
+    }
+
+    for (size_t i = 0; i < roots.size(); ++i) {
+        u8printf("%s  %s\n", hexString(trees[i].hash).data(), dirs[i].data());
+    }
+
+    // --verify asks about the last run and leaves its answer to be asked again.
+    if (verify) {
+        return different ? 1 : 0;
+    }
+    if (!manifestFile.empty()) {
+        // Trees this run did not hash are kept as they were, so that one manifest can serve runs
+        // over different directories.
+        for (const auto &tree : oldManifest) {
+            manifest.insert(tree);
+        }
+        writeManifest(manifestFile, manifest);
+    }
+    return 0;
+}
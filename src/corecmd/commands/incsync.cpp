@@ -3,11 +3,18 @@
 #include "commands.h"
 
 #include "utils/utils.h"
+#include "utils/json.h"
+#include "utils/trace.h"
 
+#include <algorithm>
+#include <cctype>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <map>
 #include <set>
+#include <sstream>
+#include <utility>
 
 #include <stdcorelib/console.h>
 #include <stdcorelib/path.h>
@@ -15,14 +22,563 @@
 
 using stdc::u8printf;
 
+namespace {
+
+    // What the last run wrote, kept in the destination beside what it wrote, so that the next
+    // run can leave alone what has not changed and take out what it wrote for a header that has
+    // gone. One record to a line, fields apart by tabs:
+    //
+    //     S <tab> target <tab> source <tab> the line the stub holds
+    //     C <tab> target <tab> source <tab> inode <tab> size <tab> mtime
+    //     L <tab> target <tab> source <tab> what the symbolic link holds
+    //     H <tab> target <tab> source <tab> inode <tab> size <tab> mtime
+    //
+    // The target is relative to the destination. A state of another version, or none at all, is
+    // a run that compares everything, which is what every run was before there was one.
+    const char stateFileName[] = ".qmcorecmd-incsync";
+    const char stateHeader[] = "# qmcorecmd incsync state 1";
+
+    // What is left in the destination for a header, named by the letter its record starts
+    // with.
+    enum class SyncKind : char {
+        Stub = 'S',
+        Copy = 'C',
+        Symlink = 'L',
+        Hardlink = 'H',
+    };
+
+    struct SyncRecord {
+        fs::path source;
+        std::string content;     ///< For a stub or a symbolic link
+        Utils::FileStamp stamp;  ///< For a copy or a hard link
+        SyncKind kind = SyncKind::Stub;
+
+        bool hasStamp() const {
+            return kind == SyncKind::Copy || kind == SyncKind::Hardlink;
+        }
+    };
+
+    using SyncState = std::map<fs::path, SyncRecord>;
+
+    std::vector<std::string> splitFields(const std::string &line) {
+        std::vector<std::string> fields;
+        std::istringstream iss(line);
+        std::string field;
+        while (std::getline(iss, field, '\t')) {
+            fields.push_back(field);
+        }
+        return fields;
+    }
+
+    // \a text is filled in with the file as read, so that writing back what is the same can be
+    // passed over.
+    SyncState loadState(const fs::path &file, std::string *text) {
+        SyncState state;
+        std::ifstream in(file, std::ios::binary);
+        if (!in.is_open()) {
+            return state;
+        }
+        std::stringstream ss;
+        ss << in.rdbuf();
+        *text = ss.str();
+
+        std::istringstream lines(*text);
+        std::string line;
+        if (!std::getline(lines, line) || line != stateHeader) {
+            return state;
+        }
+        while (std::getline(lines, line)) {
+            const auto &fields = splitFields(line);
+            if (fields.empty() || fields[0].size() != 1) {
+                continue;
+            }
+            SyncRecord record;
+            record.kind = static_cast<SyncKind>(fields[0][0]);
+            if (fields.size() == 4 &&
+                (record.kind == SyncKind::Stub || record.kind == SyncKind::Symlink)) {
+                record.content = fields[3];
+            } else if (fields.size() == 6 && record.hasStamp()) {
+                try {
+                    record.stamp.inode = std::stoull(fields[3]);
+                    record.stamp.size = std::stoull(fields[4]);
+                    record.stamp.modifyTime = std::stoll(fields[5]);
+                } catch (const std::exception &) {
+                    continue;
+                }
+            } else {
+                continue;
+            }
+            record.source = str2tstr(fields[2]);
+            state[str2tstr(fields[1])] = std::move(record);
+        }
+        return state;
+    }
+
+    std::string formatState(const SyncState &state) {
+        std::ostringstream out;
+        out << stateHeader << "\n";
+        for (const auto &pair : state) {
+            const auto &record = pair.second;
+            out << static_cast<char>(record.kind) << '\t' << tstr2str(pair.first.generic_string<TChar>())
+                << '\t' << tstr2str(record.source);
+            if (record.hasStamp()) {
+                out << '\t' << record.stamp.inode << '\t' << record.stamp.size << '\t'
+                    << record.stamp.modifyTime;
+            } else {
+                out << '\t' << record.content;
+            }
+            out << "\n";
+        }
+        return out.str();
+    }
+
+    // Whether \a file holds exactly \a content, read the way it was written.
+    bool fileHolds(const fs::path &file, const std::string &content) {
+        std::ifstream in(file);
+        if (!in.is_open()) {
+            return false;
+        }
+        std::stringstream ss;
+        ss << in.rdbuf();
+        return ss.str() == content;
+    }
+
+    // One header to be synced, worked out in the walk so that what is left can be done in any
+    // order.
+    struct SyncJob {
+        fs::path source;
+        fs::path target;
+        fs::path key; ///< The target, relative to the destination, as the state names it
+        std::string include; ///< What a stub includes, and what a symbolic link holds
+    };
+
+    // Whether \a path is there, as itself rather than as what a link there points at.
+    bool isThere(const fs::path &path) {
+        std::error_code ec;
+        return fs::symlink_status(path, ec).type() != fs::file_type::not_found && !ec;
+    }
+
+    // Takes a link out of the way of a file about to be written at \a job's target. Writing
+    // through one, hard or symbolic, would write over the header it leads to, which is what a
+    // run in one of the link modes leaves for a run in another mode to find.
+    void unlinkTarget(const SyncJob &job) {
+        std::error_code ec;
+        if (Utils::isLink(job.target) || fs::equivalent(job.source, job.target, ec)) {
+            fs::remove(job.target);
+        }
+    }
+
+    // Puts a link to \a job's source at its target, in place of whatever is there.
+    void makeLink(const SyncJob &job, SyncKind kind) {
+        std::error_code ec;
+        fs::remove(job.target, ec);
+        if (kind == SyncKind::Symlink) {
+            fs::create_symlink(job.include, job.target);
+        } else {
+            fs::create_hard_link(job.source, job.target);
+        }
+    }
+
+    // What a trace counts of a target found up to date, and of one the state answered for
+    // without the file being read.
+    void noteUnchanged(bool unchanged, const SyncRecord *old) {
+        if (unchanged) {
+            Trace::count(Trace::FilesSkipped);
+            if (old) {
+                Trace::count(Trace::CacheHits);
+            }
+        }
+    }
+
+    // Brings the target of \a job up to date and answers with what the state should say of it,
+    // and with whether anything had to be written in \a written. Touches nothing but the target,
+    // so any number of these may run at once as long as no two have the same target.
+    SyncRecord syncOne(const SyncJob &job, const SyncState &oldState, SyncKind kind,
+                       bool *written) {
+        const auto &path = job.source;
+        const auto &targetPath = job.target;
+        const auto found = oldState.find(job.key);
+        const SyncRecord *old = (found != oldState.end() && found->second.kind == kind &&
+                                 found->second.source == path)
+                                    ? &found->second
+                                    : nullptr;
+        // A hard link left by a run in that mode is as new as its header, and would pass for a
+        // copy of it.
+        const bool switched = found != oldState.end() && found->second.kind != kind;
+
+        SyncRecord record;
+        record.source = path;
+        record.kind = kind;
+
+        if (kind == SyncKind::Symlink) {
+            // One lstat where the state has it, and a link made again only when it would point
+            // somewhere else.
+            record.content = job.include;
+            const bool unchanged =
+                old ? (old->content == record.content && isThere(targetPath))
+                    : (fs::is_symlink(fs::symlink_status(targetPath)) &&
+                       fs::read_symlink(targetPath) == fs::path(record.content));
+            noteUnchanged(unchanged, old);
+            *written = !unchanged;
+            if (!unchanged) {
+                makeLink(job, kind);
+            }
+            return record;
+        }
+
+        if (kind == SyncKind::Hardlink) {
+            // A hard link is the source, until something saves over the source by writing a
+            // new file and renaming it into place, which a good many editors do. So the source
+            // is asked which file it is now.
+            Utils::fileStamp(path, &record.stamp);
+            const bool unchanged =
+                old ? (old->stamp.inode == record.stamp.inode && isThere(targetPath))
+                    : (!Utils::isLink(targetPath) && fs::exists(targetPath) &&
+                       fs::equivalent(path, targetPath));
+            noteUnchanged(unchanged, old);
+            *written = !unchanged;
+            if (!unchanged) {
+                makeLink(job, kind);
+            }
+            return record;
+        }
+
+        if (kind == SyncKind::Copy) {
+            // The source is read once, and the copy is made again only when the source is no
+            // longer what it was. Without a record of it, the times are compared as they always
+            // were.
+            Utils::fileStamp(path, &record.stamp);
+            const bool unchanged =
+                fs::exists(targetPath) &&
+                (old ? old->stamp == record.stamp
+                     : (!switched && !Utils::isLink(targetPath) &&
+                        Utils::fileTime(targetPath).modifyTime >= Utils::fileTime(path).modifyTime));
+            noteUnchanged(unchanged, old);
+            *written = !unchanged;
+            if (!unchanged) {
+                unlinkTarget(job);
+                Utils::cloneFile(path, targetPath);
+            }
+            return record;
+        }
+
+        record.content = "#include \"" + job.include + "\"";
+
+        // A stub says the same thing whenever its header changes, so it is written only when
+        // what it says is different, and one that is already right keeps its time and rebuilds
+        // nothing. What the state says was written is believed as long as the file is there,
+        // and otherwise the file itself is read.
+        const auto &text = record.content + "\n";
+        const bool unchanged = (old && old->content == record.content)
+                                   ? fs::exists(targetPath)
+                                   : fileHolds(targetPath, text);
+        noteUnchanged(unchanged, old);
+        *written = !unchanged;
+        if (!unchanged) {
+            unlinkTarget(job);
+
+            // Create file
+            std::ofstream outFile(targetPath);
+            if (!outFile.is_open()) {
+                throw std::runtime_error("failed to open file \"" + tstr2str(targetPath) +
+                                         "\": " + Utils::sysErrorMessage());
+            }
+            outFile << text;
+            outFile.close();
+
+            // Set timestamp
+            Utils::syncFileTime(targetPath, path);
+        }
+        return record;
+    }
+
+
+    // What --emit writes in place of a file for every header. Each is one file in the
+    // destination, named here so that a run in one mode can take out what a run in another
+    // left.
+    enum class EmitMode {
+        Files,
+        VfsOverlay,
+        HeaderMap,
+    };
+
+    const char vfsOverlayFileName[] = ".qmcorecmd-vfsoverlay.yaml";
+    const char headerMapFileName[] = ".qmcorecmd.hmap";
+
+    // Writes \a content to \a file unless it holds that already, so that a file a compiler
+    // reads is not made newer than what was built with it for nothing.
+    void writeIfDifferent(const fs::path &file, const std::string &content, bool verbose,
+                          bool json = false) {
+        {
+            std::ifstream in(file, std::ios::binary);
+            if (in.is_open()) {
+                std::stringstream ss;
+                ss << in.rdbuf();
+                if (ss.str() == content)
+                    return;
+            }
+        }
+        if (verbose) {
+            u8printf("Write: \"%s\"\n", tstr2str(file).data());
+        }
+        std::ofstream out(file, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            throw std::runtime_error("failed to open file \"" + tstr2str(file) +
+                                     "\": " + Utils::sysErrorMessage());
+        }
+        out << content;
+        if (json) {
+            Utils::JsonRecord("write").add("path", tstr2str(file)).print();
+        }
+    }
+
+    // A path with forward slashes, as both formats below want it on every platform.
+    std::string genericUtf8(const fs::path &path) {
+        return tstr2str(path.generic_string<TChar>());
+    }
+
+    // A Clang virtual file system overlay, which shows the compiler the destination as though
+    // every header were in it, when nothing is. It is YAML, and JSON is YAML, so it is written
+    // as JSON. A directory that is really there is still looked in, which is what
+    // "fallthrough" says.
+    //
+    //     clang -ivfsoverlay <dest>/.qmcorecmd-vfsoverlay.yaml -I <dest>
+    std::string formatVfsOverlay(const fs::path &dest, const std::vector<SyncJob> &jobs) {
+        struct Node {
+            std::map<std::string, Node> dirs;
+            std::map<std::string, std::string> files;
+        };
+        Node root;
+        for (const auto &job : jobs) {
+            Node *node = &root;
+            for (const auto &part : job.key.parent_path()) {
+                node = &node->dirs[tstr2str(part)];
+            }
+            node->files[tstr2str(job.key.filename())] = genericUtf8(job.source);
+        }
+
+        std::string out;
+        const std::function<void(const Node &, const std::string &)> write =
+            [&](const Node &node, const std::string &indent) {
+                bool first = true;
+                const auto comma = [&]() {
+                    out += first ? "\n" : ",\n";
+                    first = false;
+                };
+                for (const auto &dir : node.dirs) {
+                    comma();
+                    out += indent + "{ \"type\": \"directory\", \"name\": " +
+                           Utils::jsonQuote(dir.first) + ", \"contents\": [";
+                    write(dir.second, indent + "  ");
+                    out += "\n" + indent + "] }";
+                }
+                for (const auto &file : node.files) {
+                    comma();
+                    out += indent + "{ \"type\": \"file\", \"name\": " + Utils::jsonQuote(file.first) +
+                           ", \"external-contents\": " + Utils::jsonQuote(file.second) + " }";
+                }
+            };
+
+        out += "{\n";
+        out += "  \"version\": 0,\n";
+        out += "  \"fallthrough\": true,\n";
+        out += "  \"roots\": [\n";
+        out += "    { \"type\": \"directory\", \"name\": " + Utils::jsonQuote(genericUtf8(dest)) +
+               ", \"contents\": [";
+        write(root, "      ");
+        out += "\n    ] }\n";
+        out += "  ]\n";
+        out += "}\n";
+        return out;
+    }
+
+    // A header map, the format Xcode gives Clang for the same purpose. It is named where an
+    // include directory would be, and answers the name an #include spells with where the
+    // header is, without a directory being looked in at all.
+    //
+    //     clang -I <dest>/.qmcorecmd.hmap
+    //
+    // Nothing is looked in, so a name the map lacks is not found however the include
+    // directories are set. Each header is there twice: as it would be in \a dest, for an
+    // #include <foo.h> with \a dest as the include directory, and under the last name in
+    // \a dest, for an #include <MyCore/foo.h> with the directory above it as the include
+    // directory, which is the way a library's headers are usually spelled.
+    //
+    // Little endian throughout: a header, a hash table of buckets, then the strings. A bucket
+    // is three offsets into the strings, the key and the two halves of the path, and one whose
+    // key is nought is empty, so the strings start with a byte that is never pointed at. The
+    // table is probed linearly from the hash Clang uses, which is case-blind.
+    std::string formatHeaderMap(const fs::path &dest, const std::vector<SyncJob> &jobs) {
+        const auto hashKey = [](const std::string &key) {
+            uint32_t hash = 0;
+            for (const char c : key) {
+                hash += static_cast<uint32_t>(std::tolower(static_cast<unsigned char>(c))) * 13;
+            }
+            return hash;
+        };
+
+        const auto &destName = dest.filename();
+        std::vector<std::pair<std::string, const SyncJob *>> entries;
+        for (const auto &job : jobs) {
+            entries.emplace_back(genericUtf8(job.key), &job);
+            if (!destName.empty()) {
+                entries.emplace_back(genericUtf8(destName / job.key), &job);
+            }
+        }
+
+        uint32_t bucketCount = 8;
+        while (bucketCount < entries.size() * 2) {
+            bucketCount *= 2;
+        }
+
+        struct Bucket {
+            uint32_t key = 0, prefix = 0, suffix = 0;
+        };
+        std::vector<Bucket> buckets(bucketCount);
+        std::string strings(1, '\0');
+        const auto addString = [&strings](const std::string &s) {
+            const auto offset = static_cast<uint32_t>(strings.size());
+            strings += s;
+            strings += '\0';
+            return offset;
+        };
+
+        uint32_t maxValueLength = 0;
+        for (const auto &[key, job] : entries) {
+            std::string prefix = genericUtf8(job->source.parent_path());
+            if (prefix.empty() || prefix.back() != '/') {
+                prefix += '/';
+            }
+            const auto &suffix = tstr2str(job->source.filename());
+            maxValueLength =
+                std::max(maxValueLength, static_cast<uint32_t>(prefix.size() + suffix.size()));
+
+            uint32_t i = hashKey(key) & (bucketCount - 1);
+            while (buckets[i].key) {
+                i = (i + 1) & (bucketCount - 1);
+            }
+            buckets[i] = {addString(key), addString(prefix), addString(suffix)};
+        }
+
+        std::string out;
+        const auto put32 = [&out](uint32_t v) {
+            for (int i = 0; i < 4; ++i) {
+                out += static_cast<char>((v >> (8 * i)) & 0xff);
+            }
+        };
+        const auto put16 = [&out](uint16_t v) {
+            out += static_cast<char>(v & 0xff);
+            out += static_cast<char>((v >> 8) & 0xff);
+        };
+
+        constexpr uint32_t headerSize = 24;
+        put32(0x686D6170); // 'hmap'
+        put16(1);          // Version
+        put16(0);          // Reserved
+        put32(headerSize + bucketCount * 12);
+        put32(static_cast<uint32_t>(entries.size()));
+        put32(bucketCount);
+        put32(maxValueLength);
+        for (const auto &bucket : buckets) {
+            put32(bucket.key);
+            put32(bucket.prefix);
+            put32(bucket.suffix);
+        }
+        out += strings;
+        return out;
+    }
+
+    // One path as a Makefile rule has it, which is what Ninja reads too: forward slashes, and
+    // a space, a hash or a dollar escaped, since each means something there.
+    std::string depfilePath(const fs::path &path) {
+        std::string out;
+        for (const char c : genericUtf8(path)) {
+            if (c == ' ' || c == '#') {
+                out += '\\';
+            } else if (c == '$') {
+                out += '$';
+            }
+            out += c;
+        }
+        return out;
+    }
+
+    // A rule making \a stamp depend on \a deps, for a build system to read after the command
+    // has run and to run it again when one of them changes.
+    //
+    // The directories are what picks up a header added or taken away, since that changes the
+    // time of the directory it was in and of nothing else.
+    std::string formatDepfile(const fs::path &stamp, const std::vector<fs::path> &deps) {
+        std::string out = depfilePath(stamp) + ":";
+        for (const auto &dep : deps) {
+            out += " \\\n  " + depfilePath(dep);
+        }
+        return out + "\n";
+    }
+
+}
+
 int cmd_incsync(const cli::ParseResult &result) {
     bool dryrun = isDryRunSet(result);
-    bool verbose = dryrun || isVerboseSet(result);
+    bool json = isJsonFormatSet(result);
+    bool verbose = !json && (dryrun || isVerboseSet(result));
     bool force = isForceSet(result);
     bool standard = isStandardSet(result);
     bool copy = result.option("-c").has_value();
     bool all = !result.option("-n").has_value();
 
+    EmitMode emit = EmitMode::Files;
+    if (const auto &emitString = optionValue(result, "--emit"); !emitString.empty()) {
+        if (emitString == "vfsoverlay") {
+            emit = EmitMode::VfsOverlay;
+        } else if (emitString == "hmap") {
+            emit = EmitMode::HeaderMap;
+        } else if (emitString != "files") {
+            throw std::runtime_error("invalid emit mode: \"" + emitString +
+                                     "\", expected files, vfsoverlay or hmap");
+        }
+    }
+    if (copy && emit != EmitMode::Files) {
+        throw std::runtime_error("--emit " + optionValue(result, "--emit") +
+                                 " writes no files, so there is nothing to copy");
+    }
+
+    SyncKind kind = copy ? SyncKind::Copy : SyncKind::Stub;
+    if (const auto &linkString = optionValue(result, "--link"); !linkString.empty()) {
+        if (linkString == "symlink") {
+            kind = SyncKind::Symlink;
+        } else if (linkString == "hardlink") {
+            kind = SyncKind::Hardlink;
+        } else {
+            throw std::runtime_error("invalid link kind: \"" + linkString +
+                                     "\", expected symlink or hardlink");
+        }
+        if (copy) {
+            throw std::runtime_error("--link and --copy each say what to put in place of a "
+                                     "header, and only one of them can");
+        }
+        if (emit != EmitMode::Files) {
+            throw std::runtime_error("--emit " + optionValue(result, "--emit") +
+                                     " writes no files, so there is nothing to link");
+        }
+    }
+
+    const size_t jobCount = jobCountOf(result);
+
+    // For a build system running this as a step of the build rather than while configuring.
+    // The stamp is what the step says it makes, and the depfile says what it read.
+    fs::path stampFile, depFile;
+    if (const auto &stampString = optionValue(result, "--stamp"); !stampString.empty()) {
+        stampFile = stdc::path::clean_path(fs::absolute(str2tstr(stampString)));
+    }
+    if (const auto &depString = optionValue(result, "--depfile"); !depString.empty()) {
+        if (stampFile.empty()) {
+            throw std::runtime_error("--depfile names what the stamp depends on, so it needs "
+                                     "--stamp");
+        }
+        depFile = stdc::path::clean_path(fs::absolute(str2tstr(depString)));
+    }
+
     const fs::path &src =
         stdc::path::clean_path(fs::absolute(str2tstr(argumentValue(result, 0))));
     const fs::path &dest =
@@ -31,8 +587,10 @@ int cmd_incsync(const cli::ParseResult &result) {
         throw std::runtime_error("not a directory: \"" + tstr2str(src) + "\"");
     }
 
-    // Add includes
-    std::vector<std::pair<TString, TString>> includes;
+    // Each pattern is compiled once rather than once for every header it is tried on, which
+    // was most of what a large tree cost. The last include that matches decides, so they are
+    // tried from the end.
+    std::vector<std::pair<std::basic_regex<TChar>, fs::path>> includes;
     {
         const auto &includeResult = result.option("-i");
         int cnt = includeResult ? includeResult->count() : 0;
@@ -40,17 +598,18 @@ int cmd_incsync(const cli::ParseResult &result) {
 
         // Add standard
         if (standard) {
-            includes.emplace_back(_TSTR(R"(.*?_p\..+$)"), _TSTR("private"));
+            includes.emplace_back(std::basic_regex<TChar>(_TSTR(R"(.*?_p\..+$)")),
+                                  _TSTR("private"));
         }
 
         for (int i = 0; i < cnt; ++i) {
-            includes.emplace_back(str2tstr(givenValue(*includeResult, 0, i)),
+            includes.emplace_back(std::basic_regex<TChar>(str2tstr(givenValue(*includeResult, 0, i))),
                                   str2tstr(givenValue(*includeResult, 1, i)));
         }
     }
 
     // Add excludes
-    TStringList excludes;
+    std::vector<std::basic_regex<TChar>> excludes;
     {
         const auto &excludeResult = optionValues(result, "-e");
         excludes.reserve(excludeResult.size());
@@ -64,90 +623,266 @@ int cmd_incsync(const cli::ParseResult &result) {
         fs::remove_all(dest);
     }
 
+    const auto &stateFile = dest / stateFileName;
+    std::string oldStateText;
+    const SyncState oldState = dryrun ? SyncState() : loadState(stateFile, &oldStateText);
+
+    // The walk, which decides everything and prints as it goes, so that what is printed is in
+    // the order it always was. A stub's relative path is what fs::relative() would answer, with
+    // each directory made canonical once rather than once for every header in it.
+    std::vector<SyncJob> jobs;
+    std::map<fs::path, size_t> jobIndexes;
+    std::map<fs::path, fs::path> canonicalDirs;
+    const auto canonicalDir = [&canonicalDirs](const fs::path &dir) -> const fs::path & {
+        auto it = canonicalDirs.find(dir);
+        if (it == canonicalDirs.end()) {
+            it = canonicalDirs.emplace(dir, fs::weakly_canonical(dir)).first;
+        }
+        return it->second;
+    };
+
+    // What the depfile lists: every directory looked in, and every header used.
+    std::vector<fs::path> deps{src};
+
     for (const auto &entry : fs::recursive_directory_iterator(src)) {
-        if (entry.is_regular_file()) {
-            const auto &path = entry.path();
-            const auto &ext = stdc::str::to_lower(TString(path.extension()));
-            if (!(ext == _TSTR(".h") || ext == _TSTR(".hh") || ext == _TSTR(".hpp") ||
-                  ext == _TSTR(".hxx"))) {
-                continue;
+        if (!entry.is_regular_file()) {
+            if (!depFile.empty() && entry.is_directory()) {
+                deps.push_back(entry.path());
             }
+            continue;
+        }
 
-            // Get subdirectory
-            fs::path subdir;
-            for (const auto &pair : includes) {
-                TString pathString = path;
-                // Replace separator
-                std::replace(pathString.begin(), pathString.end(), _TSTR('\\'), _TSTR('/'));
+        const auto &path = entry.path();
+        const auto &ext = stdc::str::to_lower(TString(path.extension()));
+        if (!(ext == _TSTR(".h") || ext == _TSTR(".hh") || ext == _TSTR(".hpp") ||
+              ext == _TSTR(".hxx"))) {
+            continue;
+        }
 
-                if (std::regex_search(pathString.begin(), pathString.end(),
-                                      std::basic_regex<TChar>(pair.first))) {
-                    subdir = pair.second;
-                }
-            }
+        // Separators made uniform once, for every pattern to be tried against.
+        TString pathString = path;
+        std::replace(pathString.begin(), pathString.end(), _TSTR('\\'), _TSTR('/'));
 
-            if (!all && subdir.empty())
-                continue;
+        // Get subdirectory
+        const fs::path *subdir = nullptr;
+        for (auto it = includes.rbegin(); it != includes.rend(); ++it) {
+            if (std::regex_search(pathString, it->first)) {
+                subdir = &it->second;
+                break;
+            }
+        }
 
-            // Check if it should be excluded
-            if (Utils::searchInRegexList(TString(path), excludes))
-                continue;
+        if (!all && !subdir)
+            continue;
 
-            const fs::path &targetDir = subdir.empty() ? dest : (dest / subdir);
+        // Check if it should be excluded
+        if (std::any_of(excludes.begin(), excludes.end(), [&pathString](const auto &regex) {
+                return std::regex_search(pathString, regex);
+            }))
+            continue;
 
-            auto targetPath = targetDir / path.filename();
-            if (verbose) {
-                u8printf("Sync: from \"%s\" to \"%s\"\n", tstr2str(path).data(),
-                       tstr2str(targetPath).data());
-            }
+        const fs::path &targetDir = subdir ? (dest / *subdir) : dest;
 
-            if (dryrun)
-                continue;
+        auto targetPath = targetDir / path.filename();
+        if (verbose) {
+            u8printf("Sync: from \"%s\" to \"%s\"\n", tstr2str(path).data(),
+                   tstr2str(targetPath).data());
+        }
 
-            if (fs::exists(targetPath) &&
-                Utils::fileTime(targetPath).modifyTime >= Utils::fileTime(path).modifyTime) {
-                continue;
+        if (dryrun) {
+            // What a real run would do is not known until it looks at the target, so a dry run
+            // says only where each header would go.
+            if (json) {
+                Utils::JsonRecord("sync")
+                    .add("from", tstr2str(path))
+                    .add("to", tstr2str(targetPath))
+                    .print();
             }
+            continue;
+        }
 
-            // Create directory
-            if (!fs::exists(targetDir)) {
-                fs::create_directories(targetDir);
-            }
+        SyncJob job;
+        job.source = path;
+        job.target = std::move(targetPath);
+        job.key = job.target.lexically_relative(dest);
 
-            if (copy) {
-                // Copy
-                fs::copy(path, targetPath, fs::copy_options::overwrite_existing);
-            } else {
-                // Make relative reference
-                //
-                // `relative` answers an empty path where the two have no root in common
-                // rather than treating it as an error, which on Windows is a source
-                // directory on one drive and a build directory on another. Writing that
-                // out gave `#include ""`. There is no relative path to be had in that
-                // case, so the absolute one is written instead.
-                const auto relPath = fs::relative(path, targetDir);
-                std::string rel = tstr2str(relPath.empty() ? path : relPath);
+        if ((kind == SyncKind::Stub || kind == SyncKind::Symlink) && emit == EmitMode::Files) {
+            // Make relative reference
+            //
+            // `relative` answers an empty path where the two have no root in common rather
+            // than treating it as an error, which on Windows is a source directory on one
+            // drive and a build directory on another. Writing that out gave `#include ""`.
+            // There is no relative path to be had in that case, so the absolute one is
+            // written instead. A header that is itself a link is resolved as a whole, as
+            // fs::relative() does.
+            const auto relPath =
+                entry.is_symlink()
+                    ? fs::relative(path, targetDir)
+                    : (canonicalDir(path.parent_path()) / path.filename())
+                          .lexically_relative(canonicalDir(targetDir));
+            job.include = tstr2str(relPath.empty() ? path : relPath);
 
 #ifdef _WIN32
-                // Replace separator
-                std::replace(rel.begin(), rel.end(), '\\', '/');
+            // Replace separator
+            std::replace(job.include.begin(), job.include.end(), '\\', '/');
 #endif
+        }
 
-                // Create file
-                std::ofstream outFile(targetPath);
-                if (!outFile.is_open()) {
-                    throw std::runtime_error("failed to open file \"" + tstr2str(targetPath) +
-                                             "\": " + Utils::sysErrorMessage());
-                }
-                outFile << "#include \"" << rel << "\"" << std::endl;
-                outFile.close();
+        // Two headers of one name flattened into one directory. The later one is what was left
+        // there when they were written in turn, so it is the one kept.
+        if (const auto it = jobIndexes.find(job.key); it != jobIndexes.end()) {
+            jobs[it->second] = std::move(job);
+        } else {
+            jobIndexes.emplace(job.key, jobs.size());
+            jobs.push_back(std::move(job));
+        }
+    }
+
+    if (dryrun) {
+        return 0;
+    }
+
+    if (!depFile.empty()) {
+        for (const auto &job : std::as_const(jobs)) {
+            deps.push_back(job.source);
+        }
+    }
+
+    // One file saying where everything is, in place of a file for each header. What a run
+    // that wrote files left behind goes below, since nothing here is recorded as written.
+    const auto &vfsOverlayFile = dest / vfsOverlayFileName;
+    const auto &headerMapFile = dest / headerMapFileName;
+    if (emit != EmitMode::Files) {
+        fs::create_directories(dest);
+        if (emit == EmitMode::VfsOverlay) {
+            writeIfDifferent(vfsOverlayFile, formatVfsOverlay(dest, jobs), verbose, json);
+        } else {
+            writeIfDifferent(headerMapFile, formatHeaderMap(dest, jobs), verbose, json);
+        }
+        jobs.clear();
+    }
+    for (const auto &[file, mode] : {std::make_pair(vfsOverlayFile, EmitMode::VfsOverlay),
+                                     std::make_pair(headerMapFile, EmitMode::HeaderMap)}) {
+        if (mode != emit && fs::exists(file)) {
+            if (verbose) {
+                u8printf("Remove: \"%s\"\n", tstr2str(file).data());
+            }
+            fs::remove(file);
+            if (json) {
+                Utils::JsonRecord("remove").add("path", tstr2str(file)).print();
             }
+        }
+    }
 
-            // Set timestamp
-            Utils::syncFileTime(targetPath, path);
+    // The directories first, and once each, so that the writes need not race to make them.
+    {
+        std::set<fs::path> targetDirs;
+        for (const auto &job : std::as_const(jobs)) {
+            targetDirs.insert(job.target.parent_path());
+        }
+        for (const auto &dir : targetDirs) {
+            fs::create_directories(dir);
+        }
+    }
+
+    // The writes, each to a target of its own.
+    std::vector<SyncRecord> records(jobs.size());
+    std::vector<char> written(jobs.size(), false);
+    Utils::runParallel(jobs.size(), jobCount, [&](size_t i) {
+        bool changed = false;
+        records[i] = syncOne(jobs[i], oldState, kind, &changed);
+        written[i] = changed;
+    });
+
+    // Printed once the writes are done rather than as each finishes, so that they come out in
+    // the order the walk found the headers in, however the threads fell out.
+    if (json) {
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            Utils::JsonRecord("sync")
+                .add("from", tstr2str(jobs[i].source))
+                .add("to", tstr2str(jobs[i].target))
+                .add("action", written[i] ? "written" : "unchanged")
+                .print();
+        }
+    }
+
+    SyncState state;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        state[jobs[i].key] = std::move(records[i]);
+    }
+
+    // What the last run wrote for a header that has gone, or that now goes somewhere else. Only
+    // what the state names is taken out, so a file somebody else put here stays, and so does
+    // the directory holding it.
+    for (const auto &pair : oldState) {
+        if (state.count(pair.first)) {
+            continue;
+        }
+        const auto &targetPath = dest / pair.first;
+        if (const auto type = fs::symlink_status(targetPath).type();
+            type != fs::file_type::regular && type != fs::file_type::symlink) {
+            continue;
+        }
+        if (verbose) {
+            u8printf("Remove: \"%s\"\n", tstr2str(targetPath).data());
+        }
+        fs::remove(targetPath);
+        if (json) {
+            Utils::JsonRecord("remove").add("path", tstr2str(targetPath)).print();
+        }
+
+        for (auto dir = targetPath.parent_path(); dir != dest && !Utils::isLink(dir) &&
+                                                  fs::is_directory(dir) && fs::is_empty(dir);
+             dir = dir.parent_path()) {
+            if (verbose) {
+                u8printf("Remove: \"%s\"\n", tstr2str(dir).data());
+            }
+            fs::remove(dir);
+            if (json) {
+                Utils::JsonRecord("remove").add("path", tstr2str(dir)).print();
+            }
+        }
+    }
+
+    // Written only when it says something new, so that a run that changed nothing changes
+    // nothing at all, and not at all for a source with no headers and no state before it. It
+    // is written beside and moved over, as the copy journal is, so that a run stopped half way
+    // does not forget what it would have had to take out.
+    const auto &stateText = formatState(state);
+    if (stateText != oldStateText && !(state.empty() && oldStateText.empty())) {
+        fs::create_directories(dest);
+        auto temp = stateFile;
+        temp += ".tmp";
+        {
+            std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+            if (!out.is_open()) {
+                throw std::runtime_error("failed to open file \"" + tstr2str(temp) +
+                                         "\": " + Utils::sysErrorMessage());
+            }
+            out << stateText;
         }
+        fs::rename(temp, stateFile);
+    }
+
+    // Last, so that a run that failed leaves the stamp older than what it depends on and is
+    // run again. The depfile is written only when it changed, the stamp every time, since
+    // being newer than everything it lists is the whole of what it is for.
+    if (!depFile.empty()) {
+        fs::create_directories(depFile.parent_path());
+        writeIfDifferent(depFile, formatDepfile(stampFile, deps), false);
+    }
+    if (!stampFile.empty()) {
+        fs::create_directories(stampFile.parent_path());
+        {
+            std::ofstream out(stampFile, std::ios::binary | std::ios::trunc);
+            if (!out.is_open()) {
+                throw std::runtime_error("failed to open file \"" + tstr2str(stampFile) +
+                                         "\": " + Utils::sysErrorMessage());
+            }
+        }
+        // Truncating what is already empty is not a write everywhere.
+        fs::last_write_time(stampFile, fs::file_time_type::clock::now());
     }
 
     return 0;
 }
-
@@ -0,0 +1,186 @@
+// uninstall, which takes out what an install put in, as its manifest lists it, and then the
+// directories that leaves empty.
+
+#include "commands.h"
+
+#include "utils/utils.h"
+
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include <stdcorelib/console.h>
+#include <stdcorelib/path.h>
+
+using stdc::u8printf;
+
+namespace {
+
+    // The paths \a manifest lists, one to a line, in the order given. This is what CMake writes
+    // to install_manifest.txt, and anything else written the same way will do.
+    std::vector<fs::path> readManifest(const fs::path &manifest) {
+        std::ifstream in(manifest, std::ios::binary);
+        if (!in.is_open()) {
+            throw std::runtime_error("failed to open manifest \"" + tstr2str(manifest) +
+                                     "\": " + Utils::sysErrorMessage());
+        }
+
+        std::vector<fs::path> paths;
+        std::string line;
+        while (std::getline(in, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line.empty()) {
+                continue;
+            }
+            paths.emplace_back(stdc::path::clean_path(fs::absolute(str2tstr(line))));
+        }
+        return paths;
+    }
+
+    // Removes \a files[begin, end) and answers with the ones that were there to remove. A link
+    // is removed as a link, and a directory is left for the pruning afterwards, since a manifest
+    // naming one says nothing about what else has been put in it.
+    std::vector<fs::path> removeFiles(const std::vector<fs::path> &files, size_t begin,
+                                      size_t end, bool dryrun) {
+        std::vector<fs::path> removed;
+        for (size_t i = begin; i < end; ++i) {
+            const auto &file = files[i];
+            std::error_code ec;
+            const auto status = fs::symlink_status(file, ec);
+            if (ec || status.type() == fs::file_type::not_found ||
+                status.type() == fs::file_type::directory) {
+                continue;
+            }
+            if (!dryrun && !fs::remove(file, ec) && ec) {
+                throw std::runtime_error("failed to remove \"" + tstr2str(file) +
+                                         "\": " + ec.message());
+            }
+            removed.push_back(file);
+        }
+        return removed;
+    }
+
+    // Whether \a path is somewhere under \a dir, and not \a dir itself. Both are clean and
+    // absolute, so comparing them a component at a time is enough.
+    bool isBelow(const fs::path &path, const fs::path &dir) {
+        const auto &[d, p] = std::mismatch(dir.begin(), dir.end(), path.begin(), path.end());
+        return d == dir.end() && p != path.end();
+    }
+
+    // The deepest directory all of \a dirs are in or under.
+    fs::path commonAncestor(const std::set<fs::path> &dirs) {
+        fs::path common = *dirs.begin();
+        for (const auto &dir : dirs) {
+            fs::path shared;
+            for (auto c = common.begin(), d = dir.begin();
+                 c != common.end() && d != dir.end() && *c == *d; ++c, ++d) {
+                shared /= *c;
+            }
+            common = shared;
+        }
+        return common;
+    }
+
+}
+
+int cmd_uninstall(const cli::ParseResult &result) {
+    bool dryrun = isDryRunSet(result);
+    bool verbose = dryrun || isVerboseSet(result);
+
+    // Every manifest is read before anything is removed, so that one that cannot be read stops
+    // the command with the install as it was.
+    std::vector<fs::path> files;
+    for (const auto &item : argumentValues(result, 0)) {
+        const auto &paths = readManifest(fs::absolute(str2tstr(item)));
+        files.insert(files.end(), paths.begin(), paths.end());
+    }
+
+    // In batches of at least a few dozen, one to a core, which is as far as a file system
+    // removing from different directories at once gains anything. What was removed is printed
+    // afterwards in the order the manifests gave it.
+    std::vector<fs::path> removed;
+    {
+        constexpr size_t minBatch = 64;
+        const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+        const size_t batches = std::min(cores, (files.size() + minBatch - 1) / minBatch);
+
+        std::vector<std::future<std::vector<fs::path>>> pending;
+        const size_t batchSize = batches ? (files.size() + batches - 1) / batches : 0;
+        for (size_t begin = 0; begin < files.size(); begin += batchSize) {
+            const size_t end = std::min(files.size(), begin + batchSize);
+            pending.push_back(std::async(std::launch::async, removeFiles, std::cref(files),
+                                         begin, end, dryrun));
+        }
+        for (auto &batch : pending) {
+            auto paths = batch.get();
+            removed.insert(removed.end(), std::make_move_iterator(paths.begin()),
+                           std::make_move_iterator(paths.end()));
+        }
+    }
+
+    if (verbose) {
+        for (const auto &file : std::as_const(removed)) {
+            u8printf("Remove: \"%s\"\n", tstr2str(file).data());
+        }
+    }
+
+    // What removing the files would leave empty depends on their having gone.
+    if (dryrun) {
+        return 0;
+    }
+
+    // A manifest lists files and no directories, so the directories are the ones it put files
+    // in, and above those whatever they leave empty. Each is removed only if it is empty as it
+    // stands, and the walk goes up from it only if it was, never down or sideways. An empty
+    // directory that was there before the install, beside or below what it put in, is not the
+    // uninstall's to take. Deepest first, so that a directory is asked about once everything
+    // under it has been.
+    //
+    // Nothing at or above the prefix goes, however empty. An install prefix, or the staging
+    // directory above one, is often made by hand and expected to outlive what was installed
+    // there. Without --prefix it is the deepest directory every listed file is under, or the one
+    // above that where the manifest put files straight into it, which is the most the manifest
+    // itself can be said to own.
+    std::set<fs::path> dirs;
+    for (const auto &file : std::as_const(files)) {
+        dirs.insert(file.parent_path());
+    }
+    if (dirs.empty()) {
+        return 0;
+    }
+    fs::path prefix;
+    if (const auto &prefixOption = optionValue(result, "--prefix"); !prefixOption.empty()) {
+        prefix = stdc::path::clean_path(fs::absolute(str2tstr(prefixOption)));
+    } else {
+        prefix = commonAncestor(dirs);
+        if (dirs.count(prefix)) {
+            prefix = prefix.parent_path();
+        }
+    }
+
+    std::vector<fs::path> order(dirs.begin(), dirs.end());
+    std::sort(order.begin(), order.end(), [](const fs::path &a, const fs::path &b) {
+        return a.native().size() > b.native().size();
+    });
+
+    for (const auto &dir : std::as_const(order)) {
+        for (auto current = dir; isBelow(current, prefix); current = current.parent_path()) {
+            // Gone already, by way of a deeper one, or never there, a link, or not empty.
+            std::error_code ec;
+            if (fs::symlink_status(current, ec).type() != fs::file_type::directory ||
+                !fs::remove(current, ec)) {
+                break;
+            }
+            if (verbose) {
+                u8printf("Remove: \"%s\"\n", tstr2str(current).data());
+            }
+        }
+    }
+    return 0;
+}
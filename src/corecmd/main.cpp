@@ -5,7 +5,11 @@
 #include <stdcorelib/support/commandline.h>
 #include <stdcorelib/system.h>
 
+#include <map>
+#include <string_view>
+
 #include "commands/commands.h"
+#include "utils/trace.h"
 
 // What deploy calls the files it works on, since a message naming the wrong format would be
 // worse than naming none.
@@ -19,144 +23,309 @@
 
 static const cli::Option verboseOption({"-V", "--verbose"}, "Print more information");
 
-int main(int argc, char *argv[]) {
-    cli::Command copyCommand = []() {
-        cli::Command command("copy", "Copy files or directories if different");
-        command.addArguments({
-            cli::Argument("src", "Source files or directories").multi(),
-            cli::Argument("dest", "Destination directory"),
-        });
-        command.addOptions({
-            cli::Option({"-e", "--exclude"}, "Exclude a path pattern").arg("regex").multi(),
-            cli::Option({"-f", "--force"}, "Force overwrite existing files"),
-        });
-        command.addOption(verboseOption);
-        command.setHandler(cmd_copy);
-        return command;
-    }();
-
-    cli::Command rmdirCommand = []() {
-        cli::Command command("rmdir", "Remove empty directories recursively");
-        command.addArguments({
-            cli::Argument("dir", "Directories").multi(),
-        });
-        command.addOption(verboseOption);
-        command.setHandler(cmd_rmdir);
-        return command;
-    }();
-
-    cli::Command touchCommand = []() {
-        cli::Command command("touch", "Update file timestamp");
-        command.addArguments({
-            cli::Argument("file", "File to update time stamp"),
-            cli::Argument("ref file", "Reference file", false),
-        });
-        command.addOption(verboseOption);
-        command.setHandler(cmd_touch);
-        return command;
-    }();
-
-    cli::Command configureCommand = []() {
-        cli::Command command("configure", "Generate configuration header");
-        command.addArgument(cli::Argument("output file", "Output header path"));
-        command.addOptions({
-            cli::Option({"-D", "--define"},
-                        R"(Define a variable, format: <key>, <key>=<value>, %<raw>)")
-                .arg("expr")
-                .multi()
-                .shortMatch(cli::Option::ShortMatchSingleChar),
-            cli::Option({"-p", "--project"}, "Set project name").arg("name"),
-            cli::Option({"-w", "--warning"}, "Generate warning text").arg("file", false),
-            cli::Option({"-f", "--force"}, "Skip calculating hash and overwrite always"),
-            cli::Option({"-d", "--dryrun"}, "Print contents only"),
-        });
-        command.addOption(verboseOption);
-        command.setHandler(cmd_configure);
-        return command;
-    }();
-
-    cli::Command incsyncCommand = []() {
-        cli::Command command("incsync", "Reorganize header files of include directory");
-        command.addArguments({
-            cli::Argument("src", "Input directory containing source headers"),
-            cli::Argument("dest", "Output directory of reorganized headers"),
-        });
-        command.addOptions({
-            cli::Option({"-i", "--include"}, "Add a path pattern and corresponding subdirectory")
-                .arg("regex")
-                .arg("subdir")
-                .multi(),
-            cli::Option({"-e", "--exclude"}, "Exclude a path pattern").arg("regex").multi(),
-            cli::Option({"-s", "--standard"}, "Add standard public-private name pattern"),
-            cli::Option({"-n", "--not-all"}, "Ignore unclassified files"),
-            cli::Option({"-c", "--copy"}, "Copy files rather than indirect reference"),
-            cli::Option({"-d", "--dryrun"}, "Print reorganizing details only"),
-            cli::Option({"-f", "--force"}, "Force deleting existing directory"),
-        });
-        command.addOption(verboseOption);
-        command.setHandler(cmd_incsync);
-        return command;
-    }();
-
-    cli::Command deployCommand = []() {
-        cli::Command command("deploy", "Resolve and deploy " OS_EXECUTABLE " files' dependencies");
-        command.addArguments({
-            cli::Argument("file", OS_EXECUTABLE " file(s)").multi(),
-        });
-        command.addOptions({
-            cli::Option({"-c", "--copy"}, "Additional " OS_EXECUTABLE " file(s) to copy")
-                .arg("src")
-                .arg("dir")
-                .multi()
-                .prior(cli::Option::IgnoreMissingArguments),
-            cli::Option({"-o", "--out"},
-                        "Set output directory of dependencies, defult to current directory")
-                .arg("dir"),
-            cli::Option({"-L", "--linkdir"}, "Add a library searching path")
-                .arg("dir")
-                .multi()
-                .shortMatch(cli::Option::ShortMatchSingleChar),
-            cli::Option({"-e", "--exclude"}, "Exclude a path pattern").arg("regex").multi(),
-            cli::Option({"-s", "--standard"}, "Ignore C/C++ runtime and system libraries"),
-            cli::Option({"-d", "--dryrun"}, "Print dependencies only"),
-            cli::Option({"-f", "--force"}, "Force overwrite existing files"),
-        });
-        command.addOption(verboseOption);
-        command.setHandler(cmd_deploy);
-        return command;
-    }();
+// For the commands a build or a script wants an account of, rather than a log.
+static const cli::Option formatOption =
+    cli::Option({"--format"}, "Print text, or one JSON record per line for a program")
+        .arg("text|json");
+
+static void printError(const std::exception &e) {
+    std::string msg = e.what();
+
+#ifdef _WIN32
+    if (typeid(e) == typeid(fs::filesystem_error)) {
+        // What the standard library puts in what() is in the ANSI code page too.
+        msg = stdc::wstring_conv::to_utf8(stdc::wstring_conv::from_ansi(e.what()));
+    }
+#endif
+
+    stdc::console::printf(stdc::console::bold, stdc::console::lightred, stdc::console::nocolor,
+                          "Error: %s\n", msg.data());
+}
+
+// Runs one command line, and writes the trace it asked for once it is done, whether or not it
+// succeeded, since a run that failed is as often the one worth looking at.
+static int invoke(cli::Parser &parser, std::vector<std::string> args) {
+    int ret;
+    try {
+        if (const auto &traceFile = Trace::takeTraceFile(args); !traceFile.empty()) {
+            Trace::start(fs::absolute(str2tstr(traceFile)));
+        }
+        Trace::Span span("cli", args.size() > 1 ? "qmcorecmd " + args[1] : "qmcorecmd");
+        ret = parser.invoke(args, -1, cli::Parser::EnableResponseFile);
+    } catch (const std::exception &e) {
+        printError(e);
+        ret = -1;
+    }
+    try {
+        Trace::finish();
+    } catch (const std::exception &e) {
+        printError(e);
+        ret = -1;
+    }
+    return ret;
+}
+
+// What batch hands each command line to. It leaves what went wrong to batch, which says which job
+// it was. Set by main(), since it puts the command line together as main() does.
+static std::function<int(const std::vector<std::string> &)> runJob;
+
+static cli::Command copyCommand() {
+    cli::Command command("copy", "Copy files or directories if different");
+    command.addArguments({
+        cli::Argument("src", "Source files or directories").multi(),
+        cli::Argument("dest", "Destination directory"),
+    });
+    command.addOptions({
+        cli::Option({"-e", "--exclude"}, "Exclude a path pattern").arg("regex").multi(),
+        cli::Option({"-f", "--force"}, "Force overwrite existing files"),
+        cli::Option({"-m", "--mirror"}, "Remove destination files absent from sources"),
+        cli::Option({"--journal"}, "Remember unchanged files in a journal").arg("file"),
+    });
+    command.addOption(verboseOption);
+    command.addOption(formatOption);
+    command.setHandler(cmd_copy);
+    return command;
+}
+
+static cli::Command rmdirCommand() {
+    cli::Command command("rmdir", "Remove empty directories recursively");
+    command.addArguments({
+        cli::Argument("dir", "Directories").multi(),
+    });
+    command.addOption(verboseOption);
+    command.setHandler(cmd_rmdir);
+    return command;
+}
+
+static cli::Command uninstallCommand() {
+    cli::Command command("uninstall", "Remove installed files and the directories left empty");
+    command.addArguments({
+        cli::Argument("manifest", "Install manifests listing one file per line").multi(),
+    });
+    command.addOptions({
+        cli::Option({"-d", "--dryrun"}, "Print files to remove only"),
+        cli::Option({"--prefix"}, "Remove no directory at or above this one").arg("dir"),
+    });
+    command.addOption(verboseOption);
+    command.setHandler(cmd_uninstall);
+    return command;
+}
+
+static cli::Command touchCommand() {
+    cli::Command command("touch", "Update file timestamp");
+    command.addArguments({
+        cli::Argument("file", "File to update time stamp"),
+        cli::Argument("ref file", "Reference file", false),
+    });
+    command.addOption(verboseOption);
+    command.setHandler(cmd_touch);
+    return command;
+}
+
+static cli::Command hashCommand() {
+    cli::Command command("hash", "Compute one SHA-256 for each directory tree");
+    command.addArguments({
+        cli::Argument("dir", "Directories").multi(),
+    });
+    command.addOptions({
+        cli::Option({"-e", "--exclude"}, "Exclude a path pattern").arg("regex").multi(),
+        cli::Option({"--manifest"}, "Keep each file's hash in a manifest").arg("file"),
+        cli::Option({"--verify"}, "Print what differs from the manifest, write nothing"),
+        cli::Option({"-f", "--force"}, "Read every file even if the manifest has it"),
+        cli::Option({"-j", "--jobs"}, "Hash with this many threads, default to all cores")
+            .arg("n"),
+    });
+    command.addOption(verboseOption);
+    command.setHandler(cmd_hash);
+    return command;
+}
+
+static cli::Command configureCommand() {
+    cli::Command command("configure", "Generate configuration header");
+    command.addArgument(cli::Argument("output file", "Output header path", false));
+    command.addOptions({
+        cli::Option({"-D", "--define"},
+                    R"(Define a variable, format: <key>, <key>=<value>, %<raw>)")
+            .arg("expr")
+            .multi()
+            .shortMatch(cli::Option::ShortMatchSingleChar),
+        cli::Option({"-p", "--project"}, "Set project name").arg("name"),
+        cli::Option({"-w", "--warning"}, "Generate warning text").arg("file", false),
+        cli::Option({"-f", "--force"}, "Skip calculating hash and overwrite always"),
+        cli::Option({"-d", "--dryrun"}, "Print contents only"),
+        cli::Option({"--manifest"}, "Generate every header a JSON file describes at once")
+            .arg("file"),
+    });
+    command.addOption(verboseOption);
+    command.setHandler(cmd_configure);
+    return command;
+}
+
+static cli::Command embedCommand() {
+    cli::Command command("embed", "Generate a source file embedding a binary file");
+    command.addArguments({
+        cli::Argument("input", "File to embed"),
+        cli::Argument("output", "Output source path"),
+    });
+    command.addOptions({
+        cli::Option({"-n", "--name"}, "Set the array name, default to the output file name")
+            .arg("name"),
+        cli::Option({"--format"}, "Write a C array, an assembler .incbin or a C #embed")
+            .arg("c|incbin|embed"),
+    });
+    command.addOption(verboseOption);
+    command.setHandler(cmd_embed);
+    return command;
+}
+
+static cli::Command incsyncCommand() {
+    cli::Command command("incsync", "Reorganize header files of include directory");
+    command.addArguments({
+        cli::Argument("src", "Input directory containing source headers"),
+        cli::Argument("dest", "Output directory of reorganized headers"),
+    });
+    command.addOptions({
+        cli::Option({"-i", "--include"}, "Add a path pattern and corresponding subdirectory")
+            .arg("regex")
+            .arg("subdir")
+            .multi(),
+        cli::Option({"-e", "--exclude"}, "Exclude a path pattern").arg("regex").multi(),
+        cli::Option({"-s", "--standard"}, "Add standard public-private name pattern"),
+        cli::Option({"-n", "--not-all"}, "Ignore unclassified files"),
+        cli::Option({"-c", "--copy"}, "Copy files rather than indirect reference"),
+        cli::Option({"-d", "--dryrun"}, "Print reorganizing details only"),
+        cli::Option({"-f", "--force"}, "Force deleting existing directory"),
+        cli::Option({"--link"}, "Link files rather than indirect reference")
+            .arg("symlink|hardlink"),
+        cli::Option({"--emit"}, "Write files, a Clang VFS overlay or a header map")
+            .arg("files|vfsoverlay|hmap"),
+        cli::Option({"-j", "--jobs"}, "Write with this many threads, default to all cores")
+            .arg("n"),
+        cli::Option({"--stamp"}, "Touch a file after a successful run").arg("file"),
+        cli::Option({"--depfile"}, "Write the directories and headers read as a depfile")
+            .arg("file"),
+    });
+    command.addOption(verboseOption);
+    command.addOption(formatOption);
+    command.setHandler(cmd_incsync);
+    return command;
+}
+
+static cli::Command deployCommand() {
+    cli::Command command("deploy", "Resolve and deploy " OS_EXECUTABLE " files' dependencies");
+    command.addArguments({
+        cli::Argument("file", OS_EXECUTABLE " file(s)").multi(),
+    });
+    command.addOptions({
+        cli::Option({"-c", "--copy"}, "Additional " OS_EXECUTABLE " file(s) to copy")
+            .arg("src")
+            .arg("dir")
+            .multi()
+            .prior(cli::Option::IgnoreMissingArguments),
+        cli::Option({"-o", "--out"},
+                    "Set output directory of dependencies, defult to current directory")
+            .arg("dir"),
+        cli::Option({"-L", "--linkdir"}, "Add a library searching path")
+            .arg("dir")
+            .multi()
+            .shortMatch(cli::Option::ShortMatchSingleChar),
+        cli::Option({"-e", "--exclude"}, "Exclude a path pattern").arg("regex").multi(),
+        cli::Option({"-s", "--standard"}, "Ignore C/C++ runtime and system libraries"),
+        cli::Option({"-d", "--dryrun"}, "Print dependencies only"),
+        cli::Option({"-f", "--force"}, "Force overwrite existing files"),
+        cli::Option({"-j", "--jobs"}, "Run this many tools at once, default to all cores")
+            .arg("n"),
+        cli::Option({"--graph"}, "Write the dependency graph, .dot or .json").arg("file"),
+    });
+    command.addOption(verboseOption);
+    command.addOption(formatOption);
+    command.setHandler(cmd_deploy);
+    return command;
+}
+
+static cli::Command batchCommand() {
+    cli::Command command("batch", "Run the command lines of a job file in one process");
+    command.addArguments({
+        cli::Argument("file", "JSON array or one JSON object per line, of jobs"),
+    });
+    command.addOptions({
+        cli::Option({"-j", "--jobs"}, "Run this many jobs at once, default to all cores")
+            .arg("n"),
+    });
+    command.addOption(verboseOption);
+    command.setHandler([](const cli::ParseResult &result) {
+        return cmd_batch(result, runJob);
+    });
+    return command;
+}
+
+// Every command, in the order the help lists them, and what puts each one together.
+//
+// A build may start this program thousands of times to touch one file each time, and for that
+// the definitions of the other ten commands are nothing but cost. So a command is put together
+// only when it is needed, and the name and catalogue here are all that is known of it otherwise.
+static const struct {
+    const char *name;
+    const char *catalogue;
+    cli::Command (*build)();
+} commandTable[] = {
+    {"copy",      "Filesystem Commands",  copyCommand     },
+    {"rmdir",     "Filesystem Commands",  rmdirCommand    },
+    {"uninstall", "Filesystem Commands",  uninstallCommand},
+    {"touch",     "Filesystem Commands",  touchCommand    },
+    {"hash",      "Filesystem Commands",  hashCommand     },
+    {"configure", "Buildsystem Commands", configureCommand},
+    {"embed",     "Buildsystem Commands", embedCommand    },
+    {"incsync",   "Buildsystem Commands", incsyncCommand  },
+    {"deploy",    "Buildsystem Commands", deployCommand   },
+    {"batch",     "Buildsystem Commands", batchCommand    },
+};
+
+// The root command, with under it only the command \a args names, or every command.
+//
+// Only the one where the first argument is its name and nothing else could be meant. Anything
+// else is a command line that may print the whole tree, a help page, a version, a response file
+// or a name that is nearly right and wants the right one suggested, so it gets the whole tree.
+static cli::Command rootCommandFor(const std::vector<std::string> &args) {
+    std::string_view only;
+    if (args.size() > 1) {
+        for (const auto &entry : commandTable) {
+            if (args[1] == entry.name) {
+                only = entry.name;
+                break;
+            }
+        }
+    }
 
     cli::Command rootCommand(stdc::system::application_name(),
                              "Cross-platform utility commands for C/C++ build systems.");
-    rootCommand.addCommands({
-        copyCommand,
-        rmdirCommand,
-        touchCommand,
-        configureCommand,
-        incsyncCommand,
-        deployCommand,
-    });
+    std::vector<cli::Command> commands;
+    std::map<std::string_view, std::vector<std::string>> catalogued;
+    std::vector<std::string_view> catalogues;
+    for (const auto &entry : commandTable) {
+        if (!only.empty() && only != entry.name) {
+            continue;
+        }
+        commands.push_back(entry.build());
+        auto &names = catalogued[entry.catalogue];
+        if (names.empty()) {
+            catalogues.push_back(entry.catalogue);
+        }
+        names.emplace_back(entry.name);
+    }
+    rootCommand.addCommands(commands);
     rootCommand.addVersionOption(TOOL_VERSION);
     rootCommand.addHelpOption(true, true);
 
     cli::CommandCatalogue cc;
-    cc.addCommands("Filesystem Commands", {"copy", "rmdir", "touch"});
-    cc.addCommands("Buildsystem Commands", {"configure", "incsync", "deploy"});
-    rootCommand.setCatalogue(cc);
-
-    cli::Parser parser(rootCommand);
-    parser.setPrologue(TOOL_DESC);
-    parser.setEpilogue(TOOL_COPYRIGHT);
-    parser.setDisplayOptions(cli::Parser::AlignAllCatalogues);
-
-    // The copyright line under the page is worth setting apart from the page.
-    {
-        auto layout = cli::HelpLayout::defaultLayout();
-        layout.setBodyStyle(cli::HelpBlock::Epilogue,
-                            {stdc::console::bold, stdc::console::yellow});
-        parser.setHelpLayout(layout);
+    for (const auto &catalogue : std::as_const(catalogues)) {
+        cc.addCommands(std::string(catalogue), catalogued[catalogue]);
     }
+    rootCommand.setCatalogue(cc);
+    return rootCommand;
+}
 
+int main(int argc, char *argv[]) {
     // On Windows the arguments that reach main() are in the machine's ANSI code page, so the
     // wide command line is read instead and converted. Everywhere else argv is already what
     // the user typed.
@@ -172,22 +341,43 @@ int main(int argc, char *argv[]) {
     args.assign(argv, argv + argc);
 #endif
 
-    int ret;
+    // Started here rather than in invoke() so that the trace covers putting the command line
+    // together too.
     try {
-        ret = parser.invoke(args, -1, cli::Parser::EnableResponseFile);
+        if (const auto &traceFile = Trace::takeTraceFile(args); !traceFile.empty()) {
+            Trace::start(fs::absolute(str2tstr(traceFile)));
+        }
     } catch (const std::exception &e) {
-        std::string msg = e.what();
+        printError(e);
+        return -1;
+    }
+    std::optional<Trace::Span> buildSpan;
+    buildSpan.emplace("cli", "Build command line");
 
-#ifdef _WIN32
-        if (typeid(e) == typeid(fs::filesystem_error)) {
-            // What the standard library puts in what() is in the ANSI code page too.
-            msg = stdc::wstring_conv::to_utf8(stdc::wstring_conv::from_ansi(e.what()));
-        }
-#endif
+    cli::Command rootCommand = rootCommandFor(args);
 
-        stdc::console::printf(stdc::console::bold, stdc::console::lightred,
-                              stdc::console::nocolor, "Error: %s\n", msg.data());
-        ret = -1;
+    cli::Parser parser(rootCommand);
+    parser.setPrologue(TOOL_DESC);
+    parser.setEpilogue(TOOL_COPYRIGHT);
+    parser.setDisplayOptions(cli::Parser::AlignAllCatalogues);
+
+    // The copyright line under the page is worth setting apart from the page.
+    {
+        auto layout = cli::HelpLayout::defaultLayout();
+        layout.setBodyStyle(cli::HelpBlock::Epilogue,
+                            {stdc::console::bold, stdc::console::yellow});
+        parser.setHelpLayout(layout);
     }
-    return ret;
+
+    buildSpan.reset();
+
+    // A job's command line is put together afresh, for itself alone, rather than through the
+    // parser above. batch runs several at once, and nothing says one parser may be used by more
+    // than one thread at a time. Only the job's own command is put together, which costs little.
+    runJob = [](const std::vector<std::string> &given) {
+        const cli::Command command = rootCommandFor(given);
+        cli::Parser parser(command);
+        return parser.invoke(given, -1, cli::Parser::EnableResponseFile);
+    };
+    return invoke(parser, args);
 }
@@ -0,0 +1,123 @@
+#include "journal.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace Utils {
+
+    // One record to a line, fields apart by tabs, which no path a build names has in it:
+    //
+    //     D <tab> inode <tab> size <tab> mtime <tab> directory
+    //     F <tab> inode <tab> size <tab> mtime <tab> source <tab> target
+    //
+    // The first line names the version, and a journal of any other is read as an empty one
+    // rather than refused, since the worst it costs is one run that compares everything.
+    static const char journalHeader[] = "# qmcorecmd copy journal 1";
+
+    static std::vector<std::string> splitFields(const std::string &line) {
+        std::vector<std::string> fields;
+        std::istringstream iss(line);
+        std::string field;
+        while (std::getline(iss, field, '\t')) {
+            fields.push_back(field);
+        }
+        return fields;
+    }
+
+    static bool readStamp(const std::vector<std::string> &fields, FileStamp *stamp) {
+        try {
+            stamp->inode = std::stoull(fields[1]);
+            stamp->size = std::stoull(fields[2]);
+            stamp->modifyTime = std::stoll(fields[3]);
+        } catch (const std::exception &) {
+            return false;
+        }
+        return true;
+    }
+
+    static void writeStamp(std::ostream &out, const FileStamp &stamp) {
+        out << '\t' << stamp.inode << '\t' << stamp.size << '\t' << stamp.modifyTime;
+    }
+
+    CopyJournal::CopyJournal(fs::path file) : m_file(std::move(file)) {
+    }
+
+    void CopyJournal::load() {
+        std::ifstream in(m_file);
+        if (!in.is_open()) {
+            return;
+        }
+
+        std::string line;
+        if (!std::getline(in, line) || line != journalHeader) {
+            return;
+        }
+
+        while (std::getline(in, line)) {
+            const auto &fields = splitFields(line);
+            FileStamp stamp;
+            if (fields.size() == 5 && fields[0] == "D" && readStamp(fields, &stamp)) {
+                m_oldDirectories[str2tstr(fields[4])] = stamp;
+            } else if (fields.size() == 6 && fields[0] == "F" && readStamp(fields, &stamp)) {
+                m_oldFiles[str2tstr(fields[4])] = {str2tstr(fields[5]), stamp};
+            }
+        }
+    }
+
+    void CopyJournal::save() const {
+        // Written beside and moved over, so that a run that is stopped half way leaves the last
+        // whole journal rather than part of this one.
+        auto temp = m_file;
+        temp += ".tmp";
+        {
+            std::ofstream out(temp, std::ios::trunc);
+            if (!out.is_open()) {
+                throw std::runtime_error("failed to open file \"" + tstr2str(temp) +
+                                         "\": " + sysErrorMessage());
+            }
+
+            out << journalHeader << "\n";
+            for (const auto &pair : m_directories) {
+                out << 'D';
+                writeStamp(out, pair.second);
+                out << '\t' << tstr2str(pair.first) << "\n";
+            }
+            for (const auto &pair : m_files) {
+                out << 'F';
+                writeStamp(out, pair.second.second);
+                out << '\t' << tstr2str(pair.first) << '\t' << tstr2str(pair.second.first)
+                    << "\n";
+            }
+        }
+        fs::rename(temp, m_file);
+    }
+
+    bool CopyJournal::isUnchanged(const fs::path &file, const fs::path &target,
+                                  const FileStamp &stamp) const {
+        const auto it = m_oldFiles.find(file);
+        return it != m_oldFiles.end() && it->second.first == target && it->second.second == stamp;
+    }
+
+    bool CopyJournal::isDirectoryUnchanged(const fs::path &dir) const {
+        const auto it = m_oldDirectories.find(dir);
+        if (it == m_oldDirectories.end()) {
+            return false;
+        }
+        FileStamp stamp;
+        return fileStamp(dir, &stamp) && stamp == it->second;
+    }
+
+    void CopyJournal::recordFile(const fs::path &file, const fs::path &target,
+                                 const FileStamp &stamp) {
+        m_files[file] = {target, stamp};
+    }
+
+    void CopyJournal::recordDirectory(const fs::path &dir) {
+        FileStamp stamp;
+        if (fileStamp(dir, &stamp)) {
+            m_directories[dir] = stamp;
+        }
+    }
+
+}
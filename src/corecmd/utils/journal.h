@@ -0,0 +1,60 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <map>
+#include <utility>
+
+#include "utils/utils.h"
+
+namespace Utils {
+
+    /// What a copy saw the last time it ran, so that the next run can take a file as already
+    /// copied without looking at the destination at all.
+    ///
+    /// A file is passed over when its own stamp is what it was and the directory it was copied
+    /// into has the stamp it was left with. Adding, removing or renaming anything in a directory
+    /// changes its stamp, so a destination that somebody else has been at is compared file by
+    /// file again. The source is still read once per file, since a file edited in place leaves
+    /// the directory holding it as it was.
+    ///
+    /// Only what a run saw is written back, so a file that has gone drops out of the journal on
+    /// the run after.
+    class CopyJournal {
+    public:
+        explicit CopyJournal(fs::path file);
+
+        /// Reads what the last run left. A journal that is not there, or is of another version,
+        /// is an empty one.
+        void load();
+
+        /// Writes what this run saw, replacing the journal as a whole.
+        void save() const;
+
+        /// Whether \a file, now stamped \a stamp, is what was copied to \a target last time.
+        ///
+        /// \note Says nothing about the destination, which isDirectoryUnchanged() answers for
+        ///       once per directory rather than once per file.
+        bool isUnchanged(const fs::path &file, const fs::path &target,
+                         const FileStamp &stamp) const;
+
+        /// Whether the directory \a dir is as the last run left it.
+        bool isDirectoryUnchanged(const fs::path &dir) const;
+
+        void recordFile(const fs::path &file, const fs::path &target, const FileStamp &stamp);
+
+        /// To be called once nothing more will be written into \a dir in this run.
+        void recordDirectory(const fs::path &dir);
+
+    private:
+        fs::path m_file;
+
+        std::map<fs::path, std::pair<fs::path, FileStamp>> m_oldFiles;
+        std::map<fs::path, FileStamp> m_oldDirectories;
+
+        std::map<fs::path, std::pair<fs::path, FileStamp>> m_files;
+        std::map<fs::path, FileStamp> m_directories;
+    };
+
+}
+
+#endif // JOURNAL_H
@@ -0,0 +1,386 @@
+#include "json.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <stdexcept>
+
+#include <stdcorelib/console.h>
+
+namespace Utils {
+
+    // Recursive descent over the text, one value to a call. Nesting is bounded, so that a file
+    // of nothing but brackets is an error rather than the end of the stack.
+    class JsonParser {
+    public:
+        explicit JsonParser(const std::string &text) : s(text) {
+        }
+
+        JsonValue parseDocument() {
+            JsonValue value = parseValue(0);
+            skipSpace();
+            if (pos != s.size()) {
+                fail("unexpected text after the value");
+            }
+            return value;
+        }
+
+    private:
+        static constexpr int maxDepth = 256;
+
+        const std::string &s;
+        size_t pos = 0;
+
+        [[noreturn]] void fail(const std::string &what) const {
+            size_t line = 1, column = 1;
+            for (size_t i = 0; i < pos && i < s.size(); ++i) {
+                if (s[i] == '\n') {
+                    ++line;
+                    column = 1;
+                } else {
+                    ++column;
+                }
+            }
+            throw std::runtime_error("invalid JSON at line " + std::to_string(line) +
+                                     ", column " + std::to_string(column) + ": " + what);
+        }
+
+        void skipSpace() {
+            while (pos < s.size() &&
+                   (s[pos] == ' ' || s[pos] == '\t' || s[pos] == '\n' || s[pos] == '\r')) {
+                ++pos;
+            }
+        }
+
+        bool consume(const char *word) {
+            size_t i = 0;
+            for (; word[i]; ++i) {
+                if (pos + i >= s.size() || s[pos + i] != word[i])
+                    return false;
+            }
+            pos += i;
+            return true;
+        }
+
+        void expect(char c) {
+            skipSpace();
+            if (pos >= s.size() || s[pos] != c) {
+                fail(std::string("expected '") + c + "'");
+            }
+            ++pos;
+        }
+
+        JsonValue parseValue(int depth) {
+            if (depth > maxDepth) {
+                fail("nested too deeply");
+            }
+
+            skipSpace();
+            if (pos >= s.size()) {
+                fail("unexpected end of text");
+            }
+
+            JsonValue value;
+            switch (s[pos]) {
+                case '{': {
+                    ++pos;
+                    value.m_type = JsonValue::Object;
+                    skipSpace();
+                    if (pos < s.size() && s[pos] == '}') {
+                        ++pos;
+                        break;
+                    }
+                    while (true) {
+                        skipSpace();
+                        if (pos >= s.size() || s[pos] != '"') {
+                            fail("expected a key");
+                        }
+                        auto key = parseString();
+                        expect(':');
+                        auto item = parseValue(depth + 1);
+
+                        // A key given twice keeps its place and takes the later value.
+                        size_t i = 0;
+                        while (i < value.m_keys.size() && value.m_keys[i] != key) {
+                            ++i;
+                        }
+                        if (i < value.m_keys.size()) {
+                            value.m_values[i] = std::move(item);
+                        } else {
+                            value.m_keys.push_back(std::move(key));
+                            value.m_values.push_back(std::move(item));
+                        }
+
+                        skipSpace();
+                        if (pos < s.size() && s[pos] == ',') {
+                            ++pos;
+                            continue;
+                        }
+                        expect('}');
+                        break;
+                    }
+                    break;
+                }
+                case '[': {
+                    ++pos;
+                    value.m_type = JsonValue::Array;
+                    skipSpace();
+                    if (pos < s.size() && s[pos] == ']') {
+                        ++pos;
+                        break;
+                    }
+                    while (true) {
+                        value.m_values.push_back(parseValue(depth + 1));
+                        skipSpace();
+                        if (pos < s.size() && s[pos] == ',') {
+                            ++pos;
+                            continue;
+                        }
+                        expect(']');
+                        break;
+                    }
+                    break;
+                }
+                case '"':
+                    value.m_type = JsonValue::String;
+                    value.m_string = parseString();
+                    break;
+                case 't':
+                case 'f':
+                    value.m_type = JsonValue::Bool;
+                    if (consume("true")) {
+                        value.m_bool = true;
+                    } else if (!consume("false")) {
+                        fail("unknown word");
+                    }
+                    break;
+                case 'n':
+                    if (!consume("null")) {
+                        fail("unknown word");
+                    }
+                    break;
+                default:
+                    value.m_type = JsonValue::Number;
+                    value.m_number = parseNumber();
+                    break;
+            }
+            return value;
+        }
+
+        double parseNumber() {
+            // strtod takes more than JSON does, hex and infinities among it, so the shape is
+            // checked here and only the converting left to it.
+            const size_t start = pos;
+            const auto digits = [this]() {
+                const size_t from = pos;
+                while (pos < s.size() && s[pos] >= '0' && s[pos] <= '9') {
+                    ++pos;
+                }
+                return pos > from;
+            };
+
+            if (pos < s.size() && s[pos] == '-') {
+                ++pos;
+            }
+            if (!digits()) {
+                fail("unexpected character");
+            }
+            if (pos < s.size() && s[pos] == '.') {
+                ++pos;
+                if (!digits()) {
+                    fail("expected a digit");
+                }
+            }
+            if (pos < s.size() && (s[pos] == 'e' || s[pos] == 'E')) {
+                ++pos;
+                if (pos < s.size() && (s[pos] == '+' || s[pos] == '-')) {
+                    ++pos;
+                }
+                if (!digits()) {
+                    fail("expected a digit");
+                }
+            }
+            return std::strtod(s.substr(start, pos - start).c_str(), nullptr);
+        }
+
+        unsigned parseHex4() {
+            if (pos + 4 > s.size()) {
+                fail("unexpected end of text");
+            }
+            unsigned code = 0;
+            for (int i = 0; i < 4; ++i) {
+                const char c = s[pos++];
+                code <<= 4;
+                if (c >= '0' && c <= '9') {
+                    code |= c - '0';
+                } else if (c >= 'a' && c <= 'f') {
+                    code |= c - 'a' + 10;
+                } else if (c >= 'A' && c <= 'F') {
+                    code |= c - 'A' + 10;
+                } else {
+                    fail("invalid \\u escape");
+                }
+            }
+            return code;
+        }
+
+        static void appendUtf8(std::string &out, unsigned code) {
+            if (code < 0x80) {
+                out += static_cast<char>(code);
+            } else if (code < 0x800) {
+                out += static_cast<char>(0xC0 | (code >> 6));
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            } else if (code < 0x10000) {
+                out += static_cast<char>(0xE0 | (code >> 12));
+                out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            } else {
+                out += static_cast<char>(0xF0 | (code >> 18));
+                out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+                out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            }
+        }
+
+        // At the opening quote.
+        std::string parseString() {
+            ++pos;
+            std::string out;
+            while (true) {
+                if (pos >= s.size()) {
+                    fail("unterminated string");
+                }
+                const char c = s[pos++];
+                if (c == '"') {
+                    break;
+                }
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    fail("control character in a string");
+                }
+                if (c != '\\') {
+                    out += c;
+                    continue;
+                }
+                if (pos >= s.size()) {
+                    fail("unterminated string");
+                }
+                switch (s[pos++]) {
+                    case '"':
+                        out += '"';
+                        break;
+                    case '\\':
+                        out += '\\';
+                        break;
+                    case '/':
+                        out += '/';
+                        break;
+                    case 'b':
+                        out += '\b';
+                        break;
+                    case 'f':
+                        out += '\f';
+                        break;
+                    case 'n':
+                        out += '\n';
+                        break;
+                    case 'r':
+                        out += '\r';
+                        break;
+                    case 't':
+                        out += '\t';
+                        break;
+                    case 'u': {
+                        unsigned code = parseHex4();
+                        // A character beyond the first plane is written as two halves.
+                        if (code >= 0xD800 && code < 0xDC00 && consume("\\u")) {
+                            const unsigned low = parseHex4();
+                            if (low < 0xDC00 || low >= 0xE000) {
+                                fail("invalid surrogate pair");
+                            }
+                            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        }
+                        appendUtf8(out, code);
+                        break;
+                    }
+                    default:
+                        --pos;
+                        fail("invalid escape");
+                }
+            }
+            return out;
+        }
+    };
+
+    JsonValue JsonValue::parse(const std::string &text) {
+        return JsonParser(text).parseDocument();
+    }
+
+    const JsonValue *JsonValue::find(const std::string &key) const {
+        for (size_t i = 0; i < m_keys.size(); ++i) {
+            if (m_keys[i] == key) {
+                return &m_values[i];
+            }
+        }
+        return nullptr;
+    }
+
+    std::string jsonQuote(const std::string &s) {
+        std::string out = "\"";
+        for (const char c : s) {
+            switch (c) {
+                case '"':
+                    out += "\\\"";
+                    break;
+                case '\\':
+                    out += "\\\\";
+                    break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        char buf[8];
+                        std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                        out += buf;
+                    } else {
+                        out += c;
+                    }
+            }
+        }
+        return out + "\"";
+    }
+
+    JsonRecord::JsonRecord(const char *type) : m_text("{\"type\":" + jsonQuote(type)) {
+    }
+
+    JsonRecord &JsonRecord::add(const char *key, const std::string &value) {
+        m_text += "," + jsonQuote(key) + ":" + jsonQuote(value);
+        return *this;
+    }
+
+    JsonRecord &JsonRecord::add(const char *key, const char *value) {
+        return add(key, std::string(value));
+    }
+
+    JsonRecord &JsonRecord::add(const char *key, int64_t value) {
+        m_text += "," + jsonQuote(key) + ":" + std::to_string(value);
+        return *this;
+    }
+
+    JsonRecord &JsonRecord::add(const char *key, const std::vector<std::string> &values) {
+        m_text += "," + jsonQuote(key) + ":[";
+        for (size_t i = 0; i < values.size(); ++i) {
+            if (i > 0) {
+                m_text += ",";
+            }
+            m_text += jsonQuote(values[i]);
+        }
+        m_text += "]";
+        return *this;
+    }
+
+    void JsonRecord::print() const {
+        // One call to a line, under a lock, so that two threads never share one.
+        static std::mutex mutex;
+        std::lock_guard<std::mutex> lock(mutex);
+        stdc::u8printf("%s}\n", m_text.data());
+    }
+
+}
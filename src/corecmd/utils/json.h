@@ -0,0 +1,127 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Utils {
+
+    /// A JSON document, read whole, for the files a build hands over to say more than fits on a
+    /// command line.
+    ///
+    /// Only what reading one needs: nothing to change a value once read, and nothing to write one
+    /// out, which is what JsonRecord is for. The keys of an object keep the order they were
+    /// written in, and a key given twice answers with the later value, as most readers do.
+    class JsonValue {
+    public:
+        enum Type {
+            Null,
+            Bool,
+            Number,
+            String,
+            Array,
+            Object,
+        };
+
+        JsonValue() = default;
+
+        /// Reads \a text, which has to be one value and nothing after it but white space.
+        ///
+        /// \throw std::runtime_error naming the line and column of what could not be read.
+        static JsonValue parse(const std::string &text);
+
+        Type type() const {
+            return m_type;
+        }
+
+        bool isNull() const {
+            return m_type == Null;
+        }
+
+        bool isBool() const {
+            return m_type == Bool;
+        }
+
+        bool isNumber() const {
+            return m_type == Number;
+        }
+
+        bool isString() const {
+            return m_type == String;
+        }
+
+        bool isArray() const {
+            return m_type == Array;
+        }
+
+        bool isObject() const {
+            return m_type == Object;
+        }
+
+        bool toBool() const {
+            return m_bool;
+        }
+
+        double toNumber() const {
+            return m_number;
+        }
+
+        const std::string &toString() const {
+            return m_string;
+        }
+
+        /// The elements of an array, and nothing for anything else.
+        const std::vector<JsonValue> &elements() const {
+            return m_values;
+        }
+
+        /// The keys of an object in the order they were written, and nothing for anything else.
+        const std::vector<std::string> &keys() const {
+            return m_keys;
+        }
+
+        /// The value of \a key in an object, or null when it has none or this is not an object.
+        const JsonValue *find(const std::string &key) const;
+
+    private:
+        Type m_type = Null;
+        bool m_bool = false;
+        double m_number = 0;
+        std::string m_string;
+
+        // One list for an array, and for an object the values beside their keys.
+        std::vector<JsonValue> m_values;
+        std::vector<std::string> m_keys;
+
+        friend class JsonParser;
+    };
+
+    /// \a s as a JSON string, quotes and all.
+    std::string jsonQuote(const std::string &s);
+
+    /// One line of what \c --format=json prints, being one JSON object, put together a field at
+    /// a time and printed as soon as it is complete. Nothing is kept once it has been printed,
+    /// so a command may print as many as it likes.
+    ///
+    /// Every record begins with \c "type", which says which of the other fields it has.
+    class JsonRecord {
+    public:
+        explicit JsonRecord(const char *type);
+
+        JsonRecord &add(const char *key, const std::string &value);
+        JsonRecord &add(const char *key, const char *value);
+        JsonRecord &add(const char *key, int64_t value);
+        JsonRecord &add(const char *key, const std::vector<std::string> &values);
+
+        /// Prints the record and a line break. Records printed from several threads at once
+        /// each come out whole.
+        void print() const;
+
+    private:
+        std::string m_text;
+    };
+
+}
+
+#endif // JSON_H
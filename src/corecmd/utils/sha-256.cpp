@@ -1,14 +1,34 @@
 #include "sha-256.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <string>
 
-static constexpr const auto CHUNK_SIZE = 64;
-static constexpr const auto TOTAL_LEN_LEN = 8;
+#if defined(__x86_64__) || defined(__i386__) || \
+    ((defined(_M_X64) || defined(_M_IX86)) && !defined(_M_ARM64EC))
+#  define SHA_256_X86
+#  include <immintrin.h>
+#  ifdef _MSC_VER
+#    include <intrin.h>
+#  else
+#    include <cpuid.h>
+#  endif
+#endif
 
 /*
- * ABOUT bool: this file does not use bool in order to be as pre-C99 compatible as possible.
+ * GCC and Clang compile an intrinsic only into a function allowed the instructions it stands
+ * for, which is what lets one file carry every kernel and the machine pick at run time. MSVC
+ * compiles them anywhere.
  */
+#if defined(__GNUC__) || defined(__clang__)
+#  define SHA_256_TARGET(x) __attribute__((target(x)))
+#else
+#  define SHA_256_TARGET(x)
+#endif
+
+static constexpr const auto CHUNK_SIZE = 64;
+static constexpr const auto TOTAL_LEN_LEN = 8;
 
 /*
  * Comments from pseudo-code at https://en.wikipedia.org/wiki/SHA-2 are reproduced here.
@@ -19,7 +39,7 @@ static constexpr const auto TOTAL_LEN_LEN = 8;
  * Initialize array of round constants:
  * (first 32 bits of the fractional parts of the cube roots of the first 64 primes 2..311):
  */
-static constexpr const uint32_t k[] = {
+alignas(32) static constexpr const uint32_t k[] = {
     0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
     0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
     0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
@@ -30,12 +50,12 @@ static constexpr const uint32_t k[] = {
     0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
 };
 
-struct buffer_state {
-    const uint8_t * p;
-    size_t len;
-    size_t total_len;
-    int single_one_delivered; /* bool */
-    int total_len_delivered; /* bool */
+/*
+ * Initialize hash values:
+ * (first 32 bits of the fractional parts of the square roots of the first 8 primes 2..19):
+ */
+static constexpr const uint32_t h0[] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
 };
 
 static inline constexpr uint32_t right_rot(uint32_t value, unsigned int count)
@@ -47,81 +67,13 @@ static inline constexpr uint32_t right_rot(uint32_t value, unsigned int count)
     return value >> count | value << (32 - count);
 }
 
-static void init_buf_state(struct buffer_state * state, const void * input, size_t len)
-{
-    state->p = static_cast<const uint8_t*>(input);
-    state->len = len;
-    state->total_len = len;
-    state->single_one_delivered = 0;
-    state->total_len_delivered = 0;
-}
-
-/* Return value: bool */
-static int calc_chunk(uint8_t chunk[CHUNK_SIZE], struct buffer_state * state)
-{
-    size_t space_in_chunk;
-
-    if (state->total_len_delivered) {
-        return 0;
-    }
-
-    if (state->len >= CHUNK_SIZE) {
-        std::memcpy(chunk, state->p, CHUNK_SIZE);
-        state->p += CHUNK_SIZE;
-        state->len -= CHUNK_SIZE;
-        return 1;
-    }
-
-    std::memcpy(chunk, state->p, state->len);
-    chunk += state->len;
-    space_in_chunk = CHUNK_SIZE - state->len;
-    state->p += state->len;
-    state->len = 0;
-
-    /* If we are here, space_in_chunk is one at minimum. */
-    if (!state->single_one_delivered) {
-        *chunk++ = 0x80;
-        space_in_chunk -= 1;
-        state->single_one_delivered = 1;
-    }
-
-    /*
-     * Now:
-     * - either there is enough space left for the total length, and we can conclude,
-     * - or there is too little space left, and we have to pad the rest of this chunk with zeroes.
-     * In the latter case, we will conclude at the next invokation of this function.
-     */
-    if (space_in_chunk >= TOTAL_LEN_LEN) {
-        const size_t left = space_in_chunk - TOTAL_LEN_LEN;
-        size_t len = state->total_len;
-        int i;
-        std::memset(chunk, 0x00, left);
-        chunk += left;
-
-        /* Storing of len * 8 as a big endian 64-bit without overflow. */
-        chunk[7] = (uint8_t) (len << 3);
-        len >>= 5;
-        for (i = 6; i >= 0; i--) {
-            chunk[i] = (uint8_t) len;
-            len >>= 8;
-        }
-        state->total_len_delivered = 1;
-    } else {
-        std::memset(chunk, 0x00, space_in_chunk);
-    }
-
-    return 1;
-}
-
 /*
- * Limitations:
- * - Since input is a pointer in RAM, the data to hash should be in RAM, which could be a problem
- *   for large data sizes.
- * - SHA algorithms theoretically operate on bit strings. However, this implementation has no support
- *   for bit string lengths that are not multiples of eight, and it really operates on arrays of bytes.
- *   In particular, the len parameter is a number of bytes.
+ * Every kernel takes whole 512-bit blocks and adds them into h. The padding and the length are
+ * the streaming code's business, below, and the same whichever kernel runs.
  */
-void calc_sha_256(uint8_t hash[32], const void * input, size_t len)
+using compress_fn = void (*)(uint32_t h[8], const uint8_t *p, size_t blocks);
+
+static void compress_scalar(uint32_t h[8], const uint8_t *p, size_t blocks)
 {
     /*
      * Note 1: All integers (expect indexes) are 32-bit unsigned integers and addition is calculated modulo 2^32.
@@ -131,37 +83,19 @@ void calc_sha_256(uint8_t hash[32], const void * input, size_t len)
      *     and when parsing message block data from bytes to words, for example,
      *     the first word of the input message "abc" after padding is 0x61626380
      */
+    int i;
 
-    /*
-     * Initialize hash values:
-     * (first 32 bits of the fractional parts of the square roots of the first 8 primes 2..19):
-     */
-    uint32_t h[] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
-    int i, j;
-
-    /* 512-bit chunks is what we will operate on. */
-    uint8_t chunk[64];
-
-    struct buffer_state state;
-
-    init_buf_state(&state, input, len);
-
-    while (calc_chunk(chunk, &state)) {
+    for (; blocks; --blocks, p += CHUNK_SIZE) {
         uint32_t ah[8];
 
         /*
          * create a 64-entry message schedule array w[0..63] of 32-bit words
-         * (The initial values in w[0..63] don't matter, so many implementations zero them here)
          * copy chunk into first 16 words w[0..15] of the message schedule array
          */
         uint32_t w[64];
-        const uint8_t *p = chunk;
-
-        std::memset(w, 0x00, sizeof w);
         for (i = 0; i < 16; i++) {
-            w[i] = (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
-                (uint32_t) p[2] << 8 | (uint32_t) p[3];
-            p += 4;
+            w[i] = (uint32_t) p[4 * i] << 24 | (uint32_t) p[4 * i + 1] << 16 |
+                (uint32_t) p[4 * i + 2] << 8 | (uint32_t) p[4 * i + 3];
         }
 
         /* Extend the first 16 words into the remaining 48 words w[16..63] of the message schedule array: */
@@ -198,13 +132,470 @@ void calc_sha_256(uint8_t hash[32], const void * input, size_t len)
         for (i = 0; i < 8; i++)
             h[i] += ah[i];
     }
+}
+
+#ifdef SHA_256_X86
+
+/*
+ * The SHA extensions, which do two rounds to an instruction. The state is kept as ABEF and CDGH,
+ * the order the instructions want it in, and only turned back at the end.
+ *
+ * Four rounds to a group. In group i the words for it are added to their constants and the
+ * rounds done, and the schedule is carried forward: sha256msg1 starts the words three groups
+ * on and sha256msg2 finishes the ones for the next group.
+ */
+#  define SHA_256_SHANI_GROUP(i, cur, next, prev)                                               \
+        msg = _mm_add_epi32(cur, _mm_load_si128(reinterpret_cast<const __m128i *>(&k[4 * (i)]))); \
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);                                    \
+        if ((i) >= 3 && (i) <= 14) {                                                            \
+            tmp = _mm_alignr_epi8(cur, prev, 4);                                                \
+            next = _mm_add_epi32(next, tmp);                                                    \
+            next = _mm_sha256msg2_epu32(next, cur);                                             \
+        }                                                                                       \
+        msg = _mm_shuffle_epi32(msg, 0x0E);                                                     \
+        state0 = _mm_sha256rnds2_epu32(state0, state1, msg);                                    \
+        if ((i) >= 1 && (i) <= 12) {                                                            \
+            prev = _mm_sha256msg1_epu32(prev, cur);                                             \
+        }
+
+SHA_256_TARGET("sha,sse4.1")
+static void compress_shani(uint32_t h[8], const uint8_t *p, size_t blocks)
+{
+    const __m128i byteswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i state0, state1, msg, tmp, msg0, msg1, msg2, msg3, abef, cdgh;
+
+    tmp = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&h[0]));
+    state1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&h[4]));
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);            /* CDAB */
+    state1 = _mm_shuffle_epi32(state1, 0x1B);      /* EFGH */
+    state0 = _mm_alignr_epi8(tmp, state1, 8);      /* ABEF */
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);   /* CDGH */
+
+    for (; blocks; --blocks, p += CHUNK_SIZE) {
+        abef = state0;
+        cdgh = state1;
+
+        msg0 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)), byteswap);
+        msg1 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16)), byteswap);
+        msg2 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 32)), byteswap);
+        msg3 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 48)), byteswap);
+
+        SHA_256_SHANI_GROUP(0, msg0, msg1, msg3)
+        SHA_256_SHANI_GROUP(1, msg1, msg2, msg0)
+        SHA_256_SHANI_GROUP(2, msg2, msg3, msg1)
+        SHA_256_SHANI_GROUP(3, msg3, msg0, msg2)
+        SHA_256_SHANI_GROUP(4, msg0, msg1, msg3)
+        SHA_256_SHANI_GROUP(5, msg1, msg2, msg0)
+        SHA_256_SHANI_GROUP(6, msg2, msg3, msg1)
+        SHA_256_SHANI_GROUP(7, msg3, msg0, msg2)
+        SHA_256_SHANI_GROUP(8, msg0, msg1, msg3)
+        SHA_256_SHANI_GROUP(9, msg1, msg2, msg0)
+        SHA_256_SHANI_GROUP(10, msg2, msg3, msg1)
+        SHA_256_SHANI_GROUP(11, msg3, msg0, msg2)
+        SHA_256_SHANI_GROUP(12, msg0, msg1, msg3)
+        SHA_256_SHANI_GROUP(13, msg1, msg2, msg0)
+        SHA_256_SHANI_GROUP(14, msg2, msg3, msg1)
+        SHA_256_SHANI_GROUP(15, msg3, msg0, msg2)
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);         /* FEBA */
+    state1 = _mm_shuffle_epi32(state1, 0xB1);      /* DCHG */
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);   /* DCBA */
+    state1 = _mm_alignr_epi8(state1, tmp, 8);      /* ABEF */
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&h[0]), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&h[4]), state1);
+}
+
+#  undef SHA_256_SHANI_GROUP
+
+/*
+ * Eight messages at once, one to each 32-bit lane of an AVX2 register, with the scalar rounds
+ * done on all eight together. Each lane's sixteen words come out of a transpose of eight rows,
+ * one row a lane, rather than out of thirty-two separate loads.
+ */
+SHA_256_TARGET("avx2")
+static void load_words_x8(__m256i w[8], const uint8_t *const p[8], size_t offset)
+{
+    const __m256i byteswap = _mm256_set_epi8(
+        12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+        12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    __m256i r[8], t[8], u[8];
+    int i;
+
+    for (i = 0; i < 8; i++)
+        r[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p[i] + offset));
+
+    for (i = 0; i < 8; i += 2) {
+        t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+        t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+    }
+    for (i = 0; i < 8; i += 4) {
+        u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+        u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+        u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+        u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+    }
+    for (i = 0; i < 4; i++) {
+        w[i] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u[i], u[i + 4], 0x20), byteswap);
+        w[i + 4] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u[i], u[i + 4], 0x31), byteswap);
+    }
+}
+
+#  define SHA_256_ROTR8(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+SHA_256_TARGET("avx2")
+static void compress_avx2_x8(uint32_t h[8][8], const uint8_t *const p[8], size_t blocks)
+{
+    __m256i s[8], w[64];
+    int i;
+
+    for (i = 0; i < 8; i++)
+        s[i] = _mm256_set_epi32(h[7][i], h[6][i], h[5][i], h[4][i],
+                                h[3][i], h[2][i], h[1][i], h[0][i]);
+
+    for (size_t b = 0; b < blocks; b++) {
+        load_words_x8(&w[0], p, b * CHUNK_SIZE);
+        load_words_x8(&w[8], p, b * CHUNK_SIZE + 32);
+
+        for (i = 16; i < 64; i++) {
+            const __m256i s0 = _mm256_xor_si256(
+                _mm256_xor_si256(SHA_256_ROTR8(w[i - 15], 7), SHA_256_ROTR8(w[i - 15], 18)),
+                _mm256_srli_epi32(w[i - 15], 3));
+            const __m256i s1 = _mm256_xor_si256(
+                _mm256_xor_si256(SHA_256_ROTR8(w[i - 2], 17), SHA_256_ROTR8(w[i - 2], 19)),
+                _mm256_srli_epi32(w[i - 2], 10));
+            w[i] = _mm256_add_epi32(_mm256_add_epi32(w[i - 16], s0),
+                                    _mm256_add_epi32(w[i - 7], s1));
+        }
+
+        __m256i a = s[0], bb = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], hh = s[7];
+        for (i = 0; i < 64; i++) {
+            const __m256i s1 = _mm256_xor_si256(
+                _mm256_xor_si256(SHA_256_ROTR8(e, 6), SHA_256_ROTR8(e, 11)), SHA_256_ROTR8(e, 25));
+            const __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+            const __m256i temp1 = _mm256_add_epi32(
+                _mm256_add_epi32(_mm256_add_epi32(hh, s1), _mm256_add_epi32(ch, w[i])),
+                _mm256_set1_epi32(static_cast<int>(k[i])));
+            const __m256i s0 = _mm256_xor_si256(
+                _mm256_xor_si256(SHA_256_ROTR8(a, 2), SHA_256_ROTR8(a, 13)), SHA_256_ROTR8(a, 22));
+            const __m256i maj = _mm256_or_si256(_mm256_and_si256(a, bb),
+                                                _mm256_and_si256(c, _mm256_or_si256(a, bb)));
+            const __m256i temp2 = _mm256_add_epi32(s0, maj);
+
+            hh = g;
+            g = f;
+            f = e;
+            e = _mm256_add_epi32(d, temp1);
+            d = c;
+            c = bb;
+            bb = a;
+            a = _mm256_add_epi32(temp1, temp2);
+        }
+
+        s[0] = _mm256_add_epi32(s[0], a);
+        s[1] = _mm256_add_epi32(s[1], bb);
+        s[2] = _mm256_add_epi32(s[2], c);
+        s[3] = _mm256_add_epi32(s[3], d);
+        s[4] = _mm256_add_epi32(s[4], e);
+        s[5] = _mm256_add_epi32(s[5], f);
+        s[6] = _mm256_add_epi32(s[6], g);
+        s[7] = _mm256_add_epi32(s[7], hh);
+    }
+
+    for (i = 0; i < 8; i++) {
+        alignas(32) uint32_t lanes[8];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), s[i]);
+        for (int j = 0; j < 8; j++)
+            h[j][i] = lanes[j];
+    }
+}
+
+#  undef SHA_256_ROTR8
+
+static void cpuid(uint32_t leaf, uint32_t sub, uint32_t regs[4])
+{
+#  ifdef _MSC_VER
+    int r[4];
+    __cpuidex(r, static_cast<int>(leaf), static_cast<int>(sub));
+    for (int i = 0; i < 4; i++)
+        regs[i] = static_cast<uint32_t>(r[i]);
+#  else
+    if (!__get_cpuid_count(leaf, sub, &regs[0], &regs[1], &regs[2], &regs[3]))
+        regs[0] = regs[1] = regs[2] = regs[3] = 0;
+#  endif
+}
+
+static int has_shani()
+{
+    uint32_t regs[4];
+    cpuid(0, 0, regs);
+    if (regs[0] < 7)
+        return 0;
+    cpuid(1, 0, regs);
+    const int sse41 = (regs[2] >> 19) & 1;
+    cpuid(7, 0, regs);
+    return sse41 && ((regs[1] >> 29) & 1);
+}
+
+static int has_avx2()
+{
+    uint32_t regs[4];
+    cpuid(0, 0, regs);
+    if (regs[0] < 7)
+        return 0;
+
+    /* The processor having it is not enough: the system has to save the registers too. */
+    cpuid(1, 0, regs);
+    if (!((regs[2] >> 27) & 1))
+        return 0;
+#  ifdef _MSC_VER
+    const uint64_t xcr0 = _xgetbv(0);
+#  else
+    uint32_t eax, edx;
+    __asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    const uint64_t xcr0 = (static_cast<uint64_t>(edx) << 32) | eax;
+#  endif
+    if ((xcr0 & 6) != 6)
+        return 0;
+
+    cpuid(7, 0, regs);
+    return (regs[1] >> 5) & 1;
+}
+
+#else
+
+static int has_shani()
+{
+    return 0;
+}
+
+static int has_avx2()
+{
+    return 0;
+}
+
+#endif
+
+/*
+ * What the machine has, asked once. The kernel in use for one buffer at a time and whether eight
+ * at a time is on are read on every call and may be changed by sha_256_force(), so they are
+ * atomics rather than a static initialised once.
+ */
+struct cpu_features {
+    int shani;
+    int avx2;
+};
+
+static const cpu_features &features()
+{
+    static const cpu_features f = { has_shani(), has_avx2() };
+    return f;
+}
+
+static std::atomic<compress_fn> single_kernel{nullptr};
+static std::atomic<int> multi_enabled{-1};
+
+static compress_fn compress()
+{
+    compress_fn fn = single_kernel.load(std::memory_order_relaxed);
+    if (!fn) {
+#ifdef SHA_256_X86
+        fn = features().shani ? compress_shani : compress_scalar;
+#else
+        fn = compress_scalar;
+#endif
+        single_kernel.store(fn, std::memory_order_relaxed);
+    }
+    return fn;
+}
+
+/*
+ * Eight at a time only pays where one at a time is the scalar code. The SHA extensions are
+ * faster for a single buffer than AVX2 is for eight.
+ */
+static int use_multi()
+{
+    int on = multi_enabled.load(std::memory_order_relaxed);
+    if (on < 0) {
+        on = !features().shani && features().avx2;
+        multi_enabled.store(on, std::memory_order_relaxed);
+    }
+    return on;
+}
+
+int sha_256_force(enum sha_256_impl impl)
+{
+    switch (impl) {
+        case SHA_256_AUTO:
+            single_kernel.store(nullptr);
+            multi_enabled.store(-1);
+            return 1;
+        case SHA_256_SCALAR:
+            single_kernel.store(compress_scalar);
+            multi_enabled.store(0);
+            return 1;
+#ifdef SHA_256_X86
+        case SHA_256_SHANI:
+            if (!features().shani)
+                return 0;
+            single_kernel.store(compress_shani);
+            multi_enabled.store(0);
+            return 1;
+        case SHA_256_AVX2_X8:
+            if (!features().avx2)
+                return 0;
+            single_kernel.store(compress_scalar);
+            multi_enabled.store(1);
+            return 1;
+#endif
+        default:
+            return 0;
+    }
+}
+
+const char *sha_256_implementation(void)
+{
+    if (use_multi())
+        return "avx2-x8";
+#ifdef SHA_256_X86
+    if (compress() == compress_shani)
+        return "sha-ni";
+#endif
+    return "scalar";
+}
+
+void sha_256_init(struct sha_256 *sha)
+{
+    std::memcpy(sha->h, h0, sizeof(h0));
+    sha->chunk_pos = 0;
+    sha->total_len = 0;
+}
+
+void sha_256_write(struct sha_256 *sha, const void *data, size_t len)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    const compress_fn fn = compress();
+    sha->total_len += len;
+
+    /* Finish the chunk a write before this one left part full. */
+    if (sha->chunk_pos) {
+        const size_t n = std::min(len, CHUNK_SIZE - sha->chunk_pos);
+        std::memcpy(sha->chunk + sha->chunk_pos, p, n);
+        sha->chunk_pos += n;
+        p += n;
+        len -= n;
+        if (sha->chunk_pos < CHUNK_SIZE)
+            return;
+        fn(sha->h, sha->chunk, 1);
+        sha->chunk_pos = 0;
+    }
+
+    /* Whole chunks straight from the input, with no copy. */
+    if (len >= CHUNK_SIZE) {
+        const size_t blocks = len / CHUNK_SIZE;
+        fn(sha->h, p, blocks);
+        p += blocks * CHUNK_SIZE;
+        len -= blocks * CHUNK_SIZE;
+    }
+
+    std::memcpy(sha->chunk, p, len);
+    sha->chunk_pos = len;
+}
+
+void sha_256_close(struct sha_256 *sha, uint8_t hash[32])
+{
+    const uint64_t bits = sha->total_len << 3;
+    uint8_t *chunk = sha->chunk;
+    size_t pos = sha->chunk_pos;
+    int i, j;
+
+    /* A single one bit, then zeroes up to the last eight bytes of a chunk. */
+    chunk[pos++] = 0x80;
+    if (pos > CHUNK_SIZE - TOTAL_LEN_LEN) {
+        std::memset(chunk + pos, 0x00, CHUNK_SIZE - pos);
+        compress()(sha->h, chunk, 1);
+        pos = 0;
+    }
+    std::memset(chunk + pos, 0x00, CHUNK_SIZE - TOTAL_LEN_LEN - pos);
+
+    /* Storing of len * 8 as a big endian 64-bit. */
+    for (i = 0; i < TOTAL_LEN_LEN; i++)
+        chunk[CHUNK_SIZE - 1 - i] = (uint8_t) (bits >> (8 * i));
+    compress()(sha->h, chunk, 1);
 
     /* Produce the final hash value (big-endian): */
     for (i = 0, j = 0; i < 8; i++)
     {
-        hash[j++] = (uint8_t) (h[i] >> 24);
-        hash[j++] = (uint8_t) (h[i] >> 16);
-        hash[j++] = (uint8_t) (h[i] >> 8);
-        hash[j++] = (uint8_t) h[i];
+        hash[j++] = (uint8_t) (sha->h[i] >> 24);
+        hash[j++] = (uint8_t) (sha->h[i] >> 16);
+        hash[j++] = (uint8_t) (sha->h[i] >> 8);
+        hash[j++] = (uint8_t) sha->h[i];
+    }
+}
+
+/*
+ * Limitations:
+ * - SHA algorithms theoretically operate on bit strings. However, this implementation has no support
+ *   for bit string lengths that are not multiples of eight, and it really operates on arrays of bytes.
+ *   In particular, the len parameter is a number of bytes.
+ */
+void calc_sha_256(uint8_t hash[32], const void *input, size_t len)
+{
+    struct sha_256 sha;
+    sha_256_init(&sha);
+    sha_256_write(&sha, input, len);
+    sha_256_close(&sha, hash);
+}
+
+void calc_sha_256_many(uint8_t (*hashes)[32], const void *const *inputs, const size_t *lens,
+                       size_t count)
+{
+    size_t first = 0;
+
+#ifdef SHA_256_X86
+    /*
+     * Eight at a time for as many whole chunks as the shortest of the eight has, and each one's
+     * tail one at a time after that. A group short of eight repeats its first buffer in the
+     * lanes left over, which costs what eight would and is still fewer chunks than one lane
+     * at a time. A buffer of less than a chunk gains nothing from it.
+     */
+    if (use_multi()) {
+        for (; first + 1 < count; first += 8) {
+            const size_t n = std::min<size_t>(8, count - first);
+            const uint8_t *p[8];
+            size_t blocks = SIZE_MAX;
+            for (size_t i = 0; i < 8; i++) {
+                const size_t lane = first + (i < n ? i : 0);
+                p[i] = static_cast<const uint8_t *>(inputs[lane]);
+                blocks = std::min(blocks, lens[lane] / CHUNK_SIZE);
+            }
+
+            struct sha_256 sha[8];
+            uint32_t h[8][8];
+            for (size_t i = 0; i < 8; i++) {
+                sha_256_init(&sha[i]);
+                std::memcpy(h[i], sha[i].h, sizeof(h[i]));
+            }
+            if (blocks) {
+                compress_avx2_x8(h, p, blocks);
+            }
+
+            for (size_t i = 0; i < n; i++) {
+                std::memcpy(sha[i].h, h[i], sizeof(h[i]));
+                sha[i].total_len = blocks * CHUNK_SIZE;
+                sha_256_write(&sha[i], p[i] + blocks * CHUNK_SIZE,
+                              lens[first + i] - blocks * CHUNK_SIZE);
+                sha_256_close(&sha[i], hashes[first + i]);
+            }
+        }
+    }
+#endif
+
+    for (size_t i = first; i < count; i++) {
+        calc_sha_256(hashes[i], inputs[i], lens[i]);
     }
 }
@@ -10,8 +10,52 @@
 extern "C" {
 #endif
 
+/*
+ * A hash being computed a piece at a time. Everything in it is private to sha-256.cpp, and it is
+ * here only so that one can be put on the stack.
+ */
+struct sha_256 {
+    uint32_t h[8];
+    uint8_t chunk[64];
+    size_t chunk_pos;
+    uint64_t total_len;
+};
+
+void sha_256_init(struct sha_256 *sha);
+void sha_256_write(struct sha_256 *sha, const void *data, size_t len);
+void sha_256_close(struct sha_256 *sha, uint8_t hash[32]);
+
+/* One buffer, in one call. */
 void calc_sha_256(uint8_t hash[32], const void *input, size_t len);
 
+/*
+ * Any number of buffers, each hashed on its own. Where the machine has nothing faster for one
+ * buffer at a time, eight of them are hashed at once in the lanes of an AVX2 register, which is
+ * what many small files want.
+ */
+void calc_sha_256_many(uint8_t (*hashes)[32], const void *const *inputs, const size_t *lens,
+                       size_t count);
+
+/*
+ * The ways a block can be compressed. The fastest the machine has is picked at the first hash
+ * and used for every one after.
+ */
+enum sha_256_impl {
+    SHA_256_AUTO,
+    SHA_256_SCALAR,
+    SHA_256_SHANI,   /* x86 SHA extensions, one buffer at a time */
+    SHA_256_AVX2_X8, /* Eight buffers at a time, calc_sha_256_many() only */
+};
+
+/*
+ * Uses \a impl from now on, for a test or a benchmark to compare them. Answers 0, and changes
+ * nothing, when the machine does not have it.
+ */
+int sha_256_force(enum sha_256_impl impl);
+
+/* What sha_256_write() and calc_sha_256_many() are using, by name. */
+const char *sha_256_implementation(void);
+
 #ifdef __cplusplus
 }
 #endif
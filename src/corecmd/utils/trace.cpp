@@ -0,0 +1,199 @@
+#include "trace.h"
+#include "json.h"
+
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace Trace {
+
+    namespace detail {
+        std::atomic<bool> enabled{false};
+        std::atomic<uint64_t> counters[CounterCount];
+    }
+
+    namespace {
+
+        // Everything recorded, each event already written out, since the one thing ever done
+        // with them is writing them to the file.
+        struct Recorder {
+            std::mutex mutex;
+            fs::path file;
+            Clock::time_point origin;
+            std::vector<std::string> events;
+            std::map<std::thread::id, int64_t> threads;
+        };
+
+        Recorder &recorder() {
+            static Recorder r;
+            return r;
+        }
+
+        int64_t micros(Clock::time_point t) {
+            return std::chrono::duration_cast<std::chrono::microseconds>(t - recorder().origin)
+                .count();
+        }
+
+        // The calling thread as a small number, in the order threads first record something, so
+        // that the tracks read 1, 2, 3 rather than as whatever the system calls them.
+        int64_t currentThread(Recorder &r) {
+            const auto it = r.threads.emplace(std::this_thread::get_id(), r.threads.size() + 1);
+            return it.first->second;
+        }
+
+        std::string formatArgs(const std::vector<std::pair<std::string, std::string>> &args) {
+            std::string s = "{";
+            for (size_t i = 0; i < args.size(); ++i) {
+                if (i > 0) {
+                    s += ",";
+                }
+                s += Utils::jsonQuote(args[i].first) + ":" + args[i].second;
+            }
+            return s + "}";
+        }
+
+        const char *const counterNames[CounterCount] = {
+            "utils_stat_calls", "subprocesses", "bytes_copied", "files_skipped", "cache_hits",
+        };
+
+    }
+
+    std::string takeTraceFile(std::vector<std::string> &args) {
+        static const std::string option = "--trace";
+        for (size_t i = 1; i < args.size(); ++i) {
+            const auto &arg = args[i];
+            if (arg == "--") {
+                break;
+            }
+            if (arg == option) {
+                if (i + 1 >= args.size()) {
+                    throw std::runtime_error("--trace needs a file to write to");
+                }
+                auto file = args[i + 1];
+                args.erase(args.begin() + i, args.begin() + i + 2);
+                return file;
+            }
+            if (arg.compare(0, option.size() + 1, option + "=") == 0) {
+                auto file = arg.substr(option.size() + 1);
+                args.erase(args.begin() + i);
+                return file;
+            }
+        }
+        return {};
+    }
+
+    void start(const fs::path &file) {
+        auto &r = recorder();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.file = file;
+        r.origin = Clock::now();
+        r.events.clear();
+        for (auto &counter : detail::counters) {
+            counter = 0;
+        }
+        r.events.push_back(R"({"name":"process_name","ph":"M","pid":1,"tid":0,)"
+                           R"("args":{"name":"qmcorecmd"}})");
+        detail::enabled = true;
+    }
+
+    void finish() {
+        if (!isEnabled()) {
+            return;
+        }
+        detail::enabled = false;
+
+        auto &r = recorder();
+        std::lock_guard<std::mutex> lock(r.mutex);
+
+        // The counters at the end, once as a counter event that the viewer draws and once in
+        // otherData, which is where a script reading the file would look.
+        std::vector<std::pair<std::string, std::string>> counters;
+        for (int i = 0; i < CounterCount; ++i) {
+            counters.emplace_back(counterNames[i], std::to_string(detail::counters[i].load()));
+        }
+        const auto &values = formatArgs(counters);
+        r.events.push_back(R"({"name":"Counters","ph":"C","pid":1,"tid":0,"ts":)" +
+                           std::to_string(micros(Clock::now())) + R"(,"args":)" + values + "}");
+
+        for (auto &item : r.threads) {
+            r.events.push_back(R"({"name":"thread_name","ph":"M","pid":1,"tid":)" +
+                               std::to_string(item.second) + R"(,"args":{"name":"thread )" +
+                               std::to_string(item.second) + R"("}})");
+        }
+        r.threads.clear();
+
+        std::ofstream out(r.file, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            throw std::runtime_error("failed to open file \"" + tstr2str(r.file) +
+                                     "\": " + Utils::sysErrorMessage());
+        }
+        out << "{\"traceEvents\":[\n";
+        for (size_t i = 0; i < r.events.size(); ++i) {
+            out << r.events[i] << (i + 1 < r.events.size() ? ",\n" : "\n");
+        }
+        out << "],\n\"displayTimeUnit\":\"ms\",\n\"otherData\":{\"counters\":" << values
+            << "}}\n";
+        r.events.clear();
+        out.close();
+        if (!out) {
+            throw std::runtime_error("failed to write file \"" + tstr2str(r.file) +
+                                     "\": " + Utils::sysErrorMessage());
+        }
+    }
+
+    void complete(const char *category, const std::string &name, Clock::time_point begin,
+                  Clock::time_point end,
+                  const std::vector<std::pair<std::string, std::string>> &args, int64_t tid) {
+        if (!isEnabled()) {
+            return;
+        }
+        auto &r = recorder();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.events.push_back(
+            R"({"name":)" + Utils::jsonQuote(name) + R"(,"cat":)" + Utils::jsonQuote(category) +
+            R"(,"ph":"X","pid":1,"tid":)" + std::to_string(tid ? tid : currentThread(r)) +
+            R"(,"ts":)" + std::to_string(micros(begin)) + R"(,"dur":)" +
+            std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(end - begin)
+                               .count()) +
+            R"(,"args":)" + formatArgs(args) + "}");
+    }
+
+    void nameTrack(int64_t tid, const std::string &name) {
+        if (!isEnabled()) {
+            return;
+        }
+        auto &r = recorder();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.events.push_back(R"({"name":"thread_name","ph":"M","pid":1,"tid":)" +
+                           std::to_string(tid) + R"(,"args":{"name":)" + Utils::jsonQuote(name) +
+                           "}}");
+    }
+
+    Span::Span(const char *category, std::string name)
+        : m_enabled(isEnabled()), m_category(category) {
+        if (m_enabled) {
+            m_name = std::move(name);
+            m_begin = Clock::now();
+        }
+    }
+
+    Span::~Span() {
+        if (m_enabled) {
+            complete(m_category, m_name, m_begin, Clock::now(), m_args);
+        }
+    }
+
+    void Span::arg(const std::string &key, const std::string &value) {
+        if (m_enabled) {
+            m_args.emplace_back(key, Utils::jsonQuote(value));
+        }
+    }
+
+    void Span::arg(const std::string &key, int64_t value) {
+        if (m_enabled) {
+            m_args.emplace_back(key, std::to_string(value));
+        }
+    }
+
+}
@@ -0,0 +1,92 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utils.h"
+
+/// What \c --trace records: timed spans, written as Chrome trace events that Perfetto and
+/// chrome://tracing both open, and a handful of counters written at the end.
+///
+/// Nothing is recorded unless a trace was started, and asking costs one atomic load, so a span
+/// may sit on any path that is not itself a loop over bytes.
+namespace Trace {
+
+    using Clock = std::chrono::steady_clock;
+
+    enum Counter {
+        UtilsStatCalls, ///< Files asked about by copyFile(), fileTime() and fileStamp() only
+        Subprocesses,   ///< Tools started
+        BytesCopied,    ///< Written by cloneFile()
+        FilesSkipped,   ///< Left alone for being up to date already
+        CacheHits,      ///< Answered by a journal, a manifest, a state file or a header's hash
+        CounterCount,
+    };
+
+    namespace detail {
+        extern std::atomic<bool> enabled;
+        extern std::atomic<uint64_t> counters[CounterCount];
+    }
+
+    inline bool isEnabled() {
+        return detail::enabled.load(std::memory_order_relaxed);
+    }
+
+    inline void count(Counter counter, uint64_t n = 1) {
+        if (isEnabled()) {
+            detail::counters[counter].fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+
+    /// Removes <tt>--trace <file></tt> or <tt>--trace=<file></tt> from \a args and answers with
+    /// the file, or with nothing where it was not there. It may be anywhere before a \c --.
+    ///
+    /// \throw std::runtime_error where \c --trace is last, with no file after it.
+    std::string takeTraceFile(std::vector<std::string> &args);
+
+    /// Starts recording, for finish() to write to \a file.
+    void start(const fs::path &file);
+
+    /// Writes what was recorded and stops recording. Nothing happens where nothing was started.
+    void finish();
+
+    /// Records a span that has already happened.
+    ///
+    /// \param args each a name and a value already in JSON
+    /// \param tid the track to show it on, or 0 for the thread calling this
+    void complete(const char *category, const std::string &name, Clock::time_point begin,
+                  Clock::time_point end,
+                  const std::vector<std::pair<std::string, std::string>> &args = {},
+                  int64_t tid = 0);
+
+    /// Names the track \a tid, for the spans complete() puts on one that is not a thread.
+    void nameTrack(int64_t tid, const std::string &name);
+
+    /// Records the time from here to the end of the scope, on the thread it is made on.
+    class Span {
+    public:
+        Span(const char *category, std::string name);
+        ~Span();
+
+        Span(const Span &) = delete;
+        Span &operator=(const Span &) = delete;
+
+        void arg(const std::string &key, const std::string &value);
+        void arg(const std::string &key, int64_t value);
+
+    private:
+        bool m_enabled;
+        const char *m_category;
+        std::string m_name;
+        Clock::time_point m_begin;
+        std::vector<std::pair<std::string, std::string>> m_args;
+    };
+
+}
+
+#endif // TRACE_H
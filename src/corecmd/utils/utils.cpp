@@ -1,12 +1,16 @@
 #include "utils.h"
+#include "journal.h"
+#include "json.h"
+#include "trace.h"
 
 #include <algorithm>
+#include <atomic>
 #include <ctime>
 #include <system_error>
 
 #include <stdcorelib/console.h>
 #include <stdcorelib/path.h>
-#include <stdcorelib/support/popen.h>
+#include <stdcorelib/str.h>
 
 using stdc::u8printf;
 
@@ -33,19 +37,49 @@ namespace Utils {
         return std::error_code(code, std::generic_category()).message();
     }
 
+    namespace {
+
+        // What --format=json prints of one file that was copied or passed over.
+        void printCopyRecord(const fs::path &file, const fs::path &target, const char *action,
+                             const char *reason = nullptr) {
+            JsonRecord record("copy");
+            record.add("from", tstr2str(file)).add("to", tstr2str(target)).add("action", action);
+            if (reason) {
+                record.add("reason", reason);
+            }
+            record.print();
+        }
+
+    }
+
     bool copyFile(const fs::path &file, const fs::path &dest, const fs::path &symlinkContent,
-                  bool force, bool verbose) {
+                  bool force, bool verbose, bool json) {
         auto target = dest / file.filename();
+        Trace::count(Trace::UtilsStatCalls);
         if (fs::exists(target)) {
-            if (stdc::path::clean_path(target) == stdc::path::clean_path(file))
+            if (stdc::path::clean_path(target) == stdc::path::clean_path(file)) {
+                Trace::count(Trace::FilesSkipped);
+                if (json) {
+                    printCopyRecord(file, target, "skipped", "same file");
+                }
                 return false; // Same file
+            }
 
-            if (!force && Utils::fileTime(target).modifyTime >= Utils::fileTime(file).modifyTime)
+            if (!force && Utils::fileTime(target).modifyTime >= Utils::fileTime(file).modifyTime) {
+                Trace::count(Trace::FilesSkipped);
+                if (json) {
+                    printCopyRecord(file, target, "skipped", "up to date");
+                }
                 return false; // Not updated
+            }
         } else if (!fs::is_directory(dest)) {
             fs::create_directories(dest);
         }
 
+        Trace::Span span("copy", symlinkContent.empty() ? "Copy" : "Link");
+        span.arg("from", tstr2str(file));
+        span.arg("to", tstr2str(target));
+
         if (!symlinkContent.empty()) {
             if (verbose) {
                 u8printf("Link: from \"%s\" to \"%s\"\n", tstr2str(file).data(),
@@ -55,12 +89,22 @@ namespace Utils {
             if (fs::exists(target))
                 fs::remove(target);
             fs::create_symlink(symlinkContent, target);
+            if (json) {
+                JsonRecord("copy")
+                    .add("from", tstr2str(file))
+                    .add("to", tstr2str(target))
+                    .add("action", "linked")
+                    .add("link", tstr2str(symlinkContent))
+                    .print();
+            }
         } else {
             if (verbose) {
                 u8printf("Copy: from \"%s\" to \"%s\"\n", tstr2str(file).data(), tstr2str(target).data());
             }
-            fs::copy(file, dest, fs::copy_options::overwrite_existing);
-            Utils::syncFileTime(target, file); // Sync time for each file
+            Utils::cloneFile(file, target);
+            if (json) {
+                printCopyRecord(file, target, "copied");
+            }
         }
 
         return true;
@@ -68,9 +112,13 @@ namespace Utils {
 
     void copyDirectory(const fs::path &srcRootDir, const fs::path &srcDir, const fs::path &destDir,
                        bool force, bool verbose,
-                       const std::function<bool(const fs::path &)> &ignore) {
+                       const std::function<bool(const fs::path &)> &ignore,
+                       std::set<fs::path> *targets, CopyJournal *journal, bool json) {
         fs::create_directories(destDir); // Ensure the destination directory exists
 
+        // Asked before anything is written here, since writing is what changes the answer.
+        const bool destUnchanged = journal && !force && journal->isDirectoryUnchanged(destDir);
+
         // canonical() resolves every link on the way, so what it answers has to be compared with
         // a root that has been through the same thing. On macOS /var is a link to /private/var,
         // so a bundle under a temporary directory failed the test below and had its internal
@@ -79,19 +127,27 @@ namespace Utils {
         const auto canonicalRoot = fs::weakly_canonical(srcRootDir, ec);
         const auto &root = ec ? srcRootDir : canonicalRoot;
 
+        // What each entry is comes from the entry, which has it from reading the directory on
+        // most file systems, rather than from asking the file system about the path again. So a
+        // regular file is looked at once, by fileStamp() below, and a link or a directory not at
+        // all before it is followed.
         for (const auto &entry : fs::directory_iterator(srcDir)) {
             const auto &entryPath = entry.path();
             if (ignore && ignore(entryPath))
                 continue;
 
+            if (targets) {
+                targets->insert(destDir / entryPath.filename());
+            }
+
 #ifndef _WIN32
-            if (fs::is_symlink(entryPath)) {
+            if (entry.is_symlink()) {
                 fs::path linkPath;
                 try {
                     linkPath = fs::canonical(entryPath);
                 } catch (...) {
                     // The symlink is invalid
-                    copyFile(entryPath, destDir, {}, force, verbose);
+                    copyFile(entryPath, destDir, {}, force, verbose, json);
                     continue;
                 }
 
@@ -100,90 +156,86 @@ namespace Utils {
                          stdc::str::starts_with(linkPath.string(), root.string())
                              ? fs::relative(linkPath, fs::canonical(entryPath.parent_path())).string()
                              : std::string(),
-                         force, verbose);
+                         force, verbose, json);
                 continue;
             }
 #endif
 
-            if (fs::is_regular_file(entryPath)) {
-                copyFile(entryPath, destDir, {}, force, verbose);
-            } else if (fs::is_directory(entryPath)) {
-                copyDirectory(srcRootDir, entryPath, destDir / entryPath.filename(), force, verbose,
-                              ignore);
-            }
-        }
-    }
-
-    bool removeEmptyDirectories(const fs::path &path, bool verbose) {
-        // A link is one of the things that is not a directory, whatever it points at. Walking
-        // into one leaves the tree that was named, and what is emptied out there is emptied for
-        // good, so a caller asking about a link is told the directory holding it is not empty.
-        if (isLink(path)) {
-            return false;
-        }
+            if (entry.is_regular_file()) {
+                if (!journal) {
+                    copyFile(entryPath, destDir, {}, force, verbose, json);
+                    continue;
+                }
 
-        bool isEmpty = true;
-        for (const auto &entry : fs::directory_iterator(path)) {
-            if (fs::is_directory(entry.path()) && removeEmptyDirectories(entry.path(), verbose)) {
-                continue;
+                // One stat of the source, and none of the destination where the journal has the
+                // answer.
+                const auto &target = destDir / entryPath.filename();
+                FileStamp stamp;
+                if (!fileStamp(entryPath, &stamp)) {
+                    copyFile(entryPath, destDir, {}, force, verbose, json);
+                    continue;
+                }
+                if (!destUnchanged || !journal->isUnchanged(entryPath, target, stamp)) {
+                    copyFile(entryPath, destDir, {}, force, verbose, json);
+                } else {
+                    Trace::count(Trace::CacheHits);
+                    Trace::count(Trace::FilesSkipped);
+                    if (json) {
+                        printCopyRecord(entryPath, target, "skipped", "journal");
+                    }
+                }
+                journal->recordFile(entryPath, target, stamp);
+            } else if (entry.is_directory()) {
+                copyDirectory(srcRootDir, entryPath, destDir / entryPath.filename(), force, verbose,
+                              ignore, targets, journal, json);
             }
-
-            // File or non-empty directory
-            isEmpty = false;
         }
 
-        // Remove self if empty
-        if (isEmpty) {
-            if (verbose) {
-                u8printf("Remove: \"%s\"\n", tstr2str(path).data());
-            }
-            fs::remove(path);
+        if (journal) {
+            journal->recordDirectory(destDir);
         }
-
-        // Notify the caller the directory is empty or not
-        return isEmpty;
     }
 
     std::string executeCommand(const std::string &command, const std::vector<std::string> &args) {
-        // A generous cap rather than none at all. Everything run here is a quick tool, and a
-        // build with one of them wedged should say so rather than wait for somebody to notice.
-        constexpr int timeout = 120 * 1000;
-
-        std::vector<std::string> argv;
-        argv.reserve(args.size() + 1);
-        argv.push_back(command);
-        argv.insert(argv.end(), args.begin(), args.end());
-
-        stdc::Popen proc;
-        proc.args(argv)
-            .standardInput(stdc::Popen::DeviceNull)
-            .standardOutput(stdc::Popen::Pipe)
-            // Folded together. What a tool says when it fails is what the error below carries,
-            // and some of them say it on one stream and some on the other.
-            .standardError(stdc::Popen::StandardOutput);
-
-        if (!proc.start()) {
-            throw std::runtime_error("failed to run \"" + command + "\": " + proc.errorMessage());
-        }
+        return executeCommandAsync(command, args).get();
+    }
 
-        std::string output = std::get<0>(proc.communicate({}, timeout));
-        if (proc.errorCode()) {
-            throw std::runtime_error("failed to run \"" + command + "\": " + proc.errorMessage());
-        }
+    void runParallel(size_t count, size_t jobs, const std::function<void(size_t)> &fn) {
+        std::atomic<size_t> next{0};
+        std::atomic<bool> failed{false};
+        const auto work = [&]() {
+            try {
+                for (size_t i; !failed && (i = next++) < count;) {
+                    fn(i);
+                }
+            } catch (...) {
+                failed = true;
+                throw;
+            }
+        };
 
-        const auto code = proc.returnCode();
-        if (!code) {
-            throw std::runtime_error("command \"" + command + "\" did not finish");
+        const size_t threads = std::min(std::max<size_t>(jobs, 1), count);
+        std::vector<std::future<void>> pending;
+        for (size_t i = 1; i < threads; ++i) {
+            pending.push_back(std::async(std::launch::async, work));
         }
-        if (*code == 0) {
-            return output;
+        std::exception_ptr error;
+        try {
+            work();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        for (auto &item : pending) {
+            try {
+                item.get();
+            } catch (...) {
+                if (!error)
+                    error = std::current_exception();
+            }
         }
-        // A child that a signal ended comes back as the negated signal number.
-        if (*code < 0) {
-            throw std::runtime_error("command \"" + command + "\" was terminated by signal " +
-                                     std::to_string(-*code));
+        if (error) {
+            std::rethrow_exception(error);
         }
-        throw std::runtime_error(std::string(stdc::str::trim(output)));
     }
 
 }
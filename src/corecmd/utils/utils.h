@@ -2,8 +2,10 @@
 #define UTILS_H
 
 #include <chrono>
+#include <cstdint>
 #include <filesystem>
 #include <functional>
+#include <future>
 #include <regex>
 #include <set>
 #include <string>
@@ -44,6 +46,8 @@ TString str2tstr(const std::string &str);
 
 namespace Utils {
 
+    class CopyJournal;
+
     /// \name Text
     /// @{
 
@@ -111,6 +115,42 @@ namespace Utils {
         setFileTime(dest, fileTime(src));
     }
 
+    /// Which file is at a path and when it last changed, to tell whether it is the one seen
+    /// before without reading it.
+    struct FileStamp {
+        uint64_t inode = 0; ///< The file index on Windows
+        uint64_t size = 0;
+        int64_t modifyTime = 0; ///< In nanoseconds, from whatever epoch the platform counts from
+
+        bool operator==(const FileStamp &other) const {
+            return inode == other.inode && size == other.size && modifyTime == other.modifyTime;
+        }
+        bool operator!=(const FileStamp &other) const {
+            return !(*this == other);
+        }
+    };
+
+    /// Reads the stamp of \a path, following a link, in a single \c stat.
+    ///
+    /// \return false where there is nothing at \a path, which is not an error
+    bool fileStamp(const fs::path &path, FileStamp *stamp);
+
+    /// Writes the content of \a file to \a target, replacing whatever is there, and gives it the
+    /// timestamps of \a file.
+    ///
+    /// \note On Linux the kernel copies the data without it passing through this process, by
+    ///       whichever of \c copy_file_range and \c sendfile the running kernel has, and the
+    ///       timestamps are set to the nanosecond from the same \c fstat that sized the copy.
+    ///       Elsewhere it is the standard library's copy, then syncFileTime(), and so it is on
+    ///       Unix too where \c QMCORECMD_COPY_ENGINE is \c std, for a benchmark to compare.
+    void cloneFile(const fs::path &file, const fs::path &target);
+
+    /// The SHA-256 of what \a file holds.
+    ///
+    /// \note The file is mapped into memory rather than read, a window at a time, so that the
+    ///       hash runs at the speed of the page cache rather than of a copy out of it.
+    void hashFile(const fs::path &file, uint8_t hash[32]);
+
     /// Copies \a file into the directory \a dest.
     ///
     /// The copy is given the timestamps of what it came from, so that the comparison below holds
@@ -118,23 +158,36 @@ namespace Utils {
     ///
     /// \param symlinkContent makes a link naming that rather than copying anything
     /// \param force writes without comparing
+    /// \param json prints a \c copy JsonRecord saying what was done, or why nothing was
     /// \retval true something was written
     /// \retval false the destination was already the same file, or no older than the source
     bool copyFile(const fs::path &file, const fs::path &dest, const fs::path &symlinkContent,
-                  bool force, bool verbose);
+                  bool force, bool verbose, bool json = false);
 
     /// Copies the contents of \a srcDir into \a destDir, keeping the structure.
     ///
     /// \param srcRootDir what a path handed to \a ignore is measured from, so that a pattern can
     ///        be written against the tree rather than against wherever the walk has reached
     /// \param ignore asked about each entry, and what it says yes to is left behind
+    /// \param targets filled in with every destination path the walk arrived at, whether or not
+    ///        anything was written there, for a caller that wants to know what else is there
+    /// \param journal what the last run saw, for a file it says is unchanged to be passed over
+    ///        without the destination being looked at, and told what this run saw
+    /// \param json prints a JsonRecord for each file, as copyFile() does
     void copyDirectory(const fs::path &srcRootDir, const fs::path &srcDir, const fs::path &destDir,
                        bool force, bool verbose,
-                       const std::function<bool(const fs::path &)> &ignore = {});
+                       const std::function<bool(const fs::path &)> &ignore = {},
+                       std::set<fs::path> *targets = nullptr, CopyJournal *journal = nullptr,
+                       bool json = false);
 
     /// Removes the empty directories under \a path, and \a path itself if that leaves it empty.
+    /// A link is never walked into, whatever it points at.
     ///
     /// \return whether \a path was removed
+    /// \note On unix each directory is opened relative to the one above it and the directories
+    ///       beside one another are walked on as many threads as there are cores. What is
+    ///       removed is printed once the walk is done, deepest first, as it was when there was
+    ///       one thread.
     bool removeEmptyDirectories(const fs::path &path, bool verbose);
 
     /// @}
@@ -150,6 +203,29 @@ namespace Utils {
     ///       tool, so this function is not used on Windows now.
     std::string executeCommand(const std::string &command, const std::vector<std::string> &args);
 
+    /// Starts a program and answers at once, with what executeCommand() would have answered to
+    /// come later.
+    ///
+    /// What is started waits its turn behind setCommandJobLimit() others, so that a caller may
+    /// ask for a hundred at once and have no more than that many running. Each is stopped, and
+    /// its future fails, if it has not finished two minutes after it started.
+    ///
+    /// \note On Linux and macOS one thread starts them all with \c posix_spawn, reads what they
+    ///       say and reaps them. On Windows each takes a thread of its own while it runs.
+    std::future<std::string> executeCommandAsync(const std::string &command,
+                                                 const std::vector<std::string> &args);
+
+    /// How many programs may be running at once, for the whole of the process. The number of
+    /// cores until told otherwise.
+    void setCommandJobLimit(size_t count);
+
+    /// Calls \a fn with every index below \a count, on as many as \a jobs threads at once, this
+    /// one among them.
+    ///
+    /// A thread that fails stops the others taking more, and the first failure is rethrown once
+    /// they have all stopped.
+    void runParallel(size_t count, size_t jobs, const std::function<void(size_t)> &fn);
+
     /// @}
 
     /// \name Binaries
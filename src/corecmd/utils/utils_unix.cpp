@@ -1,21 +1,52 @@
 #include "utils.h"
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
-#include <utime.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
+#ifdef __APPLE__
+#  include <copyfile.h>
+#elif defined(__linux__)
+#  include <sys/sendfile.h>
+#  include <sys/syscall.h>
+#  include <sys/utsname.h>
+#endif
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
 #include <filesystem>
+#include <future>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <regex>
 #include <set>
 #include <sstream>
 #include <system_error>
+#include <thread>
+#include <tuple>
 
+#include <stdcorelib/console.h>
 #include <stdcorelib/path.h>
 #include <stdcorelib/str.h>
 #include <stdcorelib/stlextra/algorithms.h>
 
+#include "utils/json.h"
+#include "utils/sha-256.h"
+#include "utils/trace.h"
+
 namespace fs = std::filesystem;
 
+extern char **environ;
+
 namespace Utils {
 
     bool isLink(const fs::path &path) {
@@ -23,28 +54,445 @@ namespace Utils {
         return fs::is_symlink(path, ec);
     }
 
+    // To the nanosecond where the file system keeps that much, so that a file written twice in
+    // one second is still newer the second time than a copy made in between.
+    static std::chrono::system_clock::time_point toTimePoint(const struct timespec &ts) {
+        return std::chrono::system_clock::time_point(
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec)));
+    }
+
+    static struct timespec toTimeSpec(const std::chrono::system_clock::time_point &t) {
+        const auto ns =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+        struct timespec ts;
+        ts.tv_sec = static_cast<time_t>(ns / 1000000000);
+        ts.tv_nsec = static_cast<long>(ns % 1000000000);
+        if (ts.tv_nsec < 0) {
+            ts.tv_sec -= 1;
+            ts.tv_nsec += 1000000000;
+        }
+        return ts;
+    }
+
     FileTime fileTime(const fs::path &path) {
+        Trace::count(Trace::UtilsStatCalls);
         struct stat sb;
         if (stat(path.c_str(), &sb) == -1) {
             throw std::runtime_error("failed to get file time: \"" + path.string() + "\"");
         }
 
         FileTime times;
-        times.accessTime = std::chrono::system_clock::from_time_t(sb.st_atime);
-        times.modifyTime = std::chrono::system_clock::from_time_t(sb.st_mtime);
-        times.statusChangeTime = std::chrono::system_clock::from_time_t(sb.st_ctime);
+#ifdef __APPLE__
+        times.accessTime = toTimePoint(sb.st_atimespec);
+        times.modifyTime = toTimePoint(sb.st_mtimespec);
+        times.statusChangeTime = toTimePoint(sb.st_ctimespec);
+#else
+        times.accessTime = toTimePoint(sb.st_atim);
+        times.modifyTime = toTimePoint(sb.st_mtim);
+        times.statusChangeTime = toTimePoint(sb.st_ctim);
+#endif
         return times;
     }
 
     void setFileTime(const fs::path &path, const FileTime &times) {
-        struct utimbuf new_times;
-        new_times.actime = std::chrono::system_clock::to_time_t(times.accessTime);
-        new_times.modtime = std::chrono::system_clock::to_time_t(times.modifyTime);
-        if (utime(path.c_str(), &new_times) != 0) {
+        const struct timespec newTimes[2] = {
+            toTimeSpec(times.accessTime),
+            toTimeSpec(times.modifyTime),
+        };
+        if (utimensat(AT_FDCWD, path.c_str(), newTimes, 0) != 0) {
             throw std::runtime_error("failed to set file time: \"" + path.string() + "\"");
         }
     }
 
+    bool fileStamp(const fs::path &path, FileStamp *stamp) {
+        Trace::count(Trace::UtilsStatCalls);
+        struct stat sb;
+        if (stat(path.c_str(), &sb) != 0) {
+            return false;
+        }
+
+#ifdef __APPLE__
+        const auto &mtime = sb.st_mtimespec;
+#else
+        const auto &mtime = sb.st_mtim;
+#endif
+        stamp->inode = static_cast<uint64_t>(sb.st_ino);
+        stamp->size = static_cast<uint64_t>(sb.st_size);
+        stamp->modifyTime = static_cast<int64_t>(mtime.tv_sec) * 1000000000 + mtime.tv_nsec;
+        return true;
+    }
+
+    namespace {
+
+        // A file descriptor that is closed on the way out, however that is.
+        class FileDescriptor {
+        public:
+            explicit FileDescriptor(int fd) : fd(fd) {
+            }
+            ~FileDescriptor() {
+                if (fd >= 0)
+                    ::close(fd);
+            }
+            FileDescriptor(const FileDescriptor &) = delete;
+            FileDescriptor &operator=(const FileDescriptor &) = delete;
+
+            int fd;
+        };
+
+#ifdef __linux__
+        // Whether the running kernel has been seen to lack each of these. That is found out
+        // once, rather than once per file, since it does not change while the kernel runs.
+        std::atomic<bool> noCopyFileRange{false};
+        std::atomic<bool> noSendFile{false};
+
+        // Whether the running kernel is older than \a major.\a minor.
+        bool isKernelBefore(int major, int minor) {
+            struct utsname name;
+            int haveMajor = 0, haveMinor = 0;
+            if (::uname(&name) != 0 ||
+                std::sscanf(name.release, "%d.%d", &haveMajor, &haveMinor) != 2) {
+                return false;
+            }
+            return haveMajor < major || (haveMajor == major && haveMinor < minor);
+        }
+
+        // Whether a call declined the copy rather than failing partway through it, so that the
+        // next way of copying is worth a try. Only a few of these are about the kernel. The rest
+        // are a file system that will not take part, or a pair that will not go together, and
+        // say nothing about the next file, which is tried afresh.
+        bool isUnsupported(int code) {
+            return code == ENOSYS || code == EXDEV || code == EINVAL || code == EOPNOTSUPP ||
+                   code == EPERM;
+        }
+
+        // Whether copy_file_range being turned down says the kernel cannot do it at all. It
+        // arrived in 4.5, and crossed file systems only from 5.3, so before that EXDEV is as
+        // much the kernel's answer as ENOSYS. From 5.3 on it is about the pair of files.
+        bool isCopyFileRangeMissing(int code) {
+            static const bool beforeCrossFileSystem = isKernelBefore(5, 3);
+            return code == ENOSYS || (code == EXDEV && beforeCrossFileSystem);
+        }
+#endif
+
+#ifndef __APPLE__
+        // Moves \a size bytes from \a in to \a out, both at offset nought. What the kernel can do
+        // without the data coming up into this process is tried first, and reading and writing
+        // is what is left over.
+        bool copyContents(int in, int out, off_t size) {
+            off_t done = 0;
+
+#ifdef __linux__
+#  ifdef __NR_copy_file_range
+            while (done < size && !noCopyFileRange.load(std::memory_order_relaxed)) {
+                const auto n = ::syscall(__NR_copy_file_range, in, nullptr, out, nullptr,
+                                         static_cast<size_t>(size - done), 0u);
+                if (n > 0) {
+                    done += n;
+                    continue;
+                }
+                if (n == 0) {
+                    break; // Shorter than it said it was, which a file being written can be
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                // Nothing was written yet, so falling back starts from the same place.
+                if (done == 0 && isUnsupported(errno)) {
+                    if (isCopyFileRangeMissing(errno)) {
+                        noCopyFileRange.store(true, std::memory_order_relaxed);
+                    }
+                    break;
+                }
+                return false;
+            }
+            if (done > 0) {
+                return true;
+            }
+#  endif
+
+            while (done < size && !noSendFile.load(std::memory_order_relaxed)) {
+                const auto n = ::sendfile(out, in, nullptr, static_cast<size_t>(size - done));
+                if (n > 0) {
+                    done += n;
+                    continue;
+                }
+                if (n == 0) {
+                    break;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (done == 0 && isUnsupported(errno)) {
+                    if (errno == ENOSYS) {
+                        noSendFile.store(true, std::memory_order_relaxed);
+                    }
+                    break;
+                }
+                return false;
+            }
+            if (done > 0) {
+                return true;
+            }
+#else
+            std::ignore = size;
+#endif
+
+            char buf[64 * 1024];
+            while (true) {
+                const auto n = ::read(in, buf, sizeof(buf));
+                if (n == 0) {
+                    return true;
+                }
+                if (n < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    return false;
+                }
+                for (ssize_t written = 0; written < n;) {
+                    const auto m = ::write(out, buf + written, n - written);
+                    if (m < 0) {
+                        if (errno == EINTR)
+                            continue;
+                        return false;
+                    }
+                    written += m;
+                }
+            }
+        }
+#endif
+
+    }
+
+    void cloneFile(const fs::path &file, const fs::path &target) {
+        // QMCORECMD_COPY_ENGINE=std puts back the copy this replaced, the standard library's
+        // followed by syncFileTime(), so that qmcorecmd_bench can time one against the other in
+        // the same build. Read once, the environment not changing under a run.
+        static const bool standardCopy = [] {
+            const char *engine = std::getenv("QMCORECMD_COPY_ENGINE");
+            return engine && std::string(engine) == "std";
+        }();
+        if (standardCopy) {
+            fs::copy_file(file, target, fs::copy_options::overwrite_existing);
+            syncFileTime(target, file);
+            if (Trace::isEnabled()) {
+                Trace::count(Trace::BytesCopied, fs::file_size(target));
+            }
+            return;
+        }
+
+        const FileDescriptor in(::open(file.c_str(), O_RDONLY | O_CLOEXEC));
+        if (in.fd < 0) {
+            throw std::runtime_error("failed to open file \"" + file.string() +
+                                     "\": " + sysErrorMessage());
+        }
+
+        struct stat sb;
+        if (::fstat(in.fd, &sb) != 0) {
+            throw std::runtime_error("failed to get file time: \"" + file.string() + "\"");
+        }
+
+        const FileDescriptor out(
+            ::open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, sb.st_mode & 07777));
+        if (out.fd < 0) {
+            throw std::runtime_error("failed to open file \"" + target.string() +
+                                     "\": " + sysErrorMessage());
+        }
+
+#ifdef __APPLE__
+        const bool copied = ::fcopyfile(in.fd, out.fd, nullptr, COPYFILE_DATA) == 0;
+#else
+        const bool copied = copyContents(in.fd, out.fd, sb.st_size);
+#endif
+        if (!copied) {
+            throw std::runtime_error("failed to copy \"" + file.string() + "\" to \"" +
+                                     target.string() + "\": " + sysErrorMessage());
+        }
+        Trace::count(Trace::BytesCopied, uint64_t(sb.st_size));
+
+        // What an existing target was made with is kept by open(), so the source's mode is put
+        // on it the way fs::copy did.
+        ::fchmod(out.fd, sb.st_mode & 07777);
+
+#ifdef __APPLE__
+        const struct timespec times[2] = {sb.st_atimespec, sb.st_mtimespec};
+#else
+        const struct timespec times[2] = {sb.st_atim, sb.st_mtim};
+#endif
+        if (::futimens(out.fd, times) != 0) {
+            throw std::runtime_error("failed to set file time: \"" + target.string() + "\"");
+        }
+    }
+
+    void hashFile(const fs::path &file, uint8_t hash[32]) {
+        const FileDescriptor in(::open(file.c_str(), O_RDONLY | O_CLOEXEC));
+        if (in.fd < 0) {
+            throw std::runtime_error("failed to open file \"" + file.string() +
+                                     "\": " + sysErrorMessage());
+        }
+
+        struct stat sb;
+        if (::fstat(in.fd, &sb) != 0) {
+            throw std::runtime_error("failed to get file size: \"" + file.string() + "\"");
+        }
+
+        // A window at a time, so that a file larger than the address space of a 32-bit build is
+        // hashed all the same. A multiple of any page size there is.
+        constexpr size_t window = size_t(256) << 20;
+
+        struct sha_256 sha;
+        sha_256_init(&sha);
+        for (off_t offset = 0; offset < sb.st_size;) {
+            const size_t len = size_t(std::min<off_t>(window, sb.st_size - offset));
+            void *p = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, in.fd, offset);
+            if (p == MAP_FAILED) {
+                throw std::runtime_error("failed to map file \"" + file.string() +
+                                         "\": " + sysErrorMessage());
+            }
+            ::madvise(p, len, MADV_SEQUENTIAL);
+            sha_256_write(&sha, p, len);
+            ::munmap(p, len);
+            offset += off_t(len);
+        }
+        sha_256_close(&sha, hash);
+    }
+
+    namespace {
+
+        // How many more threads a walk may start, shared by all of it and handed back as each
+        // subtree is done. One per core beyond the one that is already walking.
+        std::atomic<int> spareWalkers{static_cast<int>(std::thread::hardware_concurrency()) - 1};
+
+        bool takeWalker() {
+            int n = spareWalkers.load();
+            while (n > 0) {
+                if (spareWalkers.compare_exchange_weak(n, n - 1))
+                    return true;
+            }
+            return false;
+        }
+
+        // What the walk below found under one directory: whether it went, and what was removed
+        // on the way, deepest first, so that a verbose caller prints it in the order it always
+        // did however many threads there were.
+        struct RemoveResult {
+            bool removed = false;
+            std::vector<std::string> paths;
+        };
+
+        // Removes \a name, under the directory open as \a parentFd, if nothing but empty
+        // directories is in it, and the empty directories under it whether or not.
+        //
+        // Everything is named relative to the directory above it, so nothing is looked up from
+        // the root again however deep the tree goes, and the type readdir() hands back is taken
+        // rather than asking for it. \a name is opened without following a link, which makes a
+        // link one of the things that is not a directory, as it always was. \a path is for
+        // messages only.
+        RemoveResult removeEmptyAt(int parentFd, const std::string &name, const std::string &path) {
+            RemoveResult result;
+
+            const int fd =
+                ::openat(parentFd, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (fd < 0) {
+                if (errno == ELOOP || errno == ENOTDIR || errno == ENOENT)
+                    return result; // A link, or something else that is not a directory
+                throw std::runtime_error("failed to open directory \"" + path +
+                                         "\": " + sysErrorMessage());
+            }
+            DIR *dir = ::fdopendir(fd);
+            if (!dir) {
+                ::close(fd);
+                throw std::runtime_error("failed to open directory \"" + path +
+                                         "\": " + sysErrorMessage());
+            }
+            const std::unique_ptr<DIR, int (*)(DIR *)> dirCloser(dir, ::closedir);
+            const int dirFd = ::dirfd(dir);
+
+            // A file settles that this directory stays, but not what happens to the directories
+            // beside it, so the reading goes on for them and only the removal at the end is
+            // passed over.
+            bool hasFile = false;
+            std::vector<std::string> subdirs;
+            while (const auto entry = ::readdir(dir)) {
+                const char *entryName = entry->d_name;
+                if (entryName[0] == '.' &&
+                    (entryName[1] == '\0' || (entryName[1] == '.' && entryName[2] == '\0')))
+                    continue;
+
+                bool isDir = entry->d_type == DT_DIR;
+                if (entry->d_type == DT_UNKNOWN) {
+                    // Some file systems do not say, and are asked.
+                    struct stat sb;
+                    isDir = ::fstatat(dirFd, entryName, &sb, AT_SYMLINK_NOFOLLOW) == 0 &&
+                            S_ISDIR(sb.st_mode);
+                }
+                if (isDir) {
+                    subdirs.emplace_back(entryName);
+                } else {
+                    hasFile = true;
+                }
+            }
+
+            const auto joined = [&path](const std::string &sub) {
+                return (!path.empty() && path.back() == '/') ? path + sub : path + '/' + sub;
+            };
+
+            // The last one is walked here rather than handed off, since this thread would only
+            // wait otherwise. The futures go before the directory is closed, whatever happens.
+            std::vector<RemoveResult> subResults(subdirs.size());
+            std::vector<std::future<RemoveResult>> pending(subdirs.size());
+            for (size_t i = 0; i < subdirs.size(); ++i) {
+                if (i + 1 < subdirs.size() && takeWalker()) {
+                    pending[i] = std::async(std::launch::async, [&, i]() {
+                        struct Release {
+                            ~Release() {
+                                spareWalkers.fetch_add(1);
+                            }
+                        } release;
+                        return removeEmptyAt(dirFd, subdirs[i], joined(subdirs[i]));
+                    });
+                } else {
+                    subResults[i] = removeEmptyAt(dirFd, subdirs[i], joined(subdirs[i]));
+                }
+            }
+
+            bool isEmpty = !hasFile;
+            for (size_t i = 0; i < subdirs.size(); ++i) {
+                if (pending[i].valid()) {
+                    subResults[i] = pending[i].get();
+                }
+                auto &sub = subResults[i];
+                isEmpty = isEmpty && sub.removed;
+                result.paths.insert(result.paths.end(), std::make_move_iterator(sub.paths.begin()),
+                                    std::make_move_iterator(sub.paths.end()));
+            }
+
+            if (isEmpty) {
+                if (::unlinkat(parentFd, name.c_str(), AT_REMOVEDIR) == 0) {
+                    result.removed = true;
+                    result.paths.push_back(path);
+                } else if (errno != ENOTEMPTY && errno != EEXIST) {
+                    // Something arriving in the meantime keeps the directory, as it would have
+                    // kept it a moment earlier. Anything else is an error.
+                    throw std::runtime_error("failed to remove directory \"" + path +
+                                             "\": " + sysErrorMessage());
+                }
+            }
+            return result;
+        }
+
+    }
+
+    bool removeEmptyDirectories(const fs::path &path, bool verbose) {
+        const auto result = removeEmptyAt(AT_FDCWD, path.string(), path.string());
+        if (verbose) {
+            for (const auto &item : result.paths) {
+                stdc::u8printf("Remove: \"%s\"\n", item.data());
+            }
+        }
+        return result.removed;
+    }
+
 
 #ifdef __APPLE__
     // Mac
@@ -280,14 +728,11 @@ namespace Utils {
 
     // The names in the binary's own DT_NEEDED, which is where its dependency
     // graph actually has an edge.
-    static std::vector<std::string> readNeededNames(const std::string &fileName) {
+    static std::vector<std::string> readNeededNames(std::future<std::string> pending) {
         std::string output;
 
         try {
-            output = executeCommand("patchelf", {
-                                                    "--print-needed",
-                                                    fileName,
-                                                });
+            output = pending.get();
         } catch (const std::exception &e) {
             throw std::runtime_error("Failed to get dependencies: " + std::string(e.what()));
         }
@@ -313,11 +758,11 @@ namespace Utils {
     // multiarch directories, the hwcaps subdirectories, and skipping a library
     // of the wrong ELF class. `ldd` has all of that right for the machine it
     // runs on, so it is asked instead.
-    static std::map<std::string, std::string> readLddOutput(const std::string &fileName) {
+    static std::map<std::string, std::string> readLddOutput(std::future<std::string> pending) {
         std::string output;
 
         try {
-            output = executeCommand("ldd", {fileName});
+            output = pending.get();
         } catch (const std::exception &e) {
             throw std::runtime_error("Failed to get dependencies: " + std::string(e.what()));
         }
@@ -353,11 +798,22 @@ namespace Utils {
         // from the binary itself, and what they resolve to comes from `ldd`.
         // Its table holds more than this file asks for, which does no harm,
         // because only the names it asks for are looked up.
-        const auto &needed = readNeededNames(path);
+        //
+        // Neither answer depends on the other, so both are started at once.
+        // `ldd` takes the longer of the two by far, being the loader actually
+        // mapping the whole closure. A file that needs nothing is one `ldd`
+        // would have refused, and its refusal is waited for and dropped.
+        auto pendingNeeded = executeCommandAsync("patchelf", {"--print-needed", path.string()});
+        auto pendingResolved = executeCommandAsync("ldd", {path.string()});
+        const auto &needed = readNeededNames(std::move(pendingNeeded));
         if (needed.empty()) {
+            try {
+                std::ignore = pendingResolved.get();
+            } catch (const std::exception &) {
+            }
             return {};
         }
-        const auto &resolved = readLddOutput(path);
+        const auto &resolved = readLddOutput(std::move(pendingResolved));
 
         std::vector<std::string> dependencies;
         dependencies.reserve(needed.size());
@@ -454,4 +910,303 @@ namespace Utils {
     }
 #endif
 
+    namespace {
+
+        // One program, from the moment it is asked for until its future has an answer.
+        struct CommandJob {
+            std::vector<std::string> argv;
+            std::promise<std::string> promise;
+
+            pid_t pid = -1;
+            int fd = -1; ///< The read end of what it writes, or -1 once that is done
+            std::string output;
+            std::chrono::steady_clock::time_point started;
+            std::chrono::steady_clock::time_point deadline;
+        };
+
+        // Starts programs, reads what they write and reaps them, all on one thread of its own,
+        // no more than a limit of them at a time.
+        //
+        // One thread for all of them, rather than one waiting on each, is what lets a deployment
+        // have dozens of tools in flight without as many threads. A program's output and its
+        // exit are both waited on with poll(): the first as its pipe, and the second by asking
+        // once the pipe has closed, which comes only a moment before. A wait is never longer
+        // than what is left of the nearest deadline.
+        class CommandRunner {
+        public:
+            static CommandRunner &instance() {
+                static CommandRunner runner;
+                return runner;
+            }
+
+            std::future<std::string> submit(std::vector<std::string> argv) {
+                auto job = std::make_unique<CommandJob>();
+                job->argv = std::move(argv);
+                auto future = job->promise.get_future();
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_queue.push_back(std::move(job));
+                }
+                wake();
+                return future;
+            }
+
+            void setLimit(size_t count) {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_limit = std::max<size_t>(count, 1);
+                }
+                wake();
+            }
+
+        private:
+            CommandRunner() {
+                if (::pipe(m_wake) != 0) {
+                    throw std::runtime_error("failed to create pipe: " + sysErrorMessage());
+                }
+                for (const int fd : m_wake) {
+                    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+                    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+                }
+                m_thread = std::thread([this]() { run(); });
+            }
+
+            // At exit, whatever is still running is stopped rather than waited for. Nothing can
+            // want its answer by then, and a tool left running would hold the exit for as long
+            // as it took.
+            ~CommandRunner() {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_stop = true;
+                }
+                wake();
+                m_thread.join();
+                ::close(m_wake[0]);
+                ::close(m_wake[1]);
+            }
+
+            void wake() {
+                const char c = 0;
+                std::ignore = ::write(m_wake[1], &c, 1);
+            }
+
+            // Starts \a job, or fails its future where it cannot be started.
+            bool start(CommandJob &job) {
+                constexpr auto timeout = std::chrono::seconds(120);
+
+                // Built before anything is spawned, so that the child is handed pointers into
+                // strings that outlive it rather than anything made between spawn and exec.
+                std::vector<char *> argv;
+                argv.reserve(job.argv.size() + 1);
+                for (auto &arg : job.argv) {
+                    argv.push_back(arg.data());
+                }
+                argv.push_back(nullptr);
+
+                int fds[2];
+                if (::pipe(fds) != 0) {
+                    fail(job, "failed to run \"" + job.argv.front() + "\": " + sysErrorMessage());
+                    return false;
+                }
+                // Only this thread spawns, so nothing can be started between pipe() and these
+                // that would inherit the ends. Everything else in the program writes files
+                // rather than starting processes.
+                ::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+                ::fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+                posix_spawn_file_actions_t actions;
+                posix_spawn_file_actions_init(&actions);
+                posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+                // Folded together. What a tool says when it fails is what the error carries, and
+                // some of them say it on one stream and some on the other.
+                posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+                posix_spawn_file_actions_adddup2(&actions, fds[1], STDERR_FILENO);
+
+                pid_t pid;
+                const int code =
+                    ::posix_spawnp(&pid, argv.front(), &actions, nullptr, argv.data(), environ);
+                posix_spawn_file_actions_destroy(&actions);
+                ::close(fds[1]);
+
+                if (code != 0) {
+                    ::close(fds[0]);
+                    fail(job, "failed to run \"" + job.argv.front() + "\": " +
+                                  sysErrorMessage(code));
+                    return false;
+                }
+
+                job.pid = pid;
+                job.fd = fds[0];
+                job.started = std::chrono::steady_clock::now();
+                job.deadline = job.started + timeout;
+                Trace::count(Trace::Subprocesses);
+                return true;
+            }
+
+            // Each program on a track of its own, named after it, since they overlap one
+            // another and nothing else on a track may.
+            static void trace(const CommandJob &job, const std::string &exit) {
+                if (!Trace::isEnabled()) {
+                    return;
+                }
+                std::string command;
+                for (const auto &arg : job.argv) {
+                    command += (command.empty() ? "" : " ") + arg;
+                }
+                Trace::nameTrack(job.pid, job.argv.front() + " " + std::to_string(job.pid));
+                Trace::complete("process", job.argv.front(), job.started,
+                                std::chrono::steady_clock::now(),
+                                {{"command", jsonQuote(command)}, {"exit", exit}}, job.pid);
+            }
+
+            static void fail(CommandJob &job, const std::string &message) {
+                job.promise.set_exception(std::make_exception_ptr(std::runtime_error(message)));
+            }
+
+            // Answers for a job whose program has exited with \a status.
+            static void finish(CommandJob &job, int status) {
+                trace(job, WIFEXITED(status) ? std::to_string(WEXITSTATUS(status))
+                                             : jsonQuote("signal " + std::to_string(WTERMSIG(status))));
+                const auto &command = job.argv.front();
+                if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+                    job.promise.set_value(std::move(job.output));
+                } else if (WIFSIGNALED(status)) {
+                    fail(job, "command \"" + command + "\" was terminated by signal " +
+                                  std::to_string(WTERMSIG(status)));
+                } else {
+                    fail(job, std::string(stdc::str::trim(job.output)));
+                }
+            }
+
+            // Stops a job that will not be waited for any longer.
+            static void kill(CommandJob &job) {
+                ::kill(job.pid, SIGKILL);
+                int status;
+                while (::waitpid(job.pid, &status, 0) < 0 && errno == EINTR) {
+                }
+                if (job.fd >= 0) {
+                    ::close(job.fd);
+                    job.fd = -1;
+                }
+                trace(job, jsonQuote("killed"));
+                fail(job, "command \"" + job.argv.front() + "\" did not finish");
+            }
+
+            void run() {
+                std::vector<std::unique_ptr<CommandJob>> running;
+                std::vector<pollfd> fds;
+                std::vector<char> buffer(64 * 1024);
+
+                while (true) {
+                    {
+                        std::unique_lock<std::mutex> lock(m_mutex);
+                        if (m_stop) {
+                            for (auto &job : running) {
+                                kill(*job);
+                            }
+                            for (auto &job : m_queue) {
+                                fail(*job, "command \"" + job->argv.front() + "\" did not finish");
+                            }
+                            return;
+                        }
+                        while (running.size() < m_limit && !m_queue.empty()) {
+                            auto job = std::move(m_queue.front());
+                            m_queue.pop_front();
+                            if (start(*job)) {
+                                running.push_back(std::move(job));
+                            }
+                        }
+                    }
+
+                    // What to wait on: the wake pipe, and every program still writing. One that
+                    // has closed its end is asked after again shortly rather than waited on.
+                    fds.clear();
+                    fds.push_back({m_wake[0], POLLIN, 0});
+                    int timeout = -1;
+                    const auto now = std::chrono::steady_clock::now();
+                    for (const auto &job : running) {
+                        if (job->fd >= 0) {
+                            fds.push_back({job->fd, POLLIN, 0});
+                        }
+                        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                              job->deadline - now)
+                                              .count() +
+                                          1;
+                        int wait = job->fd >= 0 ? int(std::max<long long>(left, 0)) : 5;
+                        timeout = timeout < 0 ? wait : std::min(timeout, wait);
+                    }
+
+                    if (::poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR) {
+                        throw std::runtime_error("failed to poll: " + sysErrorMessage());
+                    }
+
+                    if (fds[0].revents) {
+                        while (::read(m_wake[0], buffer.data(), buffer.size()) > 0) {
+                        }
+                    }
+
+                    for (size_t i = 1; i < fds.size(); ++i) {
+                        if (!fds[i].revents) {
+                            continue;
+                        }
+                        for (auto &job : running) {
+                            if (job->fd != fds[i].fd) {
+                                continue;
+                            }
+                            const auto n = ::read(job->fd, buffer.data(), buffer.size());
+                            if (n > 0) {
+                                job->output.append(buffer.data(), size_t(n));
+                            } else if (n == 0 || errno != EINTR) {
+                                ::close(job->fd);
+                                job->fd = -1;
+                            }
+                            break;
+                        }
+                    }
+
+                    const auto later = std::chrono::steady_clock::now();
+                    for (auto it = running.begin(); it != running.end();) {
+                        auto &job = **it;
+                        if (job.fd < 0) {
+                            int status;
+                            if (::waitpid(job.pid, &status, WNOHANG) == job.pid) {
+                                finish(job, status);
+                                it = running.erase(it);
+                                continue;
+                            }
+                        }
+                        if (later >= job.deadline) {
+                            kill(job);
+                            it = running.erase(it);
+                            continue;
+                        }
+                        ++it;
+                    }
+                }
+            }
+
+            std::mutex m_mutex;
+            std::deque<std::unique_ptr<CommandJob>> m_queue;
+            size_t m_limit = std::max(1u, std::thread::hardware_concurrency());
+            bool m_stop = false;
+
+            int m_wake[2] = {-1, -1};
+            std::thread m_thread;
+        };
+
+    }
+
+    std::future<std::string> executeCommandAsync(const std::string &command,
+                                                 const std::vector<std::string> &args) {
+        std::vector<std::string> argv;
+        argv.reserve(args.size() + 1);
+        argv.push_back(command);
+        argv.insert(argv.end(), args.begin(), args.end());
+        return CommandRunner::instance().submit(std::move(argv));
+    }
+
+    void setCommandJobLimit(size_t count) {
+        CommandRunner::instance().setLimit(count);
+    }
+
 }
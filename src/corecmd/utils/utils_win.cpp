@@ -8,12 +8,21 @@
 #include <delayimp.h>
 
 #include <algorithm>
+#include <condition_variable>
 #include <sstream>
 #include <filesystem>
+#include <future>
+#include <mutex>
 #include <stdexcept>
+#include <thread>
 #include <utility>
 
+#include <stdcorelib/console.h>
 #include <stdcorelib/str.h>
+#include <stdcorelib/support/popen.h>
+
+#include "utils/sha-256.h"
+#include "utils/trace.h"
 
 namespace fs = std::filesystem;
 
@@ -30,6 +39,7 @@ namespace Utils {
     }
 
     FileTime fileTime(const fs::path &path) {
+        Trace::count(Trace::UtilsStatCalls);
         HANDLE hFile = ::CreateFileW(path.wstring().data(), GENERIC_READ, FILE_SHARE_READ, nullptr,
                                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
         if (hFile == INVALID_HANDLE_VALUE) {
@@ -73,6 +83,120 @@ namespace Utils {
         ::CloseHandle(hFile);
     }
 
+    bool fileStamp(const fs::path &path, FileStamp *stamp) {
+        Trace::count(Trace::UtilsStatCalls);
+        // Backup semantics, without which a directory cannot be opened at all.
+        HANDLE hFile = ::CreateFileW(path.wstring().data(), 0,
+                                     FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                     nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+        if (hFile == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        BY_HANDLE_FILE_INFORMATION info;
+        const bool ok = ::GetFileInformationByHandle(hFile, &info);
+        ::CloseHandle(hFile);
+        if (!ok) {
+            return false;
+        }
+
+        // A FILETIME counts hundreds of nanoseconds.
+        stamp->inode = (uint64_t(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+        stamp->size = (uint64_t(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+        stamp->modifyTime =
+            int64_t((uint64_t(info.ftLastWriteTime.dwHighDateTime) << 32) |
+                    info.ftLastWriteTime.dwLowDateTime) *
+            100;
+        return true;
+    }
+
+    void cloneFile(const fs::path &file, const fs::path &target) {
+        fs::copy_file(file, target, fs::copy_options::overwrite_existing);
+        syncFileTime(target, file);
+        if (Trace::isEnabled()) {
+            Trace::count(Trace::BytesCopied, fs::file_size(target));
+        }
+    }
+
+    void hashFile(const fs::path &file, uint8_t hash[32]) {
+        HANDLE hFile = ::CreateFileW(file.wstring().data(), GENERIC_READ,
+                                     FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                     nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (hFile == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("failed to open file \"" + tstr2str(file) +
+                                     "\": " + tstr2str(stdc::windows::systemError(::GetLastError())));
+        }
+
+        LARGE_INTEGER size;
+        if (!::GetFileSizeEx(hFile, &size)) {
+            ::CloseHandle(hFile);
+            throw std::runtime_error("failed to get file size: \"" + tstr2str(file) + "\"");
+        }
+
+        struct sha_256 sha;
+        sha_256_init(&sha);
+
+        // An empty file cannot be mapped at all.
+        if (size.QuadPart > 0) {
+            HANDLE hMapping = ::CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (!hMapping) {
+                ::CloseHandle(hFile);
+                throw std::runtime_error("failed to map file \"" + tstr2str(file) +
+                                         "\": " + tstr2str(stdc::windows::systemError(::GetLastError())));
+            }
+
+            // A window at a time, a multiple of the allocation granularity.
+            constexpr uint64_t window = uint64_t(256) << 20;
+            for (uint64_t offset = 0; offset < uint64_t(size.QuadPart);) {
+                const size_t len = size_t(std::min(window, uint64_t(size.QuadPart) - offset));
+                const void *p = ::MapViewOfFile(hMapping, FILE_MAP_READ, DWORD(offset >> 32),
+                                                DWORD(offset & 0xFFFFFFFF), len);
+                if (!p) {
+                    ::CloseHandle(hMapping);
+                    ::CloseHandle(hFile);
+                    throw std::runtime_error("failed to map file \"" + tstr2str(file) +
+                                             "\": " + tstr2str(stdc::windows::systemError(::GetLastError())));
+                }
+                sha_256_write(&sha, p, len);
+                ::UnmapViewOfFile(p);
+                offset += len;
+            }
+            ::CloseHandle(hMapping);
+        }
+        ::CloseHandle(hFile);
+        sha_256_close(&sha, hash);
+    }
+
+    bool removeEmptyDirectories(const fs::path &path, bool verbose) {
+        // A link is one of the things that is not a directory, whatever it points at. Walking
+        // into one leaves the tree that was named, and what is emptied out there is emptied for
+        // good, so a caller asking about a link is told the directory holding it is not empty.
+        if (isLink(path)) {
+            return false;
+        }
+
+        bool isEmpty = true;
+        for (const auto &entry : fs::directory_iterator(path)) {
+            if (fs::is_directory(entry.path()) && removeEmptyDirectories(entry.path(), verbose)) {
+                continue;
+            }
+
+            // File or non-empty directory
+            isEmpty = false;
+        }
+
+        // Remove self if empty
+        if (isEmpty) {
+            if (verbose) {
+                stdc::u8printf("Remove: \"%s\"\n", tstr2str(path).data());
+            }
+            fs::remove(path);
+        }
+
+        // Notify the caller the directory is empty or not
+        return isEmpty;
+    }
+
 
     // ================================================================================
     // Modified from windeployqt 5.15.2(Copyright Qt company)
@@ -331,4 +455,107 @@ namespace Utils {
         return result;
     }
 
+    namespace {
+
+        // How many more programs may be started, and a wait for one of them to finish when the
+        // answer is none.
+        struct CommandSlots {
+            std::mutex mutex;
+            std::condition_variable freed;
+            size_t limit = std::max(1u, std::thread::hardware_concurrency());
+            size_t running = 0;
+        };
+
+        CommandSlots &commandSlots() {
+            static CommandSlots slots;
+            return slots;
+        }
+
+        std::string runCommand(const std::string &command, const std::vector<std::string> &args) {
+            // A generous cap rather than none at all. Everything run here is a quick tool, and a
+            // build with one of them wedged should say so rather than wait for somebody to
+            // notice.
+            constexpr int timeout = 120 * 1000;
+
+            std::vector<std::string> argv;
+            argv.reserve(args.size() + 1);
+            argv.push_back(command);
+            argv.insert(argv.end(), args.begin(), args.end());
+
+            // On the thread waiting for it, which is this job's alone.
+            Trace::Span span("process", command);
+            Trace::count(Trace::Subprocesses);
+            if (Trace::isEnabled()) {
+                std::string line;
+                for (const auto &arg : argv) {
+                    line += (line.empty() ? "" : " ") + arg;
+                }
+                span.arg("command", line);
+            }
+
+            stdc::Popen proc;
+            proc.args(argv)
+                .standardInput(stdc::Popen::DeviceNull)
+                .standardOutput(stdc::Popen::Pipe)
+                // Folded together. What a tool says when it fails is what the error below
+                // carries, and some of them say it on one stream and some on the other.
+                .standardError(stdc::Popen::StandardOutput);
+
+            if (!proc.start()) {
+                throw std::runtime_error("failed to run \"" + command +
+                                         "\": " + proc.errorMessage());
+            }
+
+            std::string output = std::get<0>(proc.communicate({}, timeout));
+            if (proc.errorCode()) {
+                throw std::runtime_error("failed to run \"" + command +
+                                         "\": " + proc.errorMessage());
+            }
+
+            const auto code = proc.returnCode();
+            if (!code) {
+                span.arg("exit", "killed");
+                throw std::runtime_error("command \"" + command + "\" did not finish");
+            }
+            span.arg("exit", int64_t(*code));
+            if (*code == 0) {
+                return output;
+            }
+            throw std::runtime_error(std::string(stdc::str::trim(output)));
+        }
+
+    }
+
+    std::future<std::string> executeCommandAsync(const std::string &command,
+                                                 const std::vector<std::string> &args) {
+        return std::async(std::launch::async, [command, args]() {
+            auto &slots = commandSlots();
+            {
+                std::unique_lock<std::mutex> lock(slots.mutex);
+                slots.freed.wait(lock, [&]() { return slots.running < slots.limit; });
+                ++slots.running;
+            }
+            struct Release {
+                CommandSlots &slots;
+                ~Release() {
+                    {
+                        std::lock_guard<std::mutex> lock(slots.mutex);
+                        --slots.running;
+                    }
+                    slots.freed.notify_one();
+                }
+            } release{slots};
+            return runCommand(command, args);
+        });
+    }
+
+    void setCommandJobLimit(size_t count) {
+        auto &slots = commandSlots();
+        {
+            std::lock_guard<std::mutex> lock(slots.mutex);
+            slots.limit = std::max<size_t>(count, 1);
+        }
+        slots.freed.notify_all();
+    }
+
 }
@@ -0,0 +1,136 @@
+"""`batch` runs the command lines of a job file in one process.
+
+A job runs once everything it names in `after` has succeeded, and is skipped
+where any of those failed. Jobs that wait for nothing run side by side.
+"""
+
+import json
+
+from testing.harness import QmTestCase
+
+
+class TestBatch(QmTestCase):
+    def write_jobs(self, *jobs, name="jobs.ndjson"):
+        self.write(name, "".join(json.dumps(job) + "\n" for job in jobs))
+        return name
+
+    def test_every_job_is_run(self):
+        self.write("a.txt", "a")
+        self.write("b.txt", "b")
+        jobs = self.write_jobs(
+            {"command": "copy", "args": ["a.txt", "one"]},
+            {"command": "copy", "args": ["b.txt", "two"]},
+        )
+        self.assertOk(self.run_cmd("batch", jobs))
+        self.assertFile("one/a.txt")
+        self.assertFile("two/b.txt")
+
+    def test_jobs_run_at_once_each_keep_their_own_arguments(self):
+        """Each job's command line is parsed apart from the others running beside it."""
+        jobs = []
+        for i in range(64):
+            self.write(f"in/{i}.txt", str(i))
+            jobs.append({"command": "copy", "args": [f"in/{i}.txt", f"out{i}"]})
+        self.assertOk(self.run_cmd("batch", self.write_jobs(*jobs), "-j", "8"))
+        for i in range(64):
+            self.assertEqual(self.read(f"out{i}/{i}.txt"), str(i))
+
+    def test_a_json_array_is_read_as_well(self):
+        self.write("a.txt", "a")
+        self.write(
+            "jobs.json",
+            json.dumps([{"command": "copy", "args": ["a.txt", "out"]}], indent=4),
+        )
+        self.assertOk(self.run_cmd("batch", "jobs.json"))
+        self.assertFile("out/a.txt")
+
+    def test_a_job_runs_after_what_it_waits_for(self):
+        """Each copies what the one before it wrote, so any other order fails."""
+        self.write("a.txt", "a")
+        jobs = [{"id": "0", "command": "copy", "args": ["a.txt", "d0"]}]
+        for i in range(1, 10):
+            jobs.append(
+                {"id": str(i), "command": "copy", "args": [f"d{i - 1}/a.txt", f"d{i}"],
+                 "after": str(i - 1)}
+            )
+        self.assertOk(self.run_cmd("batch", self.write_jobs(*jobs), "-j", "8"))
+        self.assertFile("d9/a.txt")
+
+    def test_what_waits_for_a_failure_is_skipped_and_the_rest_runs(self):
+        self.write("a.txt", "a")
+        jobs = self.write_jobs(
+            {"id": "bad", "command": "copy", "args": ["nosuch", "out"]},
+            {"id": "then", "command": "copy", "args": ["a.txt", "then"], "after": "bad"},
+            {"id": "later", "command": "copy", "args": ["a.txt", "later"], "after": ["then"]},
+            {"id": "other", "command": "copy", "args": ["a.txt", "other"]},
+        )
+        r = self.run_cmd("batch", jobs)
+        self.assertFails(r)
+        self.assertOut(r, 'job "bad"')
+        self.assertOut(r, 'Skip: job "then"')
+        self.assertOut(r, 'Skip: job "later"')
+        self.assertNoDir("then")
+        self.assertNoDir("later")
+        self.assertFile("other/a.txt")
+
+    def test_a_batch_of_one_exits_as_the_command_would(self):
+        jobs = self.write_jobs({"command": "copy", "args": ["nosuch", "out"]})
+        self.assertEqual(
+            self.run_cmd("batch", jobs).code, self.run_cmd("copy", "nosuch", "out").code
+        )
+
+    def test_a_job_without_an_id_is_named_by_its_place(self):
+        jobs = self.write_jobs(
+            {"command": "rmdir", "args": ["missing"]},
+            {"command": "copy", "args": ["nosuch", "out"]},
+        )
+        r = self.run_cmd("batch", jobs)
+        self.assertOut(r, 'job "2"')
+
+    def test_a_command_that_cannot_be_batched_is_refused(self):
+        for command in ("batch", "nosuch"):
+            with self.subTest(command=command):
+                jobs = self.write_jobs({"command": command, "args": []})
+                self.assertRefused(self.run_cmd("batch", jobs))
+
+    def test_waiting_for_a_later_job_is_refused(self):
+        self.write("a.txt", "a")
+        jobs = self.write_jobs(
+            {"id": "first", "command": "copy", "args": ["a.txt", "one"], "after": "second"},
+            {"id": "second", "command": "copy", "args": ["a.txt", "two"]},
+        )
+        self.assertRefused(self.run_cmd("batch", jobs))
+        self.assertNoDir("one")
+        self.assertNoDir("two")
+
+    def test_an_id_given_twice_is_refused(self):
+        jobs = self.write_jobs(
+            {"id": "x", "command": "rmdir", "args": ["a"]},
+            {"id": "x", "command": "rmdir", "args": ["b"]},
+        )
+        self.assertRefused(self.run_cmd("batch", jobs))
+
+    def test_a_line_that_is_not_json_is_refused_before_anything_runs(self):
+        self.write("a.txt", "a")
+        self.write(
+            "jobs.ndjson",
+            json.dumps({"command": "copy", "args": ["a.txt", "out"]}) + "\n{not json\n",
+        )
+        r = self.run_cmd("batch", "jobs.ndjson")
+        self.assertRefused(r)
+        self.assertOut(r, "line 2")
+        self.assertNoDir("out")
+
+    def test_a_job_with_a_trace_of_its_own_is_refused(self):
+        """There is one recording for the process, and batch's own --trace starts it."""
+        for trace in (["--trace", "t.json"], ["--trace=t.json"]):
+            with self.subTest(trace=trace):
+                jobs = self.write_jobs({"command": "rmdir", "args": ["a", *trace]})
+                r = self.run_cmd("batch", jobs)
+                self.assertRefused(r)
+                self.assertOut(r, "--trace")
+                self.assertNoFile("t.json")
+
+    def test_a_job_count_below_one_is_refused(self):
+        jobs = self.write_jobs({"command": "rmdir", "args": ["a"]})
+        self.assertRefused(self.run_cmd("batch", jobs, "-j", "0"))
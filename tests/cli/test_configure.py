@@ -4,6 +4,10 @@
 without touching the disk.
 """
 
+import hashlib
+import json
+import re
+
 from testing.harness import QmTestCase
 
 
@@ -163,6 +167,26 @@ class TestWritingTheFile(QmTestCase):
         self.assertOk(r)
         self.assertFileContains("out.h", "// SHA256: ")
 
+    def test_the_hash_is_the_sha256_of_the_definitions(self):
+        """Over definitions long enough to end at every place in a block and to run to many
+        blocks, which is where a hash computed a block at a time goes wrong first."""
+        for count in (1, 2, 3, 7, 8, 9, 60, 200):
+            with self.subTest(count=count):
+                defines = [f"NAME_{i}={'x' * (i % 70)}" for i in range(count)]
+                args = []
+                for define in defines:
+                    args += ["-D", define]
+                r = self.run_cmd("configure", "out.h", *args, "-d")
+                self.assertOk(r)
+
+                text = "".join(
+                    "#define " + d.replace("=", " ", 1).rstrip() + "\n" for d in defines
+                )
+                expected = hashlib.sha256(text.encode()).hexdigest()
+                self.assertEqual(
+                    re.search(r"// SHA256: ([0-9a-f]{64})", r.out).group(1), expected
+                )
+
     def test_force_leaves_the_hash_out(self):
         """Which is the point of it: the hash is only there to skip a rewrite."""
         r = self.run_cmd("configure", "out.h", "-D", "FOO=1", "-f")
@@ -184,6 +208,32 @@ class TestWritingTheFile(QmTestCase):
         self.assertFileContains("out.h", "#define FOO 2")
         self.assertFileLacks("out.h", "#define FOO 1")
 
+    def test_the_hash_is_found_below_a_warning_longer_than_the_first_read(self):
+        self.write("warning.txt", "\n".join(f"line {i} of a long notice" for i in range(400)))
+        self.assertOk(self.run_cmd("configure", "out.h", "-D", "FOO=1", "-w", "warning.txt"))
+        before = self.path("out.h").stat().st_mtime_ns
+        r = self.run_cmd("configure", "out.h", "-D", "FOO=1", "-w", "warning.txt", "-V")
+        self.assertOk(r)
+        self.assertOut(r, "Content matched")
+        self.assertEqual(before, self.path("out.h").stat().st_mtime_ns)
+
+    def test_a_header_with_crlf_line_endings_still_matches(self):
+        self.assertOk(self.run_cmd("configure", "out.h", "-D", "FOO=1"))
+        content = self.path("out.h").read_bytes().replace(b"\r\n", b"\n")
+        self.path("out.h").write_bytes(content.replace(b"\n", b"\r\n"))
+        r = self.run_cmd("configure", "out.h", "-D", "FOO=1", "-V")
+        self.assertOk(r)
+        self.assertOut(r, "Content matched")
+
+    def test_a_hash_below_the_definitions_is_not_taken_for_one(self):
+        self.assertOk(self.run_cmd("configure", "out.h", "-D", "FOO=1"))
+        text = self.read("out.h")
+        hash_line = next(line for line in text.splitlines() if line.startswith("// SHA256: "))
+        self.write("out.h", "#ifndef OUT_H\n#define OUT_H\n#define FOO 1\n" + hash_line + "\n")
+        r = self.run_cmd("configure", "out.h", "-D", "FOO=1", "-V")
+        self.assertOk(r)
+        self.assertNotOut(r, "Content matched")
+
     def test_force_rewrites_even_when_nothing_changed(self):
         self.assertOk(self.run_cmd("configure", "out.h", "-D", "FOO=1"))
         r = self.run_cmd("configure", "out.h", "-D", "FOO=1", "-f", "-V")
@@ -200,3 +250,89 @@ class TestWritingTheFile(QmTestCase):
             dry.out.replace("\r\n", "\n"),
             self.read("out.h").replace("\r\n", "\n"),
         )
+
+
+class TestManifest(QmTestCase):
+    """--manifest generates every header a JSON file describes in one run,
+    each the way the options for it on a command line would have."""
+
+    def manifest(self, *headers: dict, name: str = "manifest.json") -> str:
+        self.write(name, json.dumps({"headers": list(headers)}))
+        return name
+
+    def test_every_header_is_written(self):
+        m = self.manifest({"output": "a.h", "definitions": ["FOO=1"]},
+                          {"output": "sub/b.h", "definitions": ["BAR"]})
+        self.assertOk(self.run_cmd("configure", "--manifest", m))
+        self.assertFileContains("a.h", "#define FOO 1")
+        self.assertFileContains("sub/b.h", "#define BAR")
+
+    def test_each_header_is_what_the_command_line_would_have_written(self):
+        m = self.manifest({"output": "a.h", "definitions": ["FOO=1", "%// raw"],
+                           "project": "proj", "warning": True})
+        self.assertOk(self.run_cmd("configure", "--manifest", m))
+        self.assertOk(self.run_cmd("configure", "b.h", "-D", "FOO=1", "-D", "%// raw",
+                                   "-p", "proj", "-w"))
+        self.assertEqual(self.path("a.h").read_text().replace("PROJ_A_H", "PROJ_B_H"),
+                         self.path("b.h").read_text())
+
+    def test_paths_are_relative_to_the_manifest(self):
+        self.write("warn.txt", "from the file")
+        m = self.manifest({"output": "out/a.h", "warning": "../warn.txt"},
+                          name="conf/manifest.json")
+        self.assertOk(self.run_cmd("configure", "--manifest", m))
+        self.assertFileContains("conf/out/a.h", "// from the file")
+
+    def test_an_unchanged_header_is_left_alone(self):
+        m = self.manifest({"output": "a.h", "definitions": ["FOO=1"]},
+                          {"output": "b.h", "definitions": ["BAR"]})
+        self.assertOk(self.run_cmd("configure", "--manifest", m))
+        before = self.path("a.h").stat().st_mtime_ns
+        self.manifest({"output": "a.h", "definitions": ["FOO=1"]},
+                      {"output": "b.h", "definitions": ["BAR=2"]})
+        r = self.run_cmd("configure", "--manifest", m, "-V")
+        self.assertOk(r)
+        self.assertOut(r, "Content matched")
+        self.assertEqual(before, self.path("a.h").stat().st_mtime_ns)
+        self.assertFileContains("b.h", "#define BAR 2")
+
+    def test_hash_false_is_force(self):
+        m = self.manifest({"output": "a.h", "definitions": ["FOO"], "hash": False})
+        self.assertOk(self.run_cmd("configure", "--manifest", m))
+        self.assertFileLacks("a.h", "SHA256")
+
+    def test_dryrun_prints_each_in_order_and_writes_nothing(self):
+        m = self.manifest({"output": "a.h", "definitions": ["FIRST"]},
+                          {"output": "b.h", "definitions": ["SECOND"]})
+        r = self.run_cmd("configure", "--manifest", m, "-d")
+        self.assertOk(r)
+        self.assertOutOrder(r, "#define FIRST", "#define SECOND")
+        self.assertNoFile("a.h")
+
+    def test_many_headers_at_once(self):
+        m = self.manifest(*({"output": f"h{i}.h", "definitions": [f"N={i}"]} for i in range(100)))
+        self.assertOk(self.run_cmd("configure", "--manifest", m))
+        for i in range(100):
+            self.assertFileContains(f"h{i}.h", f"#define N {i}")
+
+    def test_a_header_named_twice_is_refused(self):
+        m = self.manifest({"output": "a.h"}, {"output": "./a.h"})
+        self.assertFails(self.run_cmd("configure", "--manifest", m))
+
+    def test_a_manifest_that_is_not_json_is_refused(self):
+        self.write("manifest.json", '{"headers": [')
+        r = self.run_cmd("configure", "--manifest", "manifest.json")
+        self.assertFails(r)
+        self.assertOut(r, "invalid manifest")
+
+    def test_an_entry_without_an_output_is_refused(self):
+        m = self.manifest({"definitions": ["FOO"]})
+        self.assertFails(self.run_cmd("configure", "--manifest", m))
+
+    def test_an_output_file_as_well_is_refused(self):
+        m = self.manifest({"output": "a.h"})
+        self.assertFails(self.run_cmd("configure", "b.h", "--manifest", m))
+
+    def test_options_for_one_header_are_refused(self):
+        m = self.manifest({"output": "a.h"})
+        self.assertFails(self.run_cmd("configure", "--manifest", m, "-D", "FOO"))
@@ -1,5 +1,7 @@
 """`copy` copies files and directories, skipping what has not changed."""
 
+import json
+
 from testing.harness import QmTestCase
 
 
@@ -94,6 +96,133 @@ class TestOverwriting(QmTestCase):
         self.assertFileContains("dest/a.txt", "new content")
 
 
+class TestMirroring(QmTestCase):
+    """`--mirror` takes out of the destination what the sources no longer have."""
+
+    def setUp(self):
+        super().setUp()
+        self.write("src/keep.txt", "keep")
+        self.write("src/sub/two.txt", "2")
+
+    def test_a_file_the_source_no_longer_has_is_removed(self):
+        self.assertOk(self.run_cmd("copy", "src/", "dest"))
+        self.path("src/keep.txt").unlink()
+        self.assertOk(self.run_cmd("copy", "src/", "dest", "--mirror"))
+        self.assertNoFile("dest/keep.txt")
+        self.assertFile("dest/sub/two.txt")
+
+    def test_without_it_the_stale_file_stays(self):
+        self.write("dest/stale.txt", "stale")
+        self.assertOk(self.run_cmd("copy", "src/", "dest"))
+        self.assertFile("dest/stale.txt")
+
+    def test_a_directory_left_empty_is_pruned(self):
+        self.write("dest/gone/deeper/stale.txt", "stale")
+        self.assertOk(self.run_cmd("copy", "src/", "dest", "-m"))
+        self.assertNoDir("dest/gone")
+        self.assertFile("dest/keep.txt")
+
+    def test_an_empty_directory_the_source_has_is_kept(self):
+        self.mkdir("src/empty")
+        self.assertOk(self.run_cmd("copy", "src/", "dest", "-m"))
+        self.assertDir("dest/empty")
+
+    def test_a_directory_copied_as_itself_mirrors_only_itself(self):
+        self.write("dest/unrelated.txt", "not from src")
+        self.write("dest/src/stale.txt", "stale")
+        self.assertOk(self.run_cmd("copy", "src", "dest", "-m"))
+        self.assertFile("dest/unrelated.txt")
+        self.assertNoFile("dest/src/stale.txt")
+        self.assertFile("dest/src/keep.txt")
+
+    def test_what_several_sources_bring_is_all_kept(self):
+        self.write("other/three.txt", "3")
+        self.write("dest/stale.txt", "stale")
+        self.assertOk(self.run_cmd("copy", "src/", "other/", "dest", "-m"))
+        self.assertFile("dest/keep.txt")
+        self.assertFile("dest/three.txt")
+        self.assertNoFile("dest/stale.txt")
+
+    def test_an_excluded_path_is_left_alone_in_the_destination(self):
+        self.write("dest/local.log", "written by something else")
+        self.write("dest/stale.txt", "stale")
+        self.assertOk(self.run_cmd("copy", "src/", "dest", "-m", "-e", r"\.log$"))
+        self.assertFile("dest/local.log")
+        self.assertNoFile("dest/stale.txt")
+
+    def test_an_excluded_empty_directory_is_kept_with_what_holds_it(self):
+        self.mkdir("dest/gone/cache")
+        self.write("dest/gone/stale.txt", "stale")
+        self.assertOk(self.run_cmd("copy", "src/", "dest", "-m", "-e", "cache$"))
+        self.assertDir("dest/gone/cache")
+        self.assertNoFile("dest/gone/stale.txt")
+
+    def test_a_link_in_the_destination_is_not_walked_into(self):
+        outside = self.write("outside/precious.txt", "precious")
+        self.mkdir("dest")
+        try:
+            (self.path("dest") / "link").symlink_to(
+                outside.parent, target_is_directory=True
+            )
+        except (OSError, NotImplementedError):
+            self.skipTest("this machine will not make a symlink")
+
+        self.assertOk(self.run_cmd("copy", "src/", "dest", "-m"))
+        self.assertFile("outside/precious.txt")
+        self.assertFalse(self.path("dest/link").exists())
+
+    def test_verbose_says_what_it_removed(self):
+        self.write("dest/stale.txt", "stale")
+        r = self.run_cmd("copy", "src/", "dest", "-m", "-V")
+        self.assertOk(r)
+        self.assertOut(r, "Remove:")
+        self.assertOut(r, "stale.txt")
+
+
+class TestJournal(QmTestCase):
+    """`--journal` remembers what was copied, so an unchanged file is passed over
+    without the destination being looked at."""
+
+    def setUp(self):
+        super().setUp()
+        self.write("src/a.txt", "a")
+        self.write("src/sub/b.txt", "b")
+
+    def copy(self):
+        return self.run_cmd("copy", "src/", "dest", "--journal", "journal.txt", "-V")
+
+    def test_the_journal_is_written(self):
+        self.assertOk(self.copy())
+        self.assertFile("journal.txt")
+        self.assertFile("dest/sub/b.txt")
+
+    def test_a_second_run_copies_nothing(self):
+        self.assertOk(self.copy())
+        r = self.copy()
+        self.assertOk(r)
+        self.assertNotOut(r, "Copy:")
+
+    def test_a_source_changed_since_is_copied_again(self):
+        self.assertOk(self.copy())
+        self.write("src/sub/b.txt", "b, but longer")
+        r = self.copy()
+        self.assertOk(r)
+        self.assertOut(r, "b.txt")
+        self.assertNotOut(r, "a.txt")
+        self.assertFileContains("dest/sub/b.txt", "b, but longer")
+
+    def test_a_destination_file_that_went_missing_comes_back(self):
+        self.assertOk(self.copy())
+        self.path("dest/sub/b.txt").unlink()
+        self.assertOk(self.copy())
+        self.assertFile("dest/sub/b.txt")
+
+    def test_a_journal_it_cannot_read_is_an_empty_one(self):
+        self.write("journal.txt", "not a journal at all")
+        self.assertOk(self.copy())
+        self.assertFile("dest/a.txt")
+
+
 class TestVerbosity(QmTestCase):
     def test_verbose_says_what_it_copied(self):
         self.write("src/a.txt", "a")
@@ -115,6 +244,53 @@ class TestVerbosity(QmTestCase):
         self.assertOut(r, "Copy: from")
 
 
+class TestJsonFormat(QmTestCase):
+    """`--format json` prints one record for each file, and nothing else."""
+
+    def setUp(self):
+        super().setUp()
+        self.write("src/a.txt", "a")
+        self.write("src/sub/b.txt", "b")
+
+    def records(self, *args):
+        r = self.run_cmd("copy", "src/", "dest", "--format", "json", *args)
+        self.assertOk(r)
+        return [json.loads(line) for line in r.out.splitlines()]
+
+    def test_each_file_copied_is_a_record(self):
+        records = self.records()
+        self.assertEqual(
+            sorted((rec["type"], rec["action"], rec["to"][-5:]) for rec in records),
+            [("copy", "copied", "a.txt"), ("copy", "copied", "b.txt")],
+        )
+
+    def test_a_file_passed_over_says_why(self):
+        self.records()
+        self.assertEqual(
+            {(rec["action"], rec["reason"]) for rec in self.records()},
+            {("skipped", "up to date")},
+        )
+
+    def test_a_file_the_journal_answered_for_says_so(self):
+        self.records("--journal", "journal.txt")
+        self.assertEqual(
+            {rec["reason"] for rec in self.records("--journal", "journal.txt")}, {"journal"}
+        )
+
+    def test_what_a_mirror_removes_is_a_record(self):
+        self.write("dest/stale.txt", "stale")
+        removed = [rec for rec in self.records("-m") if rec["type"] == "remove"]
+        self.assertEqual(len(removed), 1)
+        self.assertTrue(removed[0]["path"].endswith("stale.txt"))
+
+    def test_verbose_adds_no_text_to_it(self):
+        self.assertEqual(len(self.records("-V")), 2)
+
+    def test_an_unknown_format_is_refused(self):
+        self.assertRefused(self.run_cmd("copy", "src/", "dest", "--format", "xml"))
+        self.assertNoDir("dest")
+
+
 class TestOptionPlacement(QmTestCase):
     """An option is an option wherever it appears among the arguments."""
 
@@ -29,6 +29,7 @@ have been resolved ask first, once, and skip themselves where the answer is no.
 from __future__ import annotations
 
 import functools
+import json
 import re
 import subprocess
 import tempfile
@@ -274,6 +275,20 @@ class TestDeployCommandLine(DeployTestCase):
             self.run_cmd("deploy", self.layout.path("app_exe"), "-c", "notabinary.txt", "out", "-d")
         )
 
+    def test_a_job_count_below_one_is_refused(self):
+        self.assertRefused(self.run_cmd("deploy", self.layout.path("app_exe"), "-j", "0", "-d"))
+
+    def test_an_unknown_format_is_refused(self):
+        self.assertRefused(
+            self.run_cmd("deploy", self.layout.path("app_exe"), "--format", "xml", "-d")
+        )
+
+    def test_a_graph_file_of_an_unknown_kind_is_refused(self):
+        self.assertRefused(
+            self.run_cmd("deploy", self.layout.path("app_exe"), "--graph", "graph.png", "-d")
+        )
+        self.assertNoFile("graph.png")
+
     def test_a_search_path_may_be_joined_to_its_option(self):
         """-L takes a single-character short match, as a linker's -L does."""
         joined = self.run_cmd(
@@ -324,6 +339,18 @@ class TestResolutionDetails(DeployTestCase):
         # app, core, util, audio, render
         self.assertEqual(len(resolved), 5, msg=str(r))
 
+    def test_one_job_at_a_time_reports_the_same(self):
+        """Each level of the graph is resolved in parallel, but reported in the
+        order it was given, so the report does not depend on the job count."""
+        one = self.run_cmd(
+            "deploy", self.layout.path("app_exe"), *self.search_paths(), "-d", "-j", "1"
+        )
+        many = self.run_cmd(
+            "deploy", self.layout.path("app_exe"), *self.search_paths(), "-d", "-j", "8"
+        )
+        self.assertOk(one)
+        self.assertEqual(one.out, many.out)
+
     def test_a_library_beside_the_binary_needs_no_search_path(self):
         """The directory a named binary sits in is searched without being asked,
         which is why the program's own libraries need no -L."""
@@ -352,6 +379,81 @@ class TestResolutionDetails(DeployTestCase):
             written[:4], self.path(self.layout.path("sdk_lib")).read_bytes()[:4]
         )
 
+    def deploy_records(self, *args):
+        r = self.run_cmd(
+            "deploy", self.layout.path("app_exe"), *self.search_paths(), "-s",
+            "--format", "json", *args,
+        )
+        self.assertOk(r)
+        return [json.loads(line) for line in r.out.splitlines()]
+
+    def test_json_describes_the_graph(self):
+        records = self.deploy_records("-d")
+        nodes = {Path(rec["path"]).name: rec["level"] for rec in records if rec["type"] == "node"}
+        self.assertEqual(nodes[self.layout.name("app_exe")], 0)
+        self.assertEqual(nodes[self.layout.name("app_lib")], 1)
+        self.assertEqual(nodes[self.layout.name("sdk_leaf")], 3)
+        edges = {
+            (Path(rec["from"]).name, Path(rec["to"]).name)
+            for rec in records if rec["type"] == "edge"
+        }
+        self.assertIn((self.layout.name("app_lib"), self.layout.name("sdk_lib")), edges)
+        self.assertFalse(any(rec["type"] == "copy" for rec in records))
+
+    def test_json_says_what_was_excluded(self):
+        records = self.deploy_records("-d", "-e", re.escape(self.layout.name("sdk_lib")))
+        self.assertIn(
+            ("filter", self.layout.name("sdk_lib"), "excluded"),
+            [(rec["type"], Path(rec.get("path", "")).name, rec.get("reason")) for rec in records],
+        )
+        nodes = [Path(rec["path"]).name for rec in records if rec["type"] == "node"]
+        self.assertNotIn(self.layout.name("sdk_leaf"), nodes)
+
+    def test_json_says_what_was_copied_and_what_was_passed_over(self):
+        first = self.deploy_records("-o", "out")
+        copied = {Path(rec["to"]).name for rec in first if rec["type"] == "copy"}
+        self.assertIn(self.layout.name("sdk_lib"), copied)
+        again = self.deploy_records("-o", "out")
+        self.assertEqual(
+            {rec["action"] for rec in again if rec["type"] == "copy"}, {"skipped"}
+        )
+
+    def deploy_graph(self, name, *args):
+        r = self.run_cmd(
+            "deploy", self.layout.path("app_exe"), *self.search_paths(), "-s",
+            "--graph", name, *args,
+        )
+        self.assertOk(r)
+        return self.read(name)
+
+    def test_a_json_graph_has_every_node_and_edge(self):
+        graph = json.loads(self.deploy_graph("graph.json", "-d"))
+        nodes = {Path(node["path"]).name: node for node in graph["nodes"]}
+        self.assertEqual(nodes[self.layout.name("app_exe")]["status"], "named")
+        self.assertEqual(nodes[self.layout.name("app_exe")]["level"], 0)
+        self.assertEqual(nodes[self.layout.name("sdk_leaf")]["status"], "deployed")
+        self.assertGreater(nodes[self.layout.name("sdk_lib")]["bytes"], 0)
+        self.assertGreaterEqual(nodes[self.layout.name("sdk_lib")]["resolve_us"], 0)
+        edges = {(Path(e["from"]).name, Path(e["to"]).name) for e in graph["edges"]}
+        self.assertIn((self.layout.name("app_lib"), self.layout.name("sdk_lib")), edges)
+
+    def test_a_json_graph_keeps_what_was_passed_over(self):
+        """An excluded library is in the graph, though nothing behind it is,
+        since it was never read."""
+        graph = json.loads(
+            self.deploy_graph("graph.json", "-d", "-e", re.escape(self.layout.name("sdk_lib")))
+        )
+        nodes = {Path(node["path"]).name: node for node in graph["nodes"]}
+        self.assertEqual(nodes[self.layout.name("sdk_lib")]["status"], "excluded")
+        self.assertEqual(nodes[self.layout.name("sdk_lib")]["resolve_us"], -1)
+        self.assertNotIn(self.layout.name("sdk_leaf"), nodes)
+
+    def test_a_dot_graph_is_written_alongside_a_deployment(self):
+        dot = self.deploy_graph("graph.dot", "-o", "out")
+        self.assertTrue(dot.startswith("digraph"), msg=dot)
+        self.assertIn(self.layout.name("sdk_leaf"), dot)
+        self.assertFile(f"out/{self.layout.name('sdk_lib')}")
+
     def test_verbose_names_what_it_copied(self):
         r = self.run_cmd(
             "deploy", self.layout.path("app_exe"), *self.search_paths(), "-o", "out", "-s", "-V"
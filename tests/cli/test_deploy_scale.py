@@ -0,0 +1,141 @@
+"""Deploying graphs of thousands of libraries, each within a time budget.
+
+``test_deploy`` says what a deployment leaves behind for a program and the
+framework it uses, a dozen binaries in all. An installation is rarely that
+small, and what goes wrong at its real size is not what goes wrong at a dozen:
+a library read once for every path to it rather than once, a copy made again
+for every plugin that needs it, a set searched from end to end for every name.
+Those are right at a dozen and take minutes at a few thousand.
+
+So the graphs here are generated, at the sizes in ``deploy_scenarios.json``
+under ``generated``, by ``testing/library_graph.py``, with the system linker,
+when the test runs. Each one's deployment has to leave exactly the layout the
+declaration records, and has to be done within its ``budgetSeconds``. Building
+the graph is not timed, only the deployment.
+
+The libraries are ELF, and deploy needs patchelf to read them, so the module
+runs on Linux only and skips itself without the linker or patchelf. CTest gives
+it the label ``scale`` as well, so ``ctest -LE scale`` leaves it out of a quick
+run, and the default CI run is one of those.
+
+A budget is a time on one machine. ``QMTEST_BUDGET_FACTOR`` in the environment
+multiplies every one of them, for a machine known to be slower than that, such
+as a shared CI runner. It is 1 when not set.
+"""
+
+from __future__ import annotations
+
+import os
+import re
+import subprocess
+import time
+
+from test_deploy_rpath import rpath_problem
+from testing import fixtures_layout, library_graph
+from testing.harness import QmTestCase
+
+GROUP = re.compile(r"^\{all\.([a-zA-Z0-9_]+)\}$")
+
+#: How many names a failure lists before it only counts the rest.
+SHOWN = 10
+
+
+class TestGeneratedScenarios(QmTestCase):
+    """Generated from deploy_scenarios.json. Change the expectations there."""
+
+    def setUp(self):
+        super().setUp()
+        problem = library_graph.toolchain_problem() or rpath_problem()
+        if problem:
+            self.skipTest(problem)
+
+    def expand(self, args: list[str], groups: dict[str, list[str]]) -> list[str]:
+        """Turns each `{all.plugins}` into every path in the group, one apiece."""
+        expanded = []
+        for arg in args:
+            match = GROUP.match(arg)
+            if match:
+                expanded += groups[match.group(1)]
+            else:
+                expanded.append(arg)
+        return expanded
+
+    def assertNames(self, result, what: str, wanted: set[str], found: set[str]):
+        if found == wanted:
+            return
+
+        def describe(names):
+            names = sorted(names)
+            shown = ", ".join(names[:SHOWN])
+            more = len(names) - SHOWN
+            return f"{shown} and {more} more" if more > 0 else shown or "none"
+
+        self.fail(
+            f"{what} does not hold what it should, {len(found)} of {len(wanted)}\n"
+            f"  missing:   {describe(wanted - found)}\n"
+            f"  unwanted:  {describe(found - wanted)}{result}"
+        )
+
+    def run_generated(self, scenario: dict):
+        groups = library_graph.generate(
+            self.sandbox, scenario["generator"], scenario["parameters"]
+        )
+        args = self.expand(scenario["args"], groups)
+        budget = scenario["budgetSeconds"] * float(os.environ.get("QMTEST_BUDGET_FACTOR", "1"))
+
+        # Twice the budget before giving up on it, so that a deployment that is
+        # only slow says how slow rather than being cut off.
+        begin = time.monotonic()
+        try:
+            result = self.run_cmd(*args, timeout=budget * 2)
+        except subprocess.TimeoutExpired:
+            self.fail(
+                f"the deployment was still running at {budget * 2:g}s, and the budget is "
+                f"{budget:g}s\n  $ qmcorecmd {' '.join(args[:4])} ... ({len(args)} arguments)"
+            )
+        elapsed = time.monotonic() - begin
+        self.assertOk(result)
+
+        for directory, patterns in scenario.get("expect", {}).items():
+            wanted = {n for p in patterns for n in library_graph.expand_names(p)}
+            self.assertNames(result, directory, wanted, self.files_in(directory))
+
+        for directory, patterns in scenario.get("links", {}).items():
+            for pattern in patterns:
+                for name in library_graph.expand_names(pattern):
+                    link = self.path(directory) / name
+                    if not link.is_symlink():
+                        self.fail(f"{directory}/{name} should be a symlink{result}")
+                    if link.resolve().parent != self.path(directory).resolve():
+                        self.fail(
+                            f"{directory}/{name} should point at a file beside it, "
+                            f"not at {link.resolve()}{result}"
+                        )
+
+        if elapsed > budget:
+            self.fail(
+                f"the deployment took {elapsed:.1f}s, and the budget is {budget:g}s\n"
+                f"  $ qmcorecmd {' '.join(args[:4])} ... ({len(args)} arguments)"
+            )
+
+    def files_in(self, directory: str) -> set[str]:
+        target = self.path(directory)
+        if not target.is_dir():
+            return set()
+        return {p.name for p in target.iterdir() if p.is_file()}
+
+
+def _install_scenarios():
+    declaration = fixtures_layout.load_declaration()
+    for scenario in declaration.get("generated", []):
+        slug = re.sub(r"[^a-z0-9]+", "_", scenario["name"].lower()).strip("_")
+
+        def method(self, scenario=scenario):
+            self.run_generated(scenario)
+
+        method.__name__ = f"test_{slug}"
+        method.__doc__ = scenario.get("why")
+        setattr(TestGeneratedScenarios, method.__name__, method)
+
+
+_install_scenarios()
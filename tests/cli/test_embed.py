@@ -0,0 +1,124 @@
+"""`embed` writes a file out as a source file that links it in.
+
+The C array is read back here and compared with the input byte for byte. The
+other two formats name the input rather than hold it, so what is checked is
+that they name it.
+"""
+
+import os
+import re
+
+from testing.harness import QmTestCase
+
+
+def array_bytes(text: str) -> bytes:
+    body = text[text.index("{") + 1 : text.index("}")]
+    return bytes(int(b, 16) for b in re.findall(r"0x([0-9a-f]{2})", body))
+
+
+class TestCArray(QmTestCase):
+    def test_the_array_holds_the_input(self):
+        data = bytes(range(256)) * 3 + b"tail"
+        self.path("in.bin").write_bytes(data)
+        self.assertOk(self.run_cmd("embed", "in.bin", "out.c"))
+        self.assertEqual(array_bytes(self.read("out.c")), data)
+
+    def test_the_length_follows_the_array(self):
+        self.write("in.bin", "12345")
+        self.assertOk(self.run_cmd("embed", "in.bin", "out.c"))
+        self.assertFileContains("out.c", "unsigned int out_c_len = 5;")
+
+    def test_an_input_larger_than_a_read_is_whole(self):
+        data = os.urandom(300 * 1024 + 7)
+        self.path("in.bin").write_bytes(data)
+        self.assertOk(self.run_cmd("embed", "in.bin", "out.c"))
+        self.assertEqual(array_bytes(self.read("out.c")), data)
+
+    def test_the_name_defaults_to_the_output_file_made_an_identifier(self):
+        self.write("in.bin", "x")
+        self.assertOk(self.run_cmd("embed", "in.bin", "embedded-data.c"))
+        self.assertFileContains("embedded-data.c", "unsigned char embedded_data_c[]")
+        self.assertFileContains("embedded-data.c", "embedded_data_c_len")
+
+    def test_a_name_can_be_given(self):
+        self.write("in.bin", "x")
+        self.assertOk(self.run_cmd("embed", "in.bin", "out.c", "-n", "logo"))
+        self.assertFileContains("out.c", "unsigned char logo[]")
+        self.assertFileContains("out.c", "unsigned int logo_len = 1;")
+
+    def test_a_name_that_is_not_an_identifier_is_refused(self):
+        self.write("in.bin", "x")
+        self.assertRefused(self.run_cmd("embed", "in.bin", "out.c", "-n", "not-a-name"))
+        self.assertNoFile("out.c")
+
+    def test_an_empty_input_still_makes_valid_c(self):
+        self.write("in.bin", "")
+        self.assertOk(self.run_cmd("embed", "in.bin", "out.c"))
+        self.assertFileContains("out.c", "unsigned int out_c_len = 0;")
+        self.assertNotIn("{}", self.read("out.c").replace("\n", "").replace(" ", ""))
+
+    def test_the_output_directory_is_made(self):
+        self.write("in.bin", "x")
+        self.assertOk(self.run_cmd("embed", "in.bin", "gen/deeper/out.c"))
+        self.assertFile("gen/deeper/out.c")
+
+    def test_an_input_that_is_not_there_is_refused(self):
+        self.assertRefused(self.run_cmd("embed", "missing.bin", "out.c"))
+
+
+class TestUnchangedOutput(QmTestCase):
+    def test_the_same_input_leaves_the_output_alone(self):
+        self.write("in.bin", "same")
+        self.assertOk(self.run_cmd("embed", "in.bin", "out.c"))
+        before = self.path("out.c").stat().st_mtime_ns
+        r = self.run_cmd("embed", "in.bin", "out.c", "-V")
+        self.assertOk(r)
+        self.assertOut(r, "Content matched")
+        self.assertEqual(before, self.path("out.c").stat().st_mtime_ns)
+
+    def test_a_changed_input_rewrites_the_output(self):
+        self.write("in.bin", "before")
+        self.assertOk(self.run_cmd("embed", "in.bin", "out.c"))
+        self.write("in.bin", "after!")
+        r = self.run_cmd("embed", "in.bin", "out.c", "-V")
+        self.assertOk(r)
+        self.assertOut(r, "Write:")
+        self.assertEqual(array_bytes(self.read("out.c")), b"after!")
+
+    def test_a_change_late_in_a_large_input_keeps_what_came_before(self):
+        """The first part matched the old output and was not held, so it is copied back."""
+        data = bytearray(os.urandom(500 * 1024))
+        self.path("in.bin").write_bytes(bytes(data))
+        self.assertOk(self.run_cmd("embed", "in.bin", "out.c"))
+        data[-3] ^= 0xFF
+        self.path("in.bin").write_bytes(bytes(data))
+        self.assertOk(self.run_cmd("embed", "in.bin", "out.c"))
+        self.assertEqual(array_bytes(self.read("out.c")), bytes(data))
+
+    def test_a_shorter_input_leaves_nothing_of_the_longer_one(self):
+        self.write("in.bin", "a much longer input than the next")
+        self.assertOk(self.run_cmd("embed", "in.bin", "out.c"))
+        self.write("in.bin", "a much")
+        self.assertOk(self.run_cmd("embed", "in.bin", "out.c"))
+        self.assertEqual(array_bytes(self.read("out.c")), b"a much")
+        self.assertNoFile("out.c.tmp")
+
+
+class TestOtherFormats(QmTestCase):
+    def test_incbin_names_the_input_for_the_assembler(self):
+        self.write("in.bin", "x")
+        self.assertOk(self.run_cmd("embed", "in.bin", "out.S", "--format", "incbin"))
+        self.assertFileContains("out.S", ".incbin ")
+        self.assertFileContains("out.S", self.path("in.bin").as_posix())
+        self.assertFileContains("out.S", "QM_EMBED_SYMBOL(out_S_len)")
+
+    def test_embed_names_the_input_for_the_compiler(self):
+        self.write("in.bin", "xyz")
+        self.assertOk(self.run_cmd("embed", "in.bin", "out.c", "--format", "embed"))
+        self.assertFileContains("out.c", "#embed ")
+        self.assertFileContains("out.c", self.path("in.bin").as_posix())
+        self.assertFileContains("out.c", "unsigned int out_c_len = 3;")
+
+    def test_an_unknown_format_is_refused(self):
+        self.write("in.bin", "x")
+        self.assertRefused(self.run_cmd("embed", "in.bin", "out.c", "--format", "hex"))
@@ -0,0 +1,209 @@
+"""`hash` gives each directory one SHA-256 built from everything in it.
+
+The tree is hashed the way git lays out a tree, so the expected value is
+worked out here independently and compared with what the tool prints.
+"""
+
+import hashlib
+import os
+import sys
+
+from testing.harness import QmTestCase
+
+
+def tree_hash(root) -> str:
+    """The hash `hash` should print for `root`, computed from scratch."""
+
+    def node(path):
+        entries = []
+        for entry in sorted(os.scandir(path), key=lambda e: e.name.encode()):
+            if entry.is_symlink():
+                mode = b"120000"
+                digest = hashlib.sha256(os.readlink(entry.path).encode()).digest()
+            elif entry.is_dir():
+                mode = b"40000"
+                digest = node(entry.path)
+            else:
+                executable = sys.platform != "win32" and os.access(entry.path, os.X_OK)
+                mode = b"100755" if executable else b"100644"
+                with open(entry.path, "rb") as f:
+                    digest = hashlib.sha256(f.read()).digest()
+            entries.append(mode + b" " + entry.name.encode() + b"\0" + digest)
+        return hashlib.sha256(b"".join(entries)).digest()
+
+    return node(root).hex()
+
+
+class TestTreeHash(QmTestCase):
+    def root_hash(self, *args):
+        r = self.run_cmd("hash", *args)
+        self.assertOk(r)
+        return r.out.split()[0]
+
+    def test_the_hash_is_of_the_tree_as_git_lays_it_out(self):
+        self.write("d/a.txt", "a")
+        self.write("d/sub/b.txt", "b" * 100000)
+        self.mkdir("d/empty")
+        self.assertEqual(self.root_hash("d"), tree_hash(self.path("d")))
+
+    def test_many_small_files_hash_as_they_would_one_at_a_time(self):
+        """More than eight, so that some are hashed several to a call."""
+        for i in range(37):
+            self.write(f"d/f{i:02}.txt", "x" * (i * 13))
+        self.assertEqual(self.root_hash("d"), tree_hash(self.path("d")))
+
+    def test_the_same_tree_in_two_places_hashes_the_same(self):
+        for top in ("one", "two/deeper"):
+            self.write(f"{top}/a.txt", "a")
+            self.write(f"{top}/sub/b.txt", "b")
+        self.assertEqual(self.root_hash("one"), self.root_hash("two/deeper"))
+
+    def test_an_edit_changes_the_hash(self):
+        self.write("d/a.txt", "a")
+        before = self.root_hash("d")
+        self.write("d/a.txt", "b")
+        self.assertNotEqual(before, self.root_hash("d"))
+
+    def test_a_rename_changes_the_hash(self):
+        self.write("d/a.txt", "a")
+        before = self.root_hash("d")
+        self.path("d/a.txt").rename(self.path("d/b.txt"))
+        self.assertNotEqual(before, self.root_hash("d"))
+
+    def test_an_empty_directory_changes_the_hash(self):
+        self.write("d/a.txt", "a")
+        before = self.root_hash("d")
+        self.mkdir("d/empty")
+        self.assertNotEqual(before, self.root_hash("d"))
+
+    def test_making_a_file_executable_changes_the_hash(self):
+        if sys.platform == "win32":
+            self.skipTest("no file says whether it may be run on Windows")
+        self.write("d/run.sh", "#!/bin/sh\n")
+        before = self.root_hash("d")
+        self.path("d/run.sh").chmod(0o755)
+        self.assertNotEqual(before, self.root_hash("d"))
+
+    def test_a_link_is_hashed_by_what_it_points_at(self):
+        self.write("d/a.txt", "a")
+        try:
+            os.symlink("a.txt", self.path("d/link"))
+        except OSError:
+            self.skipTest("cannot make a link here")
+        self.assertEqual(self.root_hash("d"), tree_hash(self.path("d")))
+
+    def test_an_excluded_path_is_not_part_of_the_hash(self):
+        self.write("d/a.txt", "a")
+        before = self.root_hash("d")
+        self.write("d/build/out.o", "o")
+        self.assertEqual(before, self.root_hash("d", "-e", "build"))
+
+    def test_each_directory_gets_a_line_of_its_own(self):
+        self.write("one/a.txt", "a")
+        self.write("two/b.txt", "b")
+        r = self.run_cmd("hash", "one", "two")
+        self.assertOk(r)
+        lines = r.out.splitlines()
+        self.assertEqual(lines[0], tree_hash(self.path("one")) + "  one")
+        self.assertEqual(lines[1], tree_hash(self.path("two")) + "  two")
+
+    def test_one_thread_gives_the_same_hash(self):
+        for i in range(20):
+            self.write(f"d/f{i}.txt", str(i))
+        self.assertEqual(self.root_hash("d", "-j", "1"), self.root_hash("d"))
+
+    def test_a_job_count_below_one_is_refused(self):
+        self.mkdir("d")
+        self.assertRefused(self.run_cmd("hash", "d", "-j", "0"))
+
+    def test_what_is_not_a_directory_is_refused(self):
+        self.write("a.txt", "a")
+        self.assertRefused(self.run_cmd("hash", "a.txt"))
+
+
+class TestManifest(QmTestCase):
+    def setUp(self):
+        super().setUp()
+        self.write("d/a.txt", "a")
+        self.write("d/sub/b.txt", "b")
+
+    def test_a_second_run_reads_nothing_that_has_not_changed(self):
+        first = self.run_cmd("hash", "d", "--manifest", "m.txt", "-V")
+        self.assertOk(first)
+        self.assertOut(first, "a.txt")
+        self.assertFile("m.txt")
+
+        second = self.run_cmd("hash", "d", "--manifest", "m.txt", "-V")
+        self.assertOk(second)
+        self.assertNotOut(second, "Hash:")
+        self.assertEqual(first.out.splitlines()[-1], second.out.splitlines()[-1])
+
+    def test_only_what_changed_is_read_again(self):
+        self.assertOk(self.run_cmd("hash", "d", "--manifest", "m.txt"))
+        self.write("d/sub/b.txt", "changed")
+        r = self.run_cmd("hash", "d", "--manifest", "m.txt", "-V")
+        self.assertOk(r)
+        self.assertOut(r, "b.txt")
+        self.assertNotOut(r, "a.txt")
+        self.assertOut(r, tree_hash(self.path("d")))
+
+    def test_force_reads_everything_again(self):
+        self.assertOk(self.run_cmd("hash", "d", "--manifest", "m.txt"))
+        r = self.run_cmd("hash", "d", "--manifest", "m.txt", "-V", "-f")
+        self.assertOk(r)
+        self.assertOut(r, "a.txt")
+        self.assertOut(r, "b.txt")
+
+    def test_a_manifest_kept_in_the_tree_is_not_part_of_it(self):
+        before = tree_hash(self.path("d"))
+        for _ in range(2):
+            r = self.run_cmd("hash", "d", "--manifest", "d/m.txt")
+            self.assertOk(r)
+            self.assertOut(r, before)
+
+    def test_a_manifest_of_another_version_is_read_as_empty(self):
+        self.write("m.txt", "# something else\n")
+        r = self.run_cmd("hash", "d", "--manifest", "m.txt", "-V")
+        self.assertOk(r)
+        self.assertOut(r, "a.txt")
+        self.assertFileContains("m.txt", "# qmcorecmd hash manifest 1")
+
+    def test_verify_finds_nothing_when_nothing_changed(self):
+        self.assertOk(self.run_cmd("hash", "d", "--manifest", "m.txt"))
+        r = self.run_cmd("hash", "d", "--manifest", "m.txt", "--verify")
+        self.assertOk(r)
+        self.assertNotOut(r, "Changed")
+        self.assertNotOut(r, "Added")
+        self.assertNotOut(r, "Removed")
+
+    def test_verify_lists_what_changed_and_fails(self):
+        self.assertOk(self.run_cmd("hash", "d", "--manifest", "m.txt"))
+        self.write("d/a.txt", "edited")
+        self.write("d/new.txt", "new")
+        self.path("d/sub/b.txt").unlink()
+
+        r = self.run_cmd("hash", "d", "--manifest", "m.txt", "--verify")
+        self.assertEqual(r.code, 1, r)
+        self.assertOut(r, "Changed: ")
+        self.assertOut(r, "a.txt")
+        self.assertOut(r, "Added: ")
+        self.assertOut(r, "new.txt")
+        self.assertOut(r, "Removed: ")
+        self.assertOut(r, "b.txt")
+
+    def test_verify_leaves_the_manifest_alone(self):
+        self.assertOk(self.run_cmd("hash", "d", "--manifest", "m.txt"))
+        before = self.read("m.txt")
+        self.write("d/a.txt", "edited")
+        self.run_cmd("hash", "d", "--manifest", "m.txt", "--verify")
+        self.assertEqual(before, self.read("m.txt"))
+
+    def test_verify_without_a_manifest_is_refused(self):
+        self.assertRefused(self.run_cmd("hash", "d", "--verify"))
+
+    def test_trees_not_hashed_this_run_stay_in_the_manifest(self):
+        self.write("e/c.txt", "c")
+        self.assertOk(self.run_cmd("hash", "d", "--manifest", "m.txt"))
+        self.assertOk(self.run_cmd("hash", "e", "--manifest", "m.txt"))
+        r = self.run_cmd("hash", "d", "--manifest", "m.txt", "--verify")
+        self.assertOk(r)
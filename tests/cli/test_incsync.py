@@ -2,8 +2,11 @@
 either by copying them or by leaving a one-line stub that includes the real one.
 """
 
+import json
 import os
 import shutil
+import struct
+import subprocess
 import tempfile
 from pathlib import Path
 
@@ -222,3 +225,343 @@ class TestDryRunForceAndVerbosity(IncsyncTestCase):
         self.assertOk(self.run_cmd("incsync", "src", "include"))
         self.assertOk(self.run_cmd("incsync", "src", "include"))
         self.assertFile("include/foo.h")
+
+
+class TestJsonFormat(IncsyncTestCase):
+    """`--format json` prints one record for each header, and nothing else."""
+
+    def records(self, *args):
+        r = self.run_cmd("incsync", "src", "dest", "--format", "json", *args)
+        self.assertOk(r)
+        return [json.loads(line) for line in r.out.splitlines()]
+
+    def test_each_header_is_a_record_of_what_was_done(self):
+        first = self.records()
+        self.assertEqual(len(first), 4)
+        self.assertEqual({rec["action"] for rec in first}, {"written"})
+        self.assertEqual({rec["action"] for rec in self.records()}, {"unchanged"})
+
+    def test_a_dry_run_says_where_each_header_would_go(self):
+        records = self.records("-d")
+        self.assertEqual(len(records), 4)
+        self.assertTrue(all("action" not in rec for rec in records))
+        self.assertNoDir("dest")
+
+    def test_what_is_taken_out_is_a_record(self):
+        self.records()
+        self.path("src/bar.hpp").unlink()
+        removed = [rec for rec in self.records() if rec["type"] == "remove"]
+        self.assertEqual(len(removed), 1)
+        self.assertTrue(removed[0]["path"].endswith("bar.hpp"))
+
+    def test_the_records_do_not_depend_on_the_jobs(self):
+        one = self.records("-j", "1", "-f")
+        many = self.records("-j", "8", "-f")
+        self.assertEqual(one, many)
+
+
+class TestJobs(IncsyncTestCase):
+    def setUp(self):
+        super().setUp()
+        for i in range(200):
+            self.write(f"src/many/d{i % 9}/h{i}.h", f"// {i}")
+
+    def test_any_number_of_jobs_gives_the_same_tree(self):
+        self.assertOk(self.run_cmd("incsync", "src", "one", "-j", "1", "-s"))
+        self.assertOk(self.run_cmd("incsync", "src", "four", "-j", "4", "-s"))
+        one = sorted(p.relative_to(self.path("one")) for p in self.path("one").rglob("*"))
+        four = sorted(p.relative_to(self.path("four")) for p in self.path("four").rglob("*"))
+        self.assertEqual(one, four)
+        self.assertEqual(self.read("one/h17.h"), self.read("four/h17.h"))
+
+    def test_what_is_printed_does_not_depend_on_the_jobs(self):
+        one = self.run_cmd("incsync", "src", "include", "-j", "1", "-d")
+        four = self.run_cmd("incsync", "src", "include", "-j", "4", "-d")
+        self.assertOk(one)
+        self.assertOk(four)
+        self.assertEqual(one.out, four.out)
+
+    def test_a_job_count_that_is_not_one_is_refused(self):
+        self.assertFails(self.run_cmd("incsync", "src", "include", "-j", "0"))
+        self.assertFails(self.run_cmd("incsync", "src", "include", "-j", "many"))
+
+    def test_of_two_headers_with_one_name_the_one_found_later_is_kept(self):
+        """As it was when they were written one after the other."""
+        self.write("src/a/same.h", "// a")
+        self.write("src/b/same.h", "// b")
+        r = self.run_cmd("incsync", "src", "include", "-j", "4", "-V")
+        self.assertOk(r)
+        synced = [line.split('"')[1] for line in r.out.splitlines() if line.endswith('same.h"')]
+        last = Path(synced[-1]).parent.name
+        self.assertIn(f"{last}/same.h", self.read("include/same.h"))
+
+
+def read_header_map(data: bytes) -> dict:
+    """What a header map says, as Clang would look each name up."""
+    magic, version, _, strings, count, buckets, _ = struct.unpack_from("<IHHIIII", data)
+    assert magic == 0x686D6170 and version == 1
+    assert buckets & (buckets - 1) == 0
+
+    def string(offset: int) -> str:
+        start = strings + offset
+        return data[start:data.index(b"\0", start)].decode()
+
+    entries = {}
+    for i in range(buckets):
+        key, prefix, suffix = struct.unpack_from("<III", data, 24 + i * 12)
+        if key:
+            entries[string(key)] = string(prefix) + string(suffix)
+    assert len(entries) == count
+    return entries
+
+
+class TestEmit(IncsyncTestCase):
+    def test_vfsoverlay_writes_one_overlay_and_no_headers(self):
+        self.assertOk(self.run_cmd("incsync", "src", "include", "-s", "--emit", "vfsoverlay"))
+        self.assertNoFile("include/foo.h")
+        overlay = json.loads(self.read("include/.qmcorecmd-vfsoverlay.yaml"))
+        root = overlay["roots"][0]
+        self.assertEqual(Path(root["name"]), self.path("include"))
+        files = {e["name"]: e for e in root["contents"] if e["type"] == "file"}
+        self.assertEqual(Path(files["foo.h"]["external-contents"]), self.path("src/foo.h"))
+        private = next(e for e in root["contents"] if e["name"] == "private")
+        self.assertEqual(private["contents"][0]["name"], "qux_p.h")
+
+    def test_hmap_maps_each_include_to_its_header(self):
+        self.assertOk(self.run_cmd("incsync", "src", "include", "-s", "--emit", "hmap"))
+        self.assertNoFile("include/foo.h")
+        entries = read_header_map(self.path("include/.qmcorecmd.hmap").read_bytes())
+        self.assertEqual(Path(entries["foo.h"]), self.path("src/foo.h"))
+        self.assertEqual(Path(entries["private/qux_p.h"]), self.path("src/sub/qux_p.h"))
+        self.assertEqual(len(entries), 8)
+
+    def test_hmap_also_answers_each_include_under_the_destination_name(self):
+        """`<MyCore/foo.h>` with the directory above `include/MyCore` to include from."""
+        self.assertOk(self.run_cmd("incsync", "src", "include/MyCore", "-s", "--emit", "hmap"))
+        entries = read_header_map(self.path("include/MyCore/.qmcorecmd.hmap").read_bytes())
+        self.assertEqual(Path(entries["MyCore/foo.h"]), self.path("src/foo.h"))
+        self.assertEqual(Path(entries["MyCore/private/qux_p.h"]), self.path("src/sub/qux_p.h"))
+        self.assertEqual(Path(entries["foo.h"]), self.path("src/foo.h"))
+
+    def test_clang_finds_headers_through_the_hmap_both_ways(self):
+        clang = shutil.which("clang")
+        if not clang:
+            self.skipTest("no clang to compile with")
+        self.write("src/foo.h", "#define FOO 1\n")
+        self.write(
+            "main.c",
+            "#include <MyCore/foo.h>\n#include <foo.h>\nint main(void) { return FOO - 1; }\n",
+        )
+        self.assertOk(self.run_cmd("incsync", "src", "include/MyCore", "--emit", "hmap"))
+        compiled = subprocess.run(
+            [
+                clang,
+                "-fsyntax-only",
+                "-I",
+                str(self.path("include/MyCore/.qmcorecmd.hmap")),
+                str(self.path("main.c")),
+            ],
+            capture_output=True,
+            text=True,
+        )
+        self.assertEqual(compiled.returncode, 0, compiled.stderr)
+
+    def test_switching_to_an_emit_mode_takes_the_headers_out(self):
+        self.assertOk(self.run_cmd("incsync", "src", "include"))
+        self.assertFile("include/foo.h")
+        self.assertOk(self.run_cmd("incsync", "src", "include", "--emit", "hmap"))
+        self.assertNoFile("include/foo.h")
+        self.assertOk(self.run_cmd("incsync", "src", "include", "--emit", "files"))
+        self.assertFile("include/foo.h")
+        self.assertNoFile("include/.qmcorecmd.hmap")
+
+    def test_an_unchanged_overlay_is_not_written_again(self):
+        self.assertOk(self.run_cmd("incsync", "src", "include", "--emit", "vfsoverlay"))
+        r = self.run_cmd("incsync", "src", "include", "--emit", "vfsoverlay", "-V")
+        self.assertOk(r)
+        self.assertNotOut(r, "Write:")
+
+    def test_copy_with_an_emit_mode_is_refused(self):
+        self.assertFails(self.run_cmd("incsync", "src", "include", "-c", "--emit", "hmap"))
+
+    def test_an_unknown_emit_mode_is_refused(self):
+        self.assertFails(self.run_cmd("incsync", "src", "include", "--emit", "tarball"))
+
+
+class TestLinks(IncsyncTestCase):
+    def link(self, kind: str, *extra: str):
+        r = self.run_cmd("incsync", "src", "include", "--link", kind, *extra)
+        if not r.ok and kind == "symlink" and "privilege" in r.out.lower():
+            self.skipTest("this machine will not make a symlink")
+        self.assertOk(r)
+        return r
+
+    def test_symlink_links_each_header_relatively(self):
+        self.link("symlink", "-s")
+        link = self.path("include/private/qux_p.h")
+        self.assertTrue(link.is_symlink())
+        self.assertFalse(os.path.isabs(os.readlink(link)))
+        self.assertEqual(link.read_text(), "// private qux")
+
+    def test_hardlink_is_the_header_itself(self):
+        self.link("hardlink")
+        self.assertTrue(os.path.samefile(self.path("include/foo.h"), self.path("src/foo.h")))
+
+    def test_a_link_that_is_right_is_left_alone(self):
+        self.link("symlink")
+        before = os.lstat(self.path("include/foo.h")).st_ino
+        self.link("symlink")
+        self.assertEqual(os.lstat(self.path("include/foo.h")).st_ino, before)
+
+    def test_a_hard_link_follows_a_header_saved_as_a_new_file(self):
+        self.link("hardlink")
+        replacement = self.write("src/foo.h.new", "// foo, saved again")
+        os.replace(replacement, self.path("src/foo.h"))
+        self.link("hardlink")
+        self.assertEqual(self.read("include/foo.h"), "// foo, saved again")
+
+    def test_going_back_to_stubs_does_not_write_through_a_link(self):
+        for kind in ("symlink", "hardlink"):
+            with self.subTest(kind=kind):
+                self.link(kind)
+                self.assertOk(self.run_cmd("incsync", "src", "include"))
+                self.assertIn("#include", self.read("include/foo.h"))
+                self.assertEqual(self.read("src/foo.h"), "// foo")
+
+    def test_copying_over_a_hard_link_leaves_the_header_alone(self):
+        self.link("hardlink")
+        self.write("src/foo.h", "// foo, edited in place")
+        self.assertOk(self.run_cmd("incsync", "src", "include", "-c"))
+        self.assertEqual(self.read("src/foo.h"), "// foo, edited in place")
+        self.assertFalse(os.path.samefile(self.path("include/foo.h"), self.path("src/foo.h")))
+
+    def test_the_link_of_a_header_that_has_gone_goes_too(self):
+        self.link("symlink")
+        self.path("src/foo.h").unlink()
+        self.link("symlink")
+        self.assertFalse(os.path.lexists(self.path("include/foo.h")))
+
+    def test_link_with_copy_or_an_emit_mode_is_refused(self):
+        self.assertFails(self.run_cmd("incsync", "src", "include", "--link", "symlink", "-c"))
+        self.assertFails(
+            self.run_cmd("incsync", "src", "include", "--link", "symlink", "--emit", "hmap")
+        )
+        self.assertFails(self.run_cmd("incsync", "src", "include", "--link", "softlink"))
+
+
+class TestRunningAgain(IncsyncTestCase):
+    """A second run writes only what changed and takes out what the first
+    wrote for a header that has gone."""
+
+    def age(self, rel: str):
+        """Sets ``rel`` an hour back, so that writing it again would show."""
+        past = self.path(rel).stat().st_mtime - 3600
+        os.utime(self.path(rel), (past, past))
+        return past
+
+    def test_a_stub_that_is_already_right_keeps_its_time(self):
+        self.assertOk(self.run_cmd("incsync", "src", "include"))
+        past = self.age("include/foo.h")
+        self.write("src/foo.h", "// foo, edited")
+        self.assertOk(self.run_cmd("incsync", "src", "include"))
+        self.assertEqual(self.path("include/foo.h").stat().st_mtime, past)
+
+    def test_nothing_is_written_when_nothing_changed(self):
+        self.assertOk(self.run_cmd("incsync", "src", "include"))
+        past = self.age("include/.qmcorecmd-incsync")
+        self.assertOk(self.run_cmd("incsync", "src", "include"))
+        self.assertEqual(self.path("include/.qmcorecmd-incsync").stat().st_mtime, past)
+
+    def test_the_stub_of_a_header_that_has_gone_goes_too(self):
+        self.assertOk(self.run_cmd("incsync", "src", "include", "-i", "sub/", "nested"))
+        self.path("src/sub/baz.h").unlink()
+        self.path("src/sub/qux_p.h").unlink()
+        r = self.run_cmd("incsync", "src", "include", "-i", "sub/", "nested", "-V")
+        self.assertOk(r)
+        self.assertOut(r, "Remove:")
+        self.assertNoFile("include/nested/baz.h")
+        self.assertNoDir("include/nested")
+        self.assertFile("include/foo.h")
+
+    def test_a_header_that_now_goes_elsewhere_is_moved(self):
+        self.assertOk(self.run_cmd("incsync", "src", "include"))
+        self.assertOk(self.run_cmd("incsync", "src", "include", "-i", "sub/", "nested"))
+        self.assertFile("include/nested/baz.h")
+        self.assertNoFile("include/baz.h")
+
+    def test_what_somebody_else_put_there_stays(self):
+        self.assertOk(self.run_cmd("incsync", "src", "include"))
+        self.write("include/mine/keep.h", "// mine")
+        self.path("src/foo.h").unlink()
+        self.assertOk(self.run_cmd("incsync", "src", "include"))
+        self.assertNoFile("include/foo.h")
+        self.assertFile("include/mine/keep.h")
+
+    def test_a_stub_that_was_deleted_is_written_again(self):
+        self.assertOk(self.run_cmd("incsync", "src", "include"))
+        self.path("include/foo.h").unlink()
+        self.assertOk(self.run_cmd("incsync", "src", "include"))
+        self.assertFile("include/foo.h")
+
+    def test_a_copy_follows_its_header_even_back_in_time(self):
+        """An older file put in place of a header is still a change."""
+        self.assertOk(self.run_cmd("incsync", "src", "include", "-c"))
+        self.write("src/foo.h", "// foo, replaced")
+        self.age("src/foo.h")
+        self.assertOk(self.run_cmd("incsync", "src", "include", "-c"))
+        self.assertFileContains("include/foo.h", "// foo, replaced")
+
+    def test_dryrun_leaves_no_state(self):
+        self.assertOk(self.run_cmd("incsync", "src", "include", "-d"))
+        self.assertNoFile("include/.qmcorecmd-incsync")
+
+
+class TestStampAndDepfile(IncsyncTestCase):
+    """What a build system running incsync as a step of the build reads back:
+    a stamp to compare times against and a depfile saying what went into it."""
+
+    def depfile(self) -> str:
+        return self.path("build/sync.d").read_text(encoding="utf-8")
+
+    def sync(self, *extra: str):
+        return self.run_cmd("incsync", "src", "include", "--stamp", "build/sync.stamp",
+                            "--depfile", "build/sync.d", *extra)
+
+    def test_the_stamp_and_the_depfile_are_written(self):
+        self.assertOk(self.sync())
+        self.assertFile("build/sync.stamp")
+        self.assertFile("build/sync.d")
+
+    def test_the_rule_is_for_the_stamp(self):
+        self.assertOk(self.sync())
+        self.assertTrue(self.depfile().startswith(self.path("build/sync.stamp").as_posix() + ":"))
+
+    def test_every_directory_looked_in_and_every_header_used_is_listed(self):
+        self.assertOk(self.sync())
+        deps = self.depfile().split()
+        for rel in ("src", "src/sub", "src/foo.h", "src/sub/qux_p.h"):
+            self.assertIn(self.path(rel).as_posix(), deps)
+
+    def test_what_is_not_a_header_is_not(self):
+        self.assertOk(self.sync())
+        self.assertNotIn("foo.cpp", self.depfile())
+
+    def test_a_space_in_a_path_is_escaped(self):
+        self.write("src/with space/a.h", "// a")
+        self.assertOk(self.sync())
+        self.assertIn("with\\ space/a.h", self.depfile())
+
+    def test_the_stamp_is_touched_even_when_nothing_changed(self):
+        self.assertOk(self.sync())
+        past = self.path("build/sync.stamp").stat().st_mtime - 3600
+        os.utime(self.path("build/sync.stamp"), (past, past))
+        self.assertOk(self.sync())
+        self.assertGreater(self.path("build/sync.stamp").stat().st_mtime, past)
+
+    def test_a_depfile_without_a_stamp_is_refused(self):
+        self.assertFails(self.run_cmd("incsync", "src", "include", "--depfile", "build/sync.d"))
+
+    def test_dryrun_writes_neither(self):
+        self.assertOk(self.sync("-d"))
+        self.assertNoFile("build/sync.stamp")
+        self.assertNoFile("build/sync.d")
@@ -37,7 +37,11 @@ class TestNothingOnTheLine(QmTestCase):
     all, and its help option is global, so this holds for a subcommand too."""
 
     def test_a_subcommand_with_nothing_on_its_line_shows_its_help(self):
-        for command in ("copy", "touch", "configure", "rmdir", "incsync", "deploy"):
+        commands = (
+            "copy", "touch", "hash", "configure", "embed", "rmdir", "incsync", "deploy",
+            "batch",
+        )
+        for command in commands:
             with self.subTest(command=command):
                 r = self.run_cmd(command)
                 self.assertOk(r)
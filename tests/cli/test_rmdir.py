@@ -27,6 +27,25 @@ class TestRmdir(QmTestCase):
         self.assertFile("tree/kept/a.txt")
         self.assertNoDir("tree/empty")
 
+    def test_a_wide_tree_keeps_only_the_branch_with_a_file(self):
+        for i in range(32):
+            self.mkdir(f"tree/d{i}/a/b")
+        self.write("tree/d17/a/b/kept.txt", "a")
+        r = self.run_cmd("rmdir", "tree", "-V")
+        self.assertOk(r)
+        self.assertFile("tree/d17/a/b/kept.txt")
+        for i in range(32):
+            if i != 17:
+                self.assertNoDir(f"tree/d{i}")
+        # Children are named before the directory holding them.
+        lines = r.out.splitlines()
+        self.assertEqual(len(lines), 31 * 3)
+        for i in range(32):
+            if i != 17:
+                inner = next(n for n, l in enumerate(lines) if l.endswith(f'd{i}/a/b"'))
+                outer = next(n for n, l in enumerate(lines) if l.endswith(f'd{i}"'))
+                self.assertLess(inner, outer)
+
     def test_several_directories_may_be_given_at_once(self):
         for name in ("one", "two", "three"):
             self.mkdir(name)
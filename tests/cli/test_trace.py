@@ -0,0 +1,68 @@
+"""`--trace` writes what a command spent its time on, as Chrome trace events.
+
+Any command takes it, so these use copy, which has the most to count without
+needing anything but files.
+"""
+
+import json
+
+from testing.harness import QmTestCase
+
+
+class TestTrace(QmTestCase):
+    def read_trace(self, rel="trace.json"):
+        self.assertFile(rel)
+        return json.loads(self.read(rel))
+
+    def spans(self, trace):
+        return [e["name"] for e in trace["traceEvents"] if e["ph"] == "X"]
+
+    def test_the_trace_has_events_and_counters(self):
+        self.write("a.txt", "a")
+        self.assertOk(self.run_cmd("copy", "a.txt", "out", "--trace", "trace.json"))
+        trace = self.read_trace()
+        spans = self.spans(trace)
+        self.assertIn("Build command line", spans)
+        self.assertIn("qmcorecmd copy", spans)
+        self.assertIn("Copy", spans)
+        counters = trace["otherData"]["counters"]
+        for name in (
+            "utils_stat_calls",
+            "subprocesses",
+            "bytes_copied",
+            "files_skipped",
+            "cache_hits",
+        ):
+            self.assertIn(name, counters)
+
+    def test_bytes_copied_and_files_skipped_are_counted(self):
+        self.write("src/a.txt", "12345")
+        self.write("src/b.txt", "678")
+        self.assertOk(self.run_cmd("copy", "src", "out", "--trace", "first.json"))
+        first = self.read_trace("first.json")["otherData"]["counters"]
+        self.assertEqual(first["bytes_copied"], 8)
+        self.assertEqual(first["files_skipped"], 0)
+
+        self.assertOk(self.run_cmd("copy", "src", "out", "--trace", "second.json"))
+        second = self.read_trace("second.json")["otherData"]["counters"]
+        self.assertEqual(second["bytes_copied"], 0)
+        self.assertEqual(second["files_skipped"], 2)
+
+    def test_the_file_may_follow_an_equals_sign(self):
+        self.write("a.txt", "a")
+        self.assertOk(self.run_cmd("--trace=trace.json", "touch", "a.txt"))
+        self.assertIn("qmcorecmd touch", self.spans(self.read_trace()))
+
+    def test_a_failed_command_is_traced_too(self):
+        r = self.run_cmd("copy", "nosuch", "out", "--trace", "trace.json")
+        self.assertFails(r)
+        self.assertIn("qmcorecmd copy", self.spans(self.read_trace()))
+
+    def test_a_trace_without_a_file_is_refused(self):
+        self.write("a.txt", "a")
+        self.assertRefused(self.run_cmd("touch", "a.txt", "--trace"))
+
+    def test_without_it_nothing_is_written(self):
+        self.write("a.txt", "a")
+        self.assertOk(self.run_cmd("copy", "a.txt", "out"))
+        self.assertEqual(sorted(self.tree()), ["a.txt", "out/a.txt"])
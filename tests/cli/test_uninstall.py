@@ -0,0 +1,125 @@
+"""`uninstall` removes what a manifest lists, then the directories left empty."""
+
+from testing.harness import QmTestCase
+
+
+class TestUninstall(QmTestCase):
+    def install(self, *files: str) -> str:
+        """Writes each of ``files`` and a manifest naming them, as CMake does."""
+        for rel in files:
+            self.write(rel, rel)
+        self.write(
+            "install_manifest.txt",
+            "\n".join(str(self.path(rel)) for rel in files) + "\n",
+        )
+        return "install_manifest.txt"
+
+    def test_the_listed_files_are_removed(self):
+        manifest = self.install("prefix/bin/app", "prefix/lib/libone.so")
+        self.assertOk(self.run_cmd("uninstall", manifest))
+        self.assertNoFile("prefix/bin/app")
+        self.assertNoFile("prefix/lib/libone.so")
+
+    def test_the_directories_left_empty_are_removed(self):
+        manifest = self.install("prefix/include/pkg/a.h", "prefix/include/pkg/b.h")
+        self.assertOk(self.run_cmd("uninstall", manifest, "--prefix", "prefix"))
+        self.assertNoDir("prefix/include")
+        self.assertDir("prefix")
+
+    def test_the_prefix_and_what_is_above_it_are_kept(self):
+        """The manifest never wrote into them, however empty they are left."""
+        manifest = self.install("stage/prefix/bin/app", "stage/prefix/lib/libone.so")
+        self.assertOk(self.run_cmd("uninstall", manifest))
+        self.assertNoDir("stage/prefix/bin")
+        self.assertNoDir("stage/prefix/lib")
+        self.assertDir("stage/prefix")
+        self.assertDir("stage")
+
+    def test_a_prefix_that_is_given_is_kept_and_nothing_above_it_is_looked_at(self):
+        manifest = self.install("stage/prefix/bin/app", "stage/prefix/lib/libone.so")
+        self.assertOk(self.run_cmd("uninstall", manifest, "--prefix", "stage"))
+        self.assertNoDir("stage/prefix")
+        self.assertDir("stage")
+
+    def test_without_a_prefix_a_directory_of_files_goes_and_the_one_above_stays(self):
+        """The directory the files went straight into is the most a manifest owns."""
+        manifest = self.install("prefix/include/pkg/a.h", "prefix/include/pkg/b.h")
+        self.assertOk(self.run_cmd("uninstall", manifest))
+        self.assertNoDir("prefix/include/pkg")
+        self.assertDir("prefix/include")
+
+    def test_a_directory_holding_something_else_is_kept(self):
+        manifest = self.install("prefix/lib/libone.so")
+        self.write("prefix/lib/libother.so", "other")
+        self.assertOk(self.run_cmd("uninstall", manifest))
+        self.assertNoFile("prefix/lib/libone.so")
+        self.assertFile("prefix/lib/libother.so")
+
+    def test_an_empty_directory_beside_the_install_is_kept(self):
+        """Only directories that held something listed are walked down."""
+        manifest = self.install("prefix/lib/libone.so")
+        self.mkdir("prefix/share/empty")
+        self.assertOk(self.run_cmd("uninstall", manifest, "--prefix", "prefix"))
+        self.assertNoDir("prefix/lib")
+        self.assertDir("prefix/share/empty")
+
+    def test_empty_directories_that_were_there_before_are_kept(self):
+        """Only a directory left empty by what was removed goes, and nothing beside or below."""
+        self.mkdir("prefix/lib/empty")
+        self.mkdir("prefix/share")
+        manifest = self.install("prefix/lib/libone.so", "prefix/share/pkg/a.txt")
+        self.mkdir("prefix/share/other")
+        self.assertOk(self.run_cmd("uninstall", manifest, "--prefix", "prefix"))
+        self.assertNoFile("prefix/lib/libone.so")
+        self.assertDir("prefix/lib/empty")
+        self.assertNoDir("prefix/share/pkg")
+        self.assertDir("prefix/share/other")
+
+    def test_a_file_that_is_not_there_is_passed_over(self):
+        manifest = self.install("prefix/bin/app")
+        self.path("prefix/bin/app").unlink()
+        self.assertOk(self.run_cmd("uninstall", manifest, "--prefix", "prefix"))
+        self.assertNoDir("prefix/bin")
+
+    def test_many_files_are_all_removed(self):
+        files = [f"prefix/d{i % 7}/f{i}.txt" for i in range(500)]
+        manifest = self.install(*files)
+        self.assertOk(self.run_cmd("uninstall", manifest))
+        self.assertDir("prefix")
+        self.assertEqual(list(self.path("prefix").iterdir()), [])
+
+    def test_a_link_is_removed_and_not_followed(self):
+        self.write("outside/kept.txt", "kept")
+        manifest = self.install("prefix/lib/libone.so")
+        try:
+            (self.path("prefix/lib") / "libone.so.1").symlink_to("libone.so")
+            (self.path("prefix") / "data").symlink_to(
+                self.path("outside"), target_is_directory=True
+            )
+        except (OSError, NotImplementedError):
+            self.skipTest("this machine will not make a symlink")
+        self.write(
+            "install_manifest.txt",
+            f"{self.path('prefix/lib/libone.so')}\n"
+            f"{self.path('prefix/lib/libone.so.1')}\n",
+        )
+        self.assertOk(self.run_cmd("uninstall", manifest, "--prefix", "prefix"))
+        self.assertNoDir("prefix/lib")
+        self.assertFile("outside/kept.txt")
+        self.assertTrue((self.path("prefix") / "data").is_symlink())
+
+    def test_dryrun_removes_nothing_and_says_what_it_would(self):
+        manifest = self.install("prefix/bin/app")
+        r = self.run_cmd("uninstall", manifest, "-d")
+        self.assertOk(r)
+        self.assertOut(r, "Remove:")
+        self.assertFile("prefix/bin/app")
+
+    def test_verbose_names_files_and_directories(self):
+        manifest = self.install("prefix/bin/app")
+        r = self.run_cmd("uninstall", manifest, "-V", "--prefix", "prefix")
+        self.assertOk(r)
+        self.assertOutOrder(r, 'app"', 'bin"')
+
+    def test_a_manifest_that_is_not_there_is_an_error(self):
+        self.assertFails(self.run_cmd("uninstall", "no_such_manifest.txt"))
@@ -1,6 +1,7 @@
 """What the tests are built on, rather than a test itself.
 
-QmTestCase and its assertions live in harness, and finding the fixture binaries
-lives in fixtures_layout. Nothing here is discovered by unittest, the pattern
-being test_*.py.
+QmTestCase and its assertions live in harness, finding the fixture binaries
+lives in fixtures_layout, and linking the large generated graphs lives in
+library_graph. Nothing here is discovered by unittest, the pattern being
+test_*.py.
 """
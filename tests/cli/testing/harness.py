@@ -109,11 +109,13 @@ class QmTestCase(unittest.TestCase):
 
     # Running
 
-    def run_cmd(self, *args: str) -> Result:
+    def run_cmd(self, *args: str, timeout: float = 60) -> Result:
         """Runs the tool from inside the sandbox.
 
         The tool writes everything to stdout, but both streams are captured and
         joined so an assertion never misses a line for being on the other one.
+        A minute is long enough for anything but the deployments made to be
+        large, which say how long they may take.
         """
         argv = [str(a) for a in args]
         completed = subprocess.run(
@@ -121,7 +123,7 @@ class QmTestCase(unittest.TestCase):
             cwd=self.sandbox,
             stdout=subprocess.PIPE,
             stderr=subprocess.STDOUT,
-            timeout=60,
+            timeout=timeout,
         )
         # The tool speaks UTF-8 whatever the console is set to.
         out = completed.stdout.decode("utf-8", errors="replace")
@@ -0,0 +1,207 @@
+"""Building dependency graphs of thousands of shared libraries to deploy.
+
+The fixture build gives ``test_deploy`` a dozen binaries, which is enough to
+say what goes where and nowhere near enough to say how that holds up at the
+size of a real installation. Thousands of libraries are too many to keep in the
+repository and too slow to build with the compiler, so they are linked here at
+test time with the system linker, from one empty object, each one naming the
+ones below it. A library that holds no code is still a library to the loader,
+to ``ldd`` and to ``patchelf``, which is all that deploy ever asks of one.
+
+ELF only. ``as`` and ``ld`` have to be on the path, and ``toolchain_problem``
+says so where they are not.
+
+Each generator is a function of its parameters alone. It lays its libraries out
+under the sandbox it is given and answers with the groups of paths a command
+line can name, so that what a scenario expects can be written down once in
+``deploy_scenarios.json`` and hold on every machine.
+"""
+
+from __future__ import annotations
+
+import re
+import shutil
+import subprocess
+import sys
+from pathlib import Path
+
+RANGE = re.compile(r"\{(\d+)\.\.(\d+)\}")
+
+
+def toolchain_problem() -> str:
+    """Empty when this platform can link the graphs, else why not."""
+    if not sys.platform.startswith("linux"):
+        return f"the graphs are ELF, and {sys.platform} does not load ELF"
+    for tool in ("as", "ld"):
+        if not shutil.which(tool):
+            return f"{tool} is not on the path"
+    return ""
+
+
+def expand_names(pattern: str) -> list[str]:
+    """Every name a pattern stands for, ``lib{0..2}.so`` being three.
+
+    Several ranges in one pattern give every combination of them, so a whole
+    grid of libraries is one line of the declaration.
+    """
+    match = RANGE.search(pattern)
+    if not match:
+        return [pattern]
+    first, last = int(match.group(1)), int(match.group(2))
+    head, tail = pattern[: match.start()], pattern[match.end() :]
+    return [
+        name
+        for number in range(first, last + 1)
+        for name in expand_names(f"{head}{number}{tail}")
+    ]
+
+
+class Linker:
+    """Links empty shared libraries, one run of ``ld`` each."""
+
+    def __init__(self, sandbox: Path):
+        self.sandbox = sandbox
+        self.empty = sandbox / "empty.o"
+        subprocess.run(
+            ["as", "-o", str(self.empty), "/dev/null"], check=True, timeout=60
+        )
+        self.count = 0
+
+    def library(
+        self,
+        rel: str,
+        soname: str | None = None,
+        needs: tuple[str, ...] = (),
+        runpath: str = "$ORIGIN",
+    ) -> str:
+        """Links ``rel`` against the libraries in ``needs``, which must exist.
+
+        A library is recorded under the name it was linked against, or under
+        the soname that library gives, exactly as the linker of a real build
+        would record it.
+        """
+        target = self.sandbox / rel
+        target.parent.mkdir(parents=True, exist_ok=True)
+        argv = ["ld", "-shared", "-o", str(target), str(self.empty)]
+        argv += ["-soname", soname or target.name]
+        if runpath:
+            argv += ["-rpath", runpath]
+        argv += [str(self.sandbox / need) for need in needs]
+        completed = subprocess.run(
+            argv, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, timeout=60
+        )
+        if completed.returncode != 0:
+            out = completed.stdout.decode("utf-8", errors="replace")
+            raise RuntimeError(f"{' '.join(argv)} failed:\n{out}")
+        self.count += 1
+        return rel
+
+    def link(self, rel: str, to: str):
+        """Points ``rel`` at ``to``, relative to the directory it is in."""
+        (self.sandbox / rel).symlink_to(to)
+
+
+# ---------------------------------------------------------------------------
+# The generators. Each answers with groups of paths relative to the sandbox,
+# which a scenario's command line names as {all.<group>}.
+# ---------------------------------------------------------------------------
+
+
+def plugins(linker: Linker, plugins: int, helpers: int) -> dict[str, list[str]]:
+    """A framework's core and helpers under sdk/lib, and the program's plugins.
+
+    Every plugin links the core and one helper, round the helpers in turn, and
+    finds them through a RUNPATH relative to itself, the way a package leaves
+    them. So one graph is wide, every helper is reached many times over, and
+    nearly every library a plugin asks for has been asked for already.
+    """
+    core = linker.library("sdk/lib/libcore.so")
+    helper_paths = [
+        linker.library(f"sdk/lib/libhelper{i}.so", needs=(core,))
+        for i in range(helpers)
+    ]
+    plugin_paths = [
+        linker.library(
+            f"app/plugins/libplugin{i}.so",
+            needs=(core, helper_paths[i % helpers]),
+            runpath="$ORIGIN/../../sdk/lib",
+        )
+        for i in range(plugins)
+    ]
+    return {"plugins": plugin_paths}
+
+
+def diamonds(linker: Linker, levels: int, width: int, fanout: int) -> dict[str, list[str]]:
+    """A grid of libraries, every one linking ``fanout`` of the level below.
+
+    Library ``i`` of a level links ``i``, ``i + stride`` and so on of the next,
+    round the width, with the stride chosen so that the children of neighbours
+    overlap. Every library below the first level is reached by ``fanout``
+    parents, each by several paths, which is the shape where reading a
+    library once rather than once for every way to it is what keeps the time
+    down. The one library named on the command line links the whole first
+    level.
+    """
+    stride = max(1, width // fanout + 1)
+    for level in reversed(range(levels)):
+        for i in range(width):
+            needs = ()
+            if level + 1 < levels:
+                needs = tuple(
+                    f"sdk/lib/libd{level + 1}_{(i + k * stride) % width}.so"
+                    for k in range(fanout)
+                )
+            linker.library(f"sdk/lib/libd{level}_{i}.so", needs=needs)
+    top = linker.library(
+        "app/libtop.so",
+        needs=tuple(f"sdk/lib/libd0_{i}.so" for i in range(width)),
+        runpath="$ORIGIN/../sdk/lib",
+    )
+    return {"named": [top]}
+
+
+def soname_chains(linker: Linker, libraries: int, fanout: int) -> dict[str, list[str]]:
+    """Versioned libraries, each a chain of three names.
+
+    ``libchainN.so`` points at ``libchainN.so.1``, which points at the real
+    ``libchainN.so.1.2``, whose soname is ``libchainN.so.1``. Every library is
+    linked through the first of those, as a build links, and so names the
+    second, as the loader wants. Library ``i`` links the ``fanout`` after
+    ``i * fanout``, making a tree, and the one library named on the command
+    line links the root of it.
+    """
+    for i in reversed(range(libraries)):
+        base = f"sdk/lib/libchain{i}.so"
+        children = range(i * fanout + 1, min(libraries, i * fanout + fanout + 1))
+        linker.library(
+            f"{base}.1.2",
+            soname=f"libchain{i}.so.1",
+            needs=tuple(f"sdk/lib/libchain{child}.so" for child in children),
+        )
+        linker.link(f"{base}.1", f"libchain{i}.so.1.2")
+        linker.link(base, f"libchain{i}.so.1")
+    top = linker.library(
+        "app/libtop.so", needs=("sdk/lib/libchain0.so",), runpath="$ORIGIN/../sdk/lib"
+    )
+    return {"named": [top]}
+
+
+GENERATORS = {
+    "plugins": plugins,
+    "diamonds": diamonds,
+    "soname_chains": soname_chains,
+}
+
+
+def generate(sandbox: Path, generator: str, parameters: dict) -> dict[str, list[str]]:
+    """Builds the named graph in ``sandbox`` and answers with its groups."""
+    if generator not in GENERATORS:
+        raise SystemExit(
+            f"deploy_scenarios.json asks for a generator called {generator!r}, "
+            f"and there are only {', '.join(sorted(GENERATORS))}"
+        )
+    linker = Linker(sandbox)
+    try:
+        return GENERATORS[generator](linker, **parameters)
+    finally:
+        linker.empty.unlink(missing_ok=True)
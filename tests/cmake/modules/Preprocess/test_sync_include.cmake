@@ -81,21 +81,63 @@ qmtest_exists("and the others still come" "${_dest}/foo.h")
 # ------------------------------------------------------------------
 # Running again
 #
-# A destination that is already there is left alone, so that reconfiguring does
-# not touch every header and rebuild everything that reads one.
+# A destination that is already there is brought up to date rather than rebuilt,
+# so that reconfiguring does not touch every header and rebuild everything that
+# reads one, and still sees a header added or removed since.
 # ------------------------------------------------------------------
 
 fresh_dest(_dest)
 qm_sync_include("${_src}" "${_dest}")
 file(WRITE "${_dest}/marker.txt" "left by hand")
+file(TIMESTAMP "${_dest}/foo.h" _before "%s")
+
+execute_process(COMMAND ${CMAKE_COMMAND} -E sleep 1.1)
+file(WRITE "${_src}/foo.h" "// foo, edited")
+file(WRITE "${_src}/added.h" "// added")
+file(REMOVE "${_src}/sub/bar.h")
 
 qm_sync_include("${_src}" "${_dest}")
 qmtest_exists("a destination that is already there is not rebuilt" "${_dest}/marker.txt")
+qmtest_exists("a header added since is picked up" "${_dest}/added.h")
+qmtest_not_exists("and one removed since goes" "${_dest}/bar.h")
+
+file(TIMESTAMP "${_dest}/foo.h" _after "%s")
+qmtest_equal("a reference to an edited header is not written again" "${_after}" "${_before}")
+
+file(WRITE "${_src}/foo.h" "// foo")
+file(WRITE "${_src}/sub/bar.h" "// bar")
+file(REMOVE "${_src}/added.h")
 
 qm_sync_include("${_src}" "${_dest}" FORCE)
 qmtest_not_exists("FORCE wipes it and starts again" "${_dest}/marker.txt")
 qmtest_exists("and the headers are back" "${_dest}/foo.h")
 
+# ------------------------------------------------------------------
+# EMIT
+#
+# One file in place of a file per header. What the compiler makes of it is
+# Clang's business, and only that it is there and that nothing else is, is
+# checked here.
+# ------------------------------------------------------------------
+
+fresh_dest(_dest)
+qm_sync_include("${_src}" "${_dest}" EMIT vfsoverlay)
+qmtest_file_contains("EMIT vfsoverlay writes an overlay" "${_dest}/.qmcorecmd-vfsoverlay.yaml"
+    "${_src}/foo.h")
+qmtest_not_exists("and no header" "${_dest}/foo.h")
+
+qm_sync_include("${_src}" "${_dest}" EMIT hmap)
+qmtest_exists("EMIT hmap writes a header map" "${_dest}/.qmcorecmd.hmap")
+qmtest_not_exists("in place of the overlay" "${_dest}/.qmcorecmd-vfsoverlay.yaml")
+
+qm_sync_include("${_src}" "${_dest}")
+qmtest_exists("going back to files writes the headers" "${_dest}/foo.h")
+qmtest_not_exists("and takes the header map out" "${_dest}/.qmcorecmd.hmap")
+
+qmtest_script_fails("an EMIT mode it does not know is refused"
+    "unknown EMIT mode"
+    "qm_import(Preprocess)\nqm_sync_include(\"${_src}\" \"${QMTEST_WORK_DIR}/nowhere\" EMIT tarball)")
+
 # ------------------------------------------------------------------
 # A source that is not there
 # ------------------------------------------------------------------
@@ -0,0 +1,21 @@
+# What qm_sync_include left in the build tree, once as the project was built and
+# again after a header was added without configuring in between.
+#
+# Included by testing/build.cmake. `_build` is the project's build tree.
+
+set(_include "${_build}/include/QmTest")
+
+qmtest_exists("the build synced a header at the top of the tree" "${_include}/foo.h")
+qmtest_exists("and the private one where the pattern puts it" "${_include}/private/bar_p.h")
+
+# A header that arrives after configuring changes the time of the directory it
+# is in, which the depfile names, and that is all it takes for the step to run
+# again.
+file(WRITE "${_build}/src/sub/added.h" "// added")
+step("building again" ${CMAKE_COMMAND} --build "${_build}" --config Release)
+qmtest_exists("a header added since is synced by the next build" "${_include}/added.h")
+
+# And one taken away is taken out of the destination the same way.
+file(REMOVE "${_build}/src/foo.h")
+step("building a third time" ${CMAKE_COMMAND} --build "${_build}" --config Release)
+qmtest_not_exists("and one removed since is taken out by the one after" "${_include}/foo.h")
@@ -10,3 +10,20 @@ if(EXISTS "${_executable}")
     execute_process(COMMAND "${_executable}" RESULT_VARIABLE _code)
     qmtest_equal("the embedded bytes and length match the input" "${_code}" "0")
 endif()
+
+# qmcorecmd leaves an .incbin file alone when only the input's bytes changed,
+# since it names the input rather than holding it. Written again, the input is
+# newer than the output, and the build has to leave the output newer in turn.
+# Otherwise a Makefile generator sees the output out of date on every build
+# from then on, and generates it again each time.
+set(_incbin "${_build}/incbin-data.S")
+if(EXISTS "${_incbin}")
+    file(WRITE "${_build}/resource.bin" "QMSetup binary resource")
+    step("building again after the input was written"
+        ${CMAKE_COMMAND} --build "${_build}" --config Release)
+    set(_fresh FALSE)
+    if("${_incbin}" IS_NEWER_THAN "${_build}/resource.bin")
+        set(_fresh TRUE)
+    endif()
+    qmtest_true("an .incbin file is not left older than its input" "${_fresh}")
+endif()
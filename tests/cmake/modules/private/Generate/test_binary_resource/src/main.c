@@ -4,6 +4,11 @@
 extern unsigned char embedded_data_c[];
 extern unsigned int embedded_data_c_len;
 
+#ifdef QMTEST_INCBIN
+extern const unsigned char incbin_data_S[];
+extern const unsigned int incbin_data_S_len;
+#endif
+
 int main(void) {
     static const unsigned char expected[] = "QMSetup binary resource";
 
@@ -11,5 +16,18 @@ int main(void) {
         return 1;
     }
 
-    return memcmp(embedded_data_c, expected, sizeof(expected) - 1) == 0 ? 0 : 2;
+    if (memcmp(embedded_data_c, expected, sizeof(expected) - 1) != 0) {
+        return 2;
+    }
+
+#ifdef QMTEST_INCBIN
+    if (incbin_data_S_len != sizeof(expected) - 1) {
+        return 3;
+    }
+    if (memcmp(incbin_data_S, expected, sizeof(expected) - 1) != 0) {
+        return 4;
+    }
+#endif
+
+    return 0;
 }